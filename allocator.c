@@ -0,0 +1,116 @@
+#include "type.h"
+#include "allocator.h"
+
+#define ARENA_ALIGN 16 // Alignment of every block handed out by an arena
+
+/**
+ * Function: mem_resize
+ * Description: Allocates a block, or grows one keeping its contents, with the caller's allocator
+ *              or with realloc when there is none.
+ * Input: allocator - the allocator or NULL, ptr - the block or NULL for a new one,
+ *        old_size - current size of the block, new_size - size wanted.
+ * Output: Returns the block, or NULL if there is no memory; the old block is then left as it was.
+ */
+void *mem_resize(const Allocator *allocator, void *ptr, size_t old_size, size_t new_size)
+{
+    if (allocator == NULL)
+    {
+        return realloc(ptr, new_size);
+    }
+    return allocator->resize(allocator->ctx, ptr, old_size, new_size);
+}
+
+/**
+ * Function: mem_release
+ * Description: Frees a block from mem_resize.
+ * Input: allocator - the allocator or NULL, ptr - the block or NULL, size - size of the block.
+ * Output: The block is given back to the allocator.
+ */
+void mem_release(const Allocator *allocator, void *ptr, size_t size)
+{
+    if (allocator == NULL)
+    {
+        free(ptr);
+    }
+    else if (ptr != NULL)
+    {
+        allocator->release(allocator->ctx, ptr, size);
+    }
+}
+
+/**
+ * Function: arena_resize
+ * Description: Hands out arena memory. The last block grows in place, any other block is copied
+ *              to a new block at the end.
+ * Input: ctx - the Arena, ptr - the block or NULL, old_size - its size, new_size - size wanted.
+ * Output: Returns the block, or NULL if the arena is full.
+ */
+static void *arena_resize(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+    Arena *arena = ctx;
+    unsigned char *block = ptr;
+
+    if (block != NULL && block == arena->memory + arena->last && new_size <= arena->size - arena->last)
+    {
+        arena->used = arena->last + new_size;
+        return block;
+    }
+    size_t start = (arena->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (start > arena->size || new_size > arena->size - start)
+    {
+        return NULL;
+    }
+    if (block != NULL)
+    {
+        memcpy(arena->memory + start, block, old_size < new_size ? old_size : new_size);
+    }
+    arena->last = start;
+    arena->used = start + new_size;
+    return arena->memory + start;
+}
+
+/**
+ * Function: arena_release
+ * Description: Gives the last block back to the arena, other blocks stay until mp3tag_arena_reset.
+ * Input: ctx - the Arena, ptr - the block, size - its size.
+ * Output: The arena may reuse the block.
+ */
+static void arena_release(void *ctx, void *ptr, size_t size)
+{
+    Arena *arena = ctx;
+
+    (void)size;
+    if ((unsigned char *)ptr == arena->memory + arena->last)
+    {
+        arena->used = arena->last;
+    }
+}
+
+/**
+ * Function: mp3tag_arena_init
+ * Description: Sets up an arena over memory owned by the caller.
+ * Input: arena - pointer to the Arena struct, memory - the memory to hand out, size - its size.
+ * Output: arena->allocator hands out the memory.
+ */
+void mp3tag_arena_init(Arena *arena, void *memory, size_t size)
+{
+    arena->allocator.resize = arena_resize;
+    arena->allocator.release = arena_release;
+    arena->allocator.ctx = arena;
+    arena->memory = memory;
+    arena->size = size;
+    mp3tag_arena_reset(arena);
+}
+
+/**
+ * Function: mp3tag_arena_reset
+ * Description: Releases every block of the arena at once. Buffers that used it must be freed or
+ *              re-initialised first.
+ * Input: arena - pointer to the Arena struct.
+ * Output: The whole memory is available again.
+ */
+void mp3tag_arena_reset(Arena *arena)
+{
+    arena->used = 0;
+    arena->last = 0;
+}
@@ -0,0 +1,16 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <stddef.h>
+#include "type.h"
+#include "mp3tag.h"
+
+// The allocator and the arena are part of the library API, see mp3tag.h
+typedef Mp3TagAllocator Allocator;
+typedef Mp3TagArena Arena;
+
+// Function prototypes
+void *mem_resize(const Allocator *allocator, void *ptr, size_t old_size, size_t new_size);
+void mem_release(const Allocator *allocator, void *ptr, size_t size);
+
+#endif // ALLOCATOR_H
@@ -0,0 +1,307 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "type.h"
+#include "art.h"
+#include "mp3_edit.h"
+
+/**
+ * Function: find_picture
+ * Description: Finds where the picture starts in APIC frame data: after the encoding byte, the
+ *              MIME type (a 3 character image format in v2.2 PIC frames), the picture type and
+ *              the description, whose terminator is two null bytes in UTF-16.
+ * Input: version - ID3v2 major version, data - the frame data, size - bytes available,
+ *        offset - receives the offset of the picture inside data.
+ * Output: Returns success if the picture header lies within size, or failure otherwise.
+ */
+Status find_picture(unsigned char version, const unsigned char *data, uint32_t size, uint32_t *offset)
+{
+    uint32_t pos = 1;
+
+    if (size < 2)
+    {
+        return failure;
+    }
+    int wide = data[0] == 1 || data[0] == 2;
+    if (version == 2)
+    {
+        pos += 3;
+    }
+    else
+    {
+        const unsigned char *end = memchr(data + pos, 0, size - pos);
+        if (end == NULL)
+        {
+            return failure;
+        }
+        pos = (uint32_t)(end - data) + 1;
+    }
+    // Picture type, then the description
+    pos++;
+    while (pos < size && (wide ? pos + 1 < size && (data[pos] != 0 || data[pos + 1] != 0) : data[pos] != 0))
+    {
+        pos += wide ? 2 : 1;
+    }
+    pos += wide ? 2 : 1;
+    if (pos > size)
+    {
+        return failure;
+    }
+    *offset = pos;
+    return success;
+}
+
+/**
+ * Function: is_stored_plain
+ * Description: Checks that the frame data in the file is the frame data itself, so it can be
+ *              copied without decoding: no unsynchronisation, compression, encryption, group ID
+ *              or data length indicator.
+ * Input: tag - the tag, entry - a frame found by read_frame_heads.
+ * Output: Returns 1 if the bytes can be copied as they are, 0 otherwise.
+ */
+static int is_stored_plain(const Id3Tag *tag, const FrameEntry *entry)
+{
+    if (tag->flags & 0x80)
+    {
+        return 0;
+    }
+    if (tag->version == 3)
+    {
+        return (entry->flags & 0x00E0) == 0;
+    }
+    return tag->version != 4 || (entry->flags & 0x004F) == 0;
+}
+
+/**
+ * Function: write_picture
+ * Description: Writes the picture to the output file, or to stdout for "-". A picture stored
+ *              plainly in the mp3 file is copied file to file by the kernel, a decoded one is
+ *              written from memory.
+ * Input: out_fname - output file name, fd_src - the mp3 file, offset - position of the picture in
+ *        fd_src, length - picture size, data - decoded picture bytes, or NULL to copy from fd_src.
+ * Output: Returns success if the picture was written, or failure on an error.
+ */
+static Status write_picture(const char *out_fname, int fd_src, off_t offset, uint32_t length, const unsigned char *data)
+{
+    int to_stdout = strcmp(out_fname, "-") == 0;
+    int fd = to_stdout ? STDOUT_FILENO : open(out_fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    Status status = success;
+
+    if (fd < 0)
+    {
+        perror(out_fname);
+        return failure;
+    }
+    if (data == NULL && copy_range(fd, fd_src, offset, length) == failure)
+    {
+        perror(out_fname);
+        status = failure;
+    }
+    for (uint32_t done = 0; data != NULL && done < length;)
+    {
+        ssize_t written = write(fd, data + done, length - done);
+        if (written <= 0)
+        {
+            perror("write");
+            status = failure;
+            break;
+        }
+        done += (uint32_t)written;
+    }
+    if (!to_stdout && close(fd) != 0)
+    {
+        perror(out_fname);
+        status = failure;
+    }
+    return status;
+}
+
+/**
+ * Function: extract_art
+ * Description: Writes the picture of the first APIC frame (PIC in v2.2) to a file. Only the frame headers and
+ *              the start of the APIC frame are read; the picture bytes go from the mp3 file to the
+ *              output with copy_file_range or sendfile. Frames that are unsynchronised or carry a
+ *              data length indicator are loaded and decoded first.
+ * Input: mp3_fname - the mp3 file, out_fname - the image file to write, "-" for stdout.
+ * Output: Returns success if the picture was written, or failure otherwise.
+ */
+Status extract_art(const char *mp3_fname, const char *out_fname)
+{
+    uint32_t key[2] = {frame_key("APIC"), frame_key("PIC")};
+    Status status = failure;
+    Id3Tag tag;
+    FrameIndex index;
+    uint32_t picture;
+
+    init_id3_tag(&tag);
+    init_frame_index(&index);
+    int fd = open(mp3_fname, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(mp3_fname);
+        return failure;
+    }
+
+    if (read_frame_heads(fd, &tag, key, 2, ART_HEAD_SIZE, &index) == failure || index.count == 0)
+    {
+        if (tag.error != NULL)
+        {
+            fprintf(stderr, "ERROR: %s: %s.\n", mp3_fname, tag.error);
+        }
+        fprintf(stderr, "ERROR: %s has no cover art.\n", mp3_fname);
+    }
+    else if ((tag.version == 3 && (index.frames[0].flags & 0x00C0)) || (tag.version == 4 && (index.frames[0].flags & 0x000C)))
+    {
+        fprintf(stderr, "ERROR: The cover art of %s is compressed or encrypted.\n", mp3_fname);
+    }
+    else if (is_stored_plain(&tag, &index.frames[0]) &&
+             find_picture(tag.version, tag.data + index.frames[0].data_offset,
+                          index.frames[0].size < ART_HEAD_SIZE ? index.frames[0].size : ART_HEAD_SIZE, &picture) == success)
+    {
+        // The tag starts the file, so offsets in the tag buffer are file offsets
+        const FrameEntry *entry = &index.frames[0];
+        status = write_picture(out_fname, fd, (off_t)entry->data_offset + picture, entry->size - picture, NULL);
+    }
+    else if (read_frames(fd, &tag, key, 2, &index) == success && index.count > 0 &&
+             find_picture(tag.version, tag.data + index.frames[0].data_offset, index.frames[0].data_size, &picture) == success)
+    {
+        const FrameEntry *entry = &index.frames[0];
+        status = write_picture(out_fname, fd, 0, entry->data_size - picture, tag.data + entry->data_offset + picture);
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: The cover art of %s is damaged.\n", mp3_fname);
+    }
+
+    if (status == success && strcmp(out_fname, "-") != 0)
+    {
+        printf("----------COVER ART WRITTEN TO %s----------\n", out_fname);
+    }
+    free_frame_index(&index);
+    free_id3_tag(&tag);
+    close(fd);
+    return status;
+}
+
+/**
+ * Function: open_art
+ * Description: Opens the image for a new APIC frame and detects its MIME type from the first bytes.
+ * Input: fname - the image file, art - pointer to the ArtSource struct to fill.
+ * Output: Returns success if the image can be used, or failure if it is missing, too large or
+ *         not a JPEG, PNG or GIF image, with the reason in art->error. Nothing is printed.
+ */
+Status open_art(const char *fname, ArtSource *art)
+{
+    unsigned char magic[8];
+    struct stat st;
+
+    art->mime = NULL;
+    art->error = NULL;
+    art->fd = open(fname, O_RDONLY);
+    if (art->fd < 0)
+    {
+        art->error = strerror(errno);
+        return failure;
+    }
+    if (fstat(art->fd, &st) != 0 || !S_ISREG(st.st_mode) || pread(art->fd, magic, sizeof(magic), 0) != sizeof(magic))
+    {
+        art->error = "Not an image file";
+        close_art(art);
+        return failure;
+    }
+    art->size = st.st_size;
+
+    if (memcmp(magic, "\xFF\xD8\xFF", 3) == 0)
+    {
+        art->mime = "image/jpeg";
+    }
+    else if (memcmp(magic, "\x89PNG\r\n\x1A\n", 8) == 0)
+    {
+        art->mime = "image/png";
+    }
+    else if (memcmp(magic, "GIF8", 4) == 0)
+    {
+        art->mime = "image/gif";
+    }
+    if (art->mime == NULL)
+    {
+        art->error = "Not a JPEG, PNG or GIF image";
+        close_art(art);
+        return failure;
+    }
+    // The tag size is a 28 bit syncsafe integer
+    if (art->size > MAX_TAG_SIZE - 64)
+    {
+        art->error = "Too large for an ID3v2 tag";
+        close_art(art);
+        return failure;
+    }
+    return success;
+}
+
+/**
+ * Function: close_art
+ * Description: Closes the image of a new APIC frame.
+ * Input: art - pointer to the ArtSource struct.
+ * Output: The image file is closed.
+ */
+void close_art(ArtSource *art)
+{
+    if (art->fd >= 0)
+    {
+        close(art->fd);
+        art->fd = -1;
+    }
+}
+
+/**
+ * Function: art_frame_size
+ * Description: Computes the data size of the APIC frame for an image: encoding byte, MIME type,
+ *              picture type, empty description, then the image.
+ * Input: art - pointer to the opened ArtSource.
+ * Output: Returns the frame data size in bytes (excluding the frame header).
+ */
+uint32_t art_frame_size(const ArtSource *art)
+{
+    return 1 + (uint32_t)strlen(art->mime) + 1 + 1 + 1 + (uint32_t)art->size;
+}
+
+/**
+ * Function: write_art_frame
+ * Description: Writes an APIC frame at the current position of fd_dest. The frame header is
+ *              written from memory and the image is copied into place by the kernel.
+ * Input: fd_dest - the file being written, art - pointer to the opened ArtSource.
+ * Output: Returns success if the frame was written, or failure with errno set.
+ */
+Status write_art_frame(int fd_dest, const ArtSource *art)
+{
+    unsigned char header[FRAME_HEADER_SIZE + 64];
+    uint32_t size = art_frame_size(art);
+    size_t length = 0;
+
+    // Frame ID, big-endian size and no flags
+    memcpy(header, "APIC", 4);
+    header[4] = (size >> 24) & 0xFF;
+    header[5] = (size >> 16) & 0xFF;
+    header[6] = (size >> 8) & 0xFF;
+    header[7] = size & 0xFF;
+    header[8] = 0;
+    header[9] = 0;
+    length = FRAME_HEADER_SIZE;
+
+    // ISO-8859-1 encoding, MIME type, picture type and an empty description
+    header[length++] = 0x00;
+    memcpy(header + length, art->mime, strlen(art->mime) + 1);
+    length += strlen(art->mime) + 1;
+    header[length++] = ART_PICTURE_TYPE;
+    header[length++] = 0x00;
+
+    ssize_t written = write(fd_dest, header, length);
+    if (written != (ssize_t)length)
+    {
+        errno = written < 0 ? errno : ENOSPC;
+        return failure;
+    }
+    return copy_range(fd_dest, art->fd, 0, art->size);
+}
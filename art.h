@@ -0,0 +1,31 @@
+#ifndef ART_H
+#define ART_H
+
+#include <sys/types.h>
+#include "type.h"
+#include "frame_index.h"
+
+#define ART_HEAD_SIZE BUFFER_SIZE // Bytes of an APIC frame read to find where the picture starts
+#define ART_PICTURE_TYPE 3        // Picture type written by --set-art (front cover)
+
+/**
+ * Structure to hold the image given to --set-art. Only its first bytes are read, to detect the
+ * MIME type; the image itself is copied into the tag by the kernel.
+ */
+typedef struct
+{
+    int fd;           // Descriptor of the image file, -1 if no image is set
+    off_t size;       // Size of the image in bytes
+    const char *mime; // MIME type from the image signature (e.g., "image/jpeg")
+    const char *error; // Reason open_art failed
+} ArtSource;
+
+// Function prototypes
+Status extract_art(const char *mp3_fname, const char *out_fname);
+Status find_picture(unsigned char version, const unsigned char *data, uint32_t size, uint32_t *offset);
+Status open_art(const char *fname, ArtSource *art);
+void close_art(ArtSource *art);
+uint32_t art_frame_size(const ArtSource *art);
+Status write_art_frame(int fd_dest, const ArtSource *art);
+
+#endif // ART_H
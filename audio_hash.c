@@ -0,0 +1,292 @@
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "type.h"
+#include "batch.h"
+#include "audio_info.h"
+#include "audio_hash.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+/**
+ * Structure to hold a payload being hashed by several threads.
+ */
+typedef struct
+{
+    int fd;                // The file
+    off_t start;           // First byte of the payload
+    off_t end;             // End of the payload
+    size_t chunks;         // Number of chunks
+    size_t next;           // Next chunk to hash, taken atomically
+    uint64_t *digests;     // Hash of every chunk
+    int failed;            // Set if a chunk could not be mapped
+} HashJob;
+
+/**
+ * Function: read_le64
+ * Description: Reads a 64-bit little-endian value from any address.
+ * Input: ptr - eight bytes.
+ * Output: Returns the value.
+ */
+static inline uint64_t read_le64(const unsigned char *ptr)
+{
+    uint64_t value;
+    memcpy(&value, ptr, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+/**
+ * Function: read_le32
+ * Description: Reads a 32-bit little-endian value from any address.
+ * Input: ptr - four bytes.
+ * Output: Returns the value.
+ */
+static inline uint32_t read_le32(const unsigned char *ptr)
+{
+    return ptr[0] | ptr[1] << 8 | ptr[2] << 16 | (uint32_t)ptr[3] << 24;
+}
+
+/**
+ * Function: rotl64
+ * Description: Rotates a 64-bit value left.
+ * Input: value - the value, bits - rotation, 1 to 63.
+ * Output: Returns the rotated value.
+ */
+static inline uint64_t rotl64(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+/**
+ * Function: xxh64_round
+ * Description: Mixes eight input bytes into one XXH64 accumulator.
+ * Input: acc - the accumulator, input - the bytes as a little-endian value.
+ * Output: Returns the new accumulator.
+ */
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+/**
+ * Function: xxh64_merge
+ * Description: Folds one of the four accumulators into the hash.
+ * Input: hash - the hash so far, acc - the accumulator.
+ * Output: Returns the new hash.
+ */
+static inline uint64_t xxh64_merge(uint64_t hash, uint64_t acc)
+{
+    hash ^= xxh64_round(0, acc);
+    return hash * PRIME64_1 + PRIME64_4;
+}
+
+/**
+ * Function: xxh64
+ * Description: Computes the XXH64 hash of a buffer, compatible with the reference implementation.
+ * Input: data - the bytes, length - number of bytes, seed - hash seed.
+ * Output: Returns the 64-bit hash.
+ */
+uint64_t xxh64(const void *data, size_t length, uint64_t seed)
+{
+    const unsigned char *ptr = data;
+    const unsigned char *end = ptr + length;
+    uint64_t hash;
+
+    if (length >= 32)
+    {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+        // Four independent lanes of eight bytes per stripe
+        for (; ptr + 32 <= end; ptr += 32)
+        {
+            v1 = xxh64_round(v1, read_le64(ptr));
+            v2 = xxh64_round(v2, read_le64(ptr + 8));
+            v3 = xxh64_round(v3, read_le64(ptr + 16));
+            v4 = xxh64_round(v4, read_le64(ptr + 24));
+        }
+        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        hash = xxh64_merge(hash, v1);
+        hash = xxh64_merge(hash, v2);
+        hash = xxh64_merge(hash, v3);
+        hash = xxh64_merge(hash, v4);
+    }
+    else
+    {
+        hash = seed + PRIME64_5;
+    }
+    hash += (uint64_t)length;
+
+    for (; ptr + 8 <= end; ptr += 8)
+    {
+        hash ^= xxh64_round(0, read_le64(ptr));
+        hash = rotl64(hash, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (ptr + 4 <= end)
+    {
+        hash ^= (uint64_t)read_le32(ptr) * PRIME64_1;
+        hash = rotl64(hash, 23) * PRIME64_2 + PRIME64_3;
+        ptr += 4;
+    }
+    for (; ptr < end; ptr++)
+    {
+        hash ^= *ptr * PRIME64_5;
+        hash = rotl64(hash, 11) * PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/**
+ * Function: hash_chunk
+ * Description: Maps one chunk of the payload and hashes it.
+ * Input: job - the HashJob, chunk - index of the chunk.
+ * Output: Returns success with the chunk's hash stored, or failure if it could not be mapped.
+ */
+static Status hash_chunk(HashJob *job, size_t chunk)
+{
+    off_t first = job->start + (off_t)chunk * HASH_CHUNK;
+    off_t last = job->end - first > HASH_CHUNK ? first + HASH_CHUNK : job->end;
+    off_t page = (off_t)sysconf(_SC_PAGESIZE);
+    off_t offset = first - first % page;
+    size_t length = (size_t)(last - offset);
+
+    // Populated up front, the whole chunk is read anyway
+    void *base = mmap(NULL, length, PROT_READ, MAP_PRIVATE | MAP_POPULATE, job->fd, offset);
+    if (base == MAP_FAILED)
+    {
+        return failure;
+    }
+    job->digests[chunk] = xxh64((const unsigned char *)base + (first - offset), (size_t)(last - first), 0);
+    munmap(base, length);
+    return success;
+}
+
+/**
+ * Function: hash_worker
+ * Description: Worker thread hashing chunks until none are left.
+ * Input: arg - pointer to the shared HashJob struct.
+ * Output: Returns NULL when every chunk has been taken.
+ */
+static void *hash_worker(void *arg)
+{
+    HashJob *job = arg;
+
+    for (;;)
+    {
+        size_t chunk = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (chunk >= job->chunks)
+        {
+            break;
+        }
+        if (hash_chunk(job, chunk) == failure)
+        {
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Function: hash_audio_range
+ * Description: Computes the audio hash of a byte range of a file. Payloads of HASH_PARALLEL_MIN
+ *              bytes or more are hashed on up to threads threads, one chunk at a time.
+ * Input: fd - the file, start - first byte of the payload, end - end of the payload,
+ *        threads - threads that may be used, hash - receives the hash.
+ * Output: Returns success, or failure if the file could not be mapped.
+ */
+Status hash_audio_range(int fd, off_t start, off_t end, int threads, uint64_t *hash)
+{
+    uint64_t stack[HASH_STACK_CHUNKS];
+    HashJob job;
+
+    job.fd = fd;
+    job.start = start;
+    job.end = end > start ? end : start;
+    job.chunks = (size_t)((job.end - start + HASH_CHUNK - 1) / HASH_CHUNK);
+    job.next = 0;
+    job.failed = 0;
+    job.digests = job.chunks <= HASH_STACK_CHUNKS ? stack : malloc(job.chunks * sizeof(uint64_t));
+    if (job.digests == NULL)
+    {
+        return failure;
+    }
+
+    if (threads > 1 && job.end - start >= HASH_PARALLEL_MIN)
+    {
+        if (run_workers(threads, job.chunks, hash_worker, &job) == failure)
+        {
+            job.failed = 1;
+        }
+    }
+    else
+    {
+        hash_worker(&job);
+    }
+
+    // Hash of the chunk hashes, the same for any number of threads
+    if (!job.failed)
+    {
+        unsigned char *bytes = (unsigned char *)job.digests;
+        for (size_t i = 0; i < job.chunks; i++)
+        {
+            uint64_t digest = job.digests[i];
+            for (int b = 0; b < 8; b++)
+            {
+                bytes[i * 8 + b] = (unsigned char)(digest >> (8 * b));
+            }
+        }
+        *hash = xxh64(bytes, job.chunks * 8, (uint64_t)(job.end - start));
+    }
+    if (job.digests != stack)
+    {
+        free(job.digests);
+    }
+    return job.failed ? failure : success;
+}
+
+/**
+ * Function: hash_audio
+ * Description: Computes the audio hash of the file open in a library handle. The end of the
+ *              ID3v2 tag comes from the tag the handle has read; only the last bytes of the file
+ *              are read again to find the trailers.
+ * Input: handle - a handle opened with mp3tag_open_fd, threads - threads that may be used,
+ *        hash - receives the hash.
+ * Output: Returns success, or failure if the file could not be read.
+ */
+Status hash_audio(const Mp3Tag *handle, int threads, uint64_t *hash)
+{
+    unsigned char tail[AUDIO_TRAILER_PROBE];
+    off_t start = 0;
+
+    if (handle->fd < 0)
+    {
+        return failure;
+    }
+    if (handle->has_v2)
+    {
+        start = audio_payload_start(handle->tag.data, handle->tag.size);
+    }
+    size_t probe = handle->file_size < AUDIO_TRAILER_PROBE ? (size_t)handle->file_size : AUDIO_TRAILER_PROBE;
+    if (pread(handle->fd, tail, probe, handle->file_size - (off_t)probe) != (ssize_t)probe)
+    {
+        return failure;
+    }
+    off_t end = audio_payload_end(tail, probe, start, handle->file_size);
+    return hash_audio_range(handle->fd, start, end, threads, hash);
+}
@@ -0,0 +1,24 @@
+#ifndef AUDIO_HASH_H
+#define AUDIO_HASH_H
+
+#include <sys/types.h>
+#include "type.h"
+#include "mp3tag_private.h"
+
+/*
+ * The audio hash of --hash covers the bytes between the end of the ID3v2 tag and the start of
+ * the APEv2, TAG+ and ID3v1 trailers, so it stays the same when only the tags change. The
+ * payload is cut into HASH_CHUNK byte chunks, each chunk is hashed with XXH64 (seed 0), and the
+ * result is XXH64 over the little-endian chunk hashes with the payload length as seed. The
+ * chunks can be hashed on any number of threads without changing the result.
+ */
+#define HASH_CHUNK (4 * 1024 * 1024)          // Bytes of payload hashed by one task
+#define HASH_PARALLEL_MIN (4 * HASH_CHUNK)     // Smaller payloads are hashed by the calling thread
+#define HASH_STACK_CHUNKS 64                   // Chunk hashes kept on the stack, more are allocated
+
+// Function prototypes
+uint64_t xxh64(const void *data, size_t length, uint64_t seed);
+Status hash_audio_range(int fd, off_t start, off_t end, int threads, uint64_t *hash);
+Status hash_audio(const Mp3Tag *handle, int threads, uint64_t *hash);
+
+#endif // AUDIO_HASH_H
@@ -0,0 +1,910 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "type.h"
+#include "frame_index.h"
+#include "audio_info.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SYNC_SIMD_X86 1
+#endif
+
+
+/**
+ * Structure to hold the window of a file that is mapped. The walkers ask for a few bytes at an
+ * offset and the window moves when they run past it, so a file of any length is read through at
+ * most one mapping of AudioMap.window bytes.
+ */
+typedef struct
+{
+    int fd;              // The file
+    off_t file_size;     // Size of the file
+    size_t window;       // Bytes mapped at once
+    int advice;          // madvise advice for new windows
+    unsigned char *base; // Start of the mapping, NULL if nothing is mapped
+    off_t offset;        // File offset of base, a multiple of the page size
+    size_t length;       // Bytes mapped
+} AudioMap;
+
+/**
+ * Structure to hold the totals of a frame walk.
+ */
+typedef struct
+{
+    uint64_t frames; // Frames walked
+    uint64_t bytes;  // Bytes of those frames
+    int vbr;         // Set if a frame's bitrate differs from the first frame's
+} FrameCount;
+
+// Sync word search picked once at run time from the CPU features
+static size_t (*sync_scan)(const unsigned char *data, size_t size);
+static pthread_once_t sync_once = PTHREAD_ONCE_INIT;
+
+// Bitrates in kbps by [MPEG-1, MPEG-2/2.5][layer - 1][bitrate index], 0 for free format and invalid
+static const short bitrates[2][3][16] = {
+    {{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0},
+     {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0},
+     {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0}},
+    {{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0},
+     {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0},
+     {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0}}};
+
+// Sample rates by [MPEG-1, MPEG-2, MPEG-2.5][sample rate index]
+static const int sample_rates[3][3] = {{44100, 48000, 32000}, {22050, 24000, 16000}, {11025, 12000, 8000}};
+
+/**
+ * Function: sync_scan_scalar
+ * Description: Finds the first MPEG sync word: a 0xFF byte followed by a byte with its top
+ *              three bits set.
+ * Input: data - the bytes, size - number of bytes.
+ * Output: Returns the offset of the sync word, or size if there is none.
+ */
+static size_t sync_scan_scalar(const unsigned char *data, size_t size)
+{
+    for (size_t i = 0; i + 1 < size; i++)
+    {
+        if (data[i] == 0xFF && (data[i + 1] & 0xE0) == 0xE0)
+        {
+            return i;
+        }
+    }
+    return size;
+}
+
+#ifdef SYNC_SIMD_X86
+/**
+ * Function: sync_scan_sse2
+ * Description: Finds the first MPEG sync word, sixteen positions at a time. Each byte is
+ *              compared with 0xFF and the byte after it, loaded one position later, with its
+ *              top three bits, so stray 0xFF bytes in the audio cost no branch.
+ * Input: data - the bytes, size - number of bytes.
+ * Output: Returns the offset of the sync word, or size if there is none.
+ */
+static size_t sync_scan_sse2(const unsigned char *data, size_t size)
+{
+    const __m128i ones = _mm_set1_epi8((char)0xFF);
+    const __m128i high = _mm_set1_epi8((char)0xE0);
+    size_t i = 0;
+
+    for (; i + 17 <= size; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i next = _mm_loadu_si128((const __m128i *)(data + i + 1));
+        __m128i hit = _mm_and_si128(_mm_cmpeq_epi8(bytes, ones), _mm_cmpeq_epi8(_mm_and_si128(next, high), high));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+        if (mask != 0)
+        {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    return i + sync_scan_scalar(data + i, size - i);
+}
+
+/**
+ * Function: sync_scan_avx2
+ * Description: Finds the first MPEG sync word, thirty-two positions at a time.
+ * Input: data - the bytes, size - number of bytes.
+ * Output: Returns the offset of the sync word, or size if there is none.
+ */
+__attribute__((target("avx2"))) static size_t sync_scan_avx2(const unsigned char *data, size_t size)
+{
+    const __m256i ones = _mm256_set1_epi8((char)0xFF);
+    const __m256i high = _mm256_set1_epi8((char)0xE0);
+    size_t i = 0;
+
+    for (; i + 33 <= size; i += 32)
+    {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i next = _mm256_loadu_si256((const __m256i *)(data + i + 1));
+        __m256i hit =
+            _mm256_and_si256(_mm256_cmpeq_epi8(bytes, ones), _mm256_cmpeq_epi8(_mm256_and_si256(next, high), high));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+        if (mask != 0)
+        {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    return i + sync_scan_sse2(data + i, size - i);
+}
+#endif
+
+/**
+ * Function: select_sync_scan
+ * Description: Picks the fastest sync word search the CPU supports. MP3TAG_SIMD=scalar|sse2
+ *              limits the choice, as for the text decoders.
+ * Input: None.
+ * Output: sync_scan is set.
+ */
+static void select_sync_scan(void)
+{
+    const char *limit = getenv("MP3TAG_SIMD");
+
+    sync_scan = sync_scan_scalar;
+#ifdef SYNC_SIMD_X86
+    __builtin_cpu_init();
+    if (limit != NULL && strcmp(limit, "scalar") == 0)
+    {
+        return;
+    }
+    sync_scan = sync_scan_sse2;
+    if ((limit == NULL || strcmp(limit, "sse2") != 0) && __builtin_cpu_supports("avx2"))
+    {
+        sync_scan = sync_scan_avx2;
+    }
+#else
+    (void)limit;
+#endif
+}
+
+/**
+ * Function: find_mpeg_sync
+ * Description: Finds the first MPEG sync word in a buffer with the kernel the CPU supports.
+ * Input: data - the bytes, size - number of bytes.
+ * Output: Returns the offset of the sync word, or size if there is none.
+ */
+size_t find_mpeg_sync(const unsigned char *data, size_t size)
+{
+    pthread_once(&sync_once, select_sync_scan);
+    return sync_scan(data, size);
+}
+
+/**
+ * Function: parse_mpeg_header
+ * Description: Decodes a four byte MPEG audio frame header. Reserved values and free format
+ *              streams, whose frame length is not in the header, are rejected.
+ * Input: data - four bytes, header - receives the decoded header.
+ * Output: Returns success if the bytes are a valid header, or failure otherwise.
+ */
+Status parse_mpeg_header(const unsigned char *data, MpegHeader *header)
+{
+    if (data[0] != 0xFF || (data[1] & 0xE0) != 0xE0)
+    {
+        return failure;
+    }
+    int version_bits = (data[1] >> 3) & 3;
+    int layer_bits = (data[1] >> 1) & 3;
+    int bitrate_index = data[2] >> 4;
+    int rate_index = (data[2] >> 2) & 3;
+    if (version_bits == 1 || layer_bits == 0 || rate_index == 3)
+    {
+        return failure;
+    }
+
+    header->version = version_bits == 3 ? 10 : version_bits == 2 ? 20 : 25;
+    header->layer = 4 - layer_bits;
+    header->bitrate = bitrates[header->version == 10 ? 0 : 1][header->layer - 1][bitrate_index];
+    if (header->bitrate == 0)
+    {
+        return failure;
+    }
+    header->sample_rate = sample_rates[header->version == 10 ? 0 : header->version == 20 ? 1 : 2][rate_index];
+    header->channels = data[3] >> 6;
+
+    uint32_t padding = (data[2] >> 1) & 1;
+    uint32_t bits = (uint32_t)header->bitrate * 1000;
+    if (header->layer == 1)
+    {
+        header->samples = 384;
+        header->length = (12 * bits / (uint32_t)header->sample_rate + padding) * 4;
+    }
+    else if (header->layer == 2 || header->version == 10)
+    {
+        header->samples = 1152;
+        header->length = 144 * bits / (uint32_t)header->sample_rate + padding;
+    }
+    else
+    {
+        // Layer III of MPEG-2 and 2.5 has half the samples per frame
+        header->samples = 576;
+        header->length = 72 * bits / (uint32_t)header->sample_rate + padding;
+    }
+    return success;
+}
+
+/**
+ * Function: map_at
+ * Description: Gives access to the bytes of the file at an offset. The current window is reused
+ *              when it holds them, otherwise a new one is mapped from the page holding pos.
+ * Input: map - the AudioMap, pos - file offset, want - bytes needed, avail - receives the bytes
+ *        mapped from pos on, which is at least want unless the file ends first.
+ * Output: Returns a pointer to the byte at pos, or NULL if pos is past the end or mmap fails.
+ */
+static const unsigned char *map_at(AudioMap *map, off_t pos, size_t want, size_t *avail)
+{
+    if (pos < 0 || pos >= map->file_size)
+    {
+        return NULL;
+    }
+    if ((off_t)want > map->file_size - pos)
+    {
+        want = (size_t)(map->file_size - pos);
+    }
+    if (map->base == NULL || pos < map->offset || pos + (off_t)want > map->offset + (off_t)map->length)
+    {
+        if (map->base != NULL)
+        {
+            munmap(map->base, map->length);
+            map->base = NULL;
+        }
+        off_t page = (off_t)sysconf(_SC_PAGESIZE);
+        off_t offset = pos - pos % page;
+        size_t length = map->window > (size_t)(pos - offset) + want ? map->window : (size_t)(pos - offset) + want;
+        if ((off_t)length > map->file_size - offset)
+        {
+            length = (size_t)(map->file_size - offset);
+        }
+        void *base = mmap(NULL, length, PROT_READ, MAP_PRIVATE, map->fd, offset);
+        if (base == MAP_FAILED)
+        {
+            return NULL;
+        }
+        madvise(base, length, map->advice);
+        map->base = base;
+        map->offset = offset;
+        map->length = length;
+    }
+    *avail = (size_t)(map->offset + (off_t)map->length - pos);
+    return map->base + (pos - map->offset);
+}
+
+/**
+ * Function: unmap_window
+ * Description: Releases the window of an AudioMap.
+ * Input: map - the AudioMap.
+ * Output: Nothing is mapped afterwards.
+ */
+static void unmap_window(AudioMap *map)
+{
+    if (map->base != NULL)
+    {
+        munmap(map->base, map->length);
+        map->base = NULL;
+    }
+}
+
+/**
+ * Function: frame_at
+ * Description: Checks for a complete frame of the stream at an offset.
+ * Input: map - the AudioMap, pos - file offset, end - end of the audio, ref - header the frame
+ *        must match in version, layer and sample rate, or NULL, header - receives the header.
+ * Output: Returns success if a frame starts at pos and ends by end, or failure otherwise.
+ */
+static Status frame_at(AudioMap *map, off_t pos, off_t end, const MpegHeader *ref, MpegHeader *header)
+{
+    size_t avail;
+
+    if (pos + 4 > end)
+    {
+        return failure;
+    }
+    const unsigned char *data = map_at(map, pos, 4, &avail);
+    if (data == NULL || parse_mpeg_header(data, header) == failure)
+    {
+        return failure;
+    }
+    if (ref != NULL &&
+        (header->version != ref->version || header->layer != ref->layer || header->sample_rate != ref->sample_rate))
+    {
+        return failure;
+    }
+    return pos + (off_t)header->length <= end ? success : failure;
+}
+
+/**
+ * Function: find_audio_frame
+ * Description: Searches for the next frame with the vectorized sync word search. A sync word
+ *              only counts when a frame of the same stream follows it, or the audio ends right
+ *              after it, since 0xFFE0 turns up in audio data and in tags.
+ * Input: map - the AudioMap, pos - where the search starts, limit - the frame must start before
+ *        limit, end - end of the audio, ref - header to match or NULL, found - receives the
+ *        offset of the frame, header - receives its header.
+ * Output: Returns success if a frame was found, or failure otherwise.
+ */
+static Status find_audio_frame(AudioMap *map, off_t pos, off_t limit, off_t end, const MpegHeader *ref, off_t *found,
+                         MpegHeader *header)
+{
+    MpegHeader next;
+    size_t avail;
+
+    while (pos + 4 <= limit)
+    {
+        const unsigned char *data = map_at(map, pos, AUDIO_MAX_FRAME, &avail);
+        if (data == NULL)
+        {
+            return failure;
+        }
+        // One byte past the last candidate, for the second byte of the sync word
+        size_t size = avail < (size_t)(limit - pos) + 1 ? avail : (size_t)(limit - pos) + 1;
+        size_t hit = find_mpeg_sync(data, size);
+        if (hit + 1 >= size)
+        {
+            // The last byte may start a sync word continued in the next window
+            pos += size > 1 ? (off_t)size - 1 : 1;
+            continue;
+        }
+        off_t at = pos + (off_t)hit;
+        if (frame_at(map, at, end, ref, header) == success &&
+            (at + (off_t)header->length == end || frame_at(map, at + header->length, end, header, &next) == success))
+        {
+            *found = at;
+            return success;
+        }
+        pos = at + 1;
+    }
+    return failure;
+}
+
+/**
+ * Function: walk_audio
+ * Description: Walks frames from one to the next by their lengths. Damaged or foreign data
+ *              between frames is skipped by searching for the next frame within reach bytes.
+ * Input: map - the AudioMap, pos - offset of a frame, end - end of the audio, first - header of
+ *        the first frame, max_frames - frames to walk at most, reach - how far a lost sync is
+ *        searched for, count - totals to add to.
+ * Output: The frames walked are added to count.
+ */
+static void walk_audio(AudioMap *map, off_t pos, off_t end, const MpegHeader *first, uint64_t max_frames, off_t reach,
+                       FrameCount *count)
+{
+    MpegHeader header;
+
+    for (uint64_t walked = 0; walked < max_frames;)
+    {
+        if (frame_at(map, pos, end, first, &header) == failure)
+        {
+            off_t limit = end - pos > reach ? pos + reach : end;
+            if (find_audio_frame(map, pos + 1, limit, end, first, &pos, &header) == failure)
+            {
+                return;
+            }
+        }
+        count->vbr |= header.bitrate != first->bitrate;
+        count->frames++;
+        count->bytes += header.length;
+        pos += header.length;
+        walked++;
+    }
+}
+
+/**
+ * Function: audio_payload_start
+ * Description: Finds where the audio starts from the first bytes of a file: after the ID3v2 tag
+ *              by its declared size, and after the footer of an ID3v2.4 tag.
+ * Input: head - the first bytes of the file, size - bytes in head.
+ * Output: Returns the offset just past the ID3v2 tag, or 0 if the file has none.
+ */
+off_t audio_payload_start(const unsigned char *head, size_t size)
+{
+    off_t start = id3_tag_size(head, size);
+
+    if (start > 0 && head[3] >= 4 && (head[5] & 0x10))
+    {
+        start += ID3_HEADER_SIZE;
+    }
+    return start;
+}
+
+/**
+ * Function: audio_payload_end
+ * Description: Finds where the audio ends from the last bytes of a file: before an ID3v1
+ *              trailer with its TAG+ block and an APEv2 tag in front of them.
+ * Input: tail - the last bytes of the file, size - bytes in tail, at most AUDIO_TRAILER_PROBE,
+ *        start - where the audio starts, file_size - size of the file.
+ * Output: Returns the offset just past the audio, never before start.
+ */
+off_t audio_payload_end(const unsigned char *tail, size_t size, off_t start, off_t file_size)
+{
+    const unsigned char *ptr = tail + size;
+    off_t end = file_size;
+
+    if (end - start >= ID3V1_SIZE && size >= ID3V1_SIZE && memcmp(ptr - ID3V1_SIZE, "TAG", 3) == 0)
+    {
+        end -= ID3V1_SIZE;
+        ptr -= ID3V1_SIZE;
+        if (end - start >= ID3V1_PLUS_SIZE && ptr - tail >= ID3V1_PLUS_SIZE && memcmp(ptr - ID3V1_PLUS_SIZE, "TAG+", 4) == 0)
+        {
+            end -= ID3V1_PLUS_SIZE;
+            ptr -= ID3V1_PLUS_SIZE;
+        }
+    }
+    if (end - start >= APE_FOOTER_SIZE && ptr - tail >= APE_FOOTER_SIZE && memcmp(ptr - APE_FOOTER_SIZE, "APETAGEX", 8) == 0)
+    {
+        // The size counts the items and the footer, the flags tell if a header precedes them
+        const unsigned char *footer = ptr - APE_FOOTER_SIZE;
+        uint32_t ape = footer[12] | footer[13] << 8 | footer[14] << 16 | (uint32_t)footer[15] << 24;
+        ape += (footer[23] & 0x80) ? APE_FOOTER_SIZE : 0;
+        end = (off_t)ape <= end - start ? end - (off_t)ape : start;
+    }
+    return end < start ? start : end;
+}
+
+/**
+ * Function: get_be32
+ * Description: Reads a 32-bit big-endian value.
+ * Input: data - four bytes.
+ * Output: Returns the value.
+ */
+static uint32_t get_be32(const unsigned char *data)
+{
+    return (uint32_t)data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+/**
+ * Function: read_vbr_header
+ * Description: Reads the frame count from a Xing or Info header after the side information of
+ *              the first frame, or from a VBRI header 32 bytes after its frame header.
+ * Input: map - the AudioMap, info - with the first frame and the audio range set.
+ * Output: Returns success with the frames, bitrate and source of info set, or failure if the
+ *         first frame has no such header or it gives no frame count.
+ */
+static Status read_vbr_header(AudioMap *map, AudioInfo *info)
+{
+    const MpegHeader *first = &info->first;
+    uint64_t bytes = (uint64_t)(info->audio_end - info->audio_start);
+    size_t avail;
+
+    const unsigned char *data = map_at(map, info->audio_start, first->length, &avail);
+    if (data == NULL || avail < first->length)
+    {
+        return failure;
+    }
+    uint32_t side = first->version == 10 ? (first->channels == 3 ? 17 : 32) : (first->channels == 3 ? 9 : 17);
+    const unsigned char *xing = data + 4 + side;
+    if (4 + side + 8 <= first->length && (memcmp(xing, "Xing", 4) == 0 || memcmp(xing, "Info", 4) == 0))
+    {
+        uint32_t flags = get_be32(xing + 4);
+        uint32_t field = 8;
+        if (!(flags & 1) || field + 4 > first->length - 4 - side)
+        {
+            return failure;
+        }
+        info->frames = get_be32(xing + field);
+        field += 4;
+        if ((flags & 2) && field + 4 <= first->length - 4 - side && get_be32(xing + field) != 0)
+        {
+            bytes = get_be32(xing + field);
+        }
+        info->source = memcmp(xing, "Xing", 4) == 0 ? source_xing : source_info;
+        info->vbr = info->source == source_xing;
+    }
+    else if (4 + 32 + 18 <= first->length && memcmp(data + 36, "VBRI", 4) == 0)
+    {
+        bytes = get_be32(data + 36 + 10);
+        info->frames = get_be32(data + 36 + 14);
+        info->source = source_vbri;
+        info->vbr = 1;
+    }
+    else
+    {
+        return failure;
+    }
+    if (info->frames == 0)
+    {
+        return failure;
+    }
+    info->duration = (double)info->frames * first->samples / first->sample_rate;
+    info->bitrate = (int)(bytes * 8 / info->duration / 1000 + 0.5);
+    return success;
+}
+
+/**
+ * Function: estimate_frames
+ * Description: Counts the frames of a stream without a VBR header. The full scan walks every
+ *              frame through a moving window. The sampling scan walks AUDIO_SAMPLE_FRAMES
+ *              frames in windows spread evenly over the audio and divides the audio size by
+ *              their average length; streams too short to gain from sampling are walked whole.
+ * Input: map - the AudioMap, info - with the first frame and the audio range set, scan - the
+ *        estimator, samples - windows walked by scan_sample.
+ * Output: Returns success with the frames, bitrate and source of info set, or failure if no
+ *         frame could be walked.
+ */
+static Status estimate_frames(AudioMap *map, AudioInfo *info, ScanMode scan, int samples)
+{
+    const MpegHeader *first = &info->first;
+    off_t audio = info->audio_end - info->audio_start;
+    FrameCount count = {0, 0, 0};
+
+    if (scan == scan_sample && audio > 2 * (off_t)samples * AUDIO_SAMPLE_FRAMES * (off_t)first->length)
+    {
+        MpegHeader header;
+        for (int i = 0; i < samples; i++)
+        {
+            off_t pos = info->audio_start + (off_t)((double)audio * i / samples);
+            off_t limit = pos + AUDIO_SAMPLE_WINDOW / 2;
+            if (i > 0 && find_audio_frame(map, pos, limit, info->audio_end, first, &pos, &header) == failure)
+            {
+                continue;
+            }
+            walk_audio(map, pos, info->audio_end, first, AUDIO_SAMPLE_FRAMES, AUDIO_SAMPLE_WINDOW / 2, &count);
+        }
+        if (count.frames == 0)
+        {
+            return failure;
+        }
+        info->frames = (uint64_t)((double)audio * count.frames / count.bytes + 0.5);
+        info->source = source_sample;
+        info->samples = samples;
+    }
+    else
+    {
+        walk_audio(map, info->audio_start, info->audio_end, first, UINT64_MAX, info->audio_end, &count);
+        if (count.frames == 0)
+        {
+            return failure;
+        }
+        info->frames = count.frames;
+        info->source = source_scan;
+        audio = (off_t)count.bytes;
+    }
+    info->vbr = count.vbr;
+    info->duration = (double)info->frames * first->samples / first->sample_rate;
+    info->bitrate = (int)((double)audio * 8 / info->duration / 1000 + 0.5);
+    return success;
+}
+
+/**
+ * Function: read_audio_info
+ * Description: Finds the duration and bitrate of the MPEG audio in a file. The ID3v2 tag is
+ *              skipped by its declared size and the first frame is searched for after it. A
+ *              Xing, Info or VBRI header in that frame answers at once, otherwise the frames are
+ *              counted by the chosen estimator. The file is read through bounded mappings.
+ * Input: fd - descriptor of the file, scan - estimator for files without a VBR header,
+ *        samples - windows walked by scan_sample, info - receives the stream properties,
+ *        error - receives the reason of a failure.
+ * Output: Returns success if an MPEG audio stream was found, or failure with error set.
+ */
+Status read_audio_info(int fd, ScanMode scan, int samples, AudioInfo *info, const char **error)
+{
+    AudioMap map;
+    struct stat st;
+    size_t avail;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        *error = "Not a regular file";
+        return failure;
+    }
+    map.fd = fd;
+    map.file_size = st.st_size;
+    map.window = scan == scan_full ? AUDIO_WINDOW : AUDIO_SAMPLE_WINDOW;
+    map.advice = scan == scan_full ? MADV_SEQUENTIAL : MADV_NORMAL;
+    map.base = NULL;
+    map.offset = 0;
+    map.length = 0;
+    memset(info, 0, sizeof(*info));
+
+    // Skip the ID3v2 tag, and leave out the trailers
+    off_t start = 0;
+    const unsigned char *data = map_at(&map, 0, ID3_HEADER_SIZE, &avail);
+    if (data != NULL)
+    {
+        start = audio_payload_start(data, avail);
+    }
+    size_t probe = map.file_size < AUDIO_TRAILER_PROBE ? (size_t)map.file_size : AUDIO_TRAILER_PROBE;
+    data = map_at(&map, map.file_size - (off_t)probe, probe, &avail);
+    info->audio_end = data != NULL ? audio_payload_end(data, probe, start, map.file_size) : start;
+
+    off_t limit = info->audio_end - start > AUDIO_SYNC_LIMIT ? start + AUDIO_SYNC_LIMIT : info->audio_end;
+    if (start >= info->audio_end ||
+        find_audio_frame(&map, start, limit, info->audio_end, NULL, &info->audio_start, &info->first) == failure)
+    {
+        unmap_window(&map);
+        *error = "No MPEG audio frame found";
+        return failure;
+    }
+    Status status = read_vbr_header(&map, info);
+    if (status == failure)
+    {
+        status = estimate_frames(&map, info, scan, samples);
+    }
+    unmap_window(&map);
+    if (status == failure)
+    {
+        *error = "No MPEG audio frame found";
+    }
+    return status;
+}
+
+/**
+ * Function: read_scan_option
+ * Description: Reads the value of --scan: full, sample or sample:<windows>.
+ * Input: value - the option value, may be NULL, batch - receives the scan mode and windows.
+ * Output: Returns success if the value is valid, or failure with a message otherwise.
+ */
+static Status read_scan_option(const char *value, AudioBatch *batch)
+{
+    char *end;
+
+    if (value != NULL && strcmp(value, "full") == 0)
+    {
+        batch->scan = scan_full;
+        return success;
+    }
+    if (value != NULL && strcmp(value, "sample") == 0)
+    {
+        batch->scan = scan_sample;
+        batch->samples = AUDIO_SAMPLES;
+        return success;
+    }
+    if (value != NULL && strncmp(value, "sample:", 7) == 0)
+    {
+        errno = 0;
+        long samples = strtol(value + 7, &end, 10);
+        if (errno == 0 && end != value + 7 && *end == '\0' && samples >= 1 && samples <= AUDIO_MAX_SAMPLES)
+        {
+            batch->scan = scan_sample;
+            batch->samples = (int)samples;
+            return success;
+        }
+    }
+    fprintf(stderr, "ERROR: --scan must be full, sample or sample:<1-%d>.\n", AUDIO_MAX_SAMPLES);
+    return failure;
+}
+
+/**
+ * Function: read_and_validate_audio
+ * Description: Reads the options and the files or directories of --audio-info.
+ * Input: argc - number of command-line arguments, argv - array of arguments, batch - pointer to
+ *        the AudioBatch struct to fill.
+ * Output: Returns success if the arguments are valid and name at least one file, or failure otherwise.
+ */
+Status read_and_validate_audio(int argc, char *argv[], AudioBatch *batch)
+{
+    init_path_list(&batch->files);
+    batch->threads = default_threads();
+    batch->format = format_text;
+    batch->scan = scan_sample;
+    batch->samples = AUDIO_SAMPLES;
+
+    for (int i = 2; i < argc; i++)
+    {
+        // Number of worker threads
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            if (read_threads_option(i + 1 < argc ? argv[i + 1] : NULL, &batch->threads, NULL) == failure)
+            {
+                free_audio_batch(batch);
+                return failure;
+            }
+            i++;
+            continue;
+        }
+        // Estimator for files without a VBR header
+        if (strcmp(argv[i], "--scan") == 0)
+        {
+            if (read_scan_option(i + 1 < argc ? argv[i + 1] : NULL, batch) == failure)
+            {
+                free_audio_batch(batch);
+                return failure;
+            }
+            i++;
+            continue;
+        }
+        // Output format, the bin records hold tag fields only
+        if (is_format_option(argv[i]))
+        {
+            if (read_format_option(argv[i], &batch->format, NULL) == failure || batch->format == format_bin)
+            {
+                fprintf(stderr, "ERROR: --audio-info prints --format=text or --format=ndjson.\n");
+                free_audio_batch(batch);
+                return failure;
+            }
+            continue;
+        }
+        if (collect_paths(argv[i], &batch->files, NULL) == failure)
+        {
+            free_audio_batch(batch);
+            return failure;
+        }
+    }
+
+    if (batch->files.count == 0)
+    {
+        fprintf(stderr, "ERROR: No mp3 files found.\n");
+        free_audio_batch(batch);
+        return failure;
+    }
+    return success;
+}
+
+/**
+ * Function: format_duration
+ * Description: Writes a duration as [h:]mm:ss.mmm.
+ * Input: seconds - the duration, out - output buffer.
+ * Output: The duration is appended to out.
+ */
+static void format_duration(double seconds, OutBuffer *out)
+{
+    uint64_t millis = (uint64_t)(seconds * 1000 + 0.5);
+    uint64_t minutes = millis / 60000;
+
+    if (minutes >= 60)
+    {
+        out_printf(out, "%llu:%02llu:", (unsigned long long)(minutes / 60), (unsigned long long)(minutes % 60));
+    }
+    else
+    {
+        out_printf(out, "%llu:", (unsigned long long)minutes);
+    }
+    out_printf(out, "%02llu.%03llu", (unsigned long long)(millis / 1000 % 60), (unsigned long long)(millis % 1000));
+}
+
+/**
+ * Function: format_audio_info
+ * Description: Writes the stream properties of a file in the text or ndjson format.
+ * Input: format - output format, path - file name, info - the properties, out - output buffer.
+ * Output: The record is appended to out.
+ */
+static void format_audio_info(OutputFormat format, const char *path, const AudioInfo *info, OutBuffer *out)
+{
+    static const char *const layers[] = {"", "I", "II", "III"};
+    static const char *const channels[] = {"Stereo", "Joint stereo", "Dual channel", "Mono"};
+    static const char *const json_channels[] = {"stereo", "joint stereo", "dual channel", "mono"};
+    static const char *const sources[] = {"Xing header", "Info header", "VBRI header", "Full scan", "Sampled"};
+    static const char *const json_sources[] = {"xing", "info", "vbri", "scan", "sample"};
+    const MpegHeader *first = &info->first;
+    const char *version = first->version == 10 ? "MPEG-1" : first->version == 20 ? "MPEG-2" : "MPEG-2.5";
+
+    if (format == format_ndjson)
+    {
+        out_puts(out, "{\"path\":");
+        out_json_string(out, path, strlen(path));
+        out_printf(out, ",\"version\":\"%s\",\"layer\":%d,\"sample_rate\":%d,\"channels\":\"%s\"", version, first->layer,
+                   first->sample_rate, json_channels[first->channels]);
+        out_printf(out, ",\"bitrate\":%d,\"vbr\":%s,\"duration\":%.3f,\"frames\":%llu,\"source\":\"%s\"}\n",
+                   info->bitrate, info->vbr ? "true" : "false", info->duration, (unsigned long long)info->frames,
+                   json_sources[info->source]);
+        return;
+    }
+    out_printf(out, "FILE     :   %s\n", path);
+    out_printf(out, "AUDIO    :   %s Layer %s, %d Hz, %s\n", version, layers[first->layer], first->sample_rate,
+               channels[first->channels]);
+    out_printf(out, "BITRATE  :   %d kbps %s\n", info->bitrate, info->vbr ? "VBR" : "CBR");
+    out_puts(out, "DURATION :   ");
+    format_duration(info->duration, out);
+    out_printf(out, "\nFRAMES   :   %llu\n", (unsigned long long)info->frames);
+    out_printf(out, "SOURCE   :   %s", sources[info->source]);
+    if (info->source == source_sample)
+    {
+        out_printf(out, ", %d windows", info->samples);
+    }
+    out_puts(out, "\n\n");
+}
+
+/**
+ * Function: audio_file
+ * Description: Reads the stream properties of one file and formats them, or reports the failure.
+ * Input: batch - the AudioBatch, path - file name, out - output buffer.
+ * Output: The record is appended to out; text failures are printed on stderr.
+ */
+static void audio_file(AudioBatch *batch, const char *path, OutBuffer *out)
+{
+    AudioInfo info;
+    const char *error = "Error in opening file";
+    Status status = failure;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        status = read_audio_info(fd, batch->scan, batch->samples, &info, &error);
+        close(fd);
+    }
+    if (status == success)
+    {
+        format_audio_info(batch->format, path, &info, out);
+    }
+    else if (batch->format == format_ndjson)
+    {
+        format_failed_record(batch->format, path, error, out);
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: %s: %s\n", path, error);
+    }
+}
+
+/**
+ * Function: audio_worker
+ * Description: Worker thread of --audio-info. Takes runs of files, formats them, and prints the
+ *              run once every earlier file has been printed, so the output keeps the file order.
+ * Input: arg - pointer to the shared AudioBatch struct.
+ * Output: Returns NULL when no files are left.
+ */
+static void *audio_worker(void *arg)
+{
+    AudioBatch *batch = arg;
+    OutBuffer out;
+    size_t chunk = batch->files.count / ((size_t)batch->threads * 4);
+
+    chunk = chunk < 1 ? 1 : chunk > BATCH_CHUNK ? BATCH_CHUNK : chunk;
+    init_out_buffer(&out);
+    for (;;)
+    {
+        pthread_mutex_lock(&batch->lock);
+        size_t first = batch->next;
+        size_t last = first + chunk < batch->files.count ? first + chunk : batch->files.count;
+        batch->next = last > first ? last : first;
+        pthread_mutex_unlock(&batch->lock);
+        if (first >= batch->files.count)
+        {
+            break;
+        }
+
+        for (size_t job = first; job < last; job++)
+        {
+            audio_file(batch, batch->files.paths[job], &out);
+        }
+
+        pthread_mutex_lock(&batch->lock);
+        while (batch->printed != first)
+        {
+            pthread_cond_wait(&batch->turn, &batch->lock);
+        }
+        pthread_mutex_unlock(&batch->lock);
+
+        write_out_buffer(&out, stdout);
+
+        pthread_mutex_lock(&batch->lock);
+        batch->printed = last;
+        pthread_cond_broadcast(&batch->turn);
+        pthread_mutex_unlock(&batch->lock);
+    }
+    free_out_buffer(&out);
+    return NULL;
+}
+
+/**
+ * Function: run_audio_info
+ * Description: Prints the duration and bitrate of every file on a pool of worker threads.
+ * Input: batch - pointer to the AudioBatch struct filled by read_and_validate_audio.
+ * Output: Returns success when all files are processed, or failure if no thread could be started.
+ */
+Status run_audio_info(AudioBatch *batch)
+{
+    batch->next = 0;
+    batch->printed = 0;
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->turn, NULL);
+
+    Status status = run_workers(batch->threads, batch->files.count, audio_worker, batch);
+    fflush(stdout);
+
+    pthread_cond_destroy(&batch->turn);
+    pthread_mutex_destroy(&batch->lock);
+    free_audio_batch(batch);
+    return status;
+}
+
+/**
+ * Function: free_audio_batch
+ * Description: Releases the file list of an AudioBatch.
+ * Input: batch - pointer to the AudioBatch struct.
+ * Output: The file list is freed.
+ */
+void free_audio_batch(AudioBatch *batch)
+{
+    free_path_list(&batch->files);
+}
@@ -0,0 +1,99 @@
+#ifndef AUDIO_INFO_H
+#define AUDIO_INFO_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include "type.h"
+#include "batch.h"
+#include "id3v1.h"
+#include "output_format.h"
+
+#define AUDIO_WINDOW (1024 * 1024)      // Bytes of a file mapped at once by the full scan
+#define AUDIO_SAMPLE_WINDOW (256 * 1024) // Bytes mapped for one sampled window
+#define AUDIO_SYNC_LIMIT (64 * 1024)    // Bytes after the ID3v2 tag searched for the first frame
+#define AUDIO_MAX_FRAME 4096            // Upper bound of an MPEG audio frame (2881 bytes at most)
+#define AUDIO_SAMPLES 16                // Windows walked by the sampling estimator by default
+#define AUDIO_MAX_SAMPLES 1024          // Upper limit for --scan sample:<windows>
+#define AUDIO_SAMPLE_FRAMES 64          // Frames walked in each sampled window
+#define APE_FOOTER_SIZE 32              // Size of the APEv2 footer, and of its optional header
+#define AUDIO_TRAILER_PROBE (ID3V1_PLUS_SIZE + ID3V1_SIZE + APE_FOOTER_SIZE) // Last bytes read to find the trailers
+
+/**
+ * How the duration is found when the first frame carries no Xing, Info or VBRI header.
+ */
+typedef enum
+{
+    scan_sample, // Walk a few windows spread over the file and extrapolate (default)
+    scan_full    // Walk every frame
+} ScanMode;
+
+/**
+ * Where the frame count of an AudioInfo came from.
+ */
+typedef enum
+{
+    source_xing,  // Xing header of a VBR file
+    source_info,  // Info header, the Xing header LAME writes for CBR files
+    source_vbri,  // VBRI header of the Fraunhofer encoder
+    source_scan,  // Every frame walked
+    source_sample // Estimated from sampled windows
+} AudioSource;
+
+/**
+ * Structure to hold a decoded MPEG audio frame header.
+ */
+typedef struct
+{
+    int version;     // 10 for MPEG-1, 20 for MPEG-2, 25 for MPEG-2.5
+    int layer;       // 1, 2 or 3
+    int sample_rate; // Samples per second
+    int channels;    // Channel mode: 0 stereo, 1 joint stereo, 2 dual channel, 3 mono
+    int samples;     // Samples per frame
+    int bitrate;     // Bitrate of this frame in kbps
+    uint32_t length; // Frame length in bytes, header included
+} MpegHeader;
+
+/**
+ * Structure to hold the stream properties reported by --audio-info.
+ */
+typedef struct
+{
+    MpegHeader first;   // Header of the first frame
+    off_t audio_start;  // Offset of the first frame
+    off_t audio_end;    // End of the audio, before any ID3v1 or APEv2 trailer
+    uint64_t frames;    // Number of audio frames
+    double duration;    // Playing time in seconds
+    int bitrate;        // Average bitrate in kbps
+    int vbr;            // Set if the bitrate changes between frames
+    AudioSource source; // Where frames came from
+    int samples;        // Windows walked by source_sample
+} AudioInfo;
+
+/**
+ * Structure to hold the state shared by the --audio-info workers.
+ */
+typedef struct
+{
+    PathList files;       // Files to read, in the order their output is printed
+    int threads;          // Number of worker threads
+    OutputFormat format;  // Output format from --format, text or ndjson
+    ScanMode scan;        // Estimator used without a Xing, Info or VBRI header
+    int samples;          // Windows walked by scan_sample
+
+    size_t next;          // Next file to hand out to a worker
+    size_t printed;       // Number of files whose output has been written
+    pthread_mutex_t lock; // Protects next and printed
+    pthread_cond_t turn;  // Signalled whenever printed advances
+} AudioBatch;
+
+// Function prototypes
+Status read_and_validate_audio(int argc, char *argv[], AudioBatch *batch);
+Status run_audio_info(AudioBatch *batch);
+void free_audio_batch(AudioBatch *batch);
+Status read_audio_info(int fd, ScanMode scan, int samples, AudioInfo *info, const char **error);
+Status parse_mpeg_header(const unsigned char *data, MpegHeader *header);
+size_t find_mpeg_sync(const unsigned char *data, size_t size);
+off_t audio_payload_start(const unsigned char *head, size_t size);
+off_t audio_payload_end(const unsigned char *tail, size_t size, off_t start, off_t file_size);
+
+#endif // AUDIO_INFO_H
@@ -0,0 +1,613 @@
+#include <errno.h>
+#include <dirent.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "type.h"
+#include "view.h"
+#include "batch.h"
+#include "uring_scan.h"
+
+/**
+ * Function: is_batch_view
+ * Description: Decides whether a -v command line needs the batch viewer: more than one path,
+ *              a -j, --cache or --io option, or a directory instead of a single file.
+ * Input: argc - number of command-line arguments, argv - array of arguments.
+ * Output: Returns 1 for batch mode, 0 for the single file viewer.
+ */
+int is_batch_view(int argc, char *argv[])
+{
+    struct stat st;
+    int paths = 0;
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--cache") == 0 || strcmp(argv[i], "--io") == 0)
+        {
+            return 1;
+        }
+        // --fields and --hash work for one file as well as for many
+        if (strcmp(argv[i], "--fields") == 0)
+        {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--hash") == 0)
+        {
+            continue;
+        }
+        if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            return 1;
+        }
+        paths++;
+    }
+    return paths > 1;
+}
+
+/**
+ * Function: read_and_validate_batch
+ * Description: Reads the -j, --io, --fields, --format and --cache options and the list of files and directories to view.
+ *              Directories are walked recursively for .mp3 files.
+ * Input: argc - number of command-line arguments, argv - array of arguments, batch - pointer to the BatchView struct,
+ *        err - receives the error messages, NULL to print them on stderr.
+ * Output: Returns success if at least one file was found, or failure if the arguments are invalid.
+ */
+Status read_and_validate_batch(int argc, char *argv[], BatchView *batch, OutBuffer *err)
+{
+    init_path_list(&batch->files);
+    batch->threads = default_threads();
+    batch->cache = NULL;
+    default_field_list(&batch->wanted);
+    batch->format = format_text;
+    batch->use_uring = 0;
+    batch->hash_threads = 0;
+
+    for (int i = 2; i < argc; i++)
+    {
+        // Number of worker threads
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            if (read_threads_option(i + 1 < argc ? argv[i + 1] : NULL, &batch->threads, err) == failure)
+            {
+                free_batch_view(batch);
+                return failure;
+            }
+            i++;
+            continue;
+        }
+        // I/O backend, io_uring keeps hundreds of files in flight from one thread
+        if (strcmp(argv[i], "--io") == 0)
+        {
+            const char *value = i + 1 < argc ? argv[i + 1] : "";
+            if (strcmp(value, "uring") != 0 && strcmp(value, "threads") != 0)
+            {
+                print_error(err, "ERROR: --io must be uring or threads.\n");
+                free_batch_view(batch);
+                return failure;
+            }
+            batch->use_uring = strcmp(value, "uring") == 0;
+            i++;
+            continue;
+        }
+        // Frames to print instead of the six default fields
+        if (strcmp(argv[i], "--fields") == 0)
+        {
+            if (read_fields_option(i + 1 < argc ? argv[i + 1] : NULL, &batch->wanted, err) == failure)
+            {
+                free_batch_view(batch);
+                return failure;
+            }
+            i++;
+            continue;
+        }
+        // Output format
+        if (is_format_option(argv[i]))
+        {
+            if (read_format_option(argv[i], &batch->format, err) == failure)
+            {
+                free_batch_view(batch);
+                return failure;
+            }
+            continue;
+        }
+        // Hash of the audio payload, read in the same pass as the tags
+        if (strcmp(argv[i], "--hash") == 0)
+        {
+            batch->hash_threads = 1;
+            continue;
+        }
+        // Cache file for the decoded fields
+        if (strcmp(argv[i], "--cache") == 0)
+        {
+            TagCache *cache = (i + 1 < argc && batch->cache == NULL) ? malloc(sizeof(TagCache)) : NULL;
+            if (cache == NULL || open_tag_cache(argv[i + 1], cache) == failure)
+            {
+                // open_tag_cache releases what it allocated before failing
+                free(cache);
+                free_batch_view(batch);
+                return failure;
+            }
+            batch->cache = cache;
+            i++;
+            continue;
+        }
+        if (collect_paths(argv[i], &batch->files, err) == failure)
+        {
+            free_batch_view(batch);
+            return failure;
+        }
+    }
+
+    // Cache records hold the six default fields as printed by the text format only
+    if (batch->cache != NULL &&
+        (!is_default_field_list(&batch->wanted) || batch->format != format_text || batch->hash_threads > 0))
+    {
+        print_error(err, "ERROR: --cache can not be combined with --fields, --format or --hash.\n");
+        free_batch_view(batch);
+        return failure;
+    }
+    if (batch->cache != NULL && batch->use_uring)
+    {
+        print_error(err, "ERROR: --cache can not be combined with --io uring.\n");
+        free_batch_view(batch);
+        return failure;
+    }
+    // io_uring reads the tags only, the audio is hashed by the thread pool
+    if (batch->hash_threads > 0 && batch->use_uring)
+    {
+        print_error(err, "ERROR: --hash can not be combined with --io uring.\n");
+        free_batch_view(batch);
+        return failure;
+    }
+    if (batch->files.count == 0)
+    {
+        print_error(err, "ERROR: No mp3 files found.\n");
+        free_batch_view(batch);
+        return failure;
+    }
+    // Threads left over when there are fewer files than threads hash chunks of the large ones
+    if (batch->hash_threads > 0 && batch->files.count < (size_t)batch->threads)
+    {
+        batch->hash_threads = batch->threads / (int)batch->files.count;
+    }
+    return success;
+}
+
+/**
+ * Function: compare_names
+ * Description: qsort comparator for directory entry names, so the walk order does not depend on the filesystem.
+ * Input: a, b - pointers to the two char pointers to compare.
+ * Output: Returns <0, 0 or >0 like strcmp.
+ */
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Function: has_mp3_extension
+ * Description: Checks if a file name ends in ".mp3", ignoring case.
+ * Input: name - the file name.
+ * Output: Returns 1 if the extension matches, 0 otherwise.
+ */
+int has_mp3_extension(const char *name)
+{
+    size_t length = strlen(name);
+    return length > 4 && strcasecmp(name + length - 4, ".mp3") == 0;
+}
+
+/**
+ * Function: collect_paths
+ * Description: Adds a path to the list. A directory is walked recursively in sorted order
+ *              and every .mp3 file below it is added. Symbolic links to directories are not followed.
+ * Input: path - file or directory given by the user, list - pointer to the PathList to append to,
+ *        err - receives a line for each path that can not be read, NULL to print them on stderr.
+ * Output: Returns success if the path was added or walked, or failure on an allocation error.
+ */
+Status collect_paths(const char *path, PathList *list, OutBuffer *err)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0)
+    {
+        print_error(err, "%s: %s\n", path, strerror(errno));
+        return success;
+    }
+    if (!S_ISDIR(st.st_mode))
+    {
+        return add_path(list, path);
+    }
+
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+    {
+        print_error(err, "%s: %s\n", path, strerror(errno));
+        return success;
+    }
+
+    // Read the names first so they can be sorted
+    PathList names;
+    init_path_list(&names);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+        if (add_path(&names, entry->d_name) == failure)
+        {
+            closedir(dir);
+            free_path_list(&names);
+            return failure;
+        }
+    }
+    closedir(dir);
+    qsort(names.paths, names.count, sizeof(char *), compare_names);
+
+    Status status = success;
+    size_t dir_length = strlen(path);
+    for (size_t i = 0; i < names.count && status == success; i++)
+    {
+        char *child = malloc(dir_length + strlen(names.paths[i]) + 2);
+        if (child == NULL)
+        {
+            status = failure;
+            break;
+        }
+        sprintf(child, "%s%s%s", path, (dir_length && path[dir_length - 1] == '/') ? "" : "/", names.paths[i]);
+
+        if (lstat(child, &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            status = collect_paths(child, list, err);
+        }
+        else if (has_mp3_extension(names.paths[i]) && stat(child, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            status = add_path(list, child);
+        }
+        free(child);
+    }
+    free_path_list(&names);
+    return status;
+}
+
+/**
+ * Function: read_cached_fields
+ * Description: Reads the fields of one file, answering from the tag cache when the file's
+ *              device, inode, size and modification time match a record. On a miss the file is
+ *              read and a fresh record is queued for the cache.
+ * Input: cache - the tag cache, or NULL to always read the file, music - Music struct with the
+ *        filename set, fields - receives the field values.
+ * Output: Returns success if the fields were read, or failure if the file is not valid.
+ */
+static Status read_cached_fields(TagCache *cache, Music *music, TagFields *fields)
+{
+    struct stat st;
+
+    if (cache == NULL || stat(music->Filename, &st) != 0)
+    {
+        return read_fields(music, fields);
+    }
+
+    const CacheRecord *record = lookup_tag_cache(cache, &st);
+    if (record != NULL)
+    {
+        cache_record_fields(record, fields);
+    }
+    else if (read_fields(music, fields) == success)
+    {
+        add_tag_cache(cache, music->Filename, &st, fields);
+    }
+    else
+    {
+        return failure;
+    }
+    return success;
+}
+
+/**
+ * Function: format_batch_file
+ * Description: Appends the output of one file of a batch view: a record in the ndjson and bin
+ *              formats, an error record included, or the file name and the fields as text. A
+ *              failed file prints nothing in the text format, only an error on stderr.
+ * Input: music - Music struct with the filename and fields, status - result of reading the
+ *        fields, out - buffer receiving the output.
+ * Output: The output of the file is appended to out.
+ */
+void format_batch_file(const Music *music, Status status, OutBuffer *out)
+{
+    if (music->format != format_text)
+    {
+        // Structured formats carry the path and any error in the record itself
+        if (status == success)
+        {
+            format_record(music->format, music->Filename, &music->wanted, &music->fields, out);
+        }
+        else
+        {
+            format_failed_record(music->format, music->Filename, music->error, out);
+        }
+        return;
+    }
+    if (status == failure)
+    {
+        fprintf(stderr, "ERROR: Failed to validate MP3 file %s\n", music->Filename);
+        return;
+    }
+    out_printf(out, "FILE     :   %s\n", music->Filename);
+    format_fields(&music->wanted, &music->fields, out, music->err);
+    out_putc(out, '\n');
+}
+
+/**
+ * Function: view_batch_file
+ * Description: Reads one file of a batch view, from the tag cache if there is one, and appends its output.
+ * Input: batch - pointer to the BatchView struct, music - Music struct with the filename set,
+ *        out - buffer receiving the output.
+ * Output: The output of the file is appended to out.
+ */
+void view_batch_file(BatchView *batch, Music *music, OutBuffer *out)
+{
+    format_batch_file(music, read_cached_fields(batch->cache, music, &music->fields), out);
+}
+
+/**
+ * Function: batch_worker
+ * Description: Worker thread of the batch viewer. Takes the next run of files, formats their
+ *              tags into a buffer owned by the thread, waits for its turn and writes the buffer
+ *              to stdout with one call, so the output stays in input order. The Music struct and
+ *              buffers are reused for every file.
+ * Input: arg - pointer to the shared BatchView struct.
+ * Output: Returns NULL when no files are left.
+ */
+static void *batch_worker(void *arg)
+{
+    BatchView *batch = arg;
+    Music music;
+    OutBuffer out;
+
+    init_music(&music);
+    init_out_buffer(&out);
+    music.wanted = batch->wanted;
+    music.format = batch->format;
+    music.hash_threads = batch->hash_threads;
+
+    for (;;)
+    {
+        // Take the next run of files
+        pthread_mutex_lock(&batch->lock);
+        size_t first = batch->next;
+        size_t last = first + batch->chunk < batch->files.count ? first + batch->chunk : batch->files.count;
+        batch->next = last > first ? last : first;
+        pthread_mutex_unlock(&batch->lock);
+        if (first >= batch->files.count)
+        {
+            break;
+        }
+
+        // Format the files' tags without holding the lock
+        for (size_t job = first; job < last; job++)
+        {
+            music.Filename = batch->files.paths[job];
+            view_batch_file(batch, &music, &out);
+        }
+
+        // Wait until every earlier file has been printed
+        pthread_mutex_lock(&batch->lock);
+        while (batch->printed != first)
+        {
+            pthread_cond_wait(&batch->turn, &batch->lock);
+        }
+        pthread_mutex_unlock(&batch->lock);
+
+        write_out_buffer(&out, stdout);
+
+        pthread_mutex_lock(&batch->lock);
+        batch->printed = last;
+        pthread_cond_broadcast(&batch->turn);
+        pthread_mutex_unlock(&batch->lock);
+    }
+
+    free_out_buffer(&out);
+    free_music(&music);
+    return NULL;
+}
+
+/**
+ * Function: run_batch_view
+ * Description: Views every file in the batch using a fixed-size pool of worker threads, or from
+ *              one thread with io_uring for --io uring when the kernel supports it.
+ * Input: batch - pointer to the BatchView struct filled by read_and_validate_batch.
+ * Output: Returns success when all files are processed, or failure if no thread could be started.
+ */
+Status run_batch_view(BatchView *batch)
+{
+    batch->next = 0;
+    batch->printed = 0;
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->turn, NULL);
+
+    // Hand out runs of files so every thread writes larger blocks less often, while still
+    // leaving several runs per thread to even out the load
+    batch->chunk = batch->files.count / ((size_t)batch->threads * 4);
+    batch->chunk = batch->chunk < 1 ? 1 : batch->chunk > BATCH_CHUNK ? BATCH_CHUNK : batch->chunk;
+
+    OutBuffer header;
+    init_out_buffer(&header);
+    format_stream_header(batch->format, &header);
+    write_out_buffer(&header, stdout);
+    free_out_buffer(&header);
+
+    // run_uring_view prints nothing when the kernel lacks io_uring, the thread pool takes over
+    Status status = success;
+    if (!batch->use_uring || run_uring_view(batch) == failure)
+    {
+        status = run_workers(batch->threads, batch->files.count, batch_worker, batch);
+    }
+    fflush(stdout);
+
+    pthread_cond_destroy(&batch->turn);
+    pthread_mutex_destroy(&batch->lock);
+    if (batch->cache != NULL)
+    {
+        print_cache_stats(batch->cache);
+    }
+    free_batch_view(batch);
+    return status;
+}
+
+/**
+ * Function: free_batch_view
+ * Description: Releases the file list and closes the tag cache, saving the records added during the run.
+ * Input: batch - pointer to the BatchView struct.
+ * Output: Returns success, or failure if the cache could not be saved.
+ */
+Status free_batch_view(BatchView *batch)
+{
+    Status status = success;
+
+    if (batch->cache != NULL)
+    {
+        status = close_tag_cache(batch->cache);
+        free(batch->cache);
+        batch->cache = NULL;
+    }
+    free_path_list(&batch->files);
+    return status;
+}
+
+/**
+ * Function: run_workers
+ * Description: Starts a fixed-size pool of threads running the same worker function and waits
+ *              for all of them to finish. No more threads are started than there are jobs.
+ * Input: threads - requested number of threads, jobs - number of jobs to share out,
+ *        worker - thread function, arg - argument passed to every thread.
+ * Output: Returns success when the workers have finished, or failure if no thread could be started.
+ */
+Status run_workers(int threads, size_t jobs, void *(*worker)(void *), void *arg)
+{
+    pthread_t workers[MAX_JOBS];
+    int started = 0;
+
+    if (threads > MAX_JOBS)
+    {
+        threads = MAX_JOBS;
+    }
+    if ((size_t)threads > jobs)
+    {
+        threads = (int)jobs;
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        if (pthread_create(&workers[started], NULL, worker, arg) == 0)
+        {
+            started++;
+        }
+    }
+    if (started == 0 && jobs > 0)
+    {
+        fprintf(stderr, "ERROR: Failed to start worker threads.\n");
+        return failure;
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    return success;
+}
+
+/**
+ * Function: default_threads
+ * Description: Returns the default size of the worker pool, one thread per online CPU.
+ * Input: None.
+ * Output: Returns the number of threads to use.
+ */
+int default_threads(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+    {
+        return 1;
+    }
+    return cpus > MAX_JOBS ? MAX_JOBS : (int)cpus;
+}
+
+/**
+ * Function: read_threads_option
+ * Description: Parses the value of a -j option.
+ * Input: value - the option value (may be NULL if missing), threads - receives the thread count,
+ *        err - receives the error message, NULL to print it on stderr.
+ * Output: Returns success if the value is a number between 1 and MAX_JOBS, or failure otherwise.
+ */
+Status read_threads_option(const char *value, int *threads, OutBuffer *err)
+{
+    char *end;
+    long jobs = value ? strtol(value, &end, 10) : 0;
+    if (jobs < 1 || jobs > MAX_JOBS || *end != '\0')
+    {
+        print_error(err, "ERROR: -j needs a thread count between 1 and %d\n", MAX_JOBS);
+        return failure;
+    }
+    *threads = (int)jobs;
+    return success;
+}
+
+/**
+ * Function: init_path_list
+ * Description: Initializes an empty path list.
+ * Input: list - pointer to the PathList struct.
+ * Output: The list holds no paths.
+ */
+void init_path_list(PathList *list)
+{
+    list->paths = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+/**
+ * Function: add_path
+ * Description: Appends a copy of a path to the list.
+ * Input: list - pointer to the PathList struct, path - the path to copy.
+ * Output: Returns success if the path was added, or failure if allocation fails.
+ */
+Status add_path(PathList *list, const char *path)
+{
+    if (list->count == list->capacity)
+    {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        char **paths = realloc(list->paths, capacity * sizeof(char *));
+        if (paths == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to allocate path list.\n");
+            return failure;
+        }
+        list->paths = paths;
+        list->capacity = capacity;
+    }
+    list->paths[list->count] = strdup(path);
+    if (list->paths[list->count] == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate path list.\n");
+        return failure;
+    }
+    list->count++;
+    return success;
+}
+
+/**
+ * Function: free_path_list
+ * Description: Releases every path and the list itself.
+ * Input: list - pointer to the PathList struct.
+ * Output: The list is emptied and can be reused.
+ */
+void free_path_list(PathList *list)
+{
+    for (size_t i = 0; i < list->count; i++)
+    {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+    init_path_list(list);
+}
@@ -0,0 +1,57 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <pthread.h>
+#include "type.h"
+#include "tag_cache.h"
+
+#define MAX_JOBS 256 // Upper limit for the -j option
+#define BATCH_CHUNK 64 // Largest run of files a batch view worker takes at once
+
+/**
+ * Structure to hold a growable list of file paths.
+ */
+typedef struct
+{
+    char **paths;    // Heap allocated paths in output order
+    size_t count;    // Number of paths in the list
+    size_t capacity; // Allocated size of the array
+} PathList;
+
+/**
+ * Structure to hold the state shared by the batch view workers.
+ */
+typedef struct
+{
+    PathList files;        // Files to view, in the order their output is printed
+    int threads;           // Number of worker threads
+    TagCache *cache;       // Tag cache from --cache, NULL if not used
+    FieldList wanted;      // Frames to print for every file
+    OutputFormat format;   // Output format from --format
+    int use_uring;         // Set by --io uring to read the files with io_uring instead of threads
+    int hash_threads;      // Threads hashing one file's audio for --hash, 0 if the audio is not hashed
+
+    size_t chunk;          // Number of files handed out to a worker at once
+    size_t next;           // Next file to hand out to a worker
+    size_t printed;        // Number of files whose output has been written
+    pthread_mutex_t lock;  // Protects next and printed
+    pthread_cond_t turn;   // Signalled whenever printed advances
+} BatchView;
+
+// Function prototypes
+int is_batch_view(int argc, char *argv[]);
+Status read_and_validate_batch(int argc, char *argv[], BatchView *batch, OutBuffer *err);
+Status collect_paths(const char *path, PathList *list, OutBuffer *err);
+int has_mp3_extension(const char *name);
+Status run_batch_view(BatchView *batch);
+Status free_batch_view(BatchView *batch);
+void format_batch_file(const Music *music, Status status, OutBuffer *out);
+void view_batch_file(BatchView *batch, Music *music, OutBuffer *out);
+Status run_workers(int threads, size_t jobs, void *(*worker)(void *), void *arg);
+int default_threads(void);
+Status read_threads_option(const char *value, int *threads, OutBuffer *err);
+void init_path_list(PathList *list);
+Status add_path(PathList *list, const char *path);
+void free_path_list(PathList *list);
+
+#endif // BATCH_H
@@ -0,0 +1,289 @@
+/**
+ * Benchmark harness for the reader and the editor.
+ *
+ * Build: make bench
+ * Usage: ./bench_run <corpus dir> [-r rounds]
+ *
+ * Times viewInfo, the field reader (read_fields for every viewer field) and edit_info with one
+ * and with six fields over every .mp3 file below the corpus directory. For every phase it
+ * prints files/sec and the read/write syscalls and bytes counted by /proc/self/io, then the
+ * peak RSS of the run. The edit phases modify the corpus; regenerate it with gen_corpus
+ * before comparing runs that need an untouched tree.
+ */
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include "type.h"
+#include "view.h"
+#include "mp3_edit.h"
+#include "batch.h"
+#include "text_decode.h"
+
+/**
+ * Structure to hold the I/O counters of the process from /proc/self/io.
+ */
+typedef struct
+{
+    unsigned long long rchar; // Bytes read by read-like syscalls
+    unsigned long long wchar; // Bytes written by write-like syscalls
+    unsigned long long syscr; // Number of read-like syscalls
+    unsigned long long syscw; // Number of write-like syscalls
+} IoCounters;
+
+/**
+ * Structure to hold the result of one benchmark phase.
+ */
+typedef struct
+{
+    const char *name;  // Phase name printed in the report
+    size_t files;      // Files processed
+    size_t failed;     // Files for which the call failed
+    double seconds;    // Wall clock time of the phase
+    IoCounters io;     // I/O done during the phase
+} PhaseResult;
+
+/**
+ * Function: read_io_counters
+ * Description: Reads the syscall and byte counters of the process.
+ * Input: io - receives the counters (all zero if /proc/self/io is not available).
+ * Output: io holds the current counters.
+ */
+static void read_io_counters(IoCounters *io)
+{
+    char name[32];
+    unsigned long long value;
+    FILE *fptr = fopen("/proc/self/io", "r");
+
+    memset(io, 0, sizeof(*io));
+    if (fptr == NULL)
+    {
+        return;
+    }
+    while (fscanf(fptr, "%31[^:]: %llu\n", name, &value) == 2)
+    {
+        if (strcmp(name, "rchar") == 0)
+        {
+            io->rchar = value;
+        }
+        else if (strcmp(name, "wchar") == 0)
+        {
+            io->wchar = value;
+        }
+        else if (strcmp(name, "syscr") == 0)
+        {
+            io->syscr = value;
+        }
+        else if (strcmp(name, "syscw") == 0)
+        {
+            io->syscw = value;
+        }
+    }
+    fclose(fptr);
+}
+
+/**
+ * Function: now
+ * Description: Returns a monotonic timestamp.
+ * Input: None.
+ * Output: Returns the time in seconds.
+ */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Function: view_file
+ * Description: Phase body for viewInfo, whose output goes to /dev/null.
+ * Input: path - the mp3 file, round - round number (unused).
+ * Output: Returns success or failure like viewInfo.
+ */
+static Status view_file(char *path, int round)
+{
+    Music music;
+    (void)round;
+
+    init_music(&music);
+    music.Filename = path;
+    Status status = viewInfo(&music);
+    free_music(&music);
+    return status;
+}
+
+/**
+ * Function: read_file
+ * Description: Phase body for the field reader: runs read_fields for every viewer field, decoded to UTF-8.
+ * Input: path - the mp3 file, round - round number (unused).
+ * Output: Returns success or failure like read_fields.
+ */
+static Status read_file(char *path, int round)
+{
+    Music music;
+    (void)round;
+
+    init_music(&music);
+    music.Filename = path;
+    Status status = read_fields(&music, &music.fields);
+    free_music(&music);
+    return status;
+}
+
+/**
+ * Function: edit_file
+ * Description: Runs edit_info with the given options. Values alternate between rounds so every
+ *              round really changes the file but keeps its size after the first one.
+ * Input: path - the mp3 file, round - round number, fields - number of fields to change (1 or 6).
+ * Output: Returns success or failure like edit_info.
+ */
+static Status edit_file(char *path, int round, int fields)
+{
+    static char *options[] = {"-t", "-a", "-A", "-y", "-m", "-c"};
+    char *argv[2 + 2 * 6 + 1];
+    char value[] = "Benchmark value A";
+    Mp3EditInfo mp3Edit;
+    int argc = 0;
+
+    value[sizeof(value) - 2] = (char)('A' + round % 2);
+    argv[argc++] = "bench";
+    argv[argc++] = "-e";
+    for (int i = 0; i < fields; i++)
+    {
+        argv[argc++] = options[i];
+        argv[argc++] = value;
+    }
+    argv[argc++] = path;
+
+    if (read_and_validate_edit(argc, argv, &mp3Edit) == failure)
+    {
+        fprintf(stderr, "ERROR: %s\n", mp3Edit.error);
+        return failure;
+    }
+    mp3Edit.quiet = 1;
+    return edit_info(&mp3Edit);
+}
+
+// Phase bodies for the one-field and the six-field edit
+static Status edit_one(char *path, int round)
+{
+    return edit_file(path, round, 1);
+}
+
+static Status edit_six(char *path, int round)
+{
+    return edit_file(path, round, 6);
+}
+
+/**
+ * Function: run_phase
+ * Description: Runs one phase over every file for the given number of rounds, with stdout and
+ *              stderr sent to /dev/null so printing to the terminal is not measured.
+ * Input: name - phase name, body - function called per file, files - the corpus, rounds - number
+ *        of passes, devnull - descriptor of /dev/null, result - receives the measurements.
+ * Output: result holds the time, failures and I/O of the phase.
+ */
+static void run_phase(const char *name, Status (*body)(char *, int), const PathList *files, int rounds,
+                      int devnull, PhaseResult *result)
+{
+    IoCounters before, after;
+    int saved_out = dup(STDOUT_FILENO);
+    int saved_err = dup(STDERR_FILENO);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(devnull, STDOUT_FILENO);
+    dup2(devnull, STDERR_FILENO);
+
+    result->name = name;
+    result->files = 0;
+    result->failed = 0;
+    read_io_counters(&before);
+    double start = now();
+    for (int round = 0; round < rounds; round++)
+    {
+        for (size_t i = 0; i < files->count; i++)
+        {
+            if (body(files->paths[i], round) == failure)
+            {
+                result->failed++;
+            }
+            result->files++;
+        }
+    }
+    fflush(stdout);
+    result->seconds = now() - start;
+    read_io_counters(&after);
+
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+
+    result->io.rchar = after.rchar - before.rchar;
+    result->io.wchar = after.wchar - before.wchar;
+    result->io.syscr = after.syscr - before.syscr;
+    result->io.syscw = after.syscw - before.syscw;
+}
+
+/**
+ * Function: print_phase
+ * Description: Prints one row of the report.
+ * Input: result - measurements of the phase.
+ * Output: One line on stdout.
+ */
+static void print_phase(const PhaseResult *result)
+{
+    double files = result->files ? (double)result->files : 1.0;
+    printf("%-11s %9zu %7zu %12.0f %12.1f %10.2f %10.2f %12.1f\n", result->name, result->files, result->failed,
+           result->seconds > 0 ? result->files / result->seconds : 0.0, result->io.rchar / files,
+           result->io.syscr / files, result->io.syscw / files, result->io.wchar / files);
+}
+
+int main(int argc, char *argv[])
+{
+    PathList files;
+    int rounds = 1;
+
+    if (argc != 2 && !(argc == 4 && strcmp(argv[2], "-r") == 0 && (rounds = atoi(argv[3])) > 0))
+    {
+        fprintf(stderr, "USAGE: %s <corpus dir> [-r rounds]\n", argv[0]);
+        return 1;
+    }
+    init_path_list(&files);
+    if (collect_paths(argv[1], &files, NULL) == failure || files.count == 0)
+    {
+        fprintf(stderr, "ERROR: No mp3 files found in %s\n", argv[1]);
+        free_path_list(&files);
+        return 1;
+    }
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull < 0)
+    {
+        perror("/dev/null");
+        free_path_list(&files);
+        return 1;
+    }
+
+    PhaseResult results[4];
+    run_phase("view", view_file, &files, rounds, devnull, &results[0]);
+    run_phase("read_fields", read_file, &files, rounds, devnull, &results[1]);
+    run_phase("edit-1", edit_one, &files, rounds, devnull, &results[2]);
+    run_phase("edit-6", edit_six, &files, rounds, devnull, &results[3]);
+
+    printf("%-11s %9s %7s %12s %12s %10s %10s %12s\n", "PHASE", "FILES", "FAILED", "FILES/SEC", "READ B/FILE",
+           "READS/FILE", "WRITES/FILE", "WRITE B/FILE");
+    for (int i = 0; i < 4; i++)
+    {
+        print_phase(&results[i]);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("PEAK RSS    %ld KB\n", usage.ru_maxrss);
+    printf("TEXT        %s kernels\n", text_decode_kernel());
+
+    close(devnull);
+    free_path_list(&files);
+    return 0;
+}
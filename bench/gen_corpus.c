@@ -0,0 +1,306 @@
+/**
+ * Synthetic corpus generator for the benchmark.
+ *
+ * Build: make bench
+ * Usage: ./gen_corpus <dir> [-n files] [-V 3|4] [-f frames] [-s frame_size] [-p padding]
+ *                     [-i apic_size] [-a audio_size] [-e 0|1] [-r seed]
+ *
+ * Every file gets the six frames shown by the viewer (the year as TDRC in v2.4), then up to -f extra TXXX frames, an APIC
+ * frame of up to -i bytes, up to -p bytes of padding and -a bytes of audio. Value lengths, frame
+ * count, picture and padding size are drawn per file from the seed, so the same command always
+ * writes the same corpus. Files are spread over sub-directories of 1000 files each. With -e 1 the
+ * text frames are UTF-16 with a byte order mark, each value Latin, Cyrillic or CJK.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FILES_PER_DIR 1000
+
+/**
+ * Structure to hold the generator options.
+ */
+typedef struct
+{
+    const char *dir;     // Output directory
+    long files;          // Number of files to write
+    int version;         // ID3v2 major version, 3 or 4
+    long frames;         // Maximum number of extra TXXX frames
+    long frame_size;     // Maximum length of a frame value
+    long padding;        // Maximum padding after the frames
+    long apic_size;      // Maximum size of the APIC picture, 0 for none
+    long audio_size;     // Bytes of audio after the tag
+    int utf16;           // 1 for UTF-16 text frames, 0 for Latin-1
+    uint64_t seed;       // Seed of the random generator
+} CorpusOptions;
+
+/**
+ * Function: next_random
+ * Description: xorshift64* step, good enough to vary the files and fully reproducible.
+ * Input: state - pointer to the generator state.
+ * Output: Returns the next random value.
+ */
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * Function: random_upto
+ * Description: Draws a value between 0 and max inclusive.
+ * Input: state - pointer to the generator state, max - largest value.
+ * Output: Returns the value.
+ */
+static long random_upto(uint64_t *state, long max)
+{
+    return max > 0 ? (long)(next_random(state) % (uint64_t)(max + 1)) : 0;
+}
+
+/**
+ * Function: put_size
+ * Description: Stores a frame or tag size, syncsafe when requested, big-endian otherwise.
+ * Input: ptr - 4 output bytes, value - the size, syncsafe - 1 for a syncsafe integer.
+ * Output: Writes the encoded bytes to ptr.
+ */
+static void put_size(unsigned char *ptr, uint32_t value, int syncsafe)
+{
+    int shift = syncsafe ? 7 : 8;
+    uint32_t mask = syncsafe ? 0x7F : 0xFF;
+
+    for (int i = 3; i >= 0; i--)
+    {
+        ptr[i] = value & mask;
+        value >>= shift;
+    }
+}
+
+/**
+ * Function: put_frame
+ * Description: Appends a frame header and its data to the tag buffer.
+ * Input: ptr - write position, id - 4 character frame ID, data - frame data, size - data length,
+ *        version - ID3v2 major version.
+ * Output: Returns the position after the frame.
+ */
+static unsigned char *put_frame(unsigned char *ptr, const char *id, const unsigned char *data, size_t size, int version)
+{
+    memcpy(ptr, id, 4);
+    put_size(ptr + 4, (uint32_t)size, version == 4);
+    ptr[8] = 0;
+    ptr[9] = 0;
+    memcpy(ptr + 10, data, size);
+    return ptr + 10 + size;
+}
+
+/**
+ * Function: put_text
+ * Description: Builds the data of a text frame with a random printable value, Latin-1 or
+ *              UTF-16 with a little-endian byte order mark.
+ * Input: data - output buffer, state - generator state, max - maximum value length in characters,
+ *        prefix - bytes written after the encoding byte (language and description for COMM),
+ *        utf16 - 1 for UTF-16.
+ * Output: Returns the length of the frame data.
+ */
+static size_t put_text(unsigned char *data, uint64_t *state, long max, const char *prefix, size_t prefix_length, int utf16)
+{
+    static const unsigned int scripts[] = {'a', 0x430, 0x4E00}; // Latin, Cyrillic, CJK
+    size_t length = 1 + (size_t)random_upto(state, max > 1 ? max - 1 : 0);
+    unsigned int base = scripts[next_random(state) % 3];
+    size_t size = 0;
+
+    data[size++] = utf16 ? 1 : 0;
+    memcpy(data + size, prefix, prefix_length);
+    size += prefix_length;
+    if (utf16)
+    {
+        data[size++] = 0xFF;
+        data[size++] = 0xFE;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned int ch = utf16 ? base + (unsigned int)(next_random(state) % 26) : 'a' + next_random(state) % 26;
+        data[size++] = (unsigned char)ch;
+        if (utf16)
+        {
+            data[size++] = (unsigned char)(ch >> 8);
+        }
+    }
+    return size;
+}
+
+/**
+ * Function: write_file
+ * Description: Generates one file of the corpus.
+ * Input: opts - generator options, path - file to write, state - generator state.
+ * Output: Returns 0 on success, -1 on an error.
+ */
+static int write_file(const CorpusOptions *opts, const char *path, uint64_t *state)
+{
+    // v2.4 keeps the year in TDRC, TYER is a v2.3 frame
+    const char *ids[] = {"TIT2", "TPE1", "TALB", opts->version == 4 ? "TDRC" : "TYER", "TCON", "COMM"};
+    long extra = random_upto(state, opts->frames);
+    long apic = random_upto(state, opts->apic_size);
+    long padding = random_upto(state, opts->padding);
+    size_t value_max = 2 * (size_t)opts->frame_size + 16;
+    size_t capacity = 10 + (6 + (size_t)extra) * (10 + value_max) + 32 + (size_t)apic + (size_t)padding;
+    unsigned char *tag = calloc(1, capacity);
+    unsigned char *data = malloc(value_max + (size_t)apic + 32);
+    if (tag == NULL || data == NULL)
+    {
+        free(tag);
+        free(data);
+        return -1;
+    }
+
+    unsigned char *ptr = tag + 10;
+    for (int i = 0; i < 6; i++)
+    {
+        int comm = strcmp(ids[i], "COMM") == 0;
+        // COMM and TXXX carry an empty or short description before the value
+        size_t size = opts->utf16 ? put_text(data, state, opts->frame_size, "eng\xFF\xFE\0", comm ? 7 : 0, 1)
+                                  : put_text(data, state, opts->frame_size, "eng", comm ? 4 : 0, 0);
+        ptr = put_frame(ptr, ids[i], data, size, opts->version);
+    }
+    for (long i = 0; i < extra; i++)
+    {
+        size_t size = opts->utf16 ? put_text(data, state, opts->frame_size, "\xFF\xFE" "b\0\0", 6, 1)
+                                  : put_text(data, state, opts->frame_size, "bench", 6, 0);
+        ptr = put_frame(ptr, "TXXX", data, size, opts->version);
+    }
+    if (apic > 0)
+    {
+        static const char header[] = "\0image/jpeg\0\3";
+        size_t size = sizeof(header);
+        memcpy(data, header, size);
+        memset(data + size, 0xA5, (size_t)apic);
+        ptr = put_frame(ptr, "APIC", data, size + (size_t)apic, opts->version);
+    }
+    ptr += padding;
+
+    memcpy(tag, "ID3", 3);
+    tag[3] = (unsigned char)opts->version;
+    put_size(tag + 6, (uint32_t)(ptr - tag - 10), 1);
+
+    int status = -1;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0 && write(fd, tag, (size_t)(ptr - tag)) == ptr - tag)
+    {
+        // MPEG-1 Layer III frame headers followed by silence
+        unsigned char audio[BUFSIZ];
+        memset(audio, 0, sizeof(audio));
+        for (size_t i = 0; i + 4 <= sizeof(audio); i += 417)
+        {
+            memcpy(audio + i, "\xFF\xFB\x90\x64", 4);
+        }
+        long left = opts->audio_size;
+        status = 0;
+        while (left > 0 && status == 0)
+        {
+            size_t chunk = left < (long)sizeof(audio) ? (size_t)left : sizeof(audio);
+            status = write(fd, audio, chunk) == (ssize_t)chunk ? 0 : -1;
+            left -= (long)chunk;
+        }
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    free(tag);
+    free(data);
+    return status;
+}
+
+/**
+ * Function: read_number
+ * Description: Parses a non-negative option value.
+ * Input: value - the option value, result - receives the number.
+ * Output: Returns 0 on success, -1 if the value is missing or invalid.
+ */
+static int read_number(const char *value, long *result)
+{
+    char *end;
+
+    if (value == NULL)
+    {
+        return -1;
+    }
+    *result = strtol(value, &end, 10);
+    return *result < 0 || *end != '\0' ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    CorpusOptions opts = {NULL, 1000, 3, 4, 32, 512, 0, 64 * 1024, 0, 1};
+    long value;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *next = i + 1 < argc ? argv[i + 1] : NULL;
+        if (argv[i][0] != '-')
+        {
+            opts.dir = argv[i];
+            continue;
+        }
+        if (read_number(next, &value) != 0 || argv[i][1] == '\0' || argv[i][2] != '\0')
+        {
+            opts.dir = NULL;
+            break;
+        }
+        switch (argv[i][1])
+        {
+        case 'n': opts.files = value; break;
+        case 'V': opts.version = (int)value; break;
+        case 'f': opts.frames = value; break;
+        case 's': opts.frame_size = value; break;
+        case 'p': opts.padding = value; break;
+        case 'i': opts.apic_size = value; break;
+        case 'a': opts.audio_size = value; break;
+        case 'e': opts.utf16 = value != 0; break;
+        case 'r': opts.seed = (uint64_t)value; break;
+        default: opts.dir = NULL; break;
+        }
+        i++;
+    }
+    if (opts.dir == NULL || (opts.version != 3 && opts.version != 4) || opts.frame_size > 1000000 ||
+        opts.apic_size > (1 << 24) || opts.padding > (1 << 24) || opts.frames > 10000)
+    {
+        fprintf(stderr, "USAGE: %s <dir> [-n files] [-V 3|4] [-f frames] [-s frame_size] [-p padding] "
+                        "[-i apic_size] [-a audio_size] [-e 0|1] [-r seed]\n", argv[0]);
+        return 1;
+    }
+
+    uint64_t state = opts.seed ? opts.seed : 1;
+    char path[4096];
+    if (mkdir(opts.dir, 0755) != 0 && errno != EEXIST)
+    {
+        perror(opts.dir);
+        return 1;
+    }
+    for (long i = 0; i < opts.files; i++)
+    {
+        if (i % FILES_PER_DIR == 0)
+        {
+            snprintf(path, sizeof(path), "%s/%04ld", opts.dir, i / FILES_PER_DIR);
+            if (mkdir(path, 0755) != 0 && errno != EEXIST)
+            {
+                perror(path);
+                return 1;
+            }
+        }
+        snprintf(path, sizeof(path), "%s/%04ld/%06ld.mp3", opts.dir, i / FILES_PER_DIR, i);
+        if (write_file(&opts, path, &state) != 0)
+        {
+            perror(path);
+            return 1;
+        }
+    }
+    printf("----------%ld FILES WRITTEN TO %s----------\n", opts.files, opts.dir);
+    return 0;
+}
@@ -0,0 +1,182 @@
+/**
+ * Client of the --serve daemon, for scripts that view or edit many files one command at a time.
+ *
+ * Build: gcc -O2 -I. -o mp3tag_client client/mp3tag_client.c
+ * Usage: ./mp3tag_client <socketpath> -v|-e <arguments as for ./a.out>...
+ *
+ * Sends the working directory and the arguments to the server, copies the output to stdout and
+ * the error messages to stderr, and exits with 0 if the request succeeded, 1 if it failed and
+ * 2 if the server could not be reached. The server's cache stays warm between invocations, so
+ * a loop of clients costs a connection per file instead of a process start and a cold read.
+ */
+#include <errno.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "type.h"
+#include "serve.h"
+
+/**
+ * Function: write_all
+ * Description: Writes exactly length bytes to a descriptor.
+ * Input: fd - the descriptor, buffer - source, length - bytes to write.
+ * Output: Returns success, or failure if an error occurred.
+ */
+static Status write_all(int fd, const void *buffer, size_t length)
+{
+    const unsigned char *pos = buffer;
+
+    while (length > 0)
+    {
+        ssize_t done = write(fd, pos, length);
+        if (done < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (done <= 0)
+        {
+            return failure;
+        }
+        pos += done;
+        length -= (size_t)done;
+    }
+    return success;
+}
+
+/**
+ * Function: read_all
+ * Description: Reads exactly length bytes from a descriptor.
+ * Input: fd - the descriptor, buffer - destination, length - bytes to read.
+ * Output: Returns success, or failure if the peer closed or an error occurred.
+ */
+static Status read_all(int fd, void *buffer, size_t length)
+{
+    unsigned char *pos = buffer;
+
+    while (length > 0)
+    {
+        ssize_t got = read(fd, pos, length);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return failure;
+        }
+        pos += got;
+        length -= (size_t)got;
+    }
+    return success;
+}
+
+/**
+ * Function: get_le32
+ * Description: Reads a 32-bit little-endian value.
+ * Input: ptr - four bytes.
+ * Output: Returns the value.
+ */
+static uint32_t get_le32(const unsigned char *ptr)
+{
+    return ptr[0] | ptr[1] << 8 | ptr[2] << 16 | (uint32_t)ptr[3] << 24;
+}
+
+/**
+ * Function: main
+ * Description: Sends one request to the server and prints its response.
+ * Input: argc - number of arguments, argv - socket path followed by the command.
+ * Output: Returns 0 on success, 1 if the request failed, 2 if the server could not be used.
+ */
+int main(int argc, char *argv[])
+{
+    struct sockaddr_un address;
+    char directory[PATH_MAX];
+    unsigned char header[4 + SERVE_RESPONSE_HEADER];
+
+    if (argc < 3 || strlen(argv[1]) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "USAGE: ./mp3tag_client <socketpath> -v|-e <arguments>...\n");
+        return 2;
+    }
+    if (getcwd(directory, sizeof(directory)) == NULL)
+    {
+        perror("getcwd");
+        return 2;
+    }
+
+    // Request: length, directory, then the arguments, each null terminated
+    size_t length = strlen(directory) + 1;
+    for (int i = 2; i < argc; i++)
+    {
+        length += strlen(argv[i]) + 1;
+    }
+    if (length > SERVE_MAX_REQUEST)
+    {
+        fprintf(stderr, "ERROR: Too many arguments for one request.\n");
+        return 2;
+    }
+    unsigned char *request = malloc(4 + length);
+    if (request == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory.\n");
+        return 2;
+    }
+    request[0] = length & 0xFF;
+    request[1] = (length >> 8) & 0xFF;
+    request[2] = (length >> 16) & 0xFF;
+    request[3] = (length >> 24) & 0xFF;
+    unsigned char *pos = request + 4;
+    memcpy(pos, directory, strlen(directory) + 1);
+    pos += strlen(directory) + 1;
+    for (int i = 2; i < argc; i++)
+    {
+        memcpy(pos, argv[i], strlen(argv[i]) + 1);
+        pos += strlen(argv[i]) + 1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, argv[1]);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        perror(argv[1]);
+        free(request);
+        return 2;
+    }
+    Status status = write_all(fd, request, 4 + length);
+    free(request);
+    if (status == failure || read_all(fd, header, sizeof(header)) == failure)
+    {
+        fprintf(stderr, "ERROR: The server closed the connection.\n");
+        close(fd);
+        return 2;
+    }
+
+    // Response: status, output length, output, then error messages
+    uint32_t total = get_le32(header);
+    uint32_t out_length = get_le32(header + 5);
+    if (total < SERVE_RESPONSE_HEADER || out_length > total - SERVE_RESPONSE_HEADER)
+    {
+        fprintf(stderr, "ERROR: Malformed response.\n");
+        close(fd);
+        return 2;
+    }
+    uint32_t err_length = total - SERVE_RESPONSE_HEADER - out_length;
+    unsigned char *body = malloc(total - SERVE_RESPONSE_HEADER + 1);
+    if (body == NULL || read_all(fd, body, total - SERVE_RESPONSE_HEADER) == failure)
+    {
+        fprintf(stderr, "ERROR: The server closed the connection.\n");
+        free(body);
+        close(fd);
+        return 2;
+    }
+    close(fd);
+
+    fflush(stdout);
+    write_all(STDOUT_FILENO, body, out_length);
+    write_all(STDERR_FILENO, body + out_length, err_length);
+    free(body);
+    return header[4] == 0 ? 0 : 1;
+}
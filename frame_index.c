@@ -0,0 +1,823 @@
+#include <sys/stat.h>
+#include <unistd.h>
+#include "type.h"
+#include "frame_index.h"
+#include "stats.h"
+
+/**
+ * Function: init_id3_tag
+ * Description: Initializes an empty tag buffer that allocates with malloc.
+ * Input: tag - pointer to the Id3Tag struct.
+ * Output: The tag holds no data.
+ */
+void init_id3_tag(Id3Tag *tag)
+{
+    tag->allocator = NULL;
+    tag->data = NULL;
+    tag->size = 0;
+    tag->capacity = 0;
+    tag->version = 0;
+    tag->flags = 0;
+    tag->complete = 0;
+    tag->error = NULL;
+}
+
+/**
+ * Function: syncsafe_to_int
+ * Description: Decodes a 4 byte syncsafe integer (7 bits used per byte).
+ * Input: ptr - pointer to the 4 encoded bytes.
+ * Output: Returns the decoded value.
+ */
+uint32_t syncsafe_to_int(const unsigned char *ptr)
+{
+    return ((uint32_t)(ptr[0] & 0x7F) << 21) | ((uint32_t)(ptr[1] & 0x7F) << 14) |
+           ((uint32_t)(ptr[2] & 0x7F) << 7) | (uint32_t)(ptr[3] & 0x7F);
+}
+
+/**
+ * Function: int_to_syncsafe
+ * Description: Encodes a value as a 4 byte syncsafe integer (7 bits used per byte).
+ * Input: value - the value to encode (must be below 2^28), ptr - pointer to 4 output bytes.
+ * Output: Writes the encoded bytes to ptr.
+ */
+void int_to_syncsafe(uint32_t value, unsigned char *ptr)
+{
+    ptr[0] = (value >> 21) & 0x7F;
+    ptr[1] = (value >> 14) & 0x7F;
+    ptr[2] = (value >> 7) & 0x7F;
+    ptr[3] = value & 0x7F;
+}
+
+/**
+ * Function: parse_tag_header
+ * Description: Decodes the ID3v2 header from the first bytes of the file and makes the tag
+ *              buffer large enough for the whole tag. The bytes given are copied to the start of
+ *              the buffer. The size is checked against the file before anything is allocated, so
+ *              a corrupt header cannot leave a reused buffer at 256 MB.
+ * Input: tag - pointer to the Id3Tag struct to fill, buffer - first bytes of the file,
+ *        length - number of bytes in buffer (at least ID3_HEADER_SIZE),
+ *        file_size - size of the whole file, UINT64_MAX if it is not known,
+ *        have - receives the number of tag bytes copied.
+ * Output: Returns success if the header is valid, or failure if it is not, the tag is larger
+ *         than the file or allocation fails.
+ */
+static Status parse_tag_header(Id3Tag *tag, const unsigned char *buffer, size_t length, uint64_t file_size,
+                               uint32_t *have)
+{
+    // Check the "ID3" magic and that the size bytes are really syncsafe
+    if (memcmp(buffer, "ID3", 3) != 0 ||
+        ((buffer[6] | buffer[7] | buffer[8] | buffer[9]) & 0x80) != 0)
+    {
+        return failure;
+    }
+
+    tag->version = buffer[3];
+    tag->flags = buffer[5];
+    tag->complete = 0;
+    tag->size = ID3_HEADER_SIZE + syncsafe_to_int(buffer + 6);
+    if (tag->size > file_size)
+    {
+        tag->error = "Tag is larger than the file";
+        tag->size = 0;
+        return failure;
+    }
+    // Reuse the buffer from the previous file when it is large enough
+    if (tag->capacity < tag->size)
+    {
+        unsigned char *data = mem_resize(tag->allocator, tag->data, tag->capacity, tag->size);
+        if (data == NULL)
+        {
+            tag->error = "Failed to allocate the tag buffer";
+            return failure;
+        }
+        tag->data = data;
+        tag->capacity = tag->size;
+    }
+
+    *have = length < tag->size ? (uint32_t)length : tag->size;
+    memcpy(tag->data, buffer, *have);
+    return success;
+}
+
+/**
+ * Function: load_tag_header
+ * Description: Reads the ID3v2 header with a first read of BUFFER_SIZE bytes, decodes the
+ *              syncsafe tag size and makes the tag buffer large enough for the whole tag.
+ *              The bytes already read are kept at the start of the buffer.
+ * Input: fd - file descriptor of the mp3 file, tag - pointer to the Id3Tag struct to fill,
+ *        have - receives the number of tag bytes already in the buffer.
+ * Output: Returns success if the header is valid, or failure if it is not or the read fails.
+ */
+static Status load_tag_header(int fd, Id3Tag *tag, uint32_t *have)
+{
+    unsigned char buffer[BUFFER_SIZE];
+    struct stat st;
+
+    // Read the header and, for most files, the whole tag in one call
+    uint64_t start = stats_begin();
+    tag->error = NULL;
+    ssize_t bytesRead = pread(fd, buffer, BUFFER_SIZE, 0);
+    stats_io(1, bytesRead > 0 ? (uint64_t)bytesRead : 0, 0);
+    if (bytesRead < ID3_HEADER_SIZE)
+    {
+        tag->error = "Failed to read header";
+        stats_end(phase_header, start);
+        return failure;
+    }
+    // Only a regular file has a size to check the tag against
+    uint64_t file_size = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ? (uint64_t)st.st_size : UINT64_MAX;
+    Status status = parse_tag_header(tag, buffer, (size_t)bytesRead, file_size, have);
+    stats_end(phase_header, start);
+    return status;
+}
+
+/**
+ * Function: load_tag_range
+ * Description: Reads bytes of the tag into the same position of the tag buffer.
+ * Input: fd - file descriptor of the mp3 file, -1 for a tag in memory, tag - pointer to the Id3Tag
+ *        struct, start - first byte to read, end - one past the last byte to read.
+ * Output: Returns success if the bytes were read, or failure if the file ends first.
+ */
+static Status load_tag_range(int fd, Id3Tag *tag, uint32_t start, uint32_t end)
+{
+    // A tag given in memory has nothing behind the bytes already copied
+    if (fd < 0)
+    {
+        return start < end ? failure : success;
+    }
+    while (start < end)
+    {
+        ssize_t bytesRead = pread(fd, tag->data + start, end - start, (off_t)start);
+        stats_io(1, bytesRead > 0 ? (uint64_t)bytesRead : 0, 0);
+        if (bytesRead <= 0)
+        {
+            tag->error = "Tag is larger than the file";
+            return failure;
+        }
+        start += (uint32_t)bytesRead;
+    }
+    return success;
+}
+
+/**
+ * Function: load_whole_tag
+ * Description: Reads the part of the tag that load_tag_header did not cover and undoes
+ *              unsynchronisation of the whole tag.
+ * Input: fd - file descriptor of the mp3 file, tag - pointer to the Id3Tag with its header loaded,
+ *        have - number of tag bytes already in the buffer.
+ * Output: Returns success if the tag is complete, or failure if the file ends first.
+ */
+static Status load_whole_tag(int fd, Id3Tag *tag, uint32_t have)
+{
+    if (load_tag_range(fd, tag, have, tag->size) == failure)
+    {
+        return failure;
+    }
+
+    // v2.2 and v2.3 unsynchronise the whole tag, the decoded bytes end early and the rest becomes padding
+    if ((tag->flags & 0x80) && tag->version < 4)
+    {
+        size_t length = remove_unsync(tag->data + ID3_HEADER_SIZE, tag->size - ID3_HEADER_SIZE);
+        memset(tag->data + ID3_HEADER_SIZE + length, 0, tag->size - ID3_HEADER_SIZE - length);
+    }
+    tag->complete = 1;
+    return success;
+}
+
+/**
+ * Function: read_id3_tag
+ * Description: Reads the ID3v2 header, decodes the syncsafe tag size and loads exactly
+ *              10 + tag size bytes into memory. A first read of BUFFER_SIZE bytes usually
+ *              covers the whole tag, otherwise one more read fetches the rest. The audio
+ *              data after the tag is never read.
+ * Input: fd - file descriptor of the mp3 file, tag - pointer to the Id3Tag struct to fill
+ *        (its buffer is reused if it is already large enough).
+ * Output: Returns success if the tag was loaded, or failure if the header is invalid or a read fails.
+ */
+Status read_id3_tag(int fd, Id3Tag *tag)
+{
+    uint32_t have;
+
+    // Keep what was already read and fetch only the part of the tag that is missing
+    if (load_tag_header(fd, tag, &have) == failure)
+    {
+        return failure;
+    }
+    uint64_t start = stats_begin();
+    Status status = load_whole_tag(fd, tag, have);
+    stats_end(phase_frames, start);
+    if (status == failure)
+    {
+        const char *error = tag->error;
+        free_id3_tag(tag);
+        tag->error = error;
+        return failure;
+    }
+    return success;
+}
+
+/**
+ * Function: remove_unsync
+ * Description: Undoes unsynchronisation in place: every 0xFF 0x00 pair becomes 0xFF. memchr
+ *              finds the next 0xFF with vector instructions, and the bytes between two 0xFF are
+ *              moved as one block, so tags without 0xFF bytes cost a single scan.
+ * Input: data - the bytes to decode, size - number of bytes.
+ * Output: Returns the decoded length, which is at most size.
+ */
+size_t remove_unsync(unsigned char *data, size_t size)
+{
+    size_t in = 0;
+    size_t out = 0;
+    const unsigned char *ff;
+
+    while (in < size && (ff = memchr(data + in, 0xFF, size - in)) != NULL)
+    {
+        // Keep everything up to and including the 0xFF, then drop the 0x00 inserted after it
+        size_t length = (size_t)(ff - (data + in)) + 1;
+        if (out != in)
+        {
+            memmove(data + out, data + in, length);
+        }
+        in += length;
+        out += length;
+        if (in < size && data[in] == 0x00)
+        {
+            in++;
+        }
+    }
+    if (out != in)
+    {
+        memmove(data + out, data + in, size - in);
+    }
+    return out + (size - in);
+}
+
+/**
+ * Function: read_id3_tag_buffer
+ * Description: Copies the ID3v2 tag at the start of a memory buffer into the tag buffer and
+ *              undoes unsynchronisation of the whole tag, like read_id3_tag does for a file.
+ * Input: data - the start of the file in memory, size - bytes in data, tag - pointer to the
+ *        Id3Tag struct to fill.
+ * Output: Returns success if the whole tag is in data, or failure otherwise.
+ */
+Status read_id3_tag_buffer(const unsigned char *data, size_t size, Id3Tag *tag)
+{
+    uint32_t have;
+
+    tag->error = NULL;
+    if (size < ID3_HEADER_SIZE)
+    {
+        tag->error = "Failed to read header";
+        return failure;
+    }
+    // Nothing is left to read, the tag must be complete
+    if (parse_tag_header(tag, data, size, size, &have) == failure)
+    {
+        return failure;
+    }
+    return load_whole_tag(-1, tag, have);
+}
+
+/**
+ * Function: free_id3_tag
+ * Description: Releases the memory held by the tag buffer.
+ * Input: tag - pointer to the Id3Tag struct.
+ * Output: The tag is emptied and can be reused.
+ */
+void free_id3_tag(Id3Tag *tag)
+{
+    const Allocator *allocator = tag->allocator;
+
+    mem_release(allocator, tag->data, tag->capacity);
+    init_id3_tag(tag);
+    tag->allocator = allocator;
+}
+
+/**
+ * Function: init_frame_index
+ * Description: Initializes an empty frame index that allocates with malloc.
+ * Input: index - pointer to the FrameIndex struct.
+ * Output: The index holds no frames and no allocated memory.
+ */
+void init_frame_index(FrameIndex *index)
+{
+    index->allocator = NULL;
+    index->frames = NULL;
+    index->count = 0;
+    index->capacity = 0;
+}
+
+/**
+ * Function: read_be
+ * Description: Decodes a big-endian integer of up to 4 bytes.
+ * Input: ptr - pointer to the bytes, count - number of bytes.
+ * Output: Returns the decoded value.
+ */
+static uint32_t read_be(const unsigned char *ptr, int count)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < count; i++)
+    {
+        value = (value << 8) | ptr[i];
+    }
+    return value;
+}
+
+/**
+ * Function: frame_id_possible
+ * Description: Checks if a frame ID can occur in a tag of the given version: 3 character IDs
+ *              only in v2.2, 4 character IDs only in v2.3 and v2.4, less the frames v2.4 dropped
+ *              and the ones it added. A frame walk does not wait for an ID that cannot occur.
+ * Input: key - the packed frame ID (see frame_key), version - major version of the tag.
+ * Output: Returns 1 if the frame can be in the tag, 0 otherwise.
+ */
+static int frame_id_possible(uint32_t key, unsigned char version)
+{
+    static const char *v23_only[] = {"TYER", "TDAT", "TIME", "TORY", "TRDA", "TSIZ", "IPLS", "RVAD", "EQUA"};
+    static const char *v24_only[] = {"TDRC", "TDEN", "TDOR", "TDRL", "TDTG", "TIPL", "TMCL", "TMOO", "TPRO",
+                                     "TSOA", "TSOP", "TSOT", "TSST", "ASPI", "EQU2", "RVA2", "SEEK", "SIGN"};
+
+    if ((version == 2) != ((key & 0xFF) == 0))
+    {
+        return 0;
+    }
+    const char **dropped = version == 4 ? v23_only : v24_only;
+    size_t count = version == 4 ? sizeof(v23_only) / sizeof(v23_only[0]) : sizeof(v24_only) / sizeof(v24_only[0]);
+    for (size_t i = 0; version > 2 && i < count; i++)
+    {
+        if (frame_key(dropped[i]) == key)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Function: frame_key
+ * Description: Packs a frame ID into a 32-bit integer so IDs compare with one instruction.
+ *              A 3-character v2.2 ID keeps a zero low byte.
+ * Input: id - the null terminated frame ID.
+ * Output: Returns the packed ID.
+ */
+uint32_t frame_key(const char *id)
+{
+    uint32_t key = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        key = (key << 8) | (unsigned char)id[i];
+        if (id[i] == '\0')
+        {
+            key <<= 8 * (3 - i);
+            break;
+        }
+    }
+    return key;
+}
+
+/**
+ * Function: first_frame_offset
+ * Description: Finds where the frames start, after the extended header if there is one.
+ * Input: tag - pointer to the Id3Tag with at least its first 14 bytes loaded.
+ * Output: Returns the offset of the first frame header.
+ */
+static uint32_t first_frame_offset(const Id3Tag *tag)
+{
+    uint32_t offset = ID3_HEADER_SIZE;
+
+    // Skip the extended header if present: its v2.3 size excludes the size field, the v2.4 one is
+    // syncsafe and includes it, and v2.2 has none (the bit means compression there)
+    if ((tag->flags & 0x40) && tag->version > 2 && tag->size >= ID3_HEADER_SIZE + 4)
+    {
+        const unsigned char *ptr = tag->data + ID3_HEADER_SIZE;
+        offset += tag->version == 4 ? syncsafe_to_int(ptr) : 4 + read_be(ptr, 4);
+    }
+    return offset;
+}
+
+/**
+ * Function: parse_frame_header
+ * Description: Decodes the frame header at offset. Sizes are big-endian; v2.4 uses syncsafe
+ *              sizes, but some writers store plain integers there, which shows as a byte with
+ *              the top bit set.
+ * Input: tag - pointer to the Id3Tag with the header bytes loaded, offset - position of the header,
+ *        entry - receives the frame details.
+ * Output: Returns 1 if a frame was decoded, 0 at padding or at a frame running past the end of the
+ *         tag, which is noted in tag->error.
+ */
+static int parse_frame_header(Id3Tag *tag, uint32_t offset, FrameEntry *entry)
+{
+    const unsigned char *header = tag->data + offset;
+    uint32_t header_size = tag->version == 2 ? FRAME_HEADER_SIZE_V22 : FRAME_HEADER_SIZE;
+    int id_length = tag->version == 2 ? 3 : 4;
+
+    // A null byte where the frame ID should be marks the start of padding
+    if (header[0] == '\0')
+    {
+        return 0;
+    }
+
+    uint32_t size = read_be(header + id_length, id_length);
+    if (tag->version == 4 && ((header[4] | header[5] | header[6] | header[7]) & 0x80) == 0)
+    {
+        size = syncsafe_to_int(header + 4);
+    }
+
+    // Stop at a frame that claims to run past the end of the tag
+    if (size > tag->size - offset - header_size)
+    {
+        tag->error = "A frame is larger than the tag";
+        return 0;
+    }
+
+    // The ID as stored, 3 characters in v2.2
+    memcpy(entry->id, header, id_length);
+    entry->id[id_length] = '\0';
+    entry->key = frame_key(entry->id);
+    entry->offset = offset;
+    entry->size = size;
+    entry->flags = tag->version == 2 ? 0 : (uint16_t)((header[8] << 8) | header[9]);
+    entry->data_offset = offset + header_size;
+    entry->data_size = size;
+    return 1;
+}
+
+/**
+ * Function: decode_frame
+ * Description: Skips the v2.4 group ID and data length indicator and removes frame level
+ *              unsynchronisation in place, so data_offset and data_size describe plain frame data.
+ * Input: tag - pointer to the Id3Tag with the frame data loaded, entry - the frame to decode.
+ * Output: entry points at the decoded data.
+ */
+static void decode_frame(Id3Tag *tag, FrameEntry *entry)
+{
+    if (tag->version != 4)
+    {
+        return;
+    }
+    // Group ID and data length indicator come before the data
+    uint32_t skip = ((entry->flags & 0x0040) ? 1 : 0) + ((entry->flags & 0x0001) ? 4 : 0);
+    skip = skip < entry->size ? skip : entry->size;
+    entry->data_offset += skip;
+    entry->data_size -= skip;
+    // Frame level unsynchronisation, or all frames when the tag flag is set
+    if ((entry->flags & 0x0002) || (tag->flags & 0x80))
+    {
+        entry->data_size = (uint32_t)remove_unsync(tag->data + entry->data_offset, entry->data_size);
+    }
+}
+
+/**
+ * Function: add_frame_entry
+ * Description: Appends a frame to the index, growing the array when it is full.
+ * Input: tag - the tag the frame is in, which notes an error, index - pointer to the FrameIndex
+ *        struct, entry - the frame to append.
+ * Output: Returns success if the frame was added, or failure on an allocation error.
+ */
+static Status add_frame_entry(Id3Tag *tag, FrameIndex *index, const FrameEntry *entry)
+{
+    if (index->count == index->capacity)
+    {
+        int capacity = index->capacity ? index->capacity * 2 : 16;
+        FrameEntry *frames = mem_resize(index->allocator, index->frames, index->capacity * sizeof(FrameEntry),
+                                        capacity * sizeof(FrameEntry));
+        if (frames == NULL)
+        {
+            tag->error = "Failed to allocate the frame index";
+            return failure;
+        }
+        index->frames = frames;
+        index->capacity = capacity;
+    }
+    index->frames[index->count++] = *entry;
+    return success;
+}
+
+/**
+ * Function: build_frame_index
+ * Description: Walks the frame chain of a tag loaded in memory once and records the ID,
+ *              offset, size and flags of every frame. Stops at padding or the end of the tag.
+ *              One walker handles v2.2 (3 byte IDs and sizes), v2.3 and v2.4 (syncsafe sizes).
+ *              Unsynchronised v2.4 frames are decoded in place, so data_offset and data_size
+ *              always describe plain frame data.
+ * Input: tag - pointer to the loaded Id3Tag, index - pointer to the FrameIndex struct to fill.
+ * Output: Returns success if the frames were indexed, or failure on an allocation error.
+ */
+Status build_frame_index(Id3Tag *tag, FrameIndex *index)
+{
+    uint32_t header_size = tag->version == 2 ? FRAME_HEADER_SIZE_V22 : FRAME_HEADER_SIZE;
+    uint32_t offset = first_frame_offset(tag);
+    uint64_t start = stats_begin();
+    Status status = success;
+    FrameEntry entry;
+
+    index->count = 0;
+
+    // Read one frame header at a time and skip over the frame data
+    while (status == success && offset <= tag->size && tag->size - offset >= header_size &&
+           parse_frame_header(tag, offset, &entry))
+    {
+        decode_frame(tag, &entry);
+        status = add_frame_entry(tag, index, &entry);
+        // Skip the frame data to reach the next frame header
+        offset += header_size + entry.size;
+    }
+    stats_end(phase_frames, start);
+    return status;
+}
+
+/**
+ * Function: scan_frames
+ * Description: Walks the frame headers with reads of BUFFER_SIZE bytes and loads the first
+ *              head_size bytes of the first frame of each requested ID; a frame that was not asked
+ *              for is stepped over without reading its data, and the walk stops as soon as every
+ *              requested ID that can occur in this version of the tag has been found. Fully loaded
+ *              frames are decoded. Tags unsynchronised as a whole cannot be walked this way and
+ *              are loaded completely.
+ * Input: fd - file descriptor of the mp3 file, tag - pointer to the Id3Tag with its header loaded,
+ *        have - number of tag bytes already in the buffer, keys - packed IDs of the wanted frames
+ *        (see frame_key) or NULL for every frame, key_count - number of keys (at most 64),
+ *        head_size - bytes of frame data to load, UINT32_MAX for whole frames,
+ *        index - receives the frames that were found.
+ * Output: Returns success if the tag was walked, or failure if there is no valid ID3v2 tag or a read fails.
+ */
+static Status scan_frames(int fd, Id3Tag *tag, uint32_t have, const uint32_t *keys, int key_count, uint32_t head_size,
+                          FrameIndex *index)
+{
+    uint32_t window_start = 0;
+    uint32_t window_end = have;
+    uint64_t seen = 0;
+    int found = 0;
+    int needed = 0;
+    FrameEntry entry;
+
+    index->count = 0;
+    if (tag->version < 2 || tag->version > 4)
+    {
+        return failure;
+    }
+    for (int i = 0; keys != NULL && i < key_count; i++)
+    {
+        needed += frame_id_possible(keys[i], tag->version);
+    }
+    if ((tag->flags & 0x80) && tag->version < 4)
+    {
+        if (load_whole_tag(fd, tag, window_end) == failure)
+        {
+            return failure;
+        }
+        window_end = tag->size;
+    }
+
+    uint32_t header_size = tag->version == 2 ? FRAME_HEADER_SIZE_V22 : FRAME_HEADER_SIZE;
+    uint32_t offset = first_frame_offset(tag);
+    while ((keys == NULL || found < needed) && offset <= tag->size && tag->size - offset >= header_size)
+    {
+        // Bytes outside the window are read into their place in the buffer, with some read-ahead
+        // so the next few headers come with the same call
+        if (offset < window_start || offset + header_size > window_end)
+        {
+            window_start = offset;
+            window_end = tag->size - offset > BUFFER_SIZE ? offset + BUFFER_SIZE : tag->size;
+            if (load_tag_range(fd, tag, window_start, window_end) == failure)
+            {
+                return failure;
+            }
+        }
+        if (!parse_frame_header(tag, offset, &entry))
+        {
+            break;
+        }
+
+        int wanted = keys == NULL ? 0 : -1;
+        for (int i = 0; keys != NULL && i < key_count && wanted < 0; i++)
+        {
+            if (keys[i] == entry.key && !(seen & (1ULL << i)))
+            {
+                wanted = i;
+            }
+        }
+        if (wanted >= 0)
+        {
+            // Read the rest of a frame the window does not cover
+            uint32_t frame_end = entry.data_offset + (entry.size < head_size ? entry.size : head_size);
+            if (frame_end > window_end)
+            {
+                if (load_tag_range(fd, tag, window_end, frame_end) == failure)
+                {
+                    return failure;
+                }
+                window_end = frame_end;
+            }
+            if (head_size == UINT32_MAX)
+            {
+                decode_frame(tag, &entry);
+            }
+            if (add_frame_entry(tag, index, &entry) == failure)
+            {
+                return failure;
+            }
+            seen |= 1ULL << wanted;
+            found++;
+        }
+        offset += header_size + entry.size;
+    }
+    return success;
+}
+
+/**
+ * Function: walk_frames
+ * Description: Runs scan_frames, timed as the frame walk phase of --stats.
+ * Input: The arguments of scan_frames.
+ * Output: Returns the result of scan_frames.
+ */
+static Status walk_frames(int fd, Id3Tag *tag, uint32_t have, const uint32_t *keys, int key_count, uint32_t head_size,
+                          FrameIndex *index)
+{
+    uint64_t start = stats_begin();
+    Status status = scan_frames(fd, tag, have, keys, key_count, head_size, index);
+    stats_end(phase_frames, start);
+    return status;
+}
+
+/**
+ * Function: read_frames
+ * Description: Loads only the requested frames of the ID3v2 tag, decoded, without reading the
+ *              data of the other frames or walking past the last requested one.
+ * Input: fd - file descriptor of the mp3 file, tag - pointer to the Id3Tag struct to fill,
+ *        keys - packed IDs of the wanted frames (see frame_key), key_count - number of keys
+ *        (at most 64), index - receives the frames that were found.
+ * Output: Returns success if the tag was walked, or failure if there is no valid ID3v2 tag or a read fails.
+ */
+Status read_frames(int fd, Id3Tag *tag, const uint32_t *keys, int key_count, FrameIndex *index)
+{
+    uint32_t have;
+
+    if (load_tag_header(fd, tag, &have) == failure)
+    {
+        return failure;
+    }
+    return walk_frames(fd, tag, have, keys, key_count, UINT32_MAX, index);
+}
+
+/**
+ * Function: read_frames_buffer
+ * Description: Like read_frames for the start of a file in memory, which may end inside the tag
+ *              as long as it holds every requested frame, or the whole tag.
+ * Input: data - the start of the file, size - bytes in data, tag - pointer to the Id3Tag struct
+ *        to fill, keys - packed IDs of the wanted frames, key_count - number of keys (at most 64),
+ *        index - receives the frames that were found.
+ * Output: Returns success if the tag was walked, or failure if there is no valid ID3v2 tag or
+ *         the walk needs bytes past the end of data.
+ */
+Status read_frames_buffer(const unsigned char *data, size_t size, Id3Tag *tag, const uint32_t *keys, int key_count,
+                          FrameIndex *index)
+{
+    uint32_t have;
+
+    tag->error = NULL;
+    if (size < ID3_HEADER_SIZE)
+    {
+        tag->error = "Failed to read header";
+        return failure;
+    }
+    uint64_t start = stats_begin();
+    // data may end inside the tag, the size of the file is not known
+    Status status = parse_tag_header(tag, data, size, UINT64_MAX, &have);
+    stats_end(phase_header, start);
+    if (status == failure)
+    {
+        return failure;
+    }
+    return walk_frames(-1, tag, have, keys, key_count, UINT32_MAX, index);
+}
+
+/**
+ * Function: id3_tag_size
+ * Description: Reads the size of the ID3v2 tag from the start of a file without loading it.
+ * Input: data - the start of the file, size - bytes in data.
+ * Output: Returns the tag size including its header, or 0 if data does not start with a tag header.
+ */
+uint32_t id3_tag_size(const unsigned char *data, size_t size)
+{
+    if (size < ID3_HEADER_SIZE || memcmp(data, "ID3", 3) != 0 || ((data[6] | data[7] | data[8] | data[9]) & 0x80) != 0)
+    {
+        return 0;
+    }
+    return ID3_HEADER_SIZE + syncsafe_to_int(data + 6);
+}
+
+/**
+ * Function: read_frame_heads
+ * Description: Like read_frames, but loads only the first head_size bytes of each requested
+ *              frame and leaves them as stored in the file, so large frames such as pictures can
+ *              be located without reading them.
+ * Input: fd - file descriptor of the mp3 file, tag - pointer to the Id3Tag struct to fill,
+ *        keys - packed IDs of the wanted frames, key_count - number of keys (at most 64),
+ *        head_size - bytes of frame data to load, index - receives the frames that were found.
+ * Output: Returns success if the tag was walked, or failure if there is no valid ID3v2 tag or a read fails.
+ */
+Status read_frame_heads(int fd, Id3Tag *tag, const uint32_t *keys, int key_count, uint32_t head_size, FrameIndex *index)
+{
+    uint32_t have;
+
+    if (load_tag_header(fd, tag, &have) == failure)
+    {
+        return failure;
+    }
+    return walk_frames(fd, tag, have, keys, key_count, head_size, index);
+}
+
+/**
+ * Function: read_frame_index
+ * Description: Indexes every frame of the tag. Tags of up to whole_size bytes, and tags
+ *              unsynchronised as a whole, are loaded and decoded completely, as by read_id3_tag.
+ *              Of larger tags only the frame headers and the first head_size bytes of each frame
+ *              are read, so the memory touched does not grow with the frame sizes.
+ * Input: fd - file descriptor of the mp3 file, tag - pointer to the Id3Tag struct to fill,
+ *        whole_size - largest tag loaded completely, head_size - bytes of frame data to load
+ *        from larger tags, index - receives every frame.
+ * Output: Returns success if the frames were indexed, or failure if there is no valid ID3v2 tag
+ *         or a read fails. tag->complete tells how the tag was read.
+ */
+Status read_frame_index(int fd, Id3Tag *tag, uint32_t whole_size, uint32_t head_size, FrameIndex *index)
+{
+    uint32_t have;
+
+    if (load_tag_header(fd, tag, &have) == failure)
+    {
+        return failure;
+    }
+    if (tag->size <= whole_size)
+    {
+        if (load_whole_tag(fd, tag, have) == failure)
+        {
+            return failure;
+        }
+        return build_frame_index(tag, index);
+    }
+    return walk_frames(fd, tag, have, NULL, 0, head_size, index);
+}
+
+/**
+ * Function: checkheaderandversion
+ * Description: Checks the ID3 header and version of the loaded tag to ensure it's a valid ID3v2.2, v2.3 or v2.4 tag.
+ * Input: tag - pointer to the Id3Tag loaded from the mp3 file.
+ * Output: Returns success if the header and version are valid, or failure with the reason in
+ *         tag->error if the tag cannot be read.
+ */
+Status checkheaderandversion(Id3Tag *tag)
+{
+    if (tag->data == NULL || tag->size < ID3_HEADER_SIZE)
+    {
+        tag->error = "Failed to read header";
+        return failure;
+    }
+
+    // Check if the header matches "ID3" and the version is 2.2, 2.3 or 2.4
+    if (memcmp(tag->data, "ID3", 3) != 0 || tag->version < 2 || tag->version > 4 || tag->data[4] == 0xFF)
+    {
+        return failure;
+    }
+    // v2.2 defines a compression flag but no compression scheme
+    if (tag->version == 2 && (tag->flags & 0x40))
+    {
+        tag->error = "Compressed ID3v2.2 tags are not supported";
+        return failure;
+    }
+    return success;
+}
+
+/**
+ * Function: find_frame
+ * Description: Looks up the first frame with the given ID in the index.
+ * Input: index - pointer to the FrameIndex struct, id - the frame ID as stored in the tag.
+ * Output: Returns a pointer to the matching entry, or NULL if the frame is not present.
+ */
+const FrameEntry *find_frame(const FrameIndex *index, const char *id)
+{
+    uint32_t key = frame_key(id);
+    for (int i = 0; i < index->count; i++)
+    {
+        if (index->frames[i].key == key)
+        {
+            return &index->frames[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Function: free_frame_index
+ * Description: Releases the memory held by the frame index.
+ * Input: index - pointer to the FrameIndex struct.
+ * Output: The index is emptied and can be reused.
+ */
+void free_frame_index(FrameIndex *index)
+{
+    const Allocator *allocator = index->allocator;
+
+    mem_release(allocator, index->frames, index->capacity * sizeof(FrameEntry));
+    init_frame_index(index);
+    index->allocator = allocator;
+}
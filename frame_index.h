@@ -0,0 +1,74 @@
+#ifndef FRAME_INDEX_H
+#define FRAME_INDEX_H
+
+#include <stdio.h>
+#include "type.h"
+#include "allocator.h"
+
+#define ID3_HEADER_SIZE 10 // Size of the ID3v2 tag header
+#define FRAME_HEADER_SIZE 10 // Size of an ID3v2.3/2.4 frame header
+#define FRAME_HEADER_SIZE_V22 6 // Size of an ID3v2.2 frame header (3 byte ID and size)
+#define MAX_TAG_SIZE 0x0FFFFFFF // Largest tag size a syncsafe integer can hold
+
+/**
+ * Structure to hold a whole ID3v2 tag loaded into memory.
+ */
+typedef struct
+{
+    unsigned char *data;   // Tag bytes, starting with the 10 byte header
+    uint32_t size;         // Number of bytes in data (header + syncsafe tag size)
+    uint32_t capacity;     // Allocated size of data, kept when the buffer is reused
+    unsigned char version; // Major version from the header (2, 3 or 4)
+    unsigned char flags;   // Tag flags from the header
+    int complete;          // Set when the whole tag is loaded and decoded, not only frame headers
+    const Allocator *allocator; // Source of the buffer, NULL for malloc, kept by free_id3_tag
+    const char *error;     // Reason the tag could not be read, or was read only in part; NULL otherwise
+} Id3Tag;
+
+/**
+ * Structure to hold the location of one frame inside the tag.
+ */
+typedef struct
+{
+    char id[5];           // Frame identifier as stored (e.g., "TIT2", or "TT2" in v2.2)
+    long offset;          // Offset of the frame header from the start of the file
+    uint32_t size;        // Size of the frame data (excluding the frame header)
+    uint16_t flags;       // Frame flags
+    uint32_t data_offset; // Offset of the decoded frame data inside the tag buffer
+    uint32_t data_size;   // Size of the decoded frame data
+    uint32_t key;         // Frame ID packed into an integer for fast comparison
+} FrameEntry;
+
+/**
+ * Structure to hold every frame found in one pass over the tag.
+ */
+typedef struct
+{
+    FrameEntry *frames; // Array of frame entries in file order
+    int count;          // Number of frames in the array
+    int capacity;       // Allocated size of the array
+    const Allocator *allocator; // Source of the array, NULL for malloc, kept by free_frame_index
+} FrameIndex;
+
+// Function prototypes
+void init_id3_tag(Id3Tag *tag);
+Status read_id3_tag(int fd, Id3Tag *tag);
+Status read_id3_tag_buffer(const unsigned char *data, size_t size, Id3Tag *tag);
+void free_id3_tag(Id3Tag *tag);
+uint32_t syncsafe_to_int(const unsigned char *ptr);
+void int_to_syncsafe(uint32_t value, unsigned char *ptr);
+void init_frame_index(FrameIndex *index);
+Status build_frame_index(Id3Tag *tag, FrameIndex *index);
+Status read_frames(int fd, Id3Tag *tag, const uint32_t *keys, int key_count, FrameIndex *index);
+Status read_frames_buffer(const unsigned char *data, size_t size, Id3Tag *tag, const uint32_t *keys, int key_count,
+                          FrameIndex *index);
+uint32_t id3_tag_size(const unsigned char *data, size_t size);
+Status read_frame_heads(int fd, Id3Tag *tag, const uint32_t *keys, int key_count, uint32_t head_size, FrameIndex *index);
+Status read_frame_index(int fd, Id3Tag *tag, uint32_t whole_size, uint32_t head_size, FrameIndex *index);
+uint32_t frame_key(const char *id);
+size_t remove_unsync(unsigned char *data, size_t size);
+Status checkheaderandversion(Id3Tag *tag);
+const FrameEntry *find_frame(const FrameIndex *index, const char *id);
+void free_frame_index(FrameIndex *index);
+
+#endif // FRAME_INDEX_H
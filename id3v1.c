@@ -0,0 +1,176 @@
+#include <unistd.h>
+#include "type.h"
+#include "id3v1.h"
+#include "stats.h"
+
+/**
+ * Genre names of the ID3v1 genre byte (0 to 79 from the original list).
+ */
+static const char *const id3v1_genres[] = {
+    "Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge", "Hip-Hop",
+    "Jazz", "Metal", "New Age", "Oldies", "Other", "Pop", "R&B", "Rap",
+    "Reggae", "Rock", "Techno", "Industrial", "Alternative", "Ska", "Death Metal", "Pranks",
+    "Soundtrack", "Euro-Techno", "Ambient", "Trip-Hop", "Vocal", "Jazz+Funk", "Fusion", "Trance",
+    "Classical", "Instrumental", "Acid", "House", "Game", "Sound Clip", "Gospel", "Noise",
+    "AlternRock", "Bass", "Soul", "Punk", "Space", "Meditative", "Instrumental Pop", "Instrumental Rock",
+    "Ethnic", "Gothic", "Darkwave", "Techno-Industrial", "Electronic", "Pop-Folk", "Eurodance", "Dream",
+    "Southern Rock", "Comedy", "Cult", "Gangsta", "Top 40", "Christian Rap", "Pop/Funk", "Jungle",
+    "Native American", "Cabaret", "New Wave", "Psychadelic", "Rave", "Showtunes", "Trailer", "Lo-Fi",
+    "Tribal", "Acid Punk", "Acid Jazz", "Polka", "Retro", "Musical", "Rock & Roll", "Hard Rock",
+};
+
+/**
+ * Function: copy_field
+ * Description: Appends a fixed-size ID3v1 text field to a string, stopping at the first null byte
+ *              and dropping the trailing spaces used as padding.
+ * Input: dest - null terminated string to extend, capacity - size of dest, src - field bytes, size - field size.
+ * Output: dest holds the extended string.
+ */
+static void copy_field(char *dest, size_t capacity, const unsigned char *src, size_t size)
+{
+    size_t length = strlen(dest);
+    size_t end = 0;
+
+    while (end < size && src[end] != '\0')
+    {
+        end++;
+    }
+    while (end > 0 && src[end - 1] == ' ')
+    {
+        end--;
+    }
+    if (end > capacity - 1 - length)
+    {
+        end = capacity - 1 - length;
+    }
+    memcpy(dest + length, src, end);
+    dest[length + end] = '\0';
+}
+
+/**
+ * Function: read_id3v1_tag
+ * Description: Reads the ID3v1 trailer, and the TAG+ block in front of it, with one positioned
+ *              read of the last 128 or 355 bytes of the file.
+ * Input: fd - file descriptor of the mp3 file, file_size - size of the file from fstat,
+ *        v1 - pointer to the Id3v1Tag struct to fill.
+ * Output: Returns success if the file ends in an ID3v1 tag, or failure otherwise.
+ */
+Status read_id3v1_tag(int fd, off_t file_size, Id3v1Tag *v1)
+{
+    unsigned char buffer[ID3V1_PLUS_SIZE + ID3V1_SIZE];
+    size_t size = file_size >= (off_t)sizeof(buffer) ? sizeof(buffer) : ID3V1_SIZE;
+
+    memset(v1, 0, sizeof(*v1));
+    if (file_size < ID3V1_SIZE)
+    {
+        return failure;
+    }
+    ssize_t bytesRead = pread(fd, buffer, size, file_size - (off_t)size);
+    stats_io(1, bytesRead > 0 ? (uint64_t)bytesRead : 0, 0);
+    if (bytesRead != (ssize_t)size)
+    {
+        return failure;
+    }
+    return parse_id3v1_tag(buffer, size, v1);
+}
+
+/**
+ * Function: parse_id3v1_tag
+ * Description: Decodes the ID3v1 trailer, and the TAG+ block in front of it, from the last bytes
+ *              of the file. ID3v1.1 is recognised by a null byte before the last comment byte,
+ *              which then holds the track number.
+ * Input: data - the end of the file, size - bytes in data, v1 - pointer to the Id3v1Tag struct to fill.
+ * Output: Returns success if the data ends in an ID3v1 tag, or failure otherwise.
+ */
+Status parse_id3v1_tag(const unsigned char *data, size_t size, Id3v1Tag *v1)
+{
+    memset(v1, 0, sizeof(*v1));
+    if (size < ID3V1_SIZE)
+    {
+        return failure;
+    }
+    // Only the TAG+ block and the trailer matter
+    if (size > ID3V1_PLUS_SIZE + ID3V1_SIZE)
+    {
+        data += size - (ID3V1_PLUS_SIZE + ID3V1_SIZE);
+        size = ID3V1_PLUS_SIZE + ID3V1_SIZE;
+    }
+
+    const unsigned char *tag = data + size - ID3V1_SIZE;
+    if (memcmp(tag, "TAG", 3) != 0)
+    {
+        return failure;
+    }
+    copy_field(v1->title, sizeof(v1->title), tag + 3, 30);
+    copy_field(v1->artist, sizeof(v1->artist), tag + 33, 30);
+    copy_field(v1->album, sizeof(v1->album), tag + 63, 30);
+    copy_field(v1->year, sizeof(v1->year), tag + 93, 4);
+
+    // ID3v1.1 stores the track number in the last comment byte after a null byte
+    if (tag[125] == '\0' && tag[126] != '\0')
+    {
+        copy_field(v1->comment, sizeof(v1->comment), tag + 97, 28);
+        v1->track = tag[126];
+    }
+    else
+    {
+        copy_field(v1->comment, sizeof(v1->comment), tag + 97, 30);
+    }
+    if (tag[127] < sizeof(id3v1_genres) / sizeof(id3v1_genres[0]))
+    {
+        strcpy(v1->genre, id3v1_genres[tag[127]]);
+    }
+
+    // TAG+ continues title, artist and album with 60 more bytes each and has a free text genre
+    const unsigned char *plus = data;
+    if (size == ID3V1_PLUS_SIZE + ID3V1_SIZE && memcmp(plus, "TAG+", 4) == 0)
+    {
+        v1->enhanced = 1;
+        copy_field(v1->title, sizeof(v1->title), plus + 4, 60);
+        copy_field(v1->artist, sizeof(v1->artist), plus + 64, 60);
+        copy_field(v1->album, sizeof(v1->album), plus + 124, 60);
+        if (plus[185] != '\0')
+        {
+            v1->genre[0] = '\0';
+            copy_field(v1->genre, sizeof(v1->genre), plus + 185, 30);
+        }
+    }
+    return success;
+}
+
+/**
+ * Function: id3v1_field
+ * Description: Maps an ID3v2 frame ID to the matching ID3v1 field.
+ * Input: v1 - the ID3v1 tag, frame_id - the 4-character frame ID (e.g., "TIT2").
+ * Output: Returns the field text, or NULL if ID3v1 has no such field or it is empty.
+ */
+const char *id3v1_field(const Id3v1Tag *v1, const char *frame_id)
+{
+    const char *value = NULL;
+
+    if (strcmp(frame_id, "TIT2") == 0)
+    {
+        value = v1->title;
+    }
+    else if (strcmp(frame_id, "TPE1") == 0)
+    {
+        value = v1->artist;
+    }
+    else if (strcmp(frame_id, "TALB") == 0)
+    {
+        value = v1->album;
+    }
+    else if (strcmp(frame_id, "TYER") == 0)
+    {
+        value = v1->year;
+    }
+    else if (strcmp(frame_id, "TCON") == 0)
+    {
+        value = v1->genre;
+    }
+    else if (strcmp(frame_id, "COMM") == 0)
+    {
+        value = v1->comment;
+    }
+    return value != NULL && value[0] != '\0' ? value : NULL;
+}
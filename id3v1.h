@@ -0,0 +1,31 @@
+#ifndef ID3V1_H
+#define ID3V1_H
+
+#include <sys/types.h>
+#include "type.h"
+
+#define ID3V1_SIZE 128      // Size of the ID3v1 trailer at the end of the file
+#define ID3V1_PLUS_SIZE 227 // Size of the enhanced "TAG+" block in front of the trailer
+
+/**
+ * Structure to hold the fields of an ID3v1/v1.1 trailer, extended by TAG+ when present.
+ * Every string is null terminated with trailing spaces removed.
+ */
+typedef struct
+{
+    char title[91];      // 30 bytes in ID3v1, up to 60 more from TAG+
+    char artist[91];     // 30 bytes in ID3v1, up to 60 more from TAG+
+    char album[91];      // 30 bytes in ID3v1, up to 60 more from TAG+
+    char year[5];        // 4 digit year
+    char comment[31];    // 30 bytes in ID3v1, 28 in ID3v1.1
+    char genre[31];      // Genre name from the genre byte, or the TAG+ free text genre
+    unsigned char track; // Track number from ID3v1.1, 0 if absent
+    int enhanced;        // Set if a TAG+ block was found
+} Id3v1Tag;
+
+// Function prototypes
+Status read_id3v1_tag(int fd, off_t file_size, Id3v1Tag *v1);
+Status parse_id3v1_tag(const unsigned char *data, size_t size, Id3v1Tag *v1);
+const char *id3v1_field(const Id3v1Tag *v1, const char *frame_id);
+
+#endif // ID3V1_H
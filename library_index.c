@@ -0,0 +1,1579 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "type.h"
+#include "library_index.h"
+
+#define QUERY_FLUSH (16 * BUFFER_SIZE) // Output of --query is written whenever it grows past this
+
+/**
+ * Names of the indexed fields in a query, in the order of view_fields.
+ */
+static const char *const index_field_names[INDEX_FIELDS] = {"title", "artist", "album", "year", "genre"};
+
+/**
+ * Structure to hold one file of an index being built.
+ */
+typedef struct
+{
+    struct stat st;                      // Stat of the file when it was read
+    int indexed;                         // Set if the file has a tag and goes into the index
+    char *values;                        // Values of the fields that are present, back to back
+    uint16_t field_length[INDEX_FIELDS]; // Length of each field, INDEX_MISSING if absent
+} BuildFile;
+
+/**
+ * Structure to hold the state shared by the --index-build workers.
+ */
+typedef struct
+{
+    const IndexBuild *build;  // Files to index
+    LibraryIndex old;         // Previous index, map is NULL if there is none
+    const IndexFile **slots;  // Open addressing hash table over the old files keyed by (dev, ino)
+    size_t slot_count;        // Size of the table, a power of two
+    BuildFile *entries;       // One entry per file of build
+    size_t next;              // Next file to read, taken atomically
+    size_t read;              // Files read through the frame parser
+    size_t reused;            // Files taken unchanged from the previous index
+    size_t skipped;           // Files left out because they could not be read
+} BuildJob;
+
+/**
+ * Structure to hold one token of one file while the term table is built.
+ */
+typedef struct
+{
+    const char *token; // Normalised token
+    size_t offset;     // Position of the token in the token buffer, until token is set
+    uint32_t file;     // File ID
+    uint16_t length;   // Length of the token
+    uint8_t field;     // Position of the field
+} TermRef;
+
+/**
+ * Structure to hold a sorted list of file IDs without duplicates.
+ */
+typedef struct
+{
+    uint32_t *ids;  // File IDs in ascending order
+    size_t count;   // Number of IDs
+} IdList;
+
+/**
+ * Structure to hold the state of the query parser.
+ */
+typedef struct
+{
+    const LibraryIndex *index; // Index the query is answered from
+    const char *pos;           // Next character of the query
+    const char *error;         // Reason the query failed, NULL while it is valid
+    int depth;                 // Current nesting of parentheses and NOT
+} QueryParser;
+
+/**
+ * Function: is_token_byte
+ * Description: Tells whether a byte belongs to a token: an ASCII letter or digit, or any byte
+ *              of a UTF-8 multibyte character.
+ * Input: ch - the byte.
+ * Output: Returns 1 for a token byte, 0 for a separator.
+ */
+static int is_token_byte(unsigned char ch)
+{
+    return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch >= 0x80;
+}
+
+/**
+ * Function: next_token
+ * Description: Finds the next token of a field value and copies it lowercased.
+ * Input: text - the value, length - its length, pos - position to search from, advanced past the
+ *        token, token - receives up to INDEX_MAX_TOKEN bytes.
+ * Output: Returns the length of the token, or 0 when the value has no more tokens.
+ */
+static size_t next_token(const char *text, size_t length, size_t *pos, char *token)
+{
+    size_t i = *pos;
+    size_t token_length = 0;
+
+    while (i < length && !is_token_byte((unsigned char)text[i]))
+    {
+        i++;
+    }
+    for (; i < length && is_token_byte((unsigned char)text[i]); i++)
+    {
+        if (token_length < INDEX_MAX_TOKEN)
+        {
+            char ch = text[i];
+            token[token_length++] = ch >= 'A' && ch <= 'Z' ? ch - 'A' + 'a' : ch;
+        }
+    }
+    *pos = i;
+    return token_length;
+}
+
+/**
+ * Function: read_year
+ * Description: Finds the first four digits in a row of a year value, "2010" of "2010-05-01".
+ * Input: text - the value, length - its length, year - receives the four digits.
+ * Output: Returns 1 if the value holds a year, 0 if not.
+ */
+static int read_year(const char *text, size_t length, char *year)
+{
+    size_t digits = 0;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        digits = text[i] >= '0' && text[i] <= '9' ? digits + 1 : 0;
+        if (digits == 4)
+        {
+            memcpy(year, text + i - 3, 4);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Function: hash_key
+ * Description: Mixes a device and inode number into a hash table position.
+ * Input: dev - device number, ino - inode number.
+ * Output: Returns the hash value.
+ */
+static uint64_t hash_key(uint64_t dev, uint64_t ino)
+{
+    uint64_t hash = (ino ^ (dev << 32) ^ (dev >> 32)) * 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 29);
+}
+
+/**
+ * Function: find_slot
+ * Description: Finds the hash table slot holding an old file, or the empty slot where it would go.
+ * Input: job - pointer to the BuildJob, dev - device number, ino - inode number.
+ * Output: Returns a pointer to the slot.
+ */
+static const IndexFile **find_slot(const BuildJob *job, uint64_t dev, uint64_t ino)
+{
+    size_t mask = job->slot_count - 1;
+    size_t pos = hash_key(dev, ino) & mask;
+    while (job->slots[pos] != NULL && (job->slots[pos]->dev != dev || job->slots[pos]->ino != ino))
+    {
+        pos = (pos + 1) & mask;
+    }
+    return &job->slots[pos];
+}
+
+/**
+ * Function: file_values
+ * Description: Counts the bytes of the field values an index file entry holds.
+ * Input: file - the entry.
+ * Output: Returns the total length of the values that are present.
+ */
+static size_t file_values(const IndexFile *file)
+{
+    size_t total = 0;
+    for (int i = 0; i < INDEX_FIELDS; i++)
+    {
+        if (file->field_length[i] != INDEX_MISSING)
+        {
+            total += file->field_length[i];
+        }
+    }
+    return total;
+}
+
+/**
+ * Function: open_library_index
+ * Description: Maps an index file read-only and checks that every table, token and file ID in it
+ *              lies inside the file, so queries can follow them without further checks.
+ * Input: fname - the index file name, index - pointer to the LibraryIndex struct to fill.
+ * Output: Returns success if the index is ready, or failure if the file is missing or not an index.
+ */
+Status open_library_index(const char *fname, LibraryIndex *index)
+{
+    struct stat st;
+
+    memset(index, 0, sizeof(*index));
+    int fd = open(fname, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return failure;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IndexHeader))
+    {
+        close(fd);
+        return failure;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return failure;
+    }
+    index->map = map;
+    index->map_size = (size_t)st.st_size;
+
+    const IndexHeader *header = map;
+    uint64_t size = index->map_size;
+    if (memcmp(header->magic, INDEX_MAGIC, 8) != 0 || header->version != INDEX_VERSION ||
+        header->files_offset != sizeof(IndexHeader) ||
+        header->terms_offset != header->files_offset + (uint64_t)header->file_count * sizeof(IndexFile) ||
+        header->postings_offset != header->terms_offset + (uint64_t)header->term_count * sizeof(IndexTerm) ||
+        header->text_offset < header->postings_offset || header->text_offset % 8 != 0 ||
+        header->text_offset > size || header->text_size != size - header->text_offset)
+    {
+        close_library_index(index);
+        return failure;
+    }
+    index->header = header;
+    index->files = (const IndexFile *)(index->map + header->files_offset);
+    index->terms = (const IndexTerm *)(index->map + header->terms_offset);
+    index->postings = (const uint32_t *)(index->map + header->postings_offset);
+    index->text = (const char *)(index->map + header->text_offset);
+
+    uint64_t postings = (header->text_offset - header->postings_offset) / sizeof(uint32_t);
+    for (uint32_t i = 0; i < header->file_count; i++)
+    {
+        const IndexFile *file = &index->files[i];
+        if (file->text_offset > header->text_size ||
+            file->path_length + file_values(file) > header->text_size - file->text_offset)
+        {
+            close_library_index(index);
+            return failure;
+        }
+    }
+    for (uint32_t i = 0; i < header->term_count; i++)
+    {
+        const IndexTerm *term = &index->terms[i];
+        if (term->field >= INDEX_FIELDS || term->text_offset > header->text_size ||
+            term->length > header->text_size - term->text_offset || term->postings > postings ||
+            term->count > postings - term->postings)
+        {
+            close_library_index(index);
+            return failure;
+        }
+        for (uint32_t j = 0; j < term->count; j++)
+        {
+            if (index->postings[term->postings + j] >= header->file_count)
+            {
+                close_library_index(index);
+                return failure;
+            }
+        }
+    }
+    return success;
+}
+
+/**
+ * Function: close_library_index
+ * Description: Unmaps an index opened with open_library_index.
+ * Input: index - pointer to the LibraryIndex.
+ * Output: The mapping is released; closing an index that failed to open is harmless.
+ */
+void close_library_index(LibraryIndex *index)
+{
+    if (index->map != NULL)
+    {
+        munmap(index->map, index->map_size);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+/**
+ * Function: read_and_validate_index_build
+ * Description: Reads the -j option, the files and directories to index and the index file name,
+ *              which is the last argument.
+ * Input: argc - argument count, argv - argument vector, build - pointer to the IndexBuild struct.
+ * Output: Returns success if the arguments are valid, or failure otherwise.
+ */
+Status read_and_validate_index_build(int argc, char *argv[], IndexBuild *build)
+{
+    int last = argc - 1;
+
+    init_path_list(&build->files);
+    build->threads = default_threads();
+    build->fname = last >= 3 ? argv[last] : NULL;
+
+    for (int i = 2; i < last; i++)
+    {
+        // Number of threads reading the changed files
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            if (read_threads_option(i + 1 < last ? argv[i + 1] : NULL, &build->threads, NULL) == failure)
+            {
+                free_index_build(build);
+                return failure;
+            }
+            i++;
+            continue;
+        }
+        if (collect_paths(argv[i], &build->files, NULL) == failure)
+        {
+            free_index_build(build);
+            return failure;
+        }
+    }
+
+    if (build->fname == NULL || build->files.count == 0)
+    {
+        fprintf(stderr, "ERROR: No mp3 files found.\n");
+        free_index_build(build);
+        return failure;
+    }
+    if (build->files.count > UINT32_MAX)
+    {
+        fprintf(stderr, "ERROR: Too many files for one index.\n");
+        free_index_build(build);
+        return failure;
+    }
+    return success;
+}
+
+/**
+ * Function: free_index_build
+ * Description: Releases the file list of an IndexBuild.
+ * Input: build - pointer to the IndexBuild.
+ * Output: The list is freed.
+ */
+void free_index_build(IndexBuild *build)
+{
+    free_path_list(&build->files);
+}
+
+/**
+ * Function: store_values
+ * Description: Copies field values into a build entry.
+ * Input: entry - the BuildFile, values - the values that are present back to back,
+ *        length - length of each field, INDEX_MISSING if absent.
+ * Output: Returns success, or failure if memory is exhausted.
+ */
+static Status store_values(BuildFile *entry, const char *values, const uint16_t *length)
+{
+    size_t total = 0;
+
+    for (int i = 0; i < INDEX_FIELDS; i++)
+    {
+        entry->field_length[i] = length[i];
+        total += length[i] != INDEX_MISSING ? length[i] : 0;
+    }
+    entry->values = malloc(total > 0 ? total : 1);
+    if (entry->values == NULL)
+    {
+        return failure;
+    }
+    memcpy(entry->values, values, total);
+    entry->indexed = 1;
+    return success;
+}
+
+/**
+ * Function: build_file
+ * Description: Gets the field values of one file: from the previous index if the file's inode,
+ *              size and modification time are unchanged, otherwise through the frame parser.
+ * Input: job - the BuildJob, music - the worker's Music struct, i - position of the file.
+ * Output: The entry of the file is filled in, or left out of the index if the file has no tag.
+ */
+static void build_file(BuildJob *job, Music *music, size_t i)
+{
+    BuildFile *entry = &job->entries[i];
+    const char *path = job->build->files.paths[i];
+    uint16_t length[INDEX_FIELDS];
+
+    if (stat(path, &entry->st) != 0)
+    {
+        perror(path);
+        __atomic_fetch_add(&job->skipped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    if (job->old.map != NULL)
+    {
+        const IndexFile *old = *find_slot(job, (uint64_t)entry->st.st_dev, (uint64_t)entry->st.st_ino);
+        if (old != NULL && old->size == (uint64_t)entry->st.st_size &&
+            old->mtime_sec == (int64_t)entry->st.st_mtim.tv_sec && old->mtime_nsec == (uint32_t)entry->st.st_mtim.tv_nsec)
+        {
+            if (store_values(entry, job->old.text + old->text_offset + old->path_length, old->field_length) == success)
+            {
+                __atomic_fetch_add(&job->reused, 1, __ATOMIC_RELAXED);
+            }
+            else
+            {
+                __atomic_fetch_add(&job->skipped, 1, __ATOMIC_RELAXED);
+            }
+            return;
+        }
+    }
+
+    music->Filename = (char *)path;
+    if (read_fields(music, &music->fields) == failure)
+    {
+        __atomic_fetch_add(&job->skipped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // Compact the values in place, dropping the missing ones and cutting very long ones
+    TagFields *fields = &music->fields;
+    size_t kept = 0;
+    for (int f = 0; f < INDEX_FIELDS; f++)
+    {
+        length[f] = INDEX_MISSING;
+        if (fields->found[f])
+        {
+            size_t value_length = fields->length[f] < INDEX_MISSING ? fields->length[f] : INDEX_MISSING - 1;
+            memmove(fields->text.data + kept, fields->text.data + fields->offset[f], value_length);
+            length[f] = (uint16_t)value_length;
+            kept += value_length;
+        }
+    }
+    if (store_values(entry, fields->text.data, length) == success)
+    {
+        __atomic_fetch_add(&job->read, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_fetch_add(&job->skipped, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Function: build_worker
+ * Description: Worker thread getting the field values of files until none are left.
+ * Input: arg - pointer to the shared BuildJob struct.
+ * Output: Returns NULL when every file has been taken.
+ */
+static void *build_worker(void *arg)
+{
+    BuildJob *job = arg;
+    Music music;
+
+    init_music(&music);
+    music.wanted.count = INDEX_FIELDS;
+    for (;;)
+    {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->build->files.count)
+        {
+            break;
+        }
+        build_file(job, &music, i);
+    }
+    free_music(&music);
+    return NULL;
+}
+
+/**
+ * Function: load_old_index
+ * Description: Opens the index being replaced and hashes its files by (device, inode). A missing
+ *              or unreadable old index just means every file is read.
+ * Input: job - the BuildJob, fname - the index file name.
+ * Output: Returns success, or failure if memory is exhausted.
+ */
+static Status load_old_index(BuildJob *job, const char *fname)
+{
+    if (open_library_index(fname, &job->old) == failure)
+    {
+        if (access(fname, F_OK) == 0)
+        {
+            fprintf(stderr, "WARNING: %s is not a tag index, every file is read again.\n", fname);
+        }
+        return success;
+    }
+
+    job->slot_count = 16;
+    while (job->slot_count < (size_t)job->old.header->file_count * 2)
+    {
+        job->slot_count *= 2;
+    }
+    job->slots = calloc(job->slot_count, sizeof(IndexFile *));
+    if (job->slots == NULL)
+    {
+        return failure;
+    }
+    for (uint32_t i = 0; i < job->old.header->file_count; i++)
+    {
+        const IndexFile *file = &job->old.files[i];
+        *find_slot(job, file->dev, file->ino) = file;
+    }
+    return success;
+}
+
+/**
+ * Function: compare_refs
+ * Description: qsort comparator ordering tokens by field, token bytes and file ID.
+ * Input: a, b - pointers to TermRef entries.
+ * Output: Returns a negative, zero or positive value.
+ */
+static int compare_refs(const void *a, const void *b)
+{
+    const TermRef *x = a;
+    const TermRef *y = b;
+
+    if (x->field != y->field)
+    {
+        return x->field < y->field ? -1 : 1;
+    }
+    int cmp = memcmp(x->token, y->token, x->length < y->length ? x->length : y->length);
+    if (cmp != 0)
+    {
+        return cmp;
+    }
+    if (x->length != y->length)
+    {
+        return x->length < y->length ? -1 : 1;
+    }
+    return x->file < y->file ? -1 : x->file > y->file;
+}
+
+/**
+ * Function: add_ref
+ * Description: Appends one token of one file to the token list.
+ * Input: refs - the list, count - entries in use, capacity - allocated entries, tokens - buffer
+ *        receiving the token bytes, field - position of the field, file - file ID,
+ *        token - the token, length - its length.
+ * Output: Returns success, or failure if memory is exhausted.
+ */
+static Status add_ref(TermRef **refs, size_t *count, size_t *capacity, OutBuffer *tokens,
+                      int field, uint32_t file, const char *token, size_t length)
+{
+    if (*count == *capacity)
+    {
+        size_t grown = *capacity ? *capacity * 2 : 1024;
+        TermRef *bigger = realloc(*refs, grown * sizeof(TermRef));
+        if (bigger == NULL)
+        {
+            return failure;
+        }
+        *refs = bigger;
+        *capacity = grown;
+    }
+    TermRef *ref = &(*refs)[(*count)++];
+    ref->offset = tokens->length;
+    ref->length = (uint16_t)length;
+    ref->field = (uint8_t)field;
+    ref->file = file;
+    out_append(tokens, token, length);
+    return success;
+}
+
+/**
+ * Function: write_all
+ * Description: Writes a buffer completely.
+ * Input: fd - the file, data - the bytes, length - number of bytes.
+ * Output: Returns success, or failure on a write error.
+ */
+static Status write_all(int fd, const void *data, size_t length)
+{
+    const char *ptr = data;
+    while (length > 0)
+    {
+        ssize_t written = write(fd, ptr, length);
+        if (written <= 0)
+        {
+            return failure;
+        }
+        ptr += written;
+        length -= (size_t)written;
+    }
+    return success;
+}
+
+/**
+ * Function: index_file_mode
+ * Description: Gives the permissions of a rewritten index: those of the index it replaces, or
+ *              what the umask allows for a new one, since mkstemp creates files for their owner only.
+ * Input: fname - the index file name.
+ * Output: Returns the permission bits.
+ */
+static mode_t index_file_mode(const char *fname)
+{
+    struct stat st;
+
+    if (stat(fname, &st) == 0)
+    {
+        return st.st_mode & 07777;
+    }
+    mode_t mask = umask(0);
+    umask(mask);
+    return 0666 & ~mask;
+}
+
+/**
+ * Function: write_index
+ * Description: Builds the file table, term table and postings from the entries and writes the
+ *              index to a temporary file that replaces fname once it is complete, so queries
+ *              running meanwhile keep using the old index. The new file keeps the permissions
+ *              of the old one.
+ * Input: job - the BuildJob with every entry filled in, fname - the index file name,
+ *        terms_written - receives the number of terms.
+ * Output: Returns success, or failure if the index could not be written.
+ */
+static Status write_index(BuildJob *job, const char *fname, size_t *terms_written)
+{
+    const PathList *paths = &job->build->files;
+    size_t file_count = 0;
+    size_t ref_count = 0, ref_capacity = 0;
+    size_t term_count = 0, posting_count = 0;
+    TermRef *refs = NULL;
+    IndexTerm *terms = NULL;
+    uint32_t *postings = NULL;
+    OutBuffer text, tokens;
+    char token[INDEX_MAX_TOKEN];
+    char temp_fname[PATH_MAX];
+    Status status = success;
+
+    init_out_buffer(&text);
+    init_out_buffer(&tokens);
+    for (size_t i = 0; i < paths->count; i++)
+    {
+        file_count += job->entries[i].indexed;
+    }
+    IndexFile *files = calloc(file_count > 0 ? file_count : 1, sizeof(IndexFile));
+    if (files == NULL)
+    {
+        return failure;
+    }
+
+    // File table and text of every file, then the tokens of its fields
+    uint32_t id = 0;
+    for (size_t i = 0; i < paths->count && status == success; i++)
+    {
+        const BuildFile *entry = &job->entries[i];
+        if (!entry->indexed)
+        {
+            continue;
+        }
+        IndexFile *file = &files[id];
+        size_t path_length = strlen(paths->paths[i]);
+        file->dev = (uint64_t)entry->st.st_dev;
+        file->ino = (uint64_t)entry->st.st_ino;
+        file->size = (uint64_t)entry->st.st_size;
+        file->mtime_sec = (int64_t)entry->st.st_mtim.tv_sec;
+        file->mtime_nsec = (uint32_t)entry->st.st_mtim.tv_nsec;
+        file->text_offset = text.length;
+        file->path_length = (uint16_t)(path_length < INDEX_MISSING ? path_length : INDEX_MISSING - 1);
+        out_append(&text, paths->paths[i], file->path_length);
+
+        const char *value = entry->values;
+        for (int f = 0; f < INDEX_FIELDS && status == success; f++)
+        {
+            file->field_length[f] = entry->field_length[f];
+            if (entry->field_length[f] == INDEX_MISSING)
+            {
+                continue;
+            }
+            size_t length = entry->field_length[f];
+            out_append(&text, value, length);
+            if (f == INDEX_YEAR)
+            {
+                if (read_year(value, length, token))
+                {
+                    status = add_ref(&refs, &ref_count, &ref_capacity, &tokens, f, id, token, 4);
+                }
+            }
+            else
+            {
+                size_t pos = 0, token_length;
+                while (status == success && (token_length = next_token(value, length, &pos, token)) > 0)
+                {
+                    status = add_ref(&refs, &ref_count, &ref_capacity, &tokens, f, id, token, token_length);
+                }
+            }
+            value += length;
+        }
+        id++;
+    }
+    if (status == failure || (tokens.length > 0 && tokens.data == NULL) || (text.length > 0 && text.data == NULL))
+    {
+        status = failure;
+        goto done;
+    }
+
+    // Sort by term so each term's file IDs end up together and ascending
+    for (size_t i = 0; i < ref_count; i++)
+    {
+        refs[i].token = tokens.data + refs[i].offset;
+    }
+    if (ref_count > 0)
+    {
+        qsort(refs, ref_count, sizeof(TermRef), compare_refs);
+    }
+    terms = malloc((ref_count > 0 ? ref_count : 1) * sizeof(IndexTerm));
+    postings = malloc((ref_count > 0 ? ref_count : 1) * sizeof(uint32_t));
+    if (terms == NULL || postings == NULL)
+    {
+        status = failure;
+        goto done;
+    }
+    for (size_t i = 0; i < ref_count; i++)
+    {
+        const TermRef *ref = &refs[i];
+        int same_term = i > 0 && ref->field == refs[i - 1].field && ref->length == refs[i - 1].length &&
+                        memcmp(ref->token, refs[i - 1].token, ref->length) == 0;
+        if (!same_term)
+        {
+            IndexTerm *term = &terms[term_count++];
+            term->text_offset = text.length;
+            term->postings = posting_count;
+            term->count = 0;
+            term->length = ref->length;
+            term->field = ref->field;
+            term->reserved = 0;
+            out_append(&text, ref->token, ref->length);
+        }
+        else if (ref->file == refs[i - 1].file)
+        {
+            // The same word twice in one field
+            continue;
+        }
+        postings[posting_count++] = ref->file;
+        terms[term_count - 1].count++;
+    }
+    if (text.length > 0 && text.data == NULL)
+    {
+        status = failure;
+        goto done;
+    }
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, 8);
+    header.version = INDEX_VERSION;
+    header.file_count = (uint32_t)file_count;
+    header.term_count = (uint32_t)term_count;
+    header.files_offset = sizeof(IndexHeader);
+    header.terms_offset = header.files_offset + file_count * sizeof(IndexFile);
+    header.postings_offset = header.terms_offset + term_count * sizeof(IndexTerm);
+    header.text_offset = (header.postings_offset + posting_count * sizeof(uint32_t) + 7) & ~(uint64_t)7;
+    header.text_size = text.length;
+    uint64_t padding = 0;
+    size_t pad = (size_t)(header.text_offset - header.postings_offset - posting_count * sizeof(uint32_t));
+
+    if (snprintf(temp_fname, sizeof(temp_fname), "%s.XXXXXX", fname) >= (int)sizeof(temp_fname))
+    {
+        status = failure;
+        goto done;
+    }
+    int fd = mkstemp(temp_fname);
+    if (fd < 0)
+    {
+        perror("mkstemp");
+        status = failure;
+        goto done;
+    }
+    if (fchmod(fd, index_file_mode(fname)) != 0 || write_all(fd, &header, sizeof(header)) == failure ||
+        write_all(fd, files, file_count * sizeof(IndexFile)) == failure ||
+        write_all(fd, terms, term_count * sizeof(IndexTerm)) == failure ||
+        write_all(fd, postings, posting_count * sizeof(uint32_t)) == failure ||
+        write_all(fd, &padding, pad) == failure || write_all(fd, text.data, text.length) == failure ||
+        fsync(fd) != 0 || rename(temp_fname, fname) != 0)
+    {
+        perror(fname);
+        unlink(temp_fname);
+        status = failure;
+    }
+    close(fd);
+    *terms_written = term_count;
+
+done:
+    free(files);
+    free(refs);
+    free(terms);
+    free(postings);
+    free_out_buffer(&text);
+    free_out_buffer(&tokens);
+    return status;
+}
+
+/**
+ * Function: run_index_build
+ * Description: Builds the index of the files on a pool of worker threads. Files whose inode, size
+ *              and modification time match the previous index take their values from it; only
+ *              new and changed files are read through the frame parser.
+ * Input: build - pointer to the IndexBuild struct.
+ * Output: Returns success if the index was written, or failure otherwise.
+ */
+Status run_index_build(IndexBuild *build)
+{
+    BuildJob job;
+    size_t terms = 0;
+    Status status;
+
+    memset(&job, 0, sizeof(job));
+    job.build = build;
+    job.entries = calloc(build->files.count, sizeof(BuildFile));
+    if (job.entries == NULL || load_old_index(&job, build->fname) == failure)
+    {
+        fprintf(stderr, "ERROR: Out of memory.\n");
+        status = failure;
+    }
+    else
+    {
+        status = run_workers(build->threads, build->files.count, build_worker, &job);
+    }
+
+    // The workers copied every reused value, so the old mapping can go before it is replaced
+    if (status == success)
+    {
+        close_library_index(&job.old);
+        status = write_index(&job, build->fname, &terms);
+    }
+    if (status == success)
+    {
+        printf("----------INDEX BUILT: %zu FILES, %zu TERMS----------\n", job.read + job.reused, terms);
+        printf("READ     :   %zu\n", job.read);
+        printf("UNCHANGED:   %zu\n", job.reused);
+        printf("SKIPPED  :   %zu\n", job.skipped);
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Failed to write the index %s\n", build->fname);
+    }
+
+    close_library_index(&job.old);
+    if (job.entries != NULL)
+    {
+        for (size_t i = 0; i < build->files.count; i++)
+        {
+            free(job.entries[i].values);
+        }
+    }
+    free(job.entries);
+    free(job.slots);
+    free_index_build(build);
+    return status;
+}
+
+/**
+ * Function: term_bound
+ * Description: Binary search for the first term of a field that is not less than a token.
+ * Input: index - the LibraryIndex, field - position of the field, token - the token, length - its length.
+ * Output: Returns the position of the term, term_count if every term is less.
+ */
+static size_t term_bound(const LibraryIndex *index, int field, const char *token, size_t length)
+{
+    size_t low = 0;
+    size_t high = index->header->term_count;
+
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        const IndexTerm *term = &index->terms[mid];
+        int cmp = term->field - field;
+        if (cmp == 0)
+        {
+            cmp = memcmp(index->text + term->text_offset, token, term->length < length ? term->length : length);
+            if (cmp == 0)
+            {
+                cmp = term->length < length ? -1 : term->length > length;
+            }
+        }
+        if (cmp < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/**
+ * Function: term_matches
+ * Description: Tells whether a term is the token, or starts with it for a prefix search.
+ * Input: index - the LibraryIndex, position - position of the term, field - position of the
+ *        field, token - the token, length - its length, prefix - set for a prefix search.
+ * Output: Returns 1 if the term matches, 0 if not.
+ */
+static int term_matches(const LibraryIndex *index, size_t position, int field, const char *token, size_t length, int prefix)
+{
+    if (position >= index->header->term_count)
+    {
+        return 0;
+    }
+    const IndexTerm *term = &index->terms[position];
+    if (term->field != field || term->length < length || (!prefix && term->length != length))
+    {
+        return 0;
+    }
+    return memcmp(index->text + term->text_offset, token, length) == 0;
+}
+
+/**
+ * Function: compare_ids
+ * Description: qsort comparator for file IDs.
+ * Input: a, b - pointers to uint32_t values.
+ * Output: Returns a negative, zero or positive value.
+ */
+static int compare_ids(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Function: term_range_ids
+ * Description: Collects the file IDs of a slice of the term table into one sorted list.
+ * Input: parser - the QueryParser, first - first term, last - end of the slice, list - receives the IDs.
+ * Output: Returns success, or failure if memory is exhausted.
+ */
+static Status term_range_ids(QueryParser *parser, size_t first, size_t last, IdList *list)
+{
+    const LibraryIndex *index = parser->index;
+    size_t total = 0;
+
+    for (size_t i = first; i < last; i++)
+    {
+        total += index->terms[i].count;
+    }
+    list->count = 0;
+    list->ids = malloc((total > 0 ? total : 1) * sizeof(uint32_t));
+    if (list->ids == NULL)
+    {
+        parser->error = "Out of memory";
+        return failure;
+    }
+    for (size_t i = first; i < last; i++)
+    {
+        memcpy(list->ids + list->count, index->postings + index->terms[i].postings,
+               index->terms[i].count * sizeof(uint32_t));
+        list->count += index->terms[i].count;
+    }
+
+    // A single term is already sorted, several have to be merged
+    if (last - first > 1)
+    {
+        qsort(list->ids, list->count, sizeof(uint32_t), compare_ids);
+        size_t kept = 0;
+        for (size_t i = 0; i < list->count; i++)
+        {
+            if (kept == 0 || list->ids[i] != list->ids[kept - 1])
+            {
+                list->ids[kept++] = list->ids[i];
+            }
+        }
+        list->count = kept;
+    }
+    return success;
+}
+
+/**
+ * Function: combine_ids
+ * Description: Merges two sorted lists into their intersection or their union.
+ * Input: parser - the QueryParser, a - first list, replaced by the result, b - second list,
+ *        released, intersect - set for AND, clear for OR.
+ * Output: Returns success, or failure if memory is exhausted.
+ */
+static Status combine_ids(QueryParser *parser, IdList *a, IdList *b, int intersect)
+{
+    size_t capacity = intersect ? (a->count < b->count ? a->count : b->count) : a->count + b->count;
+    uint32_t *ids = malloc((capacity > 0 ? capacity : 1) * sizeof(uint32_t));
+    size_t count = 0, i = 0, j = 0;
+
+    if (ids == NULL)
+    {
+        parser->error = "Out of memory";
+        free(b->ids);
+        return failure;
+    }
+    while (i < a->count && j < b->count)
+    {
+        if (a->ids[i] == b->ids[j])
+        {
+            ids[count++] = a->ids[i++];
+            j++;
+        }
+        else if (a->ids[i] < b->ids[j])
+        {
+            if (!intersect)
+            {
+                ids[count++] = a->ids[i];
+            }
+            i++;
+        }
+        else
+        {
+            if (!intersect)
+            {
+                ids[count++] = b->ids[j];
+            }
+            j++;
+        }
+    }
+    if (!intersect)
+    {
+        memcpy(ids + count, a->ids + i, (a->count - i) * sizeof(uint32_t));
+        count += a->count - i;
+        memcpy(ids + count, b->ids + j, (b->count - j) * sizeof(uint32_t));
+        count += b->count - j;
+    }
+    free(a->ids);
+    free(b->ids);
+    a->ids = ids;
+    a->count = count;
+    return success;
+}
+
+/**
+ * Function: complement_ids
+ * Description: Replaces a sorted list with the IDs of every other file in the index.
+ * Input: parser - the QueryParser, list - the list.
+ * Output: Returns success, or failure if memory is exhausted.
+ */
+static Status complement_ids(QueryParser *parser, IdList *list)
+{
+    uint32_t file_count = parser->index->header->file_count;
+    uint32_t *ids = malloc((file_count - list->count + 1) * sizeof(uint32_t));
+    size_t count = 0, j = 0;
+
+    if (ids == NULL)
+    {
+        parser->error = "Out of memory";
+        return failure;
+    }
+    for (uint32_t id = 0; id < file_count; id++)
+    {
+        if (j < list->count && list->ids[j] == id)
+        {
+            j++;
+            continue;
+        }
+        ids[count++] = id;
+    }
+    free(list->ids);
+    list->ids = ids;
+    list->count = count;
+    return success;
+}
+
+/**
+ * Function: skip_space
+ * Description: Moves the parser past blanks.
+ * Input: parser - the QueryParser.
+ * Output: pos points at the next non-blank character.
+ */
+static void skip_space(QueryParser *parser)
+{
+    while (*parser->pos == ' ' || *parser->pos == '\t' || *parser->pos == '\n')
+    {
+        parser->pos++;
+    }
+}
+
+/**
+ * Function: match_keyword
+ * Description: Consumes AND, OR or NOT, in any case, if it is the next word of the query.
+ * Input: parser - the QueryParser, keyword - the upper-case keyword.
+ * Output: Returns 1 if the keyword was consumed, 0 if the next word is something else.
+ */
+static int match_keyword(QueryParser *parser, const char *keyword)
+{
+    size_t length = strlen(keyword);
+
+    skip_space(parser);
+    if (strncasecmp(parser->pos, keyword, length) != 0)
+    {
+        return 0;
+    }
+    char next = parser->pos[length];
+    if (next != '\0' && next != ' ' && next != '\t' && next != '\n' && next != '(')
+    {
+        return 0;
+    }
+    parser->pos += length;
+    return 1;
+}
+
+/**
+ * Function: read_field_name
+ * Description: Reads the field of a condition, a name such as artist or the frame ID such as TPE1.
+ * Input: parser - the QueryParser.
+ * Output: Returns the position of the field, or -1 if the word is not an indexed field.
+ */
+static int read_field_name(QueryParser *parser)
+{
+    const char *start = parser->pos;
+
+    while ((*parser->pos >= 'a' && *parser->pos <= 'z') || (*parser->pos >= 'A' && *parser->pos <= 'Z') ||
+           (*parser->pos >= '0' && *parser->pos <= '9'))
+    {
+        parser->pos++;
+    }
+    size_t length = (size_t)(parser->pos - start);
+    for (int i = 0; i < INDEX_FIELDS; i++)
+    {
+        if ((strlen(index_field_names[i]) == length && strncasecmp(start, index_field_names[i], length) == 0) ||
+            (length == 4 && strncmp(start, view_fields[i].tag, 4) == 0))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Function: match_value
+ * Description: Finds the files whose field holds every token of a value. A value ending in *
+ *              matches any word starting with its last token.
+ * Input: parser - the QueryParser, field - position of the field, value - the value,
+ *        length - its length, list - receives the file IDs.
+ * Output: Returns success, or failure with parser->error set.
+ */
+static Status match_value(QueryParser *parser, int field, const char *value, size_t length, IdList *list)
+{
+    char token[INDEX_MAX_TOKEN];
+    size_t pos = 0, token_length;
+    int prefix = length > 0 && value[length - 1] == '*';
+    int first = 1;
+
+    while ((token_length = next_token(value, length, &pos, token)) > 0)
+    {
+        // Only the last token of a value ending in * is a prefix
+        size_t after = pos;
+        char rest[INDEX_MAX_TOKEN];
+        int last_token = next_token(value, length, &after, rest) == 0;
+        int is_prefix = prefix && last_token;
+
+        size_t start = term_bound(parser->index, field, token, token_length);
+        size_t end = start;
+        while (term_matches(parser->index, end, field, token, token_length, is_prefix))
+        {
+            end++;
+            if (!is_prefix)
+            {
+                break;
+            }
+        }
+        IdList ids;
+        if (term_range_ids(parser, start, end, &ids) == failure)
+        {
+            if (!first)
+            {
+                free(list->ids);
+            }
+            return failure;
+        }
+        if (first)
+        {
+            *list = ids;
+            first = 0;
+        }
+        else if (combine_ids(parser, list, &ids, 1) == failure)
+        {
+            free(list->ids);
+            return failure;
+        }
+    }
+    if (first)
+    {
+        parser->error = "Value without any letters or digits";
+        return failure;
+    }
+    return success;
+}
+
+/**
+ * Function: match_year
+ * Description: Finds the files whose year compares to a value as the operator says. Year tokens
+ *              are four digits, so a range is a slice of the sorted year terms.
+ * Input: parser - the QueryParser, op - one of "=", "<", "<=", ">", ">=", value - the value,
+ *        length - its length, list - receives the file IDs.
+ * Output: Returns success, or failure with parser->error set.
+ */
+static Status match_year(QueryParser *parser, const char *op, const char *value, size_t length, IdList *list)
+{
+    const LibraryIndex *index = parser->index;
+    char year[4];
+
+    if (length != 4 || !read_year(value, length, year))
+    {
+        parser->error = "A year must be four digits";
+        return failure;
+    }
+    size_t first_year = term_bound(index, INDEX_YEAR, "", 0);
+    size_t end_year = term_bound(index, INDEX_YEAR + 1, "", 0);
+    size_t equal = term_bound(index, INDEX_YEAR, year, 4);
+    size_t above = term_matches(index, equal, INDEX_YEAR, year, 4, 0) ? equal + 1 : equal;
+
+    if (strcmp(op, "=") == 0)
+    {
+        return term_range_ids(parser, equal, above, list);
+    }
+    if (strcmp(op, "<") == 0)
+    {
+        return term_range_ids(parser, first_year, equal, list);
+    }
+    if (strcmp(op, "<=") == 0)
+    {
+        return term_range_ids(parser, first_year, above, list);
+    }
+    if (strcmp(op, ">") == 0)
+    {
+        return term_range_ids(parser, above, end_year, list);
+    }
+    return term_range_ids(parser, equal, end_year, list);
+}
+
+static Status parse_or(QueryParser *parser, IdList *list);
+
+/**
+ * Function: parse_condition
+ * Description: Parses and answers one condition: field, operator and value. The value is a word
+ *              or a quoted string; != is the negation of =, and <, <=, > and >= compare years.
+ * Input: parser - the QueryParser, list - receives the file IDs.
+ * Output: Returns success, or failure with parser->error set.
+ */
+static Status parse_condition(QueryParser *parser, IdList *list)
+{
+    char op[3] = {0};
+    const char *value;
+    size_t length;
+
+    skip_space(parser);
+    int field = read_field_name(parser);
+    if (field < 0)
+    {
+        parser->error = "Expected one of title, artist, album, year or genre";
+        return failure;
+    }
+    skip_space(parser);
+    if (strchr("=<>!", *parser->pos) == NULL || *parser->pos == '\0')
+    {
+        parser->error = "Expected =, !=, <, <=, > or >=";
+        return failure;
+    }
+    op[0] = *parser->pos++;
+    if (*parser->pos == '=')
+    {
+        op[1] = *parser->pos++;
+    }
+    if (strcmp(op, "!") == 0)
+    {
+        parser->error = "Expected =, !=, <, <=, > or >=";
+        return failure;
+    }
+
+    skip_space(parser);
+    if (*parser->pos == '"' || *parser->pos == '\'')
+    {
+        char quote = *parser->pos++;
+        value = parser->pos;
+        while (*parser->pos != '\0' && *parser->pos != quote)
+        {
+            parser->pos++;
+        }
+        if (*parser->pos != quote)
+        {
+            parser->error = "Unterminated quoted value";
+            return failure;
+        }
+        length = (size_t)(parser->pos++ - value);
+    }
+    else
+    {
+        value = parser->pos;
+        while (*parser->pos != '\0' && *parser->pos != ' ' && *parser->pos != '\t' && *parser->pos != '\n' &&
+               *parser->pos != '(' && *parser->pos != ')')
+        {
+            parser->pos++;
+        }
+        length = (size_t)(parser->pos - value);
+    }
+
+    if (field == INDEX_YEAR)
+    {
+        if (match_year(parser, strcmp(op, "!=") == 0 ? "=" : op, value, length, list) == failure)
+        {
+            return failure;
+        }
+    }
+    else if (strcmp(op, "=") == 0 || strcmp(op, "!=") == 0)
+    {
+        if (match_value(parser, field, value, length, list) == failure)
+        {
+            return failure;
+        }
+    }
+    else
+    {
+        parser->error = "Only year can be compared with <, <=, > and >=";
+        return failure;
+    }
+    if (strcmp(op, "!=") == 0 && complement_ids(parser, list) == failure)
+    {
+        free(list->ids);
+        return failure;
+    }
+    return success;
+}
+
+/**
+ * Function: parse_not
+ * Description: Parses a condition, a parenthesised query, or NOT followed by either.
+ * Input: parser - the QueryParser, list - receives the file IDs.
+ * Output: Returns success, or failure with parser->error set.
+ */
+static Status parse_not(QueryParser *parser, IdList *list)
+{
+    Status status;
+
+    if (++parser->depth > INDEX_MAX_DEPTH)
+    {
+        parser->error = "Query nested too deeply";
+        return failure;
+    }
+    // match_keyword leaves pos at the next non-blank character
+    if (match_keyword(parser, "NOT"))
+    {
+        status = parse_not(parser, list);
+        if (status == success && complement_ids(parser, list) == failure)
+        {
+            free(list->ids);
+            status = failure;
+        }
+    }
+    else if (*parser->pos == '(')
+    {
+        parser->pos++;
+        status = parse_or(parser, list);
+        skip_space(parser);
+        if (status == success && *parser->pos != ')')
+        {
+            parser->error = "Expected )";
+            free(list->ids);
+            status = failure;
+        }
+        parser->pos += status == success;
+    }
+    else
+    {
+        status = parse_condition(parser, list);
+    }
+    parser->depth--;
+    return status;
+}
+
+/**
+ * Function: parse_and
+ * Description: Parses conditions joined by AND. Conditions written one after the other without
+ *              a keyword are joined by AND as well.
+ * Input: parser - the QueryParser, list - receives the file IDs.
+ * Output: Returns success, or failure with parser->error set.
+ */
+static Status parse_and(QueryParser *parser, IdList *list)
+{
+    if (parse_not(parser, list) == failure)
+    {
+        return failure;
+    }
+    for (;;)
+    {
+        const char *before = parser->pos;
+        if (!match_keyword(parser, "AND"))
+        {
+            skip_space(parser);
+            if (*parser->pos == '\0' || *parser->pos == ')' || match_keyword(parser, "OR"))
+            {
+                parser->pos = before;
+                return success;
+            }
+        }
+        IdList next;
+        if (parse_not(parser, &next) == failure)
+        {
+            free(list->ids);
+            return failure;
+        }
+        if (combine_ids(parser, list, &next, 1) == failure)
+        {
+            free(list->ids);
+            return failure;
+        }
+    }
+}
+
+/**
+ * Function: parse_or
+ * Description: Parses groups of conditions joined by OR.
+ * Input: parser - the QueryParser, list - receives the file IDs.
+ * Output: Returns success, or failure with parser->error set.
+ */
+static Status parse_or(QueryParser *parser, IdList *list)
+{
+    if (parse_and(parser, list) == failure)
+    {
+        return failure;
+    }
+    while (match_keyword(parser, "OR"))
+    {
+        IdList next;
+        if (parse_and(parser, &next) == failure)
+        {
+            free(list->ids);
+            return failure;
+        }
+        if (combine_ids(parser, list, &next, 0) == failure)
+        {
+            free(list->ids);
+            return failure;
+        }
+    }
+    return success;
+}
+
+/**
+ * Function: index_file_fields
+ * Description: Copies the field values of an indexed file into a TagFields struct.
+ * Input: index - the LibraryIndex, file - the file entry, fields - receives the values.
+ * Output: fields holds the INDEX_FIELDS values.
+ */
+static void index_file_fields(const LibraryIndex *index, const IndexFile *file, TagFields *fields)
+{
+    const char *ptr = index->text + file->text_offset + file->path_length;
+
+    fields->text.length = 0;
+    fields->count = INDEX_FIELDS;
+    fields->hashed = 0;
+    for (int i = 0; i < INDEX_FIELDS; i++)
+    {
+        fields->offset[i] = fields->text.length;
+        fields->found[i] = file->field_length[i] != INDEX_MISSING;
+        if (fields->found[i])
+        {
+            out_append(&fields->text, ptr, file->field_length[i]);
+            ptr += file->field_length[i];
+        }
+        fields->length[i] = fields->text.length - fields->offset[i];
+    }
+}
+
+/**
+ * Function: read_and_validate_query
+ * Description: Reads the query, the --format option and the index file name.
+ * Input: argc - argument count, argv - argument vector, query - pointer to the IndexQuery struct.
+ * Output: Returns success if the arguments are valid, or failure otherwise.
+ */
+Status read_and_validate_query(int argc, char *argv[], IndexQuery *query)
+{
+    query->expr = NULL;
+    query->fname = NULL;
+    query->format = format_text;
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (is_format_option(argv[i]))
+        {
+            if (read_format_option(argv[i], &query->format, NULL) == failure)
+            {
+                return failure;
+            }
+        }
+        else if (query->expr == NULL)
+        {
+            query->expr = argv[i];
+        }
+        else if (query->fname == NULL)
+        {
+            query->fname = argv[i];
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Unexpected argument %s\n", argv[i]);
+            return failure;
+        }
+    }
+    if (query->fname == NULL)
+    {
+        fprintf(stderr, "ERROR: A query and an index file are needed.\n");
+        return failure;
+    }
+    return success;
+}
+
+/**
+ * Function: run_query
+ * Description: Answers a query from the index alone and prints the matching files with their
+ *              indexed fields, in path order. The MP3 files themselves are not opened.
+ * Input: query - pointer to the IndexQuery struct.
+ * Output: Returns success if the query was answered, or failure if the index or the query is invalid.
+ */
+Status run_query(const IndexQuery *query)
+{
+    LibraryIndex index;
+    QueryParser parser;
+    IdList list;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (open_library_index(query->fname, &index) == failure)
+    {
+        fprintf(stderr, "ERROR: %s is not a tag index.\n", query->fname);
+        return failure;
+    }
+
+    parser.index = &index;
+    parser.pos = query->expr;
+    parser.error = NULL;
+    parser.depth = 0;
+    Status status = parse_or(&parser, &list);
+    skip_space(&parser);
+    if (status == success && *parser.pos != '\0')
+    {
+        parser.error = "Unexpected text";
+        free(list.ids);
+        status = failure;
+    }
+    if (status == failure)
+    {
+        fprintf(stderr, "ERROR: %s at offset %zu of the query.\n", parser.error, (size_t)(parser.pos - query->expr));
+        close_library_index(&index);
+        return failure;
+    }
+
+    FieldList wanted;
+    TagFields fields;
+    OutBuffer out, path;
+    default_field_list(&wanted);
+    wanted.count = INDEX_FIELDS;
+    init_tag_fields(&fields);
+    init_out_buffer(&out);
+    init_out_buffer(&path);
+
+    format_stream_header(query->format, &out);
+    for (size_t i = 0; i < list.count; i++)
+    {
+        const IndexFile *file = &index.files[list.ids[i]];
+        path.length = 0;
+        out_append(&path, index.text + file->text_offset, file->path_length);
+        out_putc(&path, '\0');
+        index_file_fields(&index, file, &fields);
+        if (query->format == format_text)
+        {
+            out_printf(&out, "FILE     :   %s\n", path.data);
+            format_fields(&wanted, &fields, &out, NULL);
+            out_putc(&out, '\n');
+        }
+        else
+        {
+            format_record(query->format, path.data, &wanted, &fields, &out);
+        }
+        if (out.length >= QUERY_FLUSH)
+        {
+            write_out_buffer(&out, stdout);
+        }
+    }
+    write_out_buffer(&out, stdout);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (double)(end.tv_sec - start.tv_sec) * 1e3 + (double)(end.tv_nsec - start.tv_nsec) / 1e6;
+    fprintf(stderr, "----------%zu OF %u FILES MATCHED IN %.3f MS----------\n", list.count, index.header->file_count, elapsed);
+
+    free(list.ids);
+    free_out_buffer(&out);
+    free_out_buffer(&path);
+    free_out_buffer(&fields.text);
+    close_library_index(&index);
+    return success;
+}
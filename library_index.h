@@ -0,0 +1,119 @@
+#ifndef LIBRARY_INDEX_H
+#define LIBRARY_INDEX_H
+
+#include <sys/stat.h>
+#include "type.h"
+#include "batch.h"
+#include "view.h"
+
+#define INDEX_MAGIC "MP3TAGI1" // First 8 bytes of an index file
+#define INDEX_VERSION 1        // Layout version of the index file
+#define INDEX_FIELDS 5         // Indexed fields, the first five viewer fields: title, artist, album, year, genre
+#define INDEX_YEAR 3           // Position of the year among the indexed fields
+#define INDEX_MISSING 0xFFFF   // Field length stored for a frame that is not in the tag
+#define INDEX_MAX_TOKEN 64     // Longer tokens are cut to this many bytes
+#define INDEX_MAX_DEPTH 32     // Deepest nesting of parentheses and NOT in a query
+
+/*
+ * An index file is used in place through a read-only mapping. Every section starts on an
+ * 8 byte boundary and integers are in the byte order of the machine that wrote it:
+ *   IndexHeader
+ *   IndexFile[file_count]   sorted by path, the position of a file is its file ID
+ *   IndexTerm[term_count]   sorted by field, then by the bytes of the token
+ *   uint32_t postings[]     ascending file IDs of each term, the terms' lists back to back
+ *   text                    path and field values of each file, then the token of each term
+ * A token is a run of ASCII letters and digits, lowercased, where bytes above 0x7F also count
+ * as letters so UTF-8 words stay whole. The year is indexed as a single token holding its
+ * first four digits, which sort like numbers, so a year range is a slice of the term table.
+ */
+
+/**
+ * Structure at the start of an index file.
+ */
+typedef struct
+{
+    char magic[8];            // INDEX_MAGIC
+    uint32_t version;         // INDEX_VERSION
+    uint32_t file_count;      // Number of IndexFile entries
+    uint32_t term_count;      // Number of IndexTerm entries
+    uint32_t reserved;        // Zero
+    uint64_t files_offset;    // Offset of the file table
+    uint64_t terms_offset;    // Offset of the term table
+    uint64_t postings_offset; // Offset of the postings
+    uint64_t text_offset;     // Offset of the text
+    uint64_t text_size;       // Bytes of text, the end of the file
+} IndexHeader;
+
+/**
+ * Structure describing one indexed file. The path and the values of the fields that are
+ * present follow each other at text_offset.
+ */
+typedef struct
+{
+    uint64_t dev;                         // Device of the file
+    uint64_t ino;                         // Inode of the file
+    uint64_t size;                        // File size when it was read
+    int64_t mtime_sec;                    // Modification time, seconds
+    uint64_t text_offset;                 // Position of the path in the text
+    uint32_t mtime_nsec;                  // Modification time, nanoseconds
+    uint16_t path_length;                 // Length of the path
+    uint16_t field_length[INDEX_FIELDS];  // Length of each field, INDEX_MISSING if absent
+} IndexFile;
+
+/**
+ * Structure describing one (field, token) pair and where its file IDs are.
+ */
+typedef struct
+{
+    uint64_t text_offset; // Position of the token in the text
+    uint64_t postings;    // Index of the first file ID in the postings
+    uint32_t count;       // Number of file IDs
+    uint16_t length;      // Length of the token
+    uint8_t field;        // Position of the field, 0 to INDEX_FIELDS - 1
+    uint8_t reserved;     // Zero
+} IndexTerm;
+
+/**
+ * Structure to hold an open index file.
+ */
+typedef struct
+{
+    unsigned char *map;        // Index file mapped read-only
+    size_t map_size;           // Size of the mapping
+    const IndexHeader *header; // Header at the start of the mapping
+    const IndexFile *files;    // File table
+    const IndexTerm *terms;    // Term table
+    const uint32_t *postings;  // File IDs of all terms
+    const char *text;          // Paths, field values and tokens
+} LibraryIndex;
+
+/**
+ * Structure to hold the arguments of --index-build.
+ */
+typedef struct
+{
+    const char *fname; // Index file to write, replaced once the new index is complete
+    PathList files;    // Files to index, in path order
+    int threads;       // Number of worker threads reading changed files
+} IndexBuild;
+
+/**
+ * Structure to hold the arguments of --query.
+ */
+typedef struct
+{
+    const char *expr;    // The query, for example "artist=foo AND year>=2010"
+    const char *fname;   // Index file to answer from
+    OutputFormat format; // Output format of the matching files
+} IndexQuery;
+
+// Function prototypes
+Status read_and_validate_index_build(int argc, char *argv[], IndexBuild *build);
+Status run_index_build(IndexBuild *build);
+void free_index_build(IndexBuild *build);
+Status read_and_validate_query(int argc, char *argv[], IndexQuery *query);
+Status run_query(const IndexQuery *query);
+Status open_library_index(const char *fname, LibraryIndex *index);
+void close_library_index(LibraryIndex *index);
+
+#endif // LIBRARY_INDEX_H
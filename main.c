@@ -1,6 +1,15 @@
 #include "type.h"
 #include "view.h"
 #include "mp3_edit.h"
+#include "batch.h"
+#include "manifest.h"
+#include "tag_cache.h"
+#include "art.h"
+#include "serve.h"
+#include "audio_info.h"
+#include "library_index.h"
+#include "stats.h"
+#include "watch.h"
 /**
  * Function: main
  * Description: Entry point of the MP3 editing/viewing program. 
@@ -15,25 +24,43 @@ int main(int argc, char *argv[])
     Music music;
     Mp3EditInfo mp3Edit;
 
+    // --stats and --stats-json apply to every operation and are removed from the arguments
+    read_stats_options(&argc, argv);
+
     // Check if command-line arguments are provided
     if (argc > 1)
     {
         // Check the operation type based on the first argument
         OperationType operation = check_operation_type(argv[1]);
 
-        if (operation == edit)
+        if (operation == edit && is_manifest_edit(argc, argv))
+        {
+            // Batch edit: one row per file, applied on a pool of worker threads
+            Manifest manifest;
+            if (read_and_validate_manifest(argc, argv, &manifest) == failure)
+            {
+                printf("ERROR: Invalid manifest arguments.\n");
+                return failure;
+            }
+            if (run_manifest(&manifest) == failure)
+            {
+                return failure;
+            }
+        }
+        else if (operation == edit)
         {
             // If operation is to edit, check if enough arguments are provided
             if (argc >= 5)
             {
                 // Read and validate the edit information from command-line arguments
-                if (read_and_validate_edit(argv, &mp3Edit) == success)
+                if (read_and_validate_edit(argc, argv, &mp3Edit) == success)
                 {
                     // Edit the mp3 file's information based on user input
                     edit_info(&mp3Edit);
                 }
                 else
                 {
+                    printf("ERROR: ./a.out : %s\n", mp3Edit.error);
                     printf("ERROR: Invalid edit arguments.\n");
                 }
             }
@@ -41,12 +68,24 @@ int main(int argc, char *argv[])
             {
                 // Print message if insufficient arguments for edit operation
                 printf("ERROR: Insufficient arguments for edit operation.\n");
-                printf("USAGE: ./a.out -e -t/-a/-A/-m/-y/-c <newname> <mp3filename>\n");
+                printf("USAGE: ./a.out -e [-t/-a/-A/-m/-y/-c <newname>]... [-f <FRAME> <text>]... [-d <FRAME>]... [--set-art <image>] [-p <padding>] <mp3filename>\n");
             }
         }
+        else if (operation == view && is_batch_view(argc, argv))
+        {
+            // Several files or directories, view them on a pool of worker threads
+            BatchView batch;
+            if (read_and_validate_batch(argc, argv, &batch, NULL) == failure)
+            {
+                printf("ERROR: Invalid view arguments.\n");
+                return failure;
+            }
+            run_batch_view(&batch);
+        }
         else if (operation == view)
         {
             // If operation is to view, validate the mp3 file input
+            init_music(&music);
             if (read_and_validate(argc, argv, &music) == failure)
             {
                 printf("ERROR: Failed to validate MP3 file.\n");
@@ -54,6 +93,104 @@ int main(int argc, char *argv[])
             }
             // View the mp3 file's information
             viewInfo(&music);
+            free_music(&music);
+        }
+        else if (operation == compact)
+        {
+            // Drop stale and superseded records from a tag cache file
+            if (argc != 3)
+            {
+                printf("ERROR: Invalid cache arguments.\n");
+                printf("USAGE: ./a.out --cache-compact <cachefile>\n");
+                return failure;
+            }
+            if (compact_tag_cache(argv[2]) == failure)
+            {
+                return failure;
+            }
+        }
+        else if (operation == extract)
+        {
+            // Write the picture of the APIC frame to a file
+            if (argc != 4)
+            {
+                printf("ERROR: Invalid cover art arguments.\n");
+                printf("USAGE: ./a.out --extract-art <imagefile|-> <mp3filename>\n");
+                return failure;
+            }
+            if (extract_art(argv[3], argv[2]) == failure)
+            {
+                return failure;
+            }
+        }
+        else if (operation == audio)
+        {
+            // Duration and bitrate from the MPEG frames, on a pool of worker threads
+            AudioBatch batch;
+            if (read_and_validate_audio(argc, argv, &batch) == failure)
+            {
+                printf("USAGE: ./a.out --audio-info [-j threads] [--scan full|sample[:windows]] [--format=text|ndjson] <mp3file/directory>...\n");
+                return failure;
+            }
+            run_audio_info(&batch);
+        }
+        else if (operation == index_build)
+        {
+            // Write or update the tag index, reading only new and changed files
+            IndexBuild build;
+            if (read_and_validate_index_build(argc, argv, &build) == failure)
+            {
+                printf("USAGE: ./a.out --index-build [-j threads] <mp3file/directory>... <indexfile>\n");
+                return failure;
+            }
+            if (run_index_build(&build) == failure)
+            {
+                return failure;
+            }
+        }
+        else if (operation == query)
+        {
+            // Answer a query from the tag index without opening the mp3 files
+            IndexQuery query;
+            if (read_and_validate_query(argc, argv, &query) == failure)
+            {
+                printf("USAGE: ./a.out --query '<field>=<words> AND year>=<year>' [--format=text|ndjson|bin] <indexfile>\n");
+                return failure;
+            }
+            if (run_query(&query) == failure)
+            {
+                return failure;
+            }
+        }
+        else if (operation == watch)
+        {
+            // Print the tags of added, changed and removed files until stopped
+            Watcher watcher;
+            if (read_and_validate_watch(argc, argv, &watcher) == failure)
+            {
+                printf("USAGE: ./a.out --watch [--debounce ms] [--fields ID,ID,...] <directory>...\n");
+                return failure;
+            }
+            Status status = run_watch(&watcher);
+            free_watch(&watcher);
+            if (status == failure)
+            {
+                return failure;
+            }
+        }
+        else if (operation == serve)
+        {
+            // Answer view and edit requests over a Unix socket until stopped
+            Server server;
+            if (read_and_validate_serve(argc, argv, &server) == failure)
+            {
+                printf("USAGE: ./a.out --serve <socketpath> [-j threads]\n");
+                return failure;
+            }
+            if (run_server(&server) == failure)
+            {
+                return failure;
+            }
         }
         else if (operation == help)
         {
@@ -70,8 +207,18 @@ int main(int argc, char *argv[])
         // Print error message and usage instructions if no arguments are provided
         printf("ERROR: Invalid arguments.\n");
         printf("USAGE:\n");
-        printf("To view: ./a.out -v <mp3filename>\n");
-        printf("To edit: ./a.out -e -t/-a/-A/-m/-y/-c <newname> <mp3filename>\n");
+        printf("To view: ./a.out -v [--fields ID,ID,...] [--format=text|ndjson|bin] [--hash] <mp3filename>\n");
+        printf("To view many: ./a.out -v [-j threads] [--io uring|threads] [--cache cachefile] [--fields ID,ID,...] [--format=text|ndjson|bin] [--hash] <mp3file/directory>...\n");
+        printf("To edit: ./a.out -e [-t/-a/-A/-m/-y/-c <newname>]... <mp3filename>\n");
+        printf("To edit many: ./a.out -e --manifest <edits.tsv/edits.csv> [-j threads] [-p padding]\n");
+        printf("To compact a cache: ./a.out --cache-compact <cachefile>\n");
+        printf("To save the cover art: ./a.out --extract-art <imagefile|-> <mp3filename>\n");
+        printf("To get the duration and bitrate: ./a.out --audio-info [-j threads] [--scan full|sample[:windows]] [--format=text|ndjson] <mp3file/directory>...\n");
+        printf("To serve requests: ./a.out --serve <socketpath> [-j threads]\n");
+        printf("To index a library: ./a.out --index-build [-j threads] <mp3file/directory>... <indexfile>\n");
+        printf("To search the index: ./a.out --query '<field>=<words> AND year>=<year>' [--format=text|ndjson|bin] <indexfile>\n");
+        printf("To follow tag changes: ./a.out --watch [--debounce ms] [--fields ID,ID,...] <directory>...\n");
+        printf("To time any of these: add --stats and/or --stats-json <file>\n");
         printf("To get help: ./a.out --help\n");
     }
 
@@ -82,7 +229,7 @@ int main(int argc, char *argv[])
  * Function: check_operation_type
  * Description: Determines the type of operation (view, edit, help) based on the command-line argument.
  * Input: argv - Command-line argument (string) that indicates the operation type.
- * Output: Returns the corresponding OperationType (view, edit, help), or failure if no match is found.
+ * Output: Returns the corresponding OperationType (view, edit, help, compact, extract, serve, audio, index_build, query, watch), or failure if no match is found.
  */
 OperationType check_operation_type(char *argv)
 {
@@ -98,5 +245,33 @@ OperationType check_operation_type(char *argv)
     {
         return help; // Operation to display help message
     }
+    else if (strcmp(argv, "--cache-compact") == 0)
+    {
+        return compact; // Operation to compact a tag cache file
+    }
+    else if (strcmp(argv, "--extract-art") == 0)
+    {
+        return extract; // Operation to write the cover art to a file
+    }
+    else if (strcmp(argv, "--serve") == 0)
+    {
+        return serve; // Operation to answer requests over a Unix socket
+    }
+    else if (strcmp(argv, "--audio-info") == 0)
+    {
+        return audio; // Operation to print the duration and bitrate of the audio
+    }
+    else if (strcmp(argv, "--index-build") == 0)
+    {
+        return index_build; // Operation to build or update a tag index
+    }
+    else if (strcmp(argv, "--query") == 0)
+    {
+        return query; // Operation to search a tag index
+    }
+    else if (strcmp(argv, "--watch") == 0)
+    {
+        return watch; // Operation to follow tag changes in a library
+    }
     return failure; // Return failure if no recognized operation is found
 }
@@ -0,0 +1,457 @@
+#include <errno.h>
+#include <unistd.h>
+#include "type.h"
+#include "mp3_edit.h"
+#include "batch.h"
+#include "manifest.h"
+
+/**
+ * Function: is_manifest_edit
+ * Description: Checks if an -e command line asks for a batch edit from a manifest file.
+ * Input: argc - number of command-line arguments, argv - array of arguments.
+ * Output: Returns 1 if --manifest is given, 0 otherwise.
+ */
+int is_manifest_edit(int argc, char *argv[])
+{
+    return argc >= 4 && strcmp(argv[2], "--manifest") == 0;
+}
+
+/**
+ * Function: read_and_validate_manifest
+ * Description: Reads the manifest file name and the -j and -p options, then loads the manifest.
+ *              Files ending in ".csv" are comma separated, everything else is tab separated.
+ * Input: argc - number of command-line arguments, argv - array of arguments, manifest - pointer to the Manifest struct.
+ * Output: Returns success if the manifest was loaded, or failure if the arguments or the file are invalid.
+ */
+Status read_and_validate_manifest(int argc, char *argv[], Manifest *manifest)
+{
+    const char *fname = argv[3];
+    const char *extn = strrchr(fname, '.');
+
+    manifest->rows = NULL;
+    manifest->count = 0;
+    manifest->capacity = 0;
+    manifest->delimiter = (extn != NULL && strcmp(extn, ".csv") == 0) ? ',' : '\t';
+    manifest->threads = default_threads();
+    manifest->padding = EDIT_PADDING;
+
+    for (int i = 4; i < argc; i += 2)
+    {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            if (read_threads_option(value, &manifest->threads, NULL) == failure)
+            {
+                return failure;
+            }
+        }
+        else if (strcmp(argv[i], "-p") == 0)
+        {
+            char *end;
+            long padding = value ? strtol(value, &end, 10) : -1;
+            if (padding < 0 || padding > MAX_PADDING || *end != '\0')
+            {
+                fprintf(stderr, "ERROR: padding must be between 0 and %d\n", MAX_PADDING);
+                return failure;
+            }
+            manifest->padding = (uint32_t)padding;
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Unknown option %s\n", argv[i]);
+            return failure;
+        }
+    }
+    return load_manifest(fname, manifest);
+}
+
+/**
+ * Function: split_manifest_row
+ * Description: Splits a row in place into null separated fields. In CSV rows a field may be
+ *              wrapped in double quotes, with "" standing for one quote character.
+ * Input: line - the row text without its newline, delimiter - ',' or '\t'.
+ * Output: Returns the number of fields.
+ */
+int split_manifest_row(char *line, char delimiter)
+{
+    char *src = line;
+    char *dest = line;
+    int count = 1;
+
+    while (*src != '\0')
+    {
+        if (delimiter == ',' && *src == '"')
+        {
+            // Copy a quoted section up to the closing quote
+            src++;
+            while (*src != '\0')
+            {
+                if (src[0] == '"' && src[1] == '"')
+                {
+                    *dest++ = '"';
+                    src += 2;
+                }
+                else if (src[0] == '"')
+                {
+                    src++;
+                    break;
+                }
+                else
+                {
+                    *dest++ = *src++;
+                }
+            }
+        }
+        else if (*src == delimiter)
+        {
+            *dest++ = '\0';
+            src++;
+            count++;
+        }
+        else
+        {
+            *dest++ = *src++;
+        }
+    }
+    *dest = '\0';
+    return count;
+}
+
+/**
+ * Function: same_file
+ * Description: Checks if two rows name the same file. Rows whose path could be stat'ed are
+ *              compared by device and inode, so "f.mp3", "./f.mp3" and hard links match; the
+ *              others by path.
+ * Input: row_a, row_b - the two rows.
+ * Output: Returns <0, 0 or >0, 0 if both rows name the same file.
+ */
+static int same_file(const ManifestRow *row_a, const ManifestRow *row_b)
+{
+    if (row_a->found != row_b->found)
+    {
+        return row_a->found ? -1 : 1;
+    }
+    if (!row_a->found)
+    {
+        return strcmp(row_a->line, row_b->line);
+    }
+    if (row_a->dev != row_b->dev)
+    {
+        return row_a->dev < row_b->dev ? -1 : 1;
+    }
+    if (row_a->ino != row_b->ino)
+    {
+        return row_a->ino < row_b->ino ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Function: compare_rows
+ * Description: qsort comparator ordering row pointers by file, then by line number.
+ * Input: a, b - pointers to the two ManifestRow pointers to compare.
+ * Output: Returns <0, 0 or >0.
+ */
+static int compare_rows(const void *a, const void *b)
+{
+    const ManifestRow *row_a = *(const ManifestRow *const *)a;
+    const ManifestRow *row_b = *(const ManifestRow *const *)b;
+    int order = same_file(row_a, row_b);
+    if (order != 0)
+    {
+        return order;
+    }
+    return row_a->number < row_b->number ? -1 : 1;
+}
+
+/**
+ * Function: is_header_row
+ * Description: Checks if a split row is a header such as "path,title,artist": none of the fields
+ *              after the path has the FRAME=value form, so the row could never be an edit.
+ * Input: row - the row split by split_manifest_row.
+ * Output: Returns 1 if the row is a header, 0 otherwise.
+ */
+static int is_header_row(const ManifestRow *row)
+{
+    const char *field = row->line;
+
+    for (int i = 1; i < row->field_count; i++)
+    {
+        field += strlen(field) + 1;
+        if (strchr(field, '=') != NULL)
+        {
+            return 0;
+        }
+    }
+    return row->field_count > 1;
+}
+
+/**
+ * Function: load_manifest
+ * Description: Reads every row of the manifest. Empty lines and lines starting with '#' are
+ *              skipped, and so is a header on the first row. A file that appears on more than
+ *              one row, under any path, is only edited by its first row, since two workers must
+ *              never rewrite the same file at the same time.
+ * Input: fname - the manifest file name, manifest - pointer to the Manifest struct to fill.
+ * Output: Returns success if at least one row was read, or failure if the file cannot be read
+ *         or memory is exhausted.
+ */
+Status load_manifest(const char *fname, Manifest *manifest)
+{
+    FILE *fptr = fopen(fname, "r");
+    if (fptr == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to open manifest %s: %s\n", fname, strerror(errno));
+        return failure;
+    }
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    size_t number = 0;
+    Status status = success;
+    while ((length = getline(&line, &line_capacity, fptr)) >= 0)
+    {
+        number++;
+        // Strip the line ending, including a CR from files written on Windows
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+        {
+            line[--length] = '\0';
+        }
+        if (length == 0 || line[0] == '#')
+        {
+            continue;
+        }
+
+        if (manifest->count == manifest->capacity)
+        {
+            size_t capacity = manifest->capacity ? manifest->capacity * 2 : 64;
+            ManifestRow *rows = realloc(manifest->rows, capacity * sizeof(ManifestRow));
+            if (rows == NULL)
+            {
+                fprintf(stderr, "ERROR: Failed to allocate manifest.\n");
+                status = failure;
+                break;
+            }
+            manifest->rows = rows;
+            manifest->capacity = capacity;
+        }
+        ManifestRow *row = &manifest->rows[manifest->count];
+        row->line = strdup(line);
+        if (row->line == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to allocate manifest.\n");
+            status = failure;
+            break;
+        }
+        row->field_count = split_manifest_row(row->line, manifest->delimiter);
+        row->number = number;
+        row->error = NULL;
+        if (manifest->count == 0 && is_header_row(row))
+        {
+            free(row->line);
+            continue;
+        }
+
+        // Rows are matched by file, not by how the path is spelled
+        struct stat st;
+        row->found = stat(row->line, &st) == 0;
+        row->dev = row->found ? st.st_dev : 0;
+        row->ino = row->found ? st.st_ino : 0;
+        manifest->count++;
+    }
+    free(line);
+    fclose(fptr);
+
+    // A manifest missing rows must not be applied in part
+    if (status == failure)
+    {
+        free_manifest(manifest);
+        return failure;
+    }
+    if (manifest->count == 0)
+    {
+        fprintf(stderr, "ERROR: No rows in manifest %s\n", fname);
+        free_manifest(manifest);
+        return failure;
+    }
+
+    // Sort row pointers by file to find files listed more than once
+    ManifestRow **sorted = malloc(manifest->count * sizeof(ManifestRow *));
+    if (sorted == NULL)
+    {
+        free_manifest(manifest);
+        return failure;
+    }
+    for (size_t i = 0; i < manifest->count; i++)
+    {
+        sorted[i] = &manifest->rows[i];
+    }
+    qsort(sorted, manifest->count, sizeof(ManifestRow *), compare_rows);
+    for (size_t i = 1; i < manifest->count; i++)
+    {
+        if (same_file(sorted[i], sorted[i - 1]) == 0)
+        {
+            sorted[i]->error = "File already listed on an earlier row";
+        }
+    }
+    free(sorted);
+    return success;
+}
+
+/**
+ * Function: apply_manifest_row
+ * Description: Turns the FRAME=value fields of a row into edit requests and applies them to the
+ *              file with one edit_info call. An empty value deletes the frame.
+ * Input: manifest - pointer to the Manifest struct, row - the row to apply, mp3Edit - edit state owned by the calling thread.
+ * Output: Sets row->error if the row fails.
+ */
+static void apply_manifest_row(Manifest *manifest, ManifestRow *row, Mp3EditInfo *mp3Edit)
+{
+    mp3Edit->src_fname = row->line;
+    mp3Edit->out_fname[0] = '\0';
+    mp3Edit->padding = manifest->padding;
+    mp3Edit->edit_count = 0;
+    mp3Edit->art_fname = NULL;
+    mp3Edit->allocator = NULL;
+    mp3Edit->quiet = 1;
+
+    // The fields follow the path, each one null terminated
+    char *field = row->line + strlen(row->line) + 1;
+    char *next;
+    for (int i = 1; i < row->field_count; i++, field = next)
+    {
+        next = field + strlen(field) + 1;
+        if (*field == '\0')
+        {
+            continue;
+        }
+        char *value = strchr(field, '=');
+        if (value == NULL || value - field != 4)
+        {
+            row->error = "Fields must look like FRAME=value";
+            return;
+        }
+        *value++ = '\0';
+        if (!is_valid_frame_id(field) || (*value != '\0' && !is_text_frame_id(field)))
+        {
+            row->error = "Invalid frame ID";
+            return;
+        }
+        if (add_edit_request(mp3Edit, field, field, *value != '\0' ? value : NULL) == failure)
+        {
+            row->error = "Too many frames on one row";
+            return;
+        }
+    }
+
+    if (mp3Edit->edit_count == 0)
+    {
+        row->error = "Nothing to edit";
+        return;
+    }
+    if (edit_info(mp3Edit) == failure)
+    {
+        row->error = mp3Edit->error ? mp3Edit->error : "Edit failed";
+    }
+}
+
+/**
+ * Function: manifest_worker
+ * Description: Worker thread of the batch editor. Takes rows until none are left and applies each
+ *              one; every file is committed on its own, with its own temp file.
+ * Input: arg - pointer to the shared Manifest struct.
+ * Output: Returns NULL when no rows are left.
+ */
+static void *manifest_worker(void *arg)
+{
+    Manifest *manifest = arg;
+    Mp3EditInfo *mp3Edit = malloc(sizeof(Mp3EditInfo));
+
+    for (;;)
+    {
+        pthread_mutex_lock(&manifest->lock);
+        size_t job = manifest->next;
+        if (job < manifest->count)
+        {
+            manifest->next++;
+        }
+        pthread_mutex_unlock(&manifest->lock);
+        if (job >= manifest->count)
+        {
+            break;
+        }
+
+        ManifestRow *row = &manifest->rows[job];
+        if (row->error != NULL)
+        {
+            continue;
+        }
+        if (mp3Edit == NULL)
+        {
+            row->error = "Out of memory";
+            continue;
+        }
+        apply_manifest_row(manifest, row, mp3Edit);
+    }
+    free(mp3Edit);
+    return NULL;
+}
+
+/**
+ * Function: run_manifest
+ * Description: Applies every row of the manifest on a pool of worker threads, then prints a
+ *              report line for every row and a summary.
+ * Input: manifest - pointer to the Manifest struct filled by read_and_validate_manifest.
+ * Output: Returns success if every row was applied, or failure if any row failed.
+ */
+Status run_manifest(Manifest *manifest)
+{
+    size_t failed = 0;
+
+    manifest->next = 0;
+    pthread_mutex_init(&manifest->lock, NULL);
+    Status status = run_workers(manifest->threads, manifest->count, manifest_worker, manifest);
+    pthread_mutex_destroy(&manifest->lock);
+
+    // Report in manifest order
+    for (size_t i = 0; i < manifest->count; i++)
+    {
+        ManifestRow *row = &manifest->rows[i];
+        if (status == failure && row->error == NULL)
+        {
+            row->error = "Not run";
+        }
+        if (row->error == NULL)
+        {
+            printf("OK      %s\n", row->line);
+        }
+        else
+        {
+            printf("FAILED  %s : line %zu : %s\n", row->line, row->number, row->error);
+            failed++;
+        }
+    }
+    printf("----------%zu FILES EDITED, %zu FAILED----------\n", manifest->count - failed, failed);
+
+    free_manifest(manifest);
+    return failed == 0 ? success : failure;
+}
+
+/**
+ * Function: free_manifest
+ * Description: Releases every row and the row array.
+ * Input: manifest - pointer to the Manifest struct.
+ * Output: The manifest is emptied.
+ */
+void free_manifest(Manifest *manifest)
+{
+    for (size_t i = 0; i < manifest->count; i++)
+    {
+        free(manifest->rows[i].line);
+    }
+    free(manifest->rows);
+    manifest->rows = NULL;
+    manifest->count = 0;
+    manifest->capacity = 0;
+}
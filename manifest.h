@@ -0,0 +1,46 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include "type.h"
+
+/**
+ * Structure to hold one row of an edit manifest.
+ */
+typedef struct
+{
+    char *line;        // Row text split in place into null separated fields, the first is the path
+    int field_count;   // Number of fields in line
+    size_t number;     // Line number in the manifest, for the report
+    const char *error; // Reason the row failed, NULL if it was applied
+    int found;         // Set if the path could be stat'ed, dev and ino are valid
+    dev_t dev;         // Device of the file, links and spellings of one file share it
+    ino_t ino;         // Inode of the file
+} ManifestRow;
+
+/**
+ * Structure to hold a batch edit read from a CSV or TSV manifest.
+ */
+typedef struct
+{
+    ManifestRow *rows;    // Rows in manifest order
+    size_t count;         // Number of rows
+    size_t capacity;      // Allocated size of rows
+    char delimiter;       // ',' for CSV, '\t' for TSV
+    int threads;          // Number of worker threads
+    uint32_t padding;     // Padding added when a tag has to grow
+
+    size_t next;          // Next row to hand out to a worker
+    pthread_mutex_t lock; // Protects next
+} Manifest;
+
+// Function prototypes
+int is_manifest_edit(int argc, char *argv[]);
+Status read_and_validate_manifest(int argc, char *argv[], Manifest *manifest);
+Status load_manifest(const char *fname, Manifest *manifest);
+int split_manifest_row(char *line, char delimiter);
+Status run_manifest(Manifest *manifest);
+void free_manifest(Manifest *manifest);
+
+#endif // MANIFEST_H
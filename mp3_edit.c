@@ -1,418 +1,1068 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include "type.h"
 #include "view.h"
 #include "mp3_edit.h"
+#include "stats.h"
+#include "text_decode.h"
+
+/**
+ * Function: edit_usage_error
+ * Description: Records why the edit arguments were refused.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct, format - printf style format of the reason.
+ * Output: Returns failure, with the reason in mp3Edit->error.
+ */
+static Status edit_usage_error(Mp3EditInfo *mp3Edit, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(mp3Edit->error_text, sizeof(mp3Edit->error_text), format, args);
+    va_end(args);
+    mp3Edit->error = mp3Edit->error_text;
+    return failure;
+}
 
 /**
  * Function: read_and_validate_edit
- * Description: Validates the command-line arguments for editing MP3 metadata.
- * Input: argv - the array of arguments, mp3Edit - pointer to the Mp3EditInfo struct.
+ * Description: Validates the command-line arguments for editing MP3 metadata. Any number of
+ *              field options with their new text may be given, followed by the mp3 file name.
+ *              Nothing is printed; the reason of a failure is left in mp3Edit->error.
+ * Input: argc - the number of arguments, argv - the array of arguments, mp3Edit - pointer to the Mp3EditInfo struct.
  * Output: Returns success if the arguments are valid, or failure if any validation check fails.
  */
-Status read_and_validate_edit(char *argv[], Mp3EditInfo *mp3Edit)
+Status read_and_validate_edit(int argc, char *argv[], Mp3EditInfo *mp3Edit)
 {
-    char extn[10];
-    // Check if filename contains extension or not
-    if (strchr(argv[4], '.') == NULL)
+    char *extn = strrchr(argv[argc - 1], '.');
+    mp3Edit->error = NULL;
+    // Check if filename contains extension and extn is mp3 or not
+    if (extn == NULL || strcmp(extn, ".mp3") != 0)
     {
-        printf("-------------------------------------------------------------------------------\n\n");
-        printf("ERROR: ./a.out : INVALID EXTENSION\n");
-        printf("-------------------------------------------------------------------------------\n");
-        return failure;
+        return edit_usage_error(mp3Edit, "%s : INVALID EXTENSION", argv[argc - 1]);
     }
-    // Copy extn and check extn is mp3 or not
-    strcpy(extn, strchr(argv[4], '.'));
-    if (strcmp(extn, ".mp3") != 0)
+    // Copy filename to structure member
+    mp3Edit->src_fname = argv[argc - 1];
+    // Output filename is created next to the source only if the tag has to grow
+    mp3Edit->out_fname[0] = '\0';
+    // Padding to leave for later edits if the tag has to grow
+    mp3Edit->padding = EDIT_PADDING;
+    mp3Edit->edit_count = 0;
+    // Cover art is only changed by --set-art
+    mp3Edit->art_fname = NULL;
+    mp3Edit->allocator = NULL;
+    // Print the progress of the edit
+    mp3Edit->quiet = 0;
+
+    // Every option between -e and the filename takes one value, -f takes two
+    for (int i = 2; i < argc - 1; i += 2)
     {
-        printf("-------------------------------------------------------------------------------\n\n");
-        printf("ERROR: ./a.out : INVALID EXTENSION\n");
-        printf("-------------------------------------------------------------------------------\n");
-        return failure;
+        if (i + 1 >= argc - 1)
+        {
+            return edit_usage_error(mp3Edit, "%s needs a value", argv[i]);
+        }
+        // Padding to add when the tag has to grow
+        if (strcmp(argv[i], "-p") == 0)
+        {
+            char *end;
+            long padding = strtol(argv[i + 1], &end, 10);
+            if (padding < 0 || padding > MAX_PADDING || *end != '\0')
+            {
+                return edit_usage_error(mp3Edit, "padding must be between 0 and %d", MAX_PADDING);
+            }
+            mp3Edit->padding = (uint32_t)padding;
+            continue;
+        }
+        // Set any text frame or COMM by its frame ID
+        if (strcmp(argv[i], "-f") == 0)
+        {
+            char *frame_id = argv[i + 1];
+            if (i + 2 >= argc - 1 || !is_text_frame_id(frame_id))
+            {
+                return edit_usage_error(mp3Edit, "-f needs a text frame ID (T***, COMM) and a value");
+            }
+            if (add_edit_request(mp3Edit, frame_id, frame_id, argv[i + 2]) == failure)
+            {
+                return edit_usage_error(mp3Edit, "At most %d frames can be changed at once", MAX_EDITS);
+            }
+            i++;
+            continue;
+        }
+        // Replace the cover art with an image file
+        if (strcmp(argv[i], "--set-art") == 0)
+        {
+            mp3Edit->art_fname = argv[i + 1];
+            continue;
+        }
+        // Delete every frame with this frame ID
+        if (strcmp(argv[i], "-d") == 0)
+        {
+            if (!is_valid_frame_id(argv[i + 1]))
+            {
+                return edit_usage_error(mp3Edit, "-d needs a 4 character frame ID");
+            }
+            if (add_edit_request(mp3Edit, argv[i + 1], argv[i + 1], NULL) == failure)
+            {
+                return edit_usage_error(mp3Edit, "At most %d frames can be changed at once", MAX_EDITS);
+            }
+            continue;
+        }
+        // Validate edit mode option entered by user
+        const EditField *field = find_edit_field(argv[i]);
+        if (field == NULL)
+        {
+            return edit_usage_error(mp3Edit, "%s : INVALID ARGUMENTS, to edit pass -e [-t/-a/-A/-m/-y/-c changing_text]... mp3filename", argv[i]);
+        }
+        if (add_edit_request(mp3Edit, field->frame_id, field->label, argv[i + 1]) == failure)
+        {
+            return edit_usage_error(mp3Edit, "At most %d frames can be changed at once", MAX_EDITS);
+        }
     }
-    // Copy filename to structure member
-    mp3Edit->src_fname = argv[4];
-    // Initialize output filename
-    strcpy(mp3Edit->out_fname, "temp.mp3");
-    // Validate edit mode option entered by user
-    if (strcmp(argv[2], "-t") != 0 && strcmp(argv[2], "-a") != 0 && strcmp(argv[2], "-A") != 0 && strcmp(argv[2], "-m") != 0 && strcmp(argv[2], "-y") != 0 && strcmp(argv[2], "-c") != 0)
-    {
-        printf("-------------------------------------------------------------------------------\n\n");
-        printf("ERROR: ./a.out : INVALID ARGUMENTS\n");
-        printf("USAGE :\nTo edit please pass like: ./a.out -e -t/-a/-A/-m/-y/-c changing_text mp3filename\n");
-        printf("-------------------------------------------------------------------------------\n");
-        return failure;
+
+    if (mp3Edit->edit_count == 0 && mp3Edit->art_fname == NULL)
+    {
+        return edit_usage_error(mp3Edit, "Nothing to edit");
     }
-    // Copy user entered edit option
-    mp3Edit->frame = argv[2];
-    // Copy new data to be modified
-    mp3Edit->modify_data = argv[3];
-    // Store the length of new data
-    mp3Edit->data_length = strlen(mp3Edit->modify_data) + 1;
     return success;
 }
 
+/**
+ * Function: edit_error
+ * Description: Records the system error of a failed call as the detail of the edit failure.
+ *              Nothing is printed, edit_failed reports it.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct, what - the call or file that failed.
+ * Output: Always returns failure.
+ */
+static Status edit_error(Mp3EditInfo *mp3Edit, const char *what)
+{
+    snprintf(mp3Edit->error_text, sizeof(mp3Edit->error_text), "%s: %s", what, strerror(errno));
+    mp3Edit->error = mp3Edit->error_text;
+    return failure;
+}
+
+/**
+ * Function: edit_failed
+ * Description: Records why an edit failed, followed by the detail recorded by the step that
+ *              failed if there is one, and prints it unless the edit is quiet. Batch edits and
+ *              the library only report it through mp3Edit->error.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct, message - the reason.
+ * Output: Always returns failure.
+ */
+static Status edit_failed(Mp3EditInfo *mp3Edit, const char *message)
+{
+    if (mp3Edit->error != NULL)
+    {
+        // The detail may already be in error_text, move it behind the message
+        size_t prefix = strlen(message) + 2;
+        size_t length = strlen(mp3Edit->error);
+        if (prefix + length >= sizeof(mp3Edit->error_text))
+        {
+            length = sizeof(mp3Edit->error_text) - prefix - 1;
+        }
+        memmove(mp3Edit->error_text + prefix, mp3Edit->error, length);
+        mp3Edit->error_text[prefix + length] = '\0';
+        memcpy(mp3Edit->error_text, message, prefix - 2);
+        memcpy(mp3Edit->error_text + prefix - 2, ": ", 2);
+        message = mp3Edit->error_text;
+    }
+    mp3Edit->error = message;
+    if (!mp3Edit->quiet)
+    {
+        printf("%s\n", message);
+    }
+    return failure;
+}
+
 /**
  * Function: edit_info
- * Description: Edits the MP3 file's metadata based on user input.
+ * Description: Edits the MP3 file's metadata based on user input. All requested fields are planned
+ *              as pieces of the new tag and written once. Tags larger than EDIT_MEMORY_LIMIT are not
+ *              loaded: only their frame headers are read and the kept frames are copied from the
+ *              file. If the frames fit inside the existing tag and its padding, and no kept frame
+ *              read from the file has to move, only the tag is rewritten in place; otherwise the
+ *              whole file is rewritten.
  * Input: mp3Edit - pointer to the Mp3EditInfo struct.
  * Output: Returns success if the metadata is edited successfully, or failure if any error occurs.
  */
 Status edit_info(Mp3EditInfo *mp3Edit)
 {
-    // Open source and duplicate files
-    if (open_files(mp3Edit) == failure)
+    uint32_t length = 0;
+    uint32_t art_length = 0;
+    Status status;
+
+    mp3Edit->error = NULL;
+
+    // Open source file
+    uint64_t start = stats_begin();
+    status = open_files(mp3Edit);
+    stats_end(phase_open, start);
+    if (status == failure)
     {
-        printf("Error in opening files\n");
-        return failure;
+        return edit_failed(mp3Edit, "Error in opening files");
     }
-    // Check for file is ID3 format or not
-    if (check_ID3(mp3Edit) == failure)
+    // Index the frames, loading the tag only if it is small, and check for file is ID3 format and version is valid.
+    // A damaged tag is read only up to the damage, rewriting it would drop the frames behind it
+    if (read_frame_index(mp3Edit->fd_src, &mp3Edit->tag, EDIT_MEMORY_LIMIT, EDIT_HEAD_SIZE, &mp3Edit->index) == failure ||
+        checkheaderandversion(&mp3Edit->tag) == failure || mp3Edit->tag.error != NULL)
     {
-        printf("Invalid Mp3 ID format\n");
-        return failure;
+        mp3Edit->error = mp3Edit->tag.error;
+        close_files(mp3Edit);
+        return edit_failed(mp3Edit, "Invalid Mp3 ID format");
     }
-    // Check mp3file version is valid
-    if (check_mp3version(mp3Edit) == failure)
+    // Frames are written in the v2.3 layout, other versions can be viewed but not edited
+    if (mp3Edit->tag.version != 3)
     {
-        printf("Invalid ID3 version\n");
-        return failure;
+        close_files(mp3Edit);
+        return edit_failed(mp3Edit, "Only ID3v2.3 tags can be edited");
     }
-    // Copy header data to duplicate file
-    if (copy_header(mp3Edit->fptr_out, mp3Edit->fptr_src) == failure)
+    // Only the first bytes of the new cover art are read here, the image is copied into the tag later
+    if (mp3Edit->art_fname != NULL)
     {
-        printf("Error in copying header\n");
-        return failure;
+        if (open_art(mp3Edit->art_fname, &mp3Edit->art) == failure)
+        {
+            snprintf(mp3Edit->error_text, sizeof(mp3Edit->error_text), "%s: %s", mp3Edit->art_fname, mp3Edit->art.error);
+            mp3Edit->error = mp3Edit->error_text;
+            close_files(mp3Edit);
+            return edit_failed(mp3Edit, "Error in opening the cover art");
+        }
+        art_length = FRAME_HEADER_SIZE + art_frame_size(&mp3Edit->art);
     }
-    // Flag to indicate whether we need to continue or copying is completed
-    int flag = 0;
-    // Do check frame is TIT2 and whether user need to modify title
-    if (do_change(mp3Edit, "TIT2", "-t", &flag) == failure || (flag))
+
+    for (int i = 0; i < mp3Edit->edit_count && !mp3Edit->quiet; i++)
     {
-        // Modification completed if flag is set , No need to continue
-        if (flag)
+        const EditRequest *edit = &mp3Edit->edits[i];
+        if (edit->value == NULL)
         {
-            printf("----------CHANGE THE TITLE-------------\n\n");
-            printf("TITLE   : %s\n\n", mp3Edit->modify_data);
-            fclose(mp3Edit->fptr_src);
-            fclose(mp3Edit->fptr_out);
-            file_copy(mp3Edit);
-            printf("----------TITLE CHANGED SUCCESSFULLY----------\n\n");
-            return success;
+            printf("----------DELETE THE %s-------------\n\n", edit->label);
+            continue;
         }
-        printf("Error\n");
-        return failure;
+        printf("----------CHANGE THE %s-------------\n\n", edit->label);
+        printf("%s   : %s\n\n", edit->label, edit->value);
+    }
+    if (mp3Edit->art_fname != NULL && !mp3Edit->quiet)
+    {
+        printf("----------CHANGE THE COVER ART-------------\n\n");
+        printf("COVER ART   : %s (%s, %lld bytes)\n\n", mp3Edit->art_fname, mp3Edit->art.mime, (long long)mp3Edit->art.size);
     }
-    // Do check frame is TPE1 and whether user need to modify artist
-    if (do_change(mp3Edit, "TPE1", "-a", &flag) == failure || (flag))
+
+    // Lay out every frame of the new tag
+    if (plan_pieces(mp3Edit, &length) == failure)
     {
-        // Modification completed if flag is set , No need to continue
-        if (flag)
+        close_files(mp3Edit);
+        return edit_failed(mp3Edit, "Error in allocating frames");
+    }
+    if ((uint64_t)length + art_length + mp3Edit->padding > MAX_TAG_SIZE)
+    {
+        close_files(mp3Edit);
+        return edit_failed(mp3Edit, "The new tag is too large");
+    }
+
+    // Rewrite only the tag when the frames fit and no kept frame has to move: in place the file is
+    // the only copy, so a frame that is moved and cut short by a crash would be lost. Otherwise
+    // write a new copy of the file
+    start = stats_begin();
+    if (length + art_length <= mp3Edit->tag.size - ID3_HEADER_SIZE && kept_frames_stay(mp3Edit))
+    {
+        status = write_tag_in_place(mp3Edit, length);
+    }
+    else
+    {
+        status = rewrite_file(mp3Edit, length);
+    }
+    stats_end(phase_write, start);
+    close_files(mp3Edit);
+
+    if (status == failure)
+    {
+        discard_file(mp3Edit);
+        return edit_failed(mp3Edit, "Error in writing the file");
+    }
+    // The rewritten copy atomically replaces the original
+    if (mp3Edit->fd_out >= 0)
+    {
+        start = stats_begin();
+        status = commit_file(mp3Edit);
+        stats_end(phase_commit, start);
+        if (status == failure)
         {
-            printf("----------CHANGE THE ARTIST-------------\n\n");
-            printf("ARTIST   : %s\n\n", mp3Edit->modify_data);
-            fclose(mp3Edit->fptr_src);
-            fclose(mp3Edit->fptr_out);
-            file_copy(mp3Edit);
-            printf("----------ARTIST CHANGED SUCCESSFULLY----------\n\n");
-            return success;
+            return edit_failed(mp3Edit, "Error in replacing the file");
         }
-        printf("Error\n");
-        return failure;
     }
-    // Do check frame is TALB and whether user need to modify album
-    if (do_change(mp3Edit, "TALB", "-A", &flag) == failure || (flag))
+    for (int i = 0; i < mp3Edit->edit_count && !mp3Edit->quiet; i++)
+    {
+        printf("----------%s %s SUCCESSFULLY----------\n\n", mp3Edit->edits[i].label,
+               mp3Edit->edits[i].value ? "CHANGED" : "DELETED");
+    }
+    if (mp3Edit->art_fname != NULL && !mp3Edit->quiet)
+    {
+        printf("----------COVER ART CHANGED SUCCESSFULLY----------\n\n");
+    }
+    return success;
+}
+
+/**
+ * Function: open_files
+ * Description: Opens the source MP3 file for reading and writing.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct.
+ * Output: Returns success if the file is opened successfully, or failure with the reason in
+ *         mp3Edit->error.
+ */
+Status open_files(Mp3EditInfo *mp3Edit)
+{
+    init_id3_tag(&mp3Edit->tag);
+    init_frame_index(&mp3Edit->index);
+    mp3Edit->tag.allocator = mp3Edit->allocator;
+    mp3Edit->index.allocator = mp3Edit->allocator;
+    mp3Edit->fd_out = -1;
+    mp3Edit->art.fd = -1;
+    mp3Edit->art_target = NULL;
+    mp3Edit->pieces = NULL;
+    mp3Edit->piece_count = 0;
+    mp3Edit->piece_capacity = 0;
+
+    // Open original mp3 file and validate whether its opened or not
+    mp3Edit->fd_src = open(mp3Edit->src_fname, O_RDWR);
+    stats_io(1, 0, 0);
+    if (mp3Edit->fd_src < 0)
+    {
+        return edit_error(mp3Edit, mp3Edit->src_fname);
+    }
+    return success;
+}
+
+/**
+ * Function: close_files
+ * Description: Closes the source MP3 file and the cover art, and releases the tag buffer, frame index and pieces.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct.
+ * Output: The source file is closed. The temp file, if any, is left for commit_file.
+ */
+void close_files(Mp3EditInfo *mp3Edit)
+{
+    free_frame_index(&mp3Edit->index);
+    free_id3_tag(&mp3Edit->tag);
+    mem_release(mp3Edit->allocator, mp3Edit->pieces, sizeof(TagPiece) * (size_t)mp3Edit->piece_capacity);
+    mp3Edit->pieces = NULL;
+    mp3Edit->piece_count = 0;
+    mp3Edit->piece_capacity = 0;
+    close_art(&mp3Edit->art);
+    if (mp3Edit->fd_src >= 0)
+    {
+        close(mp3Edit->fd_src);
+        stats_io(1, 0, 0);
+        mp3Edit->fd_src = -1;
+    }
+}
+
+/**
+ * Function: find_edit_field
+ * Description: Looks up the frame edited by a command-line option.
+ * Input: option - the edit option (e.g., "-t").
+ * Output: Returns the matching EditField, or NULL if the option is not known.
+ */
+const EditField *find_edit_field(const char *option)
+{
+    static const EditField fields[] = {
+        {"-t", "TIT2", "TITLE"},
+        {"-a", "TPE1", "ARTIST"},
+        {"-A", "TALB", "ALBUM"},
+        {"-y", "TYER", "YEAR"},
+        {"-m", "TCON", "CONTENT"},
+        {"-c", "COMM", "COMMENT"},
+    };
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
     {
-        // Modification completed if flag is set , No need to continue
-        if (flag)
+        if (strcmp(option, fields[i].option) == 0)
         {
-            printf("----------CHANGE THE ALBUM-------------\n\n");
-            printf("ALBUM   : %s\n\n", mp3Edit->modify_data);
-            fclose(mp3Edit->fptr_src);
-            fclose(mp3Edit->fptr_out);
-            file_copy(mp3Edit);
-            printf("----------ALBUM CHANGED SUCCESSFULLY----------\n\n");
-            return success;
+            return &fields[i];
         }
-        printf("Error\n");
-        return failure;
     }
-    // Do check frame is TYER and whether user need to modify year
-    if (do_change(mp3Edit, "TYER", "-y", &flag) == failure || (flag))
+    return NULL;
+}
+
+/**
+ * Function: is_valid_frame_id
+ * Description: Checks that a string is a 4 character frame ID made of A-Z and 0-9.
+ * Input: frame_id - the string to check.
+ * Output: Returns 1 if the ID is valid, 0 otherwise.
+ */
+int is_valid_frame_id(const char *frame_id)
+{
+    if (strlen(frame_id) != 4)
     {
-        // Modification completed if flag is set , No need to continue
-        if (flag)
+        return 0;
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        if (!((frame_id[i] >= 'A' && frame_id[i] <= 'Z') || (frame_id[i] >= '0' && frame_id[i] <= '9')))
         {
-            printf("----------CHANGE THE YEAR-------------\n\n");
-            printf("YEAR   : %s\n\n", mp3Edit->modify_data);
-            fclose(mp3Edit->fptr_src);
-            fclose(mp3Edit->fptr_out);
-            file_copy(mp3Edit);
-            printf("----------YEAR CHANGED SUCCESSFULLY----------\n\n");
-            return success;
+            return 0;
         }
-        printf("Error\n");
-        return failure;
     }
-    // Do check frame is TCON and whether user need to modify content
-    if (do_change(mp3Edit, "TCON", "-m", &flag) == failure || (flag))
+    return 1;
+}
+
+/**
+ * Function: is_text_frame_id
+ * Description: Checks that a frame ID can be set from plain text: a text frame (T***, except TXXX) or COMM.
+ * Input: frame_id - the string to check.
+ * Output: Returns 1 if the frame can be set, 0 otherwise.
+ */
+int is_text_frame_id(const char *frame_id)
+{
+    return is_valid_frame_id(frame_id) &&
+           ((frame_id[0] == 'T' && strcmp(frame_id, "TXXX") != 0) || strcmp(frame_id, "COMM") == 0);
+}
+
+/**
+ * Function: add_edit_request
+ * Description: Records a frame change. A frame given twice keeps the last value.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct, frame_id - the 4-character frame ID,
+ *        label - name printed to the user, value - new text or NULL to delete the frame.
+ * Output: Returns success if the change was recorded, or failure if MAX_EDITS changes are
+ *         already recorded. Nothing is printed.
+ */
+Status add_edit_request(Mp3EditInfo *mp3Edit, const char *frame_id, const char *label, const char *value)
+{
+    EditRequest *edit = find_edit_request(mp3Edit, frame_id);
+    if (edit == NULL)
     {
-        // Modification completed if flag is set , No need to continue
-        if (flag)
+        if (mp3Edit->edit_count == MAX_EDITS)
         {
-            printf("----------CHANGE THE CONTENT-------------\n\n");
-            printf("CONTENT   : %s\n\n", mp3Edit->modify_data);
-            fclose(mp3Edit->fptr_src);
-            fclose(mp3Edit->fptr_out);
-            file_copy(mp3Edit);
-            printf("----------CONTENT CHANGED SUCCESSFULLY----------\n\n");
-            return success;
+            return failure;
         }
-        printf("Error\n");
-        return failure;
+        edit = &mp3Edit->edits[mp3Edit->edit_count++];
     }
-    // Do check frame is COMM and whether user need to modify comment
-    if (do_change(mp3Edit, "COMM", "-c", &flag) == failure || (flag))
+    memcpy(edit->frame_id, frame_id, 4);
+    edit->frame_id[4] = '\0';
+    edit->label = label;
+    edit->value = value;
+    edit->target = NULL;
+    return success;
+}
+
+/**
+ * Function: find_edit_request
+ * Description: Looks up the requested change for a frame.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct, frame_id - the 4-character frame ID.
+ * Output: Returns the matching EditRequest, or NULL if the frame is not being changed.
+ */
+EditRequest *find_edit_request(Mp3EditInfo *mp3Edit, const char *frame_id)
+{
+    for (int i = 0; i < mp3Edit->edit_count; i++)
     {
-        // Modification completed if flag is set , No need to continue
-        if (flag)
+        if (strncmp(mp3Edit->edits[i].frame_id, frame_id, 4) == 0)
         {
-            printf("----------CHANGE THE COMMENT-------------\n\n");
-            printf("COMMENT   : %s\n\n", mp3Edit->modify_data);
-            fclose(mp3Edit->fptr_src);
-            fclose(mp3Edit->fptr_out);
-            file_copy(mp3Edit);
-            printf("----------COMMENT CHANGED SUCCESSFULLY----------\n\n");
-            return success;
+            return &mp3Edit->edits[i];
         }
-        printf("Error\n");
-        return failure;
     }
-    return success;
+    return NULL;
 }
 
 /**
- * Function: open_files
- * Description: Opens the source and duplicate MP3 files.
- * Input: mp3Edit - pointer to the Mp3EditInfo struct.
- * Output: Returns success if the files are opened successfully, or failure if there is an error opening the files.
+ * Function: edit_frame_size
+ * Description: Computes the data size of the frame written for an edit: encoding byte,
+ *              language and empty description for COMM, then the text.
+ * Input: edit - pointer to the EditRequest, version - major version of the tag.
+ * Output: Returns the frame data size in bytes (excluding the frame header).
  */
-Status open_files(Mp3EditInfo *mp3Edit)
+uint32_t edit_frame_size(const EditRequest *edit, int version)
 {
-    // Open original mp3 file and validate whether its opened or not
-    mp3Edit->fptr_src = fopen(mp3Edit->src_fname, "r");
-    if (mp3Edit->fptr_src == NULL)
+    int encoding = pick_text_encoding(edit->value, version);
+    uint32_t description = encoding == ENCODING_UTF16 ? 4 : 1;
+    int is_comment = strcmp(edit->frame_id, "COMM") == 0;
+    return 1 + (is_comment ? 3 + description : 0) + (uint32_t)encoded_text_size(encoding, edit->value);
+}
+
+/**
+ * Function: write_edit_frame
+ * Description: Writes the frame for an edit. Text is written as ISO-8859-1 when every character
+ *              fits, otherwise as UTF-16 with a byte order mark, or as UTF-8 in a v2.4 tag. The
+ *              status flags and the COMM language are kept from the old frame, or default to none
+ *              and "eng". The format flags are always cleared, the new data is neither compressed,
+ *              encrypted nor grouped.
+ * Input: edit - pointer to the EditRequest, version - major version of the tag, old - the frame
+ *        being replaced or NULL, old_frame - bytes of the old frame (header included) or NULL,
+ *        ptr - where to write.
+ * Output: Returns the position just after the written frame.
+ */
+unsigned char *write_edit_frame(const EditRequest *edit, int version, const FrameEntry *old,
+                                const unsigned char *old_frame, unsigned char *ptr)
+{
+    uint32_t size = edit_frame_size(edit, version);
+    int encoding = pick_text_encoding(edit->value, version);
+
+    // Frame ID, big-endian size (syncsafe in v2.4) and flags
+    memcpy(ptr, edit->frame_id, 4);
+    if (version >= 4)
     {
-        perror("Error opening source file");
-        return failure;
+        int_to_syncsafe(size, ptr + 4);
     }
-    // Open a duplicate file and validate whether its opened or not
-    mp3Edit->fptr_out = fopen(mp3Edit->out_fname, "w");
-    if (mp3Edit->fptr_out == NULL)
+    else
     {
-        perror("Error opening temp file");
-        return failure;
+        ptr[4] = (size >> 24) & 0xFF;
+        ptr[5] = (size >> 16) & 0xFF;
+        ptr[6] = (size >> 8) & 0xFF;
+        ptr[7] = size & 0xFF;
     }
-    return success;
+    ptr[8] = old ? old_frame[8] : 0;
+    ptr[9] = 0;
+    ptr += FRAME_HEADER_SIZE;
+
+    *ptr++ = (unsigned char)encoding;
+    if (strcmp(edit->frame_id, "COMM") == 0)
+    {
+        // Keep the old language code, default to "eng", then an empty description
+        memcpy(ptr, old && old->size >= 4 ? old_frame + FRAME_HEADER_SIZE + 1 : (const unsigned char *)"eng", 3);
+        ptr += 3;
+        if (encoding == ENCODING_UTF16)
+        {
+            memcpy(ptr, "\xFF\xFE\0\0", 4);
+            ptr += 4;
+        }
+        else
+        {
+            *ptr++ = '\0';
+        }
+    }
+    return encode_text(encoding, edit->value, ptr);
 }
 
 /**
- * Function: check_ID3
- * Description: Checks if the MP3 file has a valid ID3 header.
- * Input: mp3Edit - pointer to the Mp3EditInfo struct.
- * Output: Returns success if the header is valid, or failure if there is an error.
+ * Function: add_piece
+ * Description: Appends a piece to the layout of the new tag. Kept frames that directly follow the
+ *              previous run of kept frames in the source extend that run.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct, piece - the piece to add, dest - offset in
+ *        the new tag, advanced past the piece.
+ * Output: The piece is added to mp3Edit->pieces.
  */
-Status check_ID3(Mp3EditInfo *mp3Edit)
+static void add_piece(Mp3EditInfo *mp3Edit, const TagPiece *piece, uint32_t *dest)
 {
-    // Read 3 bytes from source and check if its ID3 or not
-    char buffer[3];
-    fread(buffer, 3, 1, mp3Edit->fptr_src);
-    buffer[3] = '\0';      
-    if (strcmp(buffer, "ID3") != 0)
+    TagPiece *last = mp3Edit->piece_count > 0 ? &mp3Edit->pieces[mp3Edit->piece_count - 1] : NULL;
+
+    if (last != NULL && piece->type != piece_edit && last->type == piece->type && last->src + last->length == piece->src)
     {
+        last->length += piece->length;
+    }
+    else
+    {
+        mp3Edit->pieces[mp3Edit->piece_count] = *piece;
+        mp3Edit->pieces[mp3Edit->piece_count].dest = *dest;
+        mp3Edit->piece_count++;
+    }
+    *dest += piece->length;
+}
+
+/**
+ * Function: plan_pieces
+ * Description: Lays out the frames of the new tag in one pass over the frame index, whatever order
+ *              the frames are in. Frames that are not edited are kept byte for byte. The first frame
+ *              of each changed ID is replaced, frames of deleted IDs are dropped, and changed IDs that
+ *              are not in the tag are added after the existing frames. The APIC frame replaced by new
+ *              cover art is dropped here; the new one is streamed after these frames.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct, length - receives the size of the new frames.
+ * Output: Returns success if the pieces are planned, or failure if allocation fails.
+ */
+Status plan_pieces(Mp3EditInfo *mp3Edit, uint32_t *length)
+{
+    uint32_t dest = ID3_HEADER_SIZE;
+    TagPiece piece = {0};
+
+    // Find the frame each edit replaces, edits without one are inserted
+    for (int i = 0; i < mp3Edit->edit_count; i++)
+    {
+        EditRequest *edit = &mp3Edit->edits[i];
+        edit->target = edit->value ? find_frame(&mp3Edit->index, edit->frame_id) : NULL;
+    }
+    mp3Edit->art_target = mp3Edit->art.fd >= 0 ? find_frame(&mp3Edit->index, "APIC") : NULL;
+
+    mp3Edit->piece_count = 0;
+    mp3Edit->piece_capacity = mp3Edit->index.count + mp3Edit->edit_count + 1;
+    mp3Edit->pieces = mem_resize(mp3Edit->allocator, NULL, 0, sizeof(TagPiece) * (size_t)mp3Edit->piece_capacity);
+    if (mp3Edit->pieces == NULL)
+    {
+        mp3Edit->piece_capacity = 0;
         return failure;
     }
+
+    for (int i = 0; i < mp3Edit->index.count; i++)
+    {
+        const FrameEntry *entry = &mp3Edit->index.frames[i];
+        const EditRequest *edit = find_edit_request(mp3Edit, entry->id);
+        if (entry == mp3Edit->art_target)
+        {
+            continue;
+        }
+        if (edit != NULL && edit->target == entry)
+        {
+            piece.type = piece_edit;
+            piece.length = FRAME_HEADER_SIZE + edit_frame_size(edit, mp3Edit->tag.version);
+            piece.edit = edit;
+            piece.old = entry;
+            add_piece(mp3Edit, &piece, &dest);
+        }
+        else if (edit == NULL || edit->value != NULL)
+        {
+            // Other frames are kept, from memory if the whole tag is loaded, deleted frames are dropped
+            piece.type = mp3Edit->tag.complete ? piece_memory : piece_source;
+            piece.src = (uint32_t)entry->offset;
+            piece.length = FRAME_HEADER_SIZE + entry->size;
+            add_piece(mp3Edit, &piece, &dest);
+        }
+    }
+    for (int i = 0; i < mp3Edit->edit_count; i++)
+    {
+        if (mp3Edit->edits[i].value != NULL && mp3Edit->edits[i].target == NULL)
+        {
+            piece.type = piece_edit;
+            piece.length = FRAME_HEADER_SIZE + edit_frame_size(&mp3Edit->edits[i], mp3Edit->tag.version);
+            piece.edit = &mp3Edit->edits[i];
+            piece.old = NULL;
+            add_piece(mp3Edit, &piece, &dest);
+        }
+    }
+
+    *length = dest - ID3_HEADER_SIZE;
     return success;
 }
 
 /**
- * Function: check_mp3version
- * Description: Checks if the MP3 file has a valid ID3 version.
- * Input: mp3Edit - pointer to the Mp3EditInfo struct.
- * Output: Returns success if the version is valid, or failure if there is an error.
+ * Function: kept_frames_stay
+ * Description: Checks that every run of kept frames read from the source file keeps its position
+ *              in the new tag. Frames kept from memory can go anywhere.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct with its pieces planned.
+ * Output: Returns 1 if no run of the source file moves, 0 otherwise.
  */
-Status check_mp3version(Mp3EditInfo *mp3Edit)
+int kept_frames_stay(const Mp3EditInfo *mp3Edit)
 {
-    // Read 2 bytes from source file and check for its version
-    short version;
-    fread(&version, 2, 1, mp3Edit->fptr_src);
-    if (version != 3)
+    for (int i = 0; i < mp3Edit->piece_count; i++)
     {
-        return failure;
+        if (mp3Edit->pieces[i].type == piece_source && mp3Edit->pieces[i].dest != mp3Edit->pieces[i].src)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Function: alloc_piece_buffer
+ * Description: Allocates the buffer used to move kept frames and to build edited frames: at least
+ *              EDIT_CHUNK_SIZE bytes, more only if an edited frame is larger.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct with its pieces planned, size - receives the buffer size.
+ * Output: Returns the buffer, or NULL if allocation fails.
+ */
+static unsigned char *alloc_piece_buffer(const Mp3EditInfo *mp3Edit, uint32_t *size)
+{
+    *size = EDIT_CHUNK_SIZE;
+    for (int i = 0; i < mp3Edit->piece_count; i++)
+    {
+        if (mp3Edit->pieces[i].type == piece_edit && mp3Edit->pieces[i].length > *size)
+        {
+            *size = mp3Edit->pieces[i].length;
+        }
+    }
+    return mem_resize(mp3Edit->allocator, NULL, 0, *size);
+}
+
+/**
+ * Function: write_piece
+ * Description: Writes a piece at its offset in the destination. Edited frames are built in the
+ *              buffer, kept frames are written from memory or copied from the source file by the kernel.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct, fd_dest - the file being written,
+ *        piece - the piece to write, buffer - buffer from alloc_piece_buffer.
+ * Output: Returns success if the piece is written, or failure if there is an error.
+ */
+static Status write_piece(Mp3EditInfo *mp3Edit, int fd_dest, const TagPiece *piece, unsigned char *buffer)
+{
+    const unsigned char *data = mp3Edit->tag.data + piece->src;
+
+    if (piece->type == piece_source)
+    {
+        stats_io(1, 0, 0);
+        if (lseek(fd_dest, piece->dest, SEEK_SET) < 0)
+        {
+            return edit_error(mp3Edit, "lseek");
+        }
+        if (copy_range(fd_dest, mp3Edit->fd_src, piece->src, piece->length) == failure)
+        {
+            return edit_error(mp3Edit, "copy");
+        }
+        return success;
+    }
+    if (piece->type == piece_edit)
+    {
+        // Only the header and first bytes of the replaced frame are needed, they are always loaded
+        const FrameEntry *old = piece->old;
+        write_edit_frame(piece->edit, mp3Edit->tag.version, old, old ? mp3Edit->tag.data + old->offset : NULL, buffer);
+        data = buffer;
+    }
+    stats_io(1, 0, piece->length);
+    if (pwrite(fd_dest, data, piece->length, piece->dest) != (ssize_t)piece->length)
+    {
+        return edit_error(mp3Edit, "pwrite");
     }
     return success;
 }
 
 /**
- * Function: copy_header
- * Description: Copies the header from the source file to the duplicate file.
- * Input: fptr_dest - the file pointer of the duplicate file, fptr_src - the file pointer of the source file.
- * Output: Returns success if the header is copied successfully, or failure if there is an error.
+ * Function: write_padding
+ * Description: Fills part of the destination with zero bytes, one buffer at a time.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct, fd_dest - the file being written,
+ *        offset - first byte, length - number of bytes, buffer - buffer of at least
+ *        EDIT_CHUNK_SIZE bytes, overwritten with zeros.
+ * Output: Returns success if the padding is written, or failure with the reason in mp3Edit->error.
  */
-Status copy_header(FILE *fptr_dest, FILE *fptr_src)
+static Status write_padding(Mp3EditInfo *mp3Edit, int fd_dest, off_t offset, uint32_t length, unsigned char *buffer)
 {
-    // Rewind both pointers to file start position
-    rewind(fptr_dest);
-    rewind(fptr_src);
-    // Read and write 10 bytes from source to dest file
-    char header[10];
-    fread(header, 10, 1, fptr_src);
-    fwrite(header, 10, 1, fptr_dest);
+    memset(buffer, 0, length < EDIT_CHUNK_SIZE ? length : EDIT_CHUNK_SIZE);
+    for (uint32_t done = 0; done < length;)
+    {
+        uint32_t chunk = length - done < EDIT_CHUNK_SIZE ? length - done : EDIT_CHUNK_SIZE;
+        stats_io(1, 0, chunk);
+        if (pwrite(fd_dest, buffer, chunk, offset + done) != (ssize_t)chunk)
+        {
+            return edit_error(mp3Edit, "pwrite");
+        }
+        done += chunk;
+    }
     return success;
 }
 
 /**
- * Function: do_change
- * Description: Performs the modification of the specified frame in the MP3 file.
- * Input: mp3Edit - pointer to the Mp3EditInfo struct, str - the frame ID, frame - the frame option, flag - pointer to the flag indicating whether the modification is completed.
- * Output: Returns success if the modification is performed successfully, or failure if there is an error.
+ * Function: write_pieces
+ * Description: Writes the header, the planned pieces, the new cover art and the padding of a tag.
+ *              In place, runs of kept frames read from the file are already where they belong
+ *              (see kept_frames_stay) and are not touched.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct, fd_dest - the file being written,
+ *        header - the new tag header, length - size of the new frames, tag_size - size of the new
+ *        tag, header included.
+ * Output: Returns success if the tag is written, or failure if there is an error.
  */
-Status do_change(Mp3EditInfo *mp3Edit, char str[], char frame[], int *flag)
+static Status write_pieces(Mp3EditInfo *mp3Edit, int fd_dest, const unsigned char *header, uint32_t length, uint32_t tag_size)
 {
-    // Check frame is matching with source file
-    if (check_frame(mp3Edit, str) == failure)
+    int in_place = fd_dest == mp3Edit->fd_src;
+    uint32_t buffer_size;
+    uint32_t art_length = mp3Edit->art.fd >= 0 ? FRAME_HEADER_SIZE + art_frame_size(&mp3Edit->art) : 0;
+    Status status = success;
+
+    unsigned char *buffer = alloc_piece_buffer(mp3Edit, &buffer_size);
+    if (buffer == NULL)
     {
-        printf("Frame Matching Error\n");
+        mp3Edit->error = "Failed to allocate the copy buffer";
         return failure;
     }
-    // Check user need to modify the particular frame data or not
-    if (strcmp(mp3Edit->frame, frame) == 0)
-    {
-        // Modify the data
-        modify_data(mp3Edit);
-        // Seek the source file pointer to old data times
-        fseek(mp3Edit->fptr_src, mp3Edit->size - 1, SEEK_CUR);
-        // Copy the remaning data from source to duplicate file
-        copy_remaining(mp3Edit->fptr_out, mp3Edit->fptr_src);
-        // Set flag to indicate modification is done
-        *flag = 1;
-        return success;
+    stats_io(1, 0, ID3_HEADER_SIZE);
+    if (pwrite(fd_dest, header, ID3_HEADER_SIZE, 0) != ID3_HEADER_SIZE)
+    {
+        status = edit_error(mp3Edit, "pwrite");
     }
-    // If user dont need to modify this frame , copy the same from source to duplicate
-    if (copy_same(mp3Edit) == failure)
+
+    for (int i = 0; status == success && i < mp3Edit->piece_count; i++)
+    {
+        if (!in_place || mp3Edit->pieces[i].type != piece_source)
+        {
+            status = write_piece(mp3Edit, fd_dest, &mp3Edit->pieces[i], buffer);
+        }
+    }
+
+    // The APIC frame goes after the other frames, the rest of the tag is padding
+    uint32_t frames_end = ID3_HEADER_SIZE + length;
+    if (status == success && art_length > 0)
+    {
+        if (lseek(fd_dest, frames_end, SEEK_SET) < 0)
+        {
+            status = edit_error(mp3Edit, "lseek");
+        }
+        else if (write_art_frame(fd_dest, &mp3Edit->art) == failure)
+        {
+            status = edit_error(mp3Edit, mp3Edit->art_fname);
+        }
+    }
+    if (status == success)
+    {
+        status = write_padding(mp3Edit, fd_dest, frames_end + art_length, tag_size - frames_end - art_length, buffer);
+    }
+    mem_release(mp3Edit->allocator, buffer, buffer_size);
+    return status;
+}
+
+/**
+ * Function: write_tag_in_place
+ * Description: Writes the new frames over the existing tag and fills the rest of the tag with
+ *              padding. The tag size in the header stays the same, so the audio data is not touched.
+ *              New cover art is streamed from its file right after the frames. Kept frames read
+ *              from the file must not move. The file is synced before the call returns.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct with its pieces planned, length - size of the new frames.
+ * Output: Returns success if the tag is written, or failure if there is an error.
+ */
+Status write_tag_in_place(Mp3EditInfo *mp3Edit, uint32_t length)
+{
+    unsigned char header[ID3_HEADER_SIZE];
+
+    // The extended header is not kept, unsynchronisation was decoded on load
+    memcpy(header, mp3Edit->tag.data, ID3_HEADER_SIZE);
+    header[5] &= ~0xC0;
+    if (write_pieces(mp3Edit, mp3Edit->fd_src, header, length, mp3Edit->tag.size) == failure)
     {
-        printf("Error in copying title\n");
         return failure;
     }
+    stats_io(1, 0, 0);
+    if (fsync(mp3Edit->fd_src) != 0)
+    {
+        return edit_error(mp3Edit, "fsync");
+    }
     return success;
 }
 
 /**
- * Function: check_frame
- * Description: Checks if the specified frame exists in the MP3 file.
- * Input: mp3Edit - pointer to the Mp3EditInfo struct, str - the frame ID.
- * Output: Returns success if the frame exists, or failure if there is an error.
+ * Function: make_temp_name
+ * Description: Builds a temp file name in the same directory as the source, so that the
+ *              finished copy can replace the source with a rename on the same filesystem. The
+ *              source path is resolved first: renaming over a symbolic link would replace the
+ *              link with a regular file and leave the file it points to unchanged.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct.
+ * Output: Returns success if real_fname and out_fname are set, or failure if the path cannot be
+ *         resolved or is too long.
  */
-Status check_frame(Mp3EditInfo *mp3Edit, char str[])
+Status make_temp_name(Mp3EditInfo *mp3Edit)
 {
-    // Read 4 bytes from source
-    char buffer[4];
-    fread(buffer, 4, 1, mp3Edit->fptr_src);
-    // Check frame is matching or not
-    if (strcmp(buffer, str) != 0)
+    char dir_buf[PATH_MAX];
+    char base_buf[PATH_MAX];
+
+    mp3Edit->out_fname[0] = '\0';
+    if (realpath(mp3Edit->src_fname, mp3Edit->real_fname) == NULL)
+    {
+        return failure;
+    }
+    // dirname and basename may modify their argument, so give each its own copy
+    strcpy(dir_buf, mp3Edit->real_fname);
+    strcpy(base_buf, mp3Edit->real_fname);
+
+    int length = snprintf(mp3Edit->out_fname, PATH_MAX, "%s/.%s.XXXXXX",
+                          dirname(dir_buf), basename(base_buf));
+    if (length < 0 || length >= PATH_MAX)
     {
+        mp3Edit->out_fname[0] = '\0';
+        errno = ENAMETOOLONG;
         return failure;
     }
-    // Write frame to duplicate file
-    fwrite(buffer, 4, 1, mp3Edit->fptr_out);
-    // Read existing data size from source
-    fread(&mp3Edit->size, 4, 1, mp3Edit->fptr_src);
-    // Convert to big endian as it is stored in little endian
-    convert_endianess((char *)&mp3Edit->size, sizeof(int));
     return success;
 }
 
 /**
- * Function: modify_data
- * Description: Modifies the data of the specified frame in the MP3 file.
- * Input: mp3Edit - pointer to the Mp3EditInfo struct.
- * Output: Returns success if the data is modified successfully, or failure if there is an error.
+ * Function: rewrite_file
+ * Description: Writes a copy of the file with a new tag into a temp file next to the source:
+ *              header, new frames, new cover art, extra padding for later edits, then the audio
+ *              data. Used when the tag grows or kept frames have to move.
+ * Input: mp3Edit - pointer to the Mp3EditInfo struct with its pieces planned, length - size of the new frames.
+ * Output: Returns success if the copy is written, or failure with the reason in mp3Edit->error.
  */
-Status modify_data(Mp3EditInfo *mp3Edit)
+Status rewrite_file(Mp3EditInfo *mp3Edit, uint32_t length)
 {
-    // Convert new data size endianess before storing
-    convert_endianess((char *)&mp3Edit->data_length, sizeof(int));
-    // Write new data size to duplicate file
-    fwrite(&mp3Edit->data_length, 4, 1, mp3Edit->fptr_out);
-    // Copy flags from source to duplicate file
-    char flag[3];
-    fread(flag, 3, 1, mp3Edit->fptr_src);
-    fwrite(flag, 3, 1, mp3Edit->fptr_out);
-    // Write new data to duplicate file
-    fwrite(mp3Edit->modify_data, strlen(mp3Edit->modify_data), 1, mp3Edit->fptr_out);
+    unsigned char header[ID3_HEADER_SIZE];
+    struct stat st;
+
+    // Create a unique temp file in the source directory
+    if (make_temp_name(mp3Edit) == failure)
+    {
+        return edit_error(mp3Edit, mp3Edit->src_fname);
+    }
+    mp3Edit->fd_out = mkstemp(mp3Edit->out_fname);
+    // mkstemp, then fstat, fchown and fchmod below
+    stats_io(4, 0, 0);
+    if (mp3Edit->fd_out < 0)
+    {
+        edit_error(mp3Edit, "Error opening temp file");
+        mp3Edit->out_fname[0] = '\0';
+        return failure;
+    }
+    // Give the copy the same owner and permissions as the original. Only root can give a file
+    // away, for anyone else the copy is theirs already. fchown clears the set-ID bits, so it
+    // comes first
+    if (fstat(mp3Edit->fd_src, &st) == 0)
+    {
+        if (fchown(mp3Edit->fd_out, st.st_uid, st.st_gid) != 0)
+        {
+            fchown(mp3Edit->fd_out, (uid_t)-1, st.st_gid);
+        }
+        fchmod(mp3Edit->fd_out, st.st_mode & 07777);
+    }
+
+    // Same header with the new syncsafe size, no extended header and no unsynchronisation
+    uint32_t art_length = mp3Edit->art.fd >= 0 ? FRAME_HEADER_SIZE + art_frame_size(&mp3Edit->art) : 0;
+    uint32_t tag_size = ID3_HEADER_SIZE + length + art_length + mp3Edit->padding;
+    memcpy(header, mp3Edit->tag.data, ID3_HEADER_SIZE);
+    header[5] &= ~0xC0;
+    int_to_syncsafe(tag_size - ID3_HEADER_SIZE, header + 6);
+
+    if (write_pieces(mp3Edit, mp3Edit->fd_out, header, length, tag_size) == failure)
+    {
+        return failure;
+    }
+
+    // Copy the audio data that follows the old tag
+    stats_io(1, 0, 0);
+    if (lseek(mp3Edit->fd_out, tag_size, SEEK_SET) < 0)
+    {
+        return edit_error(mp3Edit, "lseek");
+    }
+    if (copy_remaining(mp3Edit->fd_out, mp3Edit->fd_src, mp3Edit->tag.size) == failure)
+    {
+        return edit_error(mp3Edit, "Error copying the audio");
+    }
     return success;
 }
 
 /**
  * Function: copy_remaining
- * Description: Copies the remaining data from the source file to the duplicate file.
- * Input: fptr_dest - the file pointer of the duplicate file, fptr_src - the file pointer of the source file.
- * Output: Returns success if the data is copied successfully, or failure if there is an error.
+ * Description: Copies the remaining data from the source file to the end of the duplicate file.
+ * Input: fd_dest - the descriptor of the duplicate file, fd_src - the descriptor of the source file,
+ *        offset - position in the source file to start copying from.
+ * Output: Returns success if the data is copied successfully, or failure with errno set.
  */
-Status copy_remaining(FILE *fptr_dest, FILE *fptr_src)
+Status copy_remaining(int fd_dest, int fd_src, off_t offset)
+{
+    struct stat st;
+
+    stats_io(1, 0, 0);
+    if (fstat(fd_src, &st) != 0)
+    {
+        return failure;
+    }
+    return copy_range(fd_dest, fd_src, offset, st.st_size > offset ? st.st_size - offset : 0);
+}
+
+/**
+ * Function: copy_range
+ * Description: Copies length bytes from offset in the source file to the current position of the
+ *              destination. Uses copy_file_range where the kernel supports it, so the data stays in
+ *              the kernel (or is shared by reflink on filesystems that can), then sendfile, which
+ *              also writes to pipes, and falls back to a buffered copy.
+ * Input: fd_dest - the descriptor to write to, fd_src - the descriptor of the source file,
+ *        offset - position in the source file, length - number of bytes to copy.
+ * Output: Returns success if every byte is copied, or failure with errno set, ENODATA if the
+ *         source ended early. Nothing is printed.
+ */
+Status copy_range(int fd_dest, int fd_src, off_t offset, off_t length)
 {
     char buffer[BUFFER_SIZE];
-    size_t bytesRead;
+    ssize_t bytesRead;
 
-    while ((bytesRead = fread(buffer, 1, BUFFER_SIZE, fptr_src)) > 0)
+#ifdef __linux__
+    // Let the kernel copy the data, the destination offset follows fd_dest's position
+    int use_sendfile = 0;
+    while (length > 0)
     {
-        fwrite(buffer, 1, bytesRead, fptr_dest);
+        size_t chunk = length < (1 << 30) ? (size_t)length : (1 << 30);
+        bytesRead = use_sendfile ? sendfile(fd_dest, fd_src, &offset, chunk)
+                                 : copy_file_range(fd_src, &offset, fd_dest, NULL, chunk, 0);
+        stats_io(1, bytesRead > 0 ? (uint64_t)bytesRead : 0, bytesRead > 0 ? (uint64_t)bytesRead : 0);
+        if (bytesRead < 0 && !use_sendfile)
+        {
+            // copy_file_range refuses pipes and some filesystems, sendfile takes any destination
+            use_sendfile = 1;
+            continue;
+        }
+        if (bytesRead <= 0)
+        {
+            break;
+        }
+        length -= bytesRead;
+    }
+    // Not supported for these files, copy what is left through user space
+#endif
+
+    while (length > 0)
+    {
+        bytesRead = pread(fd_src, buffer, length < BUFFER_SIZE ? (size_t)length : BUFFER_SIZE, offset);
+        stats_io(2, bytesRead > 0 ? (uint64_t)bytesRead : 0, bytesRead > 0 ? (uint64_t)bytesRead : 0);
+        if (bytesRead <= 0)
+        {
+            errno = bytesRead == 0 ? ENODATA : errno;
+            return failure;
+        }
+        ssize_t written = write(fd_dest, buffer, bytesRead);
+        if (written != bytesRead)
+        {
+            // A short write sets no errno, the disk is full
+            errno = written < 0 ? errno : ENOSPC;
+            return failure;
+        }
+        offset += bytesRead;
+        length -= bytesRead;
     }
     return success;
 }
 
 /**
- * Function: copy_same
- * Description: Copies the same data from the source file to the duplicate file.
+ * Function: commit_file
+ * Description: Flushes the temp file to disk and renames it over the original, resolved by
+ *              make_temp_name. The rename is atomic, so a crash leaves either the old file or the
+ *              new one, never a partial copy.
  * Input: mp3Edit - pointer to the Mp3EditInfo struct.
- * Output: Returns success if the data is copied successfully, or failure if there is an error.
+ * Output: Returns success if the original is replaced, or failure with the reason in mp3Edit->error.
  */
-Status copy_same(Mp3EditInfo *mp3Edit)
+Status commit_file(Mp3EditInfo *mp3Edit)
 {
-    // Copy the old size stored in structure
-    int size = mp3Edit->size;
-    // Convert endianess and write to duplicate file
-    convert_endianess((char *)&size, sizeof(int));
-    fwrite(&size, 4, 1, mp3Edit->fptr_out);
-    // Copy the 2 flags and null character from source to duplicate
-    char flag[3];
-    fread(flag, 3, 1, mp3Edit->fptr_src);
-    fwrite(flag, 3, 1, mp3Edit->fptr_out);
-    // Copy the same data from source to duplicate file
-    char data[mp3Edit->size];
-    fread(data, mp3Edit->size - 1, 1, mp3Edit->fptr_src);
-    fwrite(data, mp3Edit->size - 1, 1, mp3Edit->fptr_out);
+    // Make sure the data is on disk before it becomes visible under the original name
+    // fsync, close and rename of the copy, open, fsync and close of the directory
+    stats_io(6, 0, 0);
+    if (fsync(mp3Edit->fd_out) != 0)
+    {
+        edit_error(mp3Edit, "fsync");
+        discard_file(mp3Edit);
+        return failure;
+    }
+    close(mp3Edit->fd_out);
+    mp3Edit->fd_out = -1;
+
+    // Replace the file a symbolic link points to, not the link
+    if (rename(mp3Edit->out_fname, mp3Edit->real_fname) != 0)
+    {
+        edit_error(mp3Edit, "rename");
+        discard_file(mp3Edit);
+        return failure;
+    }
+    mp3Edit->out_fname[0] = '\0';
+
+    // Flush the directory entry so the rename itself survives a crash
+    char dir_buf[PATH_MAX];
+    strcpy(dir_buf, mp3Edit->real_fname);
+    int fd_dir = open(dirname(dir_buf), O_RDONLY | O_DIRECTORY);
+    if (fd_dir >= 0)
+    {
+        fsync(fd_dir);
+        close(fd_dir);
+    }
     return success;
 }
 
 /**
- * Function: file_copy
- * Description: Copies the modified file to the original file.
+ * Function: discard_file
+ * Description: Closes and removes the temp file after a failed edit, leaving the original untouched.
  * Input: mp3Edit - pointer to the Mp3EditInfo struct.
- * Output: Returns success if the file is copied successfully, or failure if there is an error.
+ * Output: The temp file, if any, is deleted.
  */
-Status file_copy(Mp3EditInfo *mp3Edit)
+void discard_file(Mp3EditInfo *mp3Edit)
 {
-    // Open both original file and duplicate file
-    mp3Edit->fptr_src = fopen(mp3Edit->src_fname, "w");
-    mp3Edit->fptr_out = fopen(mp3Edit->out_fname, "r");
-    rewind(mp3Edit->fptr_src);
-    rewind(mp3Edit->fptr_out);
-    char ch;
-    // Copy the Duplicate file to Original file, So the changes will be affected on original file
-    while (fread(&ch, 1, 1, mp3Edit->fptr_out) > 0)
+    if (mp3Edit->fd_out >= 0)
     {
-        fwrite(&ch, 1, 1, mp3Edit->fptr_src);
+        close(mp3Edit->fd_out);
+        mp3Edit->fd_out = -1;
+    }
+    if (mp3Edit->out_fname[0] != '\0')
+    {
+        unlink(mp3Edit->out_fname);
+        mp3Edit->out_fname[0] = '\0';
     }
-    return success;
 }
 
 /**
@@ -430,4 +1080,4 @@ void convert_endianess(char *ptr, int size)
         ptr[i] = ptr[size - i - 1];
         ptr[size - i - 1] = temp;
     }
-}
\ No newline at end of file
+}
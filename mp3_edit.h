@@ -1,39 +1,118 @@
 #ifndef MP3_EDIT_H
 #define MP3_EDIT_H
 
+#include <limits.h>
+#include <sys/types.h>
 #include "type.h"
+#include "frame_index.h"
+#include "art.h"
+
+#define EDIT_PADDING 1024 // Default padding added when the tag has to grow
+#define MAX_PADDING MP3TAG_MAX_PADDING // Upper limit for the -p option
+#define MAX_EDITS MP3TAG_MAX_EDITS // Maximum number of fields changed in one run
+#define EDIT_MEMORY_LIMIT (64 * 1024) // Largest tag loaded whole for an edit, larger tags are streamed
+#define EDIT_HEAD_SIZE 4 // Frame bytes read from a streamed tag (encoding and COMM language)
+#define EDIT_CHUNK_SIZE (64 * 1024) // Buffer for moving frames inside the file
+
+/**
+ * Structure to map an edit option to its frame
+ */
+typedef struct
+{
+    const char *option;   // Command-line option (e.g., "-t")
+    const char *frame_id; // Frame identifier (e.g., "TIT2")
+    const char *label;    // Name printed to the user (e.g., "TITLE")
+} EditField;
+
+/**
+ * Structure to hold one frame change requested by the user
+ */
+typedef struct
+{
+    char frame_id[5];         // Frame to change (e.g., "TIT2")
+    const char *label;        // Name printed to the user (e.g., "TITLE")
+    const char *value;        // New text for the frame, NULL to delete every frame with this ID
+    const FrameEntry *target; // Frame replaced by the new text, NULL if it has to be inserted
+} EditRequest;
+
+/**
+ * Where the bytes of a piece of the new tag come from
+ */
+typedef enum
+{
+    piece_source, // Kept frames copied from the source file
+    piece_memory, // Kept frames copied from the tag loaded into memory
+    piece_edit    // A frame written for an edit
+} PieceType;
+
+/**
+ * Structure to hold one piece of the new tag. Runs of kept frames become a single piece, so a
+ * large frame is copied without being read into memory.
+ */
+typedef struct
+{
+    PieceType type;           // Source of the bytes
+    uint32_t src;             // Offset of kept frames in the source tag (piece_source, piece_memory)
+    uint32_t dest;            // Offset of the piece in the new tag
+    uint32_t length;          // Number of bytes
+    const EditRequest *edit;  // Edit written by a piece_edit
+    const FrameEntry *old;    // Frame replaced by the edit, NULL if it is inserted
+} TagPiece;
 
 /**
  * Structure to hold MP3 editing-related information
  */
 typedef struct Mp3EditInfo
 {
-    char *src_fname;      // Source MP3 file name
-    FILE *fptr_src;       // File pointer for the source MP3 file
+    const char *src_fname; // Source MP3 file name
+    int fd_src;           // File descriptor for the source MP3 file
+
+    char real_fname[PATH_MAX]; // Source with symbolic links resolved, replaced by the temp file
+    char out_fname[PATH_MAX]; // Temp file next to the source, used only when the tag has to grow
+    int fd_out;               // File descriptor for the temp file
+
+    EditRequest edits[MAX_EDITS]; // Frames to change, all written in one pass
+    int edit_count;               // Number of entries in edits
 
-    char out_fname[20];   // Output MP3 file name (edited version)
-    FILE *fptr_out;       // File pointer for the output MP3 file
+    const char *art_fname;        // Image from --set-art, NULL if the cover art is not changed
+    ArtSource art;                // The opened image, written as the last frame of the tag
+    const FrameEntry *art_target; // APIC frame replaced by the image, NULL if there is none
 
-    char *modify_data;    // Data to be modified in the MP3 file
-    int data_length;      // Length of the data to be modified
-    char *frame;          // Frame identifier for editing (e.g., "TIT2" for title)
+    const Allocator *allocator; // Source of the tag buffer, frame index, pieces and copy buffer, NULL for malloc
+    uint32_t padding;     // Padding added after the frames when the tag has to grow
+    int quiet;            // Set to skip the progress messages (batch edits)
+    const char *error;    // Reason for the last failure of edit_info, NULL on success
+    char error_text[PATH_MAX + 256]; // Holds error when it names a file or a system error
 
-    int size;             // Size of the frame data
+    Id3Tag tag;           // Source tag, loaded whole up to EDIT_MEMORY_LIMIT bytes, else only frame heads
+    FrameIndex index;     // Frames found in the source tag
+    TagPiece *pieces;     // Layout of the new frames
+    int piece_count;      // Number of entries in pieces
+    int piece_capacity;   // Allocated size of pieces
 } Mp3EditInfo;
 
 // Function prototypes
-Status read_and_validate_edit(char *argv[], Mp3EditInfo *mp3Edit);
+Status read_and_validate_edit(int argc, char *argv[], Mp3EditInfo *mp3Edit);
 Status edit_info(Mp3EditInfo *mp3Edit);
 Status open_files(Mp3EditInfo *mp3Edit);
-Status check_ID3(Mp3EditInfo *mp3Edit);
-Status check_mp3version(Mp3EditInfo *mp3Edit);
-Status copy_header(FILE *fptr_dest, FILE *fptr_src);
-Status do_change(Mp3EditInfo *mp3Edit, char str[], char frame[], int *flag);
-Status check_frame(Mp3EditInfo *mp3Edit, char str[]);
-Status modify_data(Mp3EditInfo *mp3Edit);
-Status copy_remaining(FILE *fptr_dest, FILE *fptr_src);
-Status copy_same(Mp3EditInfo *mp3Edit);
-Status file_copy(Mp3EditInfo *mp3Edit);
+void close_files(Mp3EditInfo *mp3Edit);
+const EditField *find_edit_field(const char *option);
+int is_valid_frame_id(const char *frame_id);
+int is_text_frame_id(const char *frame_id);
+Status add_edit_request(Mp3EditInfo *mp3Edit, const char *frame_id, const char *label, const char *value);
+EditRequest *find_edit_request(Mp3EditInfo *mp3Edit, const char *frame_id);
+uint32_t edit_frame_size(const EditRequest *edit, int version);
+unsigned char *write_edit_frame(const EditRequest *edit, int version, const FrameEntry *old,
+                                const unsigned char *old_frame, unsigned char *ptr);
+Status plan_pieces(Mp3EditInfo *mp3Edit, uint32_t *length);
+int kept_frames_stay(const Mp3EditInfo *mp3Edit);
+Status write_tag_in_place(Mp3EditInfo *mp3Edit, uint32_t length);
+Status make_temp_name(Mp3EditInfo *mp3Edit);
+Status rewrite_file(Mp3EditInfo *mp3Edit, uint32_t length);
+Status copy_remaining(int fd_dest, int fd_src, off_t offset);
+Status copy_range(int fd_dest, int fd_src, off_t offset, off_t length);
+Status commit_file(Mp3EditInfo *mp3Edit);
+void discard_file(Mp3EditInfo *mp3Edit);
 void convert_endianess(char *ptr, int size);
 
-#endif // MP3_EDIT_H
\ No newline at end of file
+#endif // MP3_EDIT_H
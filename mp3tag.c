@@ -0,0 +1,427 @@
+#include <sys/stat.h>
+#include "type.h"
+#include "mp3tag_private.h"
+#include "mp3_edit.h"
+#include "text_decode.h"
+#include "stats.h"
+
+/**
+ * Function: mp3tag_init
+ * Description: Initializes a handle with no file open. Every buffer of the handle, and of the
+ *              edits it applies, comes from the allocator.
+ * Input: handle - pointer to the Mp3Tag struct, allocator - the allocator, NULL for malloc.
+ * Output: The handle is ready to open files or buffers.
+ */
+void mp3tag_init(Mp3Tag *handle, const Allocator *allocator)
+{
+    handle->allocator = allocator;
+    init_id3_tag(&handle->tag);
+    init_frame_index(&handle->index);
+    init_out_buffer(&handle->value);
+    handle->tag.allocator = allocator;
+    handle->index.allocator = allocator;
+    handle->value.allocator = allocator;
+    handle->has_v2 = 0;
+    handle->fd = -1;
+    handle->file_size = 0;
+    handle->v1_state = -1;
+    handle->error = NULL;
+}
+
+/**
+ * Function: mp3tag_free
+ * Description: Releases the buffers of a handle. The file it was reading is not closed.
+ * Input: handle - pointer to the Mp3Tag struct.
+ * Output: The handle is empty and can be used again.
+ */
+void mp3tag_free(Mp3Tag *handle)
+{
+    free_frame_index(&handle->index);
+    free_id3_tag(&handle->tag);
+    free_out_buffer(&handle->value);
+    handle->has_v2 = 0;
+    handle->fd = -1;
+    handle->v1_state = -1;
+}
+
+/**
+ * Function: mp3tag_new
+ * Description: Creates a handle with no file open, for callers that only see mp3tag.h.
+ * Input: allocator - the allocator of the handle and its buffers, NULL for malloc.
+ * Output: Returns the handle, or NULL if there is no memory.
+ */
+Mp3Tag *mp3tag_new(const Mp3TagAllocator *allocator)
+{
+    Mp3Tag *handle = mem_resize(allocator, NULL, 0, sizeof(Mp3Tag));
+
+    if (handle != NULL)
+    {
+        mp3tag_init(handle, allocator);
+    }
+    return handle;
+}
+
+/**
+ * Function: mp3tag_delete
+ * Description: Releases a handle from mp3tag_new and its buffers. The file it was reading is not closed.
+ * Input: handle - the handle, or NULL.
+ * Output: The handle is gone.
+ */
+void mp3tag_delete(Mp3Tag *handle)
+{
+    if (handle != NULL)
+    {
+        mp3tag_free(handle);
+        mem_release(handle->allocator, handle, sizeof(Mp3Tag));
+    }
+}
+
+/**
+ * Function: mp3tag_frame_key
+ * Description: Packs a frame ID for the keys of mp3tag_open_fd and mp3tag_open_parts.
+ * Input: frame_id - the frame ID as stored, 3 characters in v2.2 tags.
+ * Output: Returns the packed ID.
+ */
+uint32_t mp3tag_frame_key(const char *frame_id)
+{
+    return frame_key(frame_id);
+}
+
+/**
+ * Function: mp3tag_open_fd
+ * Description: Reads the ID3v2 tag of an open file. With keys only the first frame of each
+ *              requested ID is loaded and the frame walk stops once all are found; without keys
+ *              the whole tag is loaded and every frame indexed. The ID3v1 trailer is read later,
+ *              and only if a field is missing from the ID3v2 tag.
+ * Input: handle - pointer to the Mp3Tag struct, fd - the file, which the caller keeps open while
+ *        using the handle, keys - packed frame IDs (see mp3tag_frame_key) or NULL, key_count -
+ *        number of keys (at most 64).
+ * Output: Returns MP3TAG_OK if the file was read, whether or not it has a tag, or MP3TAG_ERROR on
+ *         an error. A tag that is damaged or cannot be read is left out and noted in mp3tag_error.
+ */
+Mp3TagStatus mp3tag_open_fd(Mp3Tag *handle, int fd, const uint32_t *keys, int key_count)
+{
+    struct stat st;
+    Status status;
+
+    handle->fd = fd;
+    handle->has_v2 = 0;
+    handle->v1_state = 0;
+    handle->error = NULL;
+    stats_io(1, 0, 0);
+    if (fstat(fd, &st) != 0)
+    {
+        handle->error = "Error in reading file size";
+        return MP3TAG_ERROR;
+    }
+    handle->file_size = st.st_size;
+
+    // The audio data is never read
+    if (keys == NULL)
+    {
+        status = read_id3_tag(fd, &handle->tag);
+        status = status == success ? build_frame_index(&handle->tag, &handle->index) : failure;
+    }
+    else
+    {
+        status = read_frames(fd, &handle->tag, keys, key_count, &handle->index);
+    }
+    handle->has_v2 = status == success && checkheaderandversion(&handle->tag) == success;
+    handle->error = handle->tag.error;
+    if (!handle->has_v2)
+    {
+        handle->index.count = 0;
+    }
+    return MP3TAG_OK;
+}
+
+/**
+ * Function: mp3tag_open_buffer
+ * Description: Reads the tags of a file held in memory: the ID3v2 tag at the start, which is
+ *              copied into the handle, and the ID3v1 trailer at the end.
+ * Input: handle - pointer to the Mp3Tag struct, data - the file in memory, size - bytes in data.
+ * Output: Returns MP3TAG_OK if the buffer was read, whether or not it has a tag, or MP3TAG_ERROR if there is none.
+ */
+Mp3TagStatus mp3tag_open_buffer(Mp3Tag *handle, const void *data, size_t size)
+{
+    return mp3tag_open_parts(handle, data, size, NULL, 0, data, size);
+}
+
+/**
+ * Function: mp3tag_open_parts
+ * Description: Reads the tags of a file whose start and end the caller has read, for instance
+ *              with asynchronous I/O. The ID3v2 tag is copied into the handle. With keys only the
+ *              first frame of each requested ID is loaded, and head may end inside the tag as
+ *              long as the frame walk finds them all before its end.
+ * Input: handle - pointer to the Mp3Tag struct, head - the start of the file, which must hold the
+ *        whole ID3v2 tag without keys, head_size - bytes in head, keys - packed frame IDs (see
+ *        mp3tag_frame_key) or NULL, key_count - number of keys (at most 64), tail - the last bytes of
+ *        the file (at least ID3V1_SIZE, ID3V1_PLUS_SIZE more for TAG+) or NULL if not read,
+ *        tail_size - bytes in tail.
+ * Output: Returns MP3TAG_OK if the parts were read, whether or not they hold a tag, or MP3TAG_ERROR
+ *         if head is missing or ends before the requested frames.
+ */
+Mp3TagStatus mp3tag_open_parts(Mp3Tag *handle, const void *head, size_t head_size, const uint32_t *keys, int key_count,
+                               const void *tail, size_t tail_size)
+{
+    Status status;
+
+    handle->fd = -1;
+    handle->file_size = 0;
+    handle->has_v2 = 0;
+    handle->v1_state = -1;
+    handle->index.count = 0;
+    handle->error = NULL;
+    if (head == NULL)
+    {
+        handle->error = "No buffer";
+        return MP3TAG_ERROR;
+    }
+
+    if (keys == NULL)
+    {
+        status = read_id3_tag_buffer(head, head_size, &handle->tag);
+        status = status == success ? build_frame_index(&handle->tag, &handle->index) : failure;
+    }
+    else
+    {
+        status = read_frames_buffer(head, head_size, &handle->tag, keys, key_count, &handle->index);
+        if (status == failure && id3_tag_size(head, head_size) > head_size)
+        {
+            handle->error = "Tag continues past the buffer";
+            return MP3TAG_ERROR;
+        }
+    }
+    handle->has_v2 = status == success && checkheaderandversion(&handle->tag) == success;
+    handle->error = handle->tag.error;
+    if (!handle->has_v2)
+    {
+        handle->index.count = 0;
+    }
+    if (tail != NULL)
+    {
+        handle->v1_state = parse_id3v1_tag(tail, tail_size, &handle->v1) == success ? 1 : -1;
+    }
+    return MP3TAG_OK;
+}
+
+/**
+ * Function: mp3tag_set_tail
+ * Description: Reads the ID3v1 trailer of parts opened with mp3tag_open_parts without a tail,
+ *              once the caller has read the end of the file. The ID3v2 tag is kept.
+ * Input: handle - pointer to the Mp3Tag struct, tail - the last bytes of the file, tail_size - bytes in tail.
+ * Output: Returns MP3TAG_OK if the tail ends in an ID3v1 tag, or MP3TAG_ERROR otherwise.
+ */
+Mp3TagStatus mp3tag_set_tail(Mp3Tag *handle, const void *tail, size_t tail_size)
+{
+    handle->v1_state = parse_id3v1_tag(tail, tail_size, &handle->v1) == success ? 1 : -1;
+    return handle->v1_state > 0 ? MP3TAG_OK : MP3TAG_ERROR;
+}
+
+/**
+ * Function: load_v1
+ * Description: Reads the ID3v1 trailer of the open file the first time it is needed.
+ * Input: handle - pointer to the Mp3Tag struct.
+ * Output: Returns success if the file ends in an ID3v1 tag, or failure otherwise.
+ */
+static Status load_v1(Mp3Tag *handle)
+{
+    if (handle->v1_state == 0)
+    {
+        handle->v1_state = read_id3v1_tag(handle->fd, handle->file_size, &handle->v1) == success ? 1 : -1;
+    }
+    return handle->v1_state > 0 ? success : failure;
+}
+
+/**
+ * Function: mp3tag_detach
+ * Description: Reads what the handle would still need from its file, the ID3v1 trailer, so the
+ *              file can be closed while the handle keeps answering. Used to keep handles in a cache.
+ * Input: handle - pointer to the Mp3Tag struct opened with mp3tag_open_fd.
+ * Output: The handle no longer uses the file.
+ */
+void mp3tag_detach(Mp3Tag *handle)
+{
+    load_v1(handle);
+    handle->fd = -1;
+}
+
+/**
+ * Function: mp3tag_has_tag
+ * Description: Checks that the open file has an ID3v2 tag or an ID3v1 trailer.
+ * Input: handle - pointer to the Mp3Tag struct.
+ * Output: Returns 1 if there is a tag, 0 otherwise.
+ */
+int mp3tag_has_tag(Mp3Tag *handle)
+{
+    return handle->has_v2 || load_v1(handle) == success;
+}
+
+/**
+ * Function: mp3tag_has_frame
+ * Description: Checks that the ID3v2 tag holds a frame, the trailer is not consulted.
+ * Input: handle - pointer to the Mp3Tag struct, frame_id - the frame ID as stored in the tag,
+ *        e.g. TT2 in a v2.2 tag.
+ * Output: Returns 1 if the frame is present, 0 otherwise.
+ */
+int mp3tag_has_frame(const Mp3Tag *handle, const char *frame_id)
+{
+    return handle->has_v2 && find_frame(&handle->index, frame_id) != NULL;
+}
+
+/**
+ * Function: mp3tag_frame_count
+ * Description: Counts the frames read from the ID3v2 tag.
+ * Input: handle - pointer to the Mp3Tag struct.
+ * Output: Returns the number of frames, 0 without an ID3v2 tag.
+ */
+int mp3tag_frame_count(const Mp3Tag *handle)
+{
+    return handle->index.count;
+}
+
+/**
+ * Function: mp3tag_frame
+ * Description: Describes one frame of the ID3v2 tag, in file order.
+ * Input: handle - pointer to the Mp3Tag struct, i - frame number from 0 to mp3tag_frame_count - 1,
+ *        frame - receives the frame.
+ * Output: Returns MP3TAG_OK if the frame exists, or MP3TAG_ERROR otherwise.
+ */
+Mp3TagStatus mp3tag_frame(const Mp3Tag *handle, int i, Mp3TagFrame *frame)
+{
+    if (i < 0 || i >= handle->index.count)
+    {
+        return MP3TAG_ERROR;
+    }
+    const FrameEntry *entry = &handle->index.frames[i];
+    frame->id = entry->id;
+    frame->data = handle->tag.data + entry->data_offset;
+    frame->size = entry->data_size;
+    frame->flags = entry->flags;
+    return MP3TAG_OK;
+}
+
+/**
+ * Function: mp3tag_append_field
+ * Description: Appends the value of a frame to a buffer as UTF-8. Text frames are decoded by their
+ *              encoding byte, other frames are copied without their null bytes. A frame the ID3v2
+ *              tag lacks is taken from the ID3v1/TAG+ trailer.
+ * Input: handle - pointer to the Mp3Tag struct, frame_id - the frame ID as stored in the tag,
+ *        out - buffer receiving the value.
+ * Output: Returns success if the field was found, or failure otherwise.
+ */
+Status mp3tag_append_field(Mp3Tag *handle, const char *frame_id, OutBuffer *out)
+{
+    const FrameEntry *entry = handle->has_v2 ? find_frame(&handle->index, frame_id) : NULL;
+    uint64_t start = stats_begin();
+
+    if (entry != NULL)
+    {
+        const unsigned char *data = handle->tag.data + entry->data_offset;
+        if (decode_frame_text(entry->id, data, entry->data_size, out) == failure)
+        {
+            for (uint32_t i = 0; i < entry->data_size; i++)
+            {
+                if (data[i] != '\0')
+                {
+                    out_putc(out, data[i]);
+                }
+            }
+        }
+        stats_end(phase_decode, start);
+        return success;
+    }
+
+    const char *value = load_v1(handle) == success ? id3v1_field(&handle->v1, frame_id) : NULL;
+    if (value != NULL)
+    {
+        append_latin1(out, (const unsigned char *)value, strlen(value));
+    }
+    stats_end(phase_decode, start);
+    return value != NULL ? success : failure;
+}
+
+/**
+ * Function: mp3tag_get_field
+ * Description: Gets the value of a frame as null terminated UTF-8, see mp3tag_append_field.
+ * Input: handle - pointer to the Mp3Tag struct, frame_id - the 4-character frame ID,
+ *        value - receives the text, owned by the handle, length - receives its length in bytes.
+ * Output: Returns MP3TAG_OK if the field was found, or MP3TAG_ERROR otherwise.
+ */
+Mp3TagStatus mp3tag_get_field(Mp3Tag *handle, const char *frame_id, const char **value, size_t *length)
+{
+    handle->value.length = 0;
+    if (mp3tag_append_field(handle, frame_id, &handle->value) == failure)
+    {
+        handle->error = "Frame not found";
+        return MP3TAG_ERROR;
+    }
+    out_putc(&handle->value, '\0');
+    if (handle->value.length == 0)
+    {
+        handle->error = "Error in allocating the value";
+        return MP3TAG_ERROR;
+    }
+    *value = handle->value.data;
+    *length = handle->value.length - 1;
+    return MP3TAG_OK;
+}
+
+/**
+ * Function: mp3tag_apply_edits
+ * Description: Applies a set of frame changes to a file in one write, like the -e option: in place
+ *              when the frames fit in the tag, otherwise through an atomically renamed copy with
+ *              padding bytes to spare. Nothing is printed. Only ID3v2.3 tags can be edited.
+ * Input: handle - pointer to the Mp3Tag struct, whose allocator is used, path - the mp3 file,
+ *        edits - the changes, count - number of changes (1 to MP3TAG_MAX_EDITS), padding - padding
+ *        added if the tag has to grow (at most MP3TAG_MAX_PADDING).
+ * Output: Returns MP3TAG_OK if the file was edited, or MP3TAG_ERROR with the reason in mp3tag_error.
+ */
+Mp3TagStatus mp3tag_apply_edits(Mp3Tag *handle, const char *path, const Mp3TagEdit *edits, int count, uint32_t padding)
+{
+    Mp3EditInfo mp3Edit;
+
+    handle->error = NULL;
+    if (count < 1 || count > MAX_EDITS || padding > MAX_PADDING)
+    {
+        handle->error = "Invalid number of edits or padding";
+        return MP3TAG_ERROR;
+    }
+
+    mp3Edit.src_fname = path;
+    mp3Edit.out_fname[0] = '\0';
+    mp3Edit.padding = padding;
+    mp3Edit.edit_count = 0;
+    mp3Edit.art_fname = NULL;
+    mp3Edit.quiet = 1;
+    mp3Edit.allocator = handle->allocator;
+    for (int i = 0; i < count; i++)
+    {
+        const char *frame_id = edits[i].frame_id;
+        if (frame_id == NULL || !(edits[i].value ? is_text_frame_id(frame_id) : is_valid_frame_id(frame_id)))
+        {
+            handle->error = "Invalid frame ID";
+            return MP3TAG_ERROR;
+        }
+        add_edit_request(&mp3Edit, frame_id, frame_id, edits[i].value);
+    }
+
+    if (edit_info(&mp3Edit) == failure)
+    {
+        handle->error = mp3Edit.error;
+        return MP3TAG_ERROR;
+    }
+    return MP3TAG_OK;
+}
+
+/**
+ * Function: mp3tag_error
+ * Description: Gives the reason for the last failure of a handle. After an open that succeeded
+ *              it tells why the ID3v2 tag was left out or read only in part.
+ * Input: handle - pointer to the Mp3Tag struct.
+ * Output: Returns the reason, or NULL if the last call succeeded.
+ */
+const char *mp3tag_error(const Mp3Tag *handle)
+{
+    return handle->error;
+}
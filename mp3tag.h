@@ -0,0 +1,107 @@
+#ifndef MP3TAG_H
+#define MP3TAG_H
+
+/*
+ * libmp3tag: the tag reader and editor behind the CLI, for use inside another process.
+ *
+ * Build: make lib   (libmp3tag.a and libmp3tag.so)
+ *
+ * A handle is opened on one file or memory buffer at a time and reused for the next, keeping its
+ * buffers, so a scan allocates only until the buffers fit the largest tag. Pointers handed out
+ * by a handle stay valid until the next call that opens, reads a field from or frees it. The
+ * library prints nothing; a failed call leaves its reason in mp3tag_error.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Marks the functions the shared library exports, everything else is built hidden
+#if defined(__GNUC__)
+#define MP3TAG_API __attribute__((visibility("default")))
+#else
+#define MP3TAG_API
+#endif
+
+#define MP3TAG_MAX_EDITS 16          // Most changes taken by one mp3tag_apply_edits call
+#define MP3TAG_MAX_PADDING (1 << 20) // Most padding mp3tag_apply_edits adds to a growing tag
+
+/**
+ * Result of the library calls.
+ */
+typedef enum
+{
+    MP3TAG_OK,   // The call succeeded
+    MP3TAG_ERROR // The call failed, see mp3tag_error
+} Mp3TagStatus;
+
+/**
+ * Structure to hold an allocator supplied by the caller. Buffers that grow (the tag buffer, the
+ * frame index, output buffers) get their memory from it and keep it across files, so once they
+ * have reached the largest size needed a scan allocates nothing. A NULL allocator means malloc.
+ */
+typedef struct Mp3TagAllocator
+{
+    void *(*resize)(void *ctx, void *ptr, size_t old_size, size_t new_size); // Allocates (ptr NULL) or grows a block
+    void (*release)(void *ctx, void *ptr, size_t size);                      // Frees a block, may do nothing
+    void *ctx;                                                               // Passed to both functions
+} Mp3TagAllocator;
+
+/**
+ * Structure to hold a bump allocator over memory owned by the caller. The last block can grow
+ * and be released in place; other blocks are released only by mp3tag_arena_reset.
+ */
+typedef struct Mp3TagArena
+{
+    Mp3TagAllocator allocator; // Pass &arena->allocator where an allocator is taken
+    unsigned char *memory;     // Memory handed out by the arena
+    size_t size;               // Size of memory
+    size_t used;               // Bytes handed out
+    size_t last;               // Offset of the last block
+} Mp3TagArena;
+
+/**
+ * A reader for one file at a time, created by mp3tag_new.
+ */
+typedef struct Mp3Tag Mp3Tag;
+
+/**
+ * Structure to describe one frame of the open tag.
+ */
+typedef struct
+{
+    const char *id;            // Frame ID as stored, 3 characters in v2.2 tags
+    const unsigned char *data; // Frame data with unsynchronisation and the data length indicator removed
+    uint32_t size;             // Bytes of data
+    uint16_t flags;            // Frame flags as stored
+} Mp3TagFrame;
+
+/**
+ * Structure to hold one change for mp3tag_apply_edits.
+ */
+typedef struct
+{
+    const char *frame_id; // Text frame (T***) or COMM to set, any frame ID to delete
+    const char *value;    // New text, NULL deletes every frame with this ID
+} Mp3TagEdit;
+
+// Function prototypes
+MP3TAG_API Mp3Tag *mp3tag_new(const Mp3TagAllocator *allocator);
+MP3TAG_API void mp3tag_delete(Mp3Tag *handle);
+MP3TAG_API uint32_t mp3tag_frame_key(const char *frame_id);
+MP3TAG_API Mp3TagStatus mp3tag_open_fd(Mp3Tag *handle, int fd, const uint32_t *keys, int key_count);
+MP3TAG_API Mp3TagStatus mp3tag_open_buffer(Mp3Tag *handle, const void *data, size_t size);
+MP3TAG_API Mp3TagStatus mp3tag_open_parts(Mp3Tag *handle, const void *head, size_t head_size, const uint32_t *keys, int key_count,
+                                          const void *tail, size_t tail_size);
+MP3TAG_API Mp3TagStatus mp3tag_set_tail(Mp3Tag *handle, const void *tail, size_t tail_size);
+MP3TAG_API void mp3tag_detach(Mp3Tag *handle);
+MP3TAG_API int mp3tag_has_tag(Mp3Tag *handle);
+MP3TAG_API int mp3tag_has_frame(const Mp3Tag *handle, const char *frame_id);
+MP3TAG_API int mp3tag_frame_count(const Mp3Tag *handle);
+MP3TAG_API Mp3TagStatus mp3tag_frame(const Mp3Tag *handle, int i, Mp3TagFrame *frame);
+MP3TAG_API Mp3TagStatus mp3tag_get_field(Mp3Tag *handle, const char *frame_id, const char **value, size_t *length);
+MP3TAG_API Mp3TagStatus mp3tag_apply_edits(Mp3Tag *handle, const char *path, const Mp3TagEdit *edits, int count, uint32_t padding);
+MP3TAG_API const char *mp3tag_error(const Mp3Tag *handle);
+MP3TAG_API void mp3tag_arena_init(Mp3TagArena *arena, void *memory, size_t size);
+MP3TAG_API void mp3tag_arena_reset(Mp3TagArena *arena);
+
+#endif // MP3TAG_H
@@ -0,0 +1,39 @@
+#ifndef MP3TAG_PRIVATE_H
+#define MP3TAG_PRIVATE_H
+
+/*
+ * The inside of a libmp3tag handle, for the CLI, which keeps handles by value and reads fields
+ * straight into its own output buffers. Not installed with the library.
+ */
+
+#include <sys/types.h>
+#include "type.h"
+#include "mp3tag.h"
+#include "allocator.h"
+#include "frame_index.h"
+#include "id3v1.h"
+#include "out_buffer.h"
+
+/**
+ * Structure to hold a reader for one file at a time.
+ */
+struct Mp3Tag
+{
+    const Allocator *allocator; // Source of every buffer, NULL for malloc
+    Id3Tag tag;                 // ID3v2 tag of the open file
+    FrameIndex index;           // Frames of the tag, or only the ones asked for
+    int has_v2;                 // Set if the file has a valid ID3v2 tag
+    int fd;                     // Open file, -1 for a memory buffer; not owned by the handle
+    off_t file_size;            // Size of the file, locates the ID3v1 trailer
+    int v1_state;               // 0 if the trailer is not read yet, 1 if read, -1 if there is none
+    Id3v1Tag v1;                // ID3v1/TAG+ trailer, read when a field is missing from ID3v2
+    OutBuffer value;            // Text returned by mp3tag_get_field
+    const char *error;          // Reason for the last failure
+};
+
+// Function prototypes
+void mp3tag_init(Mp3Tag *handle, const Allocator *allocator);
+void mp3tag_free(Mp3Tag *handle);
+Status mp3tag_append_field(Mp3Tag *handle, const char *frame_id, OutBuffer *out);
+
+#endif // MP3TAG_PRIVATE_H
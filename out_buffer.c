@@ -0,0 +1,146 @@
+#include <stdarg.h>
+#include "type.h"
+#include "out_buffer.h"
+#include "stats.h"
+
+/**
+ * Function: init_out_buffer
+ * Description: Initializes an empty output buffer that allocates with malloc.
+ * Input: out - pointer to the OutBuffer struct.
+ * Output: The buffer holds no data and no allocated memory.
+ */
+void init_out_buffer(OutBuffer *out)
+{
+    out->allocator = NULL;
+    out->data = NULL;
+    out->length = 0;
+    out->capacity = 0;
+}
+
+/**
+ * Function: out_reserve
+ * Description: Makes room for at least extra more bytes, growing the buffer geometrically.
+ * Input: out - pointer to the OutBuffer struct, extra - number of bytes about to be appended.
+ * Output: Returns success if the space is available, or failure if allocation fails.
+ */
+Status out_reserve(OutBuffer *out, size_t extra)
+{
+    if (out->length + extra <= out->capacity)
+    {
+        return success;
+    }
+    size_t capacity = out->capacity ? out->capacity : BUFFER_SIZE;
+    while (capacity < out->length + extra)
+    {
+        capacity *= 2;
+    }
+    char *data = mem_resize(out->allocator, out->data, out->capacity, capacity);
+    if (data == NULL)
+    {
+        return failure;
+    }
+    out->data = data;
+    out->capacity = capacity;
+    return success;
+}
+
+/**
+ * Function: out_append
+ * Description: Appends raw bytes to the buffer.
+ * Input: out - pointer to the OutBuffer struct, data - bytes to append, length - number of bytes.
+ * Output: The bytes are added to the end of the buffer (dropped if allocation fails).
+ */
+void out_append(OutBuffer *out, const void *data, size_t length)
+{
+    // An empty value may come from a buffer that was never allocated
+    if (length > 0 && out_reserve(out, length) == success)
+    {
+        memcpy(out->data + out->length, data, length);
+        out->length += length;
+    }
+}
+
+/**
+ * Function: out_puts
+ * Description: Appends a string without its terminator.
+ * Input: out - pointer to the OutBuffer struct, str - string to append.
+ * Output: The string is added to the end of the buffer.
+ */
+void out_puts(OutBuffer *out, const char *str)
+{
+    out_append(out, str, strlen(str));
+}
+
+/**
+ * Function: out_putc
+ * Description: Appends one character.
+ * Input: out - pointer to the OutBuffer struct, ch - character to append.
+ * Output: The character is added to the end of the buffer.
+ */
+void out_putc(OutBuffer *out, char ch)
+{
+    if (out->length < out->capacity || out_reserve(out, 1) == success)
+    {
+        out->data[out->length++] = ch;
+    }
+}
+
+/**
+ * Function: out_printf
+ * Description: Appends printf-style formatted text.
+ * Input: out - pointer to the OutBuffer struct, format - printf format string, ... - format arguments.
+ * Output: The formatted text is added to the end of the buffer.
+ */
+void out_printf(OutBuffer *out, const char *format, ...)
+{
+    va_list args;
+
+    // Measure first, then format straight into the buffer
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (length < 0 || out_reserve(out, (size_t)length + 1) == failure)
+    {
+        return;
+    }
+    va_start(args, format);
+    vsnprintf(out->data + out->length, (size_t)length + 1, format, args);
+    va_end(args);
+    out->length += (size_t)length;
+}
+
+/**
+ * Function: write_out_buffer
+ * Description: Writes the buffered bytes to a stream in one call and empties the buffer.
+ *              The allocation is kept so the buffer can be reused.
+ * Input: out - pointer to the OutBuffer struct, fptr - the stream to write to.
+ * Output: Returns success if every byte was written, or failure on a write error.
+ */
+Status write_out_buffer(OutBuffer *out, FILE *fptr)
+{
+    Status status = success;
+    uint64_t start = stats_begin();
+    if (out->length > 0 && fwrite(out->data, 1, out->length, fptr) != out->length)
+    {
+        status = failure;
+    }
+    stats_io(out->length > 0, 0, out->length);
+    stats_end(phase_write, start);
+    out->length = 0;
+    return status;
+}
+
+/**
+ * Function: free_out_buffer
+ * Description: Releases the memory held by the buffer.
+ * Input: out - pointer to the OutBuffer struct.
+ * Output: The buffer is emptied and can be reused.
+ */
+void free_out_buffer(OutBuffer *out)
+{
+    const Allocator *allocator = out->allocator;
+
+    mem_release(allocator, out->data, out->capacity);
+    init_out_buffer(out);
+    out->allocator = allocator;
+}
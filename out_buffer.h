@@ -0,0 +1,29 @@
+#ifndef OUT_BUFFER_H
+#define OUT_BUFFER_H
+
+#include <stdio.h>
+#include "type.h"
+#include "allocator.h"
+
+/**
+ * Structure to hold output text before it is written in one call.
+ */
+typedef struct
+{
+    char *data;      // Buffered bytes
+    size_t length;   // Number of bytes in use
+    size_t capacity; // Allocated size of data
+    const Allocator *allocator; // Source of data, NULL for malloc, kept by free_out_buffer
+} OutBuffer;
+
+// Function prototypes
+void init_out_buffer(OutBuffer *out);
+Status out_reserve(OutBuffer *out, size_t extra);
+void out_append(OutBuffer *out, const void *data, size_t length);
+void out_puts(OutBuffer *out, const char *str);
+void out_putc(OutBuffer *out, char ch);
+void out_printf(OutBuffer *out, const char *format, ...);
+Status write_out_buffer(OutBuffer *out, FILE *fptr);
+void free_out_buffer(OutBuffer *out);
+
+#endif // OUT_BUFFER_H
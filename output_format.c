@@ -0,0 +1,225 @@
+#include <limits.h>
+#include <stdarg.h>
+#include "type.h"
+#include "output_format.h"
+
+/**
+ * Function: print_error
+ * Description: Reports an error of a request. The command line prints it; the server collects
+ *              it to send back to its client instead of printing it in the daemon.
+ * Input: err - buffer receiving the message, NULL to print it on stderr,
+ *        format - printf style format of the message, including the newline.
+ * Output: The message is appended to err or printed on stderr.
+ */
+void print_error(OutBuffer *err, const char *format, ...)
+{
+    char message[PATH_MAX + 256];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    if (err == NULL)
+    {
+        fputs(message, stderr);
+    }
+    else
+    {
+        out_puts(err, message);
+    }
+}
+
+/**
+ * Function: is_format_option
+ * Description: Checks if a command-line argument is a --format option.
+ * Input: arg - the argument.
+ * Output: Returns 1 for --format=..., 0 otherwise.
+ */
+int is_format_option(const char *arg)
+{
+    return strncmp(arg, "--format=", 9) == 0;
+}
+
+/**
+ * Function: read_format_option
+ * Description: Parses a --format=text|ndjson|bin option.
+ * Input: arg - the argument, format - receives the output format,
+ *        err - receives the error message, NULL to print it on stderr.
+ * Output: Returns success for a known format, or failure otherwise.
+ */
+Status read_format_option(const char *arg, OutputFormat *format, OutBuffer *err)
+{
+    const char *name = arg + 9;
+
+    if (strcmp(name, "text") == 0)
+    {
+        *format = format_text;
+    }
+    else if (strcmp(name, "ndjson") == 0)
+    {
+        *format = format_ndjson;
+    }
+    else if (strcmp(name, "bin") == 0)
+    {
+        *format = format_bin;
+    }
+    else
+    {
+        print_error(err, "ERROR: --format must be text, ndjson or bin\n");
+        return failure;
+    }
+    return success;
+}
+
+/**
+ * Function: format_stream_header
+ * Description: Appends what goes before the first record: the magic of a bin stream, nothing otherwise.
+ * Input: format - the output format, out - buffer receiving the bytes.
+ * Output: The header is appended.
+ */
+void format_stream_header(OutputFormat format, OutBuffer *out)
+{
+    if (format == format_bin)
+    {
+        out_append(out, BIN_MAGIC, 8);
+    }
+}
+
+/**
+ * Function: format_failed_record
+ * Description: Appends the record of a file whose tag could not be read. Text output reports
+ *              failures on stderr only, so nothing is appended for it.
+ * Input: format - the output format, path - the file, reason - why it failed, out - buffer receiving the record.
+ * Output: The record is appended.
+ */
+void format_failed_record(OutputFormat format, const char *path, const char *reason, OutBuffer *out)
+{
+    if (format == format_ndjson)
+    {
+        out_puts(out, "{\"path\":");
+        out_json_string(out, path, strlen(path));
+        out_puts(out, ",\"error\":");
+        out_json_string(out, reason, strlen(reason));
+        out_puts(out, "}\n");
+    }
+    else if (format == format_bin)
+    {
+        size_t start = begin_bin_record(out, 1, path);
+        size_t length = strlen(reason);
+        out_le16(out, (uint16_t)length);
+        out_append(out, reason, length);
+        end_bin_record(out, start);
+    }
+}
+
+/**
+ * Function: out_json_string
+ * Description: Appends a JSON string literal. Quotes, backslashes and control characters are
+ *              escaped; the text must already be UTF-8.
+ * Input: out - buffer receiving the text, str - the UTF-8 text, length - number of bytes.
+ * Output: The quoted string is appended.
+ */
+void out_json_string(OutBuffer *out, const char *str, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t run = 0;
+
+    out_putc(out, '"');
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned char ch = (unsigned char)str[i];
+        if (ch >= 0x20 && ch != '"' && ch != '\\')
+        {
+            continue;
+        }
+        // Copy the plain run before the character, then its escape
+        out_append(out, str + run, i - run);
+        run = i + 1;
+        out_putc(out, '\\');
+        switch (ch)
+        {
+        case '"':
+        case '\\':
+            out_putc(out, (char)ch);
+            break;
+        case '\n':
+            out_putc(out, 'n');
+            break;
+        case '\r':
+            out_putc(out, 'r');
+            break;
+        case '\t':
+            out_putc(out, 't');
+            break;
+        default:
+            out_puts(out, "u00");
+            out_putc(out, hex[ch >> 4]);
+            out_putc(out, hex[ch & 0xF]);
+            break;
+        }
+    }
+    out_append(out, str + run, length - run);
+    out_putc(out, '"');
+}
+
+/**
+ * Function: out_le16
+ * Description: Appends a 16-bit little-endian integer.
+ * Input: out - buffer receiving the bytes, value - the integer.
+ * Output: Two bytes are appended.
+ */
+void out_le16(OutBuffer *out, uint16_t value)
+{
+    unsigned char bytes[2] = {value & 0xFF, value >> 8};
+    out_append(out, bytes, 2);
+}
+
+/**
+ * Function: out_le32
+ * Description: Appends a 32-bit little-endian integer.
+ * Input: out - buffer receiving the bytes, value - the integer.
+ * Output: Four bytes are appended.
+ */
+void out_le32(OutBuffer *out, uint32_t value)
+{
+    unsigned char bytes[4] = {value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24};
+    out_append(out, bytes, 4);
+}
+
+/**
+ * Function: begin_bin_record
+ * Description: Starts a bin record with a length placeholder, the status and the path.
+ * Input: out - buffer receiving the record, status - 0 if the tag was read, 1 if the file failed, path - the file.
+ * Output: Returns the position of the length field, to be passed to end_bin_record.
+ */
+size_t begin_bin_record(OutBuffer *out, int status, const char *path)
+{
+    size_t start = out->length;
+    size_t length = strlen(path);
+
+    out_le32(out, 0);
+    out_putc(out, (char)status);
+    out_le16(out, (uint16_t)(length < 0xFFFF ? length : 0xFFFF));
+    out_append(out, path, length < 0xFFFF ? length : 0xFFFF);
+    return start;
+}
+
+/**
+ * Function: end_bin_record
+ * Description: Fills in the length field of a bin record once its content is appended.
+ * Input: out - buffer holding the record, start - value returned by begin_bin_record.
+ * Output: The length field holds the size of the rest of the record.
+ */
+void end_bin_record(OutBuffer *out, size_t start)
+{
+    if (out->length < start + 4)
+    {
+        return;
+    }
+    uint32_t length = (uint32_t)(out->length - start - 4);
+    unsigned char *ptr = (unsigned char *)out->data + start;
+    ptr[0] = length & 0xFF;
+    ptr[1] = (length >> 8) & 0xFF;
+    ptr[2] = (length >> 16) & 0xFF;
+    ptr[3] = length >> 24;
+}
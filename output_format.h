@@ -0,0 +1,40 @@
+#ifndef OUTPUT_FORMAT_H
+#define OUTPUT_FORMAT_H
+
+#include "type.h"
+#include "out_buffer.h"
+
+#define BIN_MAGIC "MP3TAGB1" // First 8 bytes of a --format=bin stream
+#define BIN_MISSING 0xFFFFFFFF // Value length written for a frame that is not in the tag
+
+/**
+ * Output formats of the viewer. A bin stream starts with BIN_MAGIC and holds one record per
+ * file, all integers little-endian:
+ *   u32 length of the rest of the record
+ *   u8  status, 0 if the tag was read, 1 if the file failed
+ *   u16 path length, path bytes
+ *   status 0: u16 field count, then per field 4 byte frame ID, u32 value length
+ *             (BIN_MISSING if absent) and the UTF-8 value
+ *   status 1: u16 reason length, reason bytes
+ * With --hash the fields end with one whose ID is HASH, holding the audio hash in 16 hex digits.
+ */
+typedef enum
+{
+    format_text,   // Labelled lines for people (default)
+    format_ndjson, // One JSON object per file and line
+    format_bin     // Length-prefixed binary records
+} OutputFormat;
+
+// Function prototypes
+void print_error(OutBuffer *err, const char *format, ...);
+int is_format_option(const char *arg);
+Status read_format_option(const char *arg, OutputFormat *format, OutBuffer *err);
+void format_stream_header(OutputFormat format, OutBuffer *out);
+void format_failed_record(OutputFormat format, const char *path, const char *reason, OutBuffer *out);
+void out_json_string(OutBuffer *out, const char *str, size_t length);
+void out_le16(OutBuffer *out, uint16_t value);
+void out_le32(OutBuffer *out, uint32_t value);
+size_t begin_bin_record(OutBuffer *out, int status, const char *path);
+void end_bin_record(OutBuffer *out, size_t start);
+
+#endif // OUTPUT_FORMAT_H
@@ -0,0 +1,795 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "type.h"
+#include "view.h"
+#include "batch.h"
+#include "mp3_edit.h"
+#include "output_format.h"
+#include "serve.h"
+
+#define SERVE_MIN_THREADS 4 // Default worker count on small machines, a worker serves one connection at a time
+
+/**
+ * Structure to hold the buffers of one worker thread, reused for every request.
+ */
+typedef struct
+{
+    Server *server;       // The server the worker belongs to
+    Music music;          // Filename, wanted frames and fields of the file being viewed
+    Mp3Tag spare;         // Handle filled on a cache miss, then swapped into the cache
+    Mp3EditInfo *edit;    // Edit state, on the heap for its path buffer
+    OutBuffer request;    // The request being served
+    OutBuffer out;        // Output of the request
+    OutBuffer err;        // Error messages of the request
+    char **argv;          // Arguments split out of the request
+    size_t argv_capacity; // Allocated size of argv
+} ServeWorker;
+
+/**
+ * Function: read_and_validate_serve
+ * Description: Reads the socket path and the -j option of --serve.
+ * Input: argc - number of command-line arguments, argv - array of arguments, server - pointer to the Server struct.
+ * Output: Returns success if the arguments are valid, or failure otherwise.
+ */
+Status read_and_validate_serve(int argc, char *argv[], Server *server)
+{
+    struct sockaddr_un address;
+
+    server->path = NULL;
+    server->listen_fd = -1;
+    server->threads = default_threads() < SERVE_MIN_THREADS ? SERVE_MIN_THREADS : default_threads();
+    server->stopping = 0;
+    server->failed = 0;
+    server->cache = NULL;
+
+    for (int i = 2; i < argc; i++)
+    {
+        // Number of worker threads, each serves one connection at a time
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            if (read_threads_option(i + 1 < argc ? argv[i + 1] : NULL, &server->threads, NULL) == failure)
+            {
+                return failure;
+            }
+            i++;
+            continue;
+        }
+        if (server->path != NULL)
+        {
+            fprintf(stderr, "ERROR: Only one socket path can be given.\n");
+            return failure;
+        }
+        server->path = argv[i];
+    }
+
+    if (server->path == NULL)
+    {
+        fprintf(stderr, "ERROR: Socket path missing.\n");
+        return failure;
+    }
+    if (strlen(server->path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "ERROR: Socket path is too long.\n");
+        return failure;
+    }
+#ifndef CLONE_FS
+    // Without a working directory per thread, requests from clients in different directories
+    // would change directory under each other
+    fprintf(stderr, "ERROR: --serve needs unshare(CLONE_FS), which this system does not have.\n");
+    return failure;
+#endif
+    return success;
+}
+
+/**
+ * Function: file_slot
+ * Description: Picks a slot for a file from its device and inode.
+ * Input: dev - device of the file, ino - inode of the file, count - number of slots, a power of two.
+ * Output: Returns the slot number.
+ */
+static size_t file_slot(dev_t dev, ino_t ino, size_t count)
+{
+    uint64_t hash = ((uint64_t)dev * 0x9E3779B97F4A7C15ULL) ^ (uint64_t)ino;
+    hash *= 0x9E3779B97F4A7C15ULL;
+    return (size_t)(hash >> 32) & (count - 1);
+}
+
+/**
+ * Function: entry_matches
+ * Description: Checks that a cache entry holds the current tags of a file.
+ * Input: entry - the cache entry, st - stat of the file.
+ * Output: Returns 1 if the entry is valid for the file, 0 otherwise.
+ */
+static int entry_matches(const ServeEntry *entry, const struct stat *st)
+{
+    return entry->valid && entry->dev == st->st_dev && entry->ino == st->st_ino && entry->size == st->st_size &&
+           entry->mtime.tv_sec == st->st_mtim.tv_sec && entry->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+           entry->ctime.tv_sec == st->st_ctim.tv_sec && entry->ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+/**
+ * Function: serve_fields
+ * Description: Reads the wanted fields of a file from the frame index cache. On a miss the whole
+ *              tag and the trailer are read into the worker's spare handle, which then takes the
+ *              place of the cache entry; the entry's old handle becomes the spare, so the buffers
+ *              circulate instead of being reallocated. Tags over SERVE_CACHE_TAG_LIMIT are not kept.
+ * Input: worker - the worker, with music->Filename and music->wanted set.
+ * Output: Returns success if the file has an ID3v2 or ID3v1 tag, or failure with music->error set.
+ */
+static Status serve_fields(ServeWorker *worker)
+{
+    Server *server = worker->server;
+    Music *music = &worker->music;
+    struct stat st;
+
+    if (stat(music->Filename, &st) != 0 || !S_ISREG(st.st_mode) || music->hash_threads > 0)
+    {
+        // Let read_fields fail the way the command line does; the audio hash needs the file anyway
+        return read_fields(music, &music->fields);
+    }
+
+    ServeEntry *entry = &server->cache[file_slot(st.st_dev, st.st_ino, SERVE_CACHE_SLOTS)];
+    pthread_mutex_lock(&server->cache_lock);
+    if (entry_matches(entry, &st))
+    {
+        Status status = read_handle_fields(music, &entry->handle, &music->fields);
+        server->hits++;
+        pthread_mutex_unlock(&server->cache_lock);
+        return status;
+    }
+    server->misses++;
+    pthread_mutex_unlock(&server->cache_lock);
+
+    // Read the file outside the cache lock, but not halfway through an edit
+    pthread_mutex_t *file_lock = &server->file_locks[file_slot(st.st_dev, st.st_ino, SERVE_FILE_LOCKS)];
+    pthread_mutex_lock(file_lock);
+    if (openFiles(music) == failure)
+    {
+        pthread_mutex_unlock(file_lock);
+        print_error(music->err, "ERROR: %s: %s.\n", music->Filename, music->error);
+        return failure;
+    }
+    Status status = fstat(music->fd, &st) == 0 && mp3tag_open_fd(&worker->spare, music->fd, NULL, 0) == MP3TAG_OK ?
+                    success : failure;
+    if (status == success)
+    {
+        mp3tag_detach(&worker->spare);
+    }
+    closeFiles(music);
+    pthread_mutex_unlock(file_lock);
+    if (status == failure)
+    {
+        music->error = "Error in reading file size";
+        return failure;
+    }
+    status = read_handle_fields(music, &worker->spare, &music->fields);
+
+    if (worker->spare.tag.capacity > SERVE_CACHE_TAG_LIMIT)
+    {
+        // Give the memory of a large tag back instead of keeping it in the cache
+        mp3tag_free(&worker->spare);
+        return status;
+    }
+    entry = &server->cache[file_slot(st.st_dev, st.st_ino, SERVE_CACHE_SLOTS)];
+    pthread_mutex_lock(&server->cache_lock);
+    Mp3Tag old = entry->handle;
+    entry->handle = worker->spare;
+    worker->spare = old;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtim;
+    entry->ctime = st.st_ctim;
+    entry->valid = 1;
+    pthread_mutex_unlock(&server->cache_lock);
+    return status;
+}
+
+/**
+ * Function: serve_view
+ * Description: Serves a -v request with the output of the command line: the single file viewer
+ *              for one file, the batch viewer's format for many files or directories. Fields
+ *              come from the frame index cache. Errors for files that fail go to the error part.
+ * Input: worker - the worker, argc - number of arguments, argv - the arguments, argv[1] is -v.
+ * Output: Returns success if every file was read, or failure otherwise.
+ */
+static Status serve_view(ServeWorker *worker, int argc, char *argv[])
+{
+    Music *music = &worker->music;
+    BatchView batch;
+    Status result = success;
+
+    default_field_list(&music->wanted);
+    music->format = format_text;
+    music->hash_threads = 0;
+    if (!is_batch_view(argc, argv))
+    {
+        if (read_and_validate(argc, argv, music) == failure)
+        {
+            out_puts(&worker->err, "ERROR: Failed to validate MP3 file.\n");
+            return failure;
+        }
+        // The other workers keep the cores busy
+        music->hash_threads = music->hash_threads > 0 ? 1 : 0;
+        format_stream_header(music->format, &worker->out);
+        if (serve_fields(worker) == failure)
+        {
+            format_failed_record(music->format, music->Filename, music->error, &worker->out);
+            out_printf(&worker->err, "ERROR: Failed to validate MP3 file %s\n", music->Filename);
+            return failure;
+        }
+        if (music->format == format_text)
+        {
+            format_fields(&music->wanted, &music->fields, &worker->out, &worker->err);
+        }
+        else
+        {
+            format_record(music->format, music->Filename, &music->wanted, &music->fields, &worker->out);
+        }
+        return success;
+    }
+
+    // The server keeps its own cache and thread pool
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--cache") == 0)
+        {
+            out_puts(&worker->err, "ERROR: --cache is not served, the server caches the tags itself.\n");
+            return failure;
+        }
+    }
+    if (read_and_validate_batch(argc, argv, &batch, &worker->err) == failure)
+    {
+        out_puts(&worker->err, "ERROR: Invalid view arguments.\n");
+        return failure;
+    }
+    music->wanted = batch.wanted;
+    music->format = batch.format;
+    music->hash_threads = batch.hash_threads > 0 ? 1 : 0;
+    format_stream_header(music->format, &worker->out);
+    for (size_t i = 0; i < batch.files.count; i++)
+    {
+        music->Filename = batch.files.paths[i];
+        Status status = serve_fields(worker);
+        if (status == failure)
+        {
+            result = failure;
+        }
+        if (status == failure && music->format == format_text)
+        {
+            out_printf(&worker->err, "ERROR: Failed to validate MP3 file %s\n", music->Filename);
+            continue;
+        }
+        format_batch_file(music, status, &worker->out);
+    }
+    free_batch_view(&batch);
+    music->Filename = NULL;
+    return result;
+}
+
+/**
+ * Function: serve_edit
+ * Description: Serves a -e request for one file. Edits of the same file take turns, and the
+ *              file's cache entry is dropped once the edit is done.
+ * Input: worker - the worker, argc - number of arguments, argv - the arguments, argv[1] is -e.
+ * Output: Returns success if the file was edited, or failure otherwise.
+ */
+static Status serve_edit(ServeWorker *worker, int argc, char *argv[])
+{
+    Server *server = worker->server;
+    Mp3EditInfo *mp3Edit = worker->edit;
+    struct stat st;
+
+    if (mp3Edit == NULL)
+    {
+        out_puts(&worker->err, "ERROR: Out of memory.\n");
+        return failure;
+    }
+    if (argc < 5)
+    {
+        out_puts(&worker->err, "ERROR: Invalid edit arguments.\n");
+        return failure;
+    }
+    if (read_and_validate_edit(argc, argv, mp3Edit) == failure)
+    {
+        out_printf(&worker->err, "ERROR: %s\n", mp3Edit->error);
+        return failure;
+    }
+    mp3Edit->quiet = 1;
+    if (stat(mp3Edit->src_fname, &st) != 0)
+    {
+        out_printf(&worker->err, "ERROR: Unable to open file %s\n", mp3Edit->src_fname);
+        return failure;
+    }
+
+    pthread_mutex_t *file_lock = &server->file_locks[file_slot(st.st_dev, st.st_ino, SERVE_FILE_LOCKS)];
+    pthread_mutex_lock(file_lock);
+    Status status = edit_info(mp3Edit);
+    pthread_mutex_unlock(file_lock);
+
+    // Changed in place or replaced by a new file, the cached tags are stale either way
+    ServeEntry *entry = &server->cache[file_slot(st.st_dev, st.st_ino, SERVE_CACHE_SLOTS)];
+    pthread_mutex_lock(&server->cache_lock);
+    if (entry->valid && entry->dev == st.st_dev && entry->ino == st.st_ino)
+    {
+        entry->valid = 0;
+    }
+    pthread_mutex_unlock(&server->cache_lock);
+
+    if (status == failure)
+    {
+        out_printf(&worker->err, "ERROR: %s\n", mp3Edit->error);
+    }
+    return status;
+}
+
+/**
+ * Function: serve_request
+ * Description: Splits a request into the client's directory and the arguments, moves the worker
+ *              into that directory so relative paths mean what they meant to the client, and
+ *              serves the command.
+ * Input: worker - the worker, with the request read.
+ * Output: Returns success if the command succeeded, or failure otherwise.
+ */
+static Status serve_request(ServeWorker *worker)
+{
+    static char program[] = "a.out";
+    char *data = worker->request.data;
+    size_t length = worker->request.length;
+    size_t count = 0;
+
+    if (length == 0 || data[length - 1] != '\0')
+    {
+        out_puts(&worker->err, "ERROR: Malformed request.\n");
+        return failure;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        count += data[i] == '\0';
+    }
+    // The directory takes the place of the program name, and argv ends with NULL
+    if (count + 1 > worker->argv_capacity)
+    {
+        char **argv = realloc(worker->argv, (count + 1) * sizeof(char *));
+        if (argv == NULL)
+        {
+            out_puts(&worker->err, "ERROR: Out of memory.\n");
+            return failure;
+        }
+        worker->argv = argv;
+        worker->argv_capacity = count + 1;
+    }
+    const char *directory = data;
+    int argc = 0;
+    worker->argv[argc++] = program;
+    for (char *arg = data + strlen(data) + 1; arg < data + length; arg += strlen(arg) + 1)
+    {
+        worker->argv[argc++] = arg;
+    }
+    worker->argv[argc] = NULL;
+    if (argc < 2)
+    {
+        out_puts(&worker->err, "ERROR: Malformed request.\n");
+        return failure;
+    }
+    if (chdir(directory) != 0)
+    {
+        out_printf(&worker->err, "ERROR: Unable to enter %s\n", directory);
+        return failure;
+    }
+
+    if (strcmp(worker->argv[1], "-v") == 0)
+    {
+        return serve_view(worker, argc, worker->argv);
+    }
+    if (strcmp(worker->argv[1], "-e") == 0)
+    {
+        return serve_edit(worker, argc, worker->argv);
+    }
+    out_puts(&worker->err, "ERROR: Only -v and -e requests are served.\n");
+    return failure;
+}
+
+/**
+ * Function: read_full
+ * Description: Reads exactly length bytes from a socket.
+ * Input: fd - the socket, buffer - destination, length - bytes to read.
+ * Output: Returns success, or failure if the peer closed, timed out or an error occurred.
+ */
+static Status read_full(int fd, void *buffer, size_t length)
+{
+    unsigned char *pos = buffer;
+
+    while (length > 0)
+    {
+        ssize_t got = read(fd, pos, length);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return failure;
+        }
+        pos += got;
+        length -= (size_t)got;
+    }
+    return success;
+}
+
+/**
+ * Function: write_full
+ * Description: Writes exactly length bytes to a socket without raising SIGPIPE.
+ * Input: fd - the socket, buffer - source, length - bytes to write.
+ * Output: Returns success, or failure if the peer went away or an error occurred.
+ */
+static Status write_full(int fd, const void *buffer, size_t length)
+{
+    const unsigned char *pos = buffer;
+
+    while (length > 0)
+    {
+        ssize_t done = send(fd, pos, length, MSG_NOSIGNAL);
+        if (done < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (done <= 0)
+        {
+            return failure;
+        }
+        pos += done;
+        length -= (size_t)done;
+    }
+    return success;
+}
+
+/**
+ * Function: put_le32
+ * Description: Stores a 32-bit value little-endian.
+ * Input: ptr - destination, value - the value.
+ * Output: Four bytes are written to ptr.
+ */
+static void put_le32(unsigned char *ptr, uint32_t value)
+{
+    ptr[0] = value & 0xFF;
+    ptr[1] = (value >> 8) & 0xFF;
+    ptr[2] = (value >> 16) & 0xFF;
+    ptr[3] = (value >> 24) & 0xFF;
+}
+
+/**
+ * Function: read_request
+ * Description: Reads one length-prefixed request.
+ * Input: fd - the client socket, request - buffer receiving the request.
+ * Output: Returns success, or failure if the client closed the connection or sent too much.
+ */
+static Status read_request(int fd, OutBuffer *request)
+{
+    unsigned char header[4];
+
+    if (read_full(fd, header, sizeof(header)) == failure)
+    {
+        return failure;
+    }
+    uint32_t length = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t)header[3] << 24;
+    if (length > SERVE_MAX_REQUEST)
+    {
+        return failure;
+    }
+    request->length = 0;
+    if (out_reserve(request, length) == failure || read_full(fd, request->data, length) == failure)
+    {
+        return failure;
+    }
+    request->length = length;
+    return success;
+}
+
+/**
+ * Function: send_response
+ * Description: Sends the status, the output and the error messages of a request. Small
+ *              responses are gathered into one send.
+ * Input: fd - the client socket, status - result of the request, out - the output, err - the error messages.
+ * Output: Returns success, or failure if the client went away.
+ */
+static Status send_response(int fd, Status status, OutBuffer *out, const OutBuffer *err)
+{
+    unsigned char header[4 + SERVE_RESPONSE_HEADER];
+
+    put_le32(header, (uint32_t)(SERVE_RESPONSE_HEADER + out->length + err->length));
+    header[4] = status == success ? 0 : 1;
+    put_le32(header + 5, (uint32_t)out->length);
+    if (out->length + err->length <= BUFFER_SIZE)
+    {
+        // One send: the header goes in front of the output, the errors after it
+        if (out_reserve(out, sizeof(header) + err->length) == failure)
+        {
+            return failure;
+        }
+        if (err->length > 0)
+        {
+            out_append(out, err->data, err->length);
+        }
+        memmove(out->data + sizeof(header), out->data, out->length);
+        memcpy(out->data, header, sizeof(header));
+        out->length += sizeof(header);
+        return write_full(fd, out->data, out->length);
+    }
+    if (write_full(fd, header, sizeof(header)) == failure || write_full(fd, out->data, out->length) == failure)
+    {
+        return failure;
+    }
+    return write_full(fd, err->data, err->length);
+}
+
+/**
+ * Function: serve_worker
+ * Description: Worker thread of the server. Accepts a connection and answers its requests in
+ *              order until the client closes it or stays silent for SERVE_TIMEOUT seconds, then
+ *              accepts the next one. The worker has a working directory of its own, so each
+ *              request can change into its client's directory; if it cannot get one, it stops
+ *              the whole server rather than serve with a directory shared by every worker.
+ * Input: arg - pointer to the shared Server struct.
+ * Output: Returns NULL once the server stops.
+ */
+static void *serve_worker(void *arg)
+{
+    Server *server = arg;
+    ServeWorker worker;
+
+    worker.server = server;
+    init_music(&worker.music);
+    // Errors of a request go back to the client, the daemon prints nothing for them
+    worker.music.err = &worker.err;
+    mp3tag_init(&worker.spare, NULL);
+    worker.edit = malloc(sizeof(Mp3EditInfo));
+    init_out_buffer(&worker.request);
+    init_out_buffer(&worker.out);
+    init_out_buffer(&worker.err);
+    worker.argv = NULL;
+    worker.argv_capacity = 0;
+#ifdef CLONE_FS
+    // Stop sharing the working directory with the other threads
+    if (unshare(CLONE_FS) != 0)
+    {
+        perror("unshare");
+        // The first worker to fail wakes wait_for_stop, which stops the others
+        if (__atomic_exchange_n(&server->failed, 1, __ATOMIC_ACQ_REL) == 0)
+        {
+            kill(getpid(), SIGTERM);
+        }
+    }
+#endif
+
+    while (!__atomic_load_n(&server->failed, __ATOMIC_ACQUIRE))
+    {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (__atomic_load_n(&server->stopping, __ATOMIC_ACQUIRE))
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            break;
+        }
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            perror("accept");
+            if (errno == EMFILE || errno == ENFILE)
+            {
+                // Wait for other connections to close
+                sleep(1);
+                continue;
+            }
+            break;
+        }
+
+        struct timeval timeout = {SERVE_TIMEOUT, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        while (read_request(fd, &worker.request) == success)
+        {
+            worker.out.length = 0;
+            worker.err.length = 0;
+            Status status = serve_request(&worker);
+            if (send_response(fd, status, &worker.out, &worker.err) == failure)
+            {
+                break;
+            }
+        }
+        close(fd);
+    }
+
+    free(worker.argv);
+    free_out_buffer(&worker.err);
+    free_out_buffer(&worker.out);
+    free_out_buffer(&worker.request);
+    free(worker.edit);
+    mp3tag_free(&worker.spare);
+    free_music(&worker.music);
+    return NULL;
+}
+
+/**
+ * Function: wait_for_stop
+ * Description: Waits for SIGINT, SIGTERM or SIGHUP, then wakes every worker blocked in accept
+ *              with an empty connection so it sees the stop flag.
+ * Input: arg - pointer to the shared Server struct.
+ * Output: Returns NULL once the workers have been woken.
+ */
+static void *wait_for_stop(void *arg)
+{
+    Server *server = arg;
+    struct sockaddr_un address;
+    sigset_t signals;
+    int signal_number;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    sigwait(&signals, &signal_number);
+    __atomic_store_n(&server->stopping, 1, __ATOMIC_RELEASE);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, server->path);
+    for (int i = 0; i < server->threads; i++)
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0)
+        {
+            connect(fd, (struct sockaddr *)&address, sizeof(address));
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Function: open_socket
+ * Description: Creates the listening socket, readable and writable by the owner only since the
+ *              server edits files with its own rights. A socket file left by a server that is no
+ *              longer running is replaced; one that still answers is an error.
+ * Input: server - pointer to the Server struct with the path set.
+ * Output: Returns success if the server is listening, or failure otherwise.
+ */
+static Status open_socket(Server *server)
+{
+    struct sockaddr_un address;
+    struct stat st;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, server->path);
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0)
+    {
+        perror("socket");
+        return failure;
+    }
+    if (lstat(server->path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int live = probe >= 0 && connect(probe, (struct sockaddr *)&address, sizeof(address)) == 0;
+        if (probe >= 0)
+        {
+            close(probe);
+        }
+        if (live)
+        {
+            fprintf(stderr, "ERROR: A server is already listening on %s\n", server->path);
+            return failure;
+        }
+        unlink(server->path);
+    }
+
+    mode_t mask = umask(0077);
+    int bound = bind(server->listen_fd, (struct sockaddr *)&address, sizeof(address));
+    umask(mask);
+    if (bound != 0 || listen(server->listen_fd, SOMAXCONN) != 0)
+    {
+        perror(server->path);
+        return failure;
+    }
+    return success;
+}
+
+/**
+ * Function: run_server
+ * Description: Serves view and edit requests on the socket with a pool of worker threads until a
+ *              stop signal arrives, then removes the socket and prints the cache counters.
+ * Input: server - pointer to the Server struct filled by read_and_validate_serve.
+ * Output: Returns success after a clean stop, or failure if the server could not start.
+ */
+Status run_server(Server *server)
+{
+    pthread_t stopper;
+    sigset_t signals;
+    Status status = failure;
+
+    server->cache = calloc(SERVE_CACHE_SLOTS, sizeof(ServeEntry));
+    if (server->cache == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to allocate the tag cache.\n");
+        return failure;
+    }
+    for (int i = 0; i < SERVE_CACHE_SLOTS; i++)
+    {
+        mp3tag_init(&server->cache[i].handle, NULL);
+    }
+    pthread_mutex_init(&server->cache_lock, NULL);
+    for (int i = 0; i < SERVE_FILE_LOCKS; i++)
+    {
+        pthread_mutex_init(&server->file_locks[i], NULL);
+    }
+    server->hits = 0;
+    server->misses = 0;
+
+    // Every thread started from here leaves the stop signals to wait_for_stop
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    if (open_socket(server) == success)
+    {
+        printf("----------SERVING ON %s WITH %d THREADS----------\n", server->path, server->threads);
+        fflush(stdout);
+        if (pthread_create(&stopper, NULL, wait_for_stop, server) != 0)
+        {
+            fprintf(stderr, "ERROR: Failed to start the signal thread.\n");
+        }
+        else
+        {
+            status = run_workers(server->threads, (size_t)server->threads, serve_worker, server);
+            if (!__atomic_load_n(&server->stopping, __ATOMIC_ACQUIRE))
+            {
+                // The workers gave up on their own
+                pthread_cancel(stopper);
+                status = failure;
+            }
+            pthread_join(stopper, NULL);
+            if (__atomic_load_n(&server->failed, __ATOMIC_ACQUIRE))
+            {
+                fprintf(stderr, "ERROR: A worker could not get a working directory of its own.\n");
+                status = failure;
+            }
+        }
+        unlink(server->path);
+        printf("CACHE    :   %zu hits, %zu misses\n", server->hits, server->misses);
+    }
+
+    if (server->listen_fd >= 0)
+    {
+        close(server->listen_fd);
+    }
+    for (int i = 0; i < SERVE_CACHE_SLOTS; i++)
+    {
+        mp3tag_free(&server->cache[i].handle);
+    }
+    free(server->cache);
+    server->cache = NULL;
+    for (int i = 0; i < SERVE_FILE_LOCKS; i++)
+    {
+        pthread_mutex_destroy(&server->file_locks[i]);
+    }
+    pthread_mutex_destroy(&server->cache_lock);
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+    return status;
+}
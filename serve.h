@@ -0,0 +1,64 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include "type.h"
+#include "mp3tag_private.h"
+
+/*
+ * Protocol of --serve over a Unix domain stream socket. Every message is a 4-byte little-endian
+ * length followed by that many bytes, and a connection may carry any number of requests.
+ *
+ * Request:  the client's working directory, then the arguments of one command as given after
+ *           ./a.out, each null terminated: "/home/me\0-v\0--fields\0TIT2\0song.mp3\0".
+ *           -v (one or many files) and -e (one file) are served.
+ * Response: a status byte (0 success, 1 failure), the 4-byte little-endian length of the
+ *           output, the output the command prints on stdout, then its error messages.
+ */
+#define SERVE_MAX_REQUEST (1024 * 1024)  // Largest request accepted
+#define SERVE_RESPONSE_HEADER 5          // Status byte and output length
+#define SERVE_CACHE_SLOTS 4096           // Entries of the frame index cache, a power of two
+#define SERVE_CACHE_TAG_LIMIT (64 * 1024) // Largest ID3v2 tag kept in the cache
+#define SERVE_FILE_LOCKS 64              // Locks serialising edits, picked by the file's inode
+#define SERVE_TIMEOUT 30                 // Seconds a client may stay silent before it is dropped
+
+/**
+ * Structure to hold the tags of one file in the frame index cache: the whole ID3v2 tag with
+ * every frame indexed and the ID3v1 trailer, valid while the file's identity and times match.
+ */
+typedef struct
+{
+    dev_t dev;             // Device of the file
+    ino_t ino;             // Inode of the file
+    off_t size;            // File size when the tags were read
+    struct timespec mtime; // Modification time when the tags were read
+    struct timespec ctime; // Status change time, catches edits that keep size and mtime
+    int valid;             // Set if the entry holds a file
+    Mp3Tag handle;         // The tags, detached from the file
+} ServeEntry;
+
+/**
+ * Structure to hold the state of a running server, shared by its workers.
+ */
+typedef struct
+{
+    const char *path;          // Socket path
+    int listen_fd;             // Listening socket
+    int threads;               // Number of worker threads
+    int stopping;              // Set once a stop signal arrived
+    int failed;                // Set by a worker that could not start, stops the server
+
+    ServeEntry *cache;         // SERVE_CACHE_SLOTS entries, picked by (dev, ino)
+    pthread_mutex_t cache_lock; // Protects cache and the counters
+    size_t hits;               // Views answered from the cache
+    size_t misses;             // Views that read the file
+
+    pthread_mutex_t file_locks[SERVE_FILE_LOCKS]; // Edits and cache fills of one file take turns
+} Server;
+
+// Function prototypes
+Status read_and_validate_serve(int argc, char *argv[], Server *server);
+Status run_server(Server *server);
+
+#endif // SERVE_H
@@ -0,0 +1,270 @@
+#include <pthread.h>
+#include <time.h>
+#include "type.h"
+#include "stats.h"
+#include "out_buffer.h"
+
+/**
+ * Names of the phases in the report, in StatsPhase order.
+ */
+static const char *const phase_names[STATS_PHASES] = {"open", "header", "frames", "decode", "output", "write", "commit"};
+
+int stats_enabled = 0;                 // Set by --stats or --stats-json
+static int stats_print = 0;            // Set by --stats to print the report
+static const char *stats_json = NULL;  // File for the JSON snapshot, - for stdout
+static ThreadStats *stats_threads = NULL;              // Counters of every thread that recorded something
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER; // Protects stats_threads
+static __thread ThreadStats *local_stats = NULL;       // Counters of the calling thread
+
+/**
+ * Function: thread_stats
+ * Description: Gives the counters of the calling thread, allocating and registering them on the
+ *              first call. Only this registration takes a lock.
+ * Input: None.
+ * Output: Returns the thread's counters, or NULL if memory is exhausted.
+ */
+static ThreadStats *thread_stats(void)
+{
+    if (local_stats == NULL)
+    {
+        local_stats = calloc(1, sizeof(ThreadStats));
+        if (local_stats != NULL)
+        {
+            pthread_mutex_lock(&stats_lock);
+            local_stats->next = stats_threads;
+            stats_threads = local_stats;
+            pthread_mutex_unlock(&stats_lock);
+        }
+    }
+    return local_stats;
+}
+
+/**
+ * Function: stats_clock
+ * Description: Reads the monotonic clock.
+ * Input: None.
+ * Output: Returns the time in nanoseconds, never 0.
+ */
+uint64_t stats_clock(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec + 1;
+}
+
+/**
+ * Function: stats_record
+ * Description: Counts one call of a phase in the thread's histogram.
+ * Input: phase - the phase, start - the time stats_begin returned.
+ * Output: The thread's counters are updated.
+ */
+void stats_record(StatsPhase phase, uint64_t start)
+{
+    uint64_t elapsed = stats_clock() - start;
+    ThreadStats *stats = thread_stats();
+    if (stats == NULL)
+    {
+        return;
+    }
+
+    PhaseStats *entry = &stats->phase[phase];
+    int bucket = elapsed < 2 ? 0 : 63 - __builtin_clzll(elapsed);
+    entry->count++;
+    entry->total_ns += elapsed;
+    entry->max_ns = elapsed > entry->max_ns ? elapsed : entry->max_ns;
+    entry->buckets[bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1]++;
+}
+
+/**
+ * Function: stats_count_io
+ * Description: Adds system calls and bytes to the thread's counters.
+ * Input: syscalls - number of calls, bytes_read - bytes read, bytes_written - bytes written.
+ * Output: The thread's counters are updated.
+ */
+void stats_count_io(uint64_t syscalls, uint64_t bytes_read, uint64_t bytes_written)
+{
+    ThreadStats *stats = thread_stats();
+    if (stats != NULL)
+    {
+        stats->syscalls += syscalls;
+        stats->bytes_read += bytes_read;
+        stats->bytes_written += bytes_written;
+    }
+}
+
+/**
+ * Function: read_stats_options
+ * Description: Takes --stats and --stats-json <file> out of the arguments, wherever they are, so
+ *              every operation accepts them. The report is printed when the program exits.
+ * Input: argc - pointer to the argument count, argv - argument vector, both updated.
+ * Output: Statistics are enabled if either option was given.
+ */
+void read_stats_options(int *argc, char *argv[])
+{
+    int kept = 1;
+
+    for (int i = 1; i < *argc; i++)
+    {
+        if (strcmp(argv[i], "--stats") == 0)
+        {
+            stats_print = 1;
+        }
+        else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < *argc)
+        {
+            stats_json = argv[++i];
+        }
+        else
+        {
+            argv[kept++] = argv[i];
+        }
+    }
+    argv[kept] = NULL;
+    *argc = kept;
+    if (stats_print || stats_json != NULL)
+    {
+        stats_enabled = 1;
+        atexit(report_stats);
+    }
+}
+
+/**
+ * Function: percentile
+ * Description: Finds the histogram bucket holding a percentile of the calls.
+ * Input: entry - the phase, percent - 1 to 100.
+ * Output: Returns the upper bound of the bucket in nanoseconds, at most the slowest call.
+ */
+static uint64_t percentile(const PhaseStats *entry, int percent)
+{
+    uint64_t rank = (entry->count * (uint64_t)percent + 99) / 100;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < STATS_BUCKETS; i++)
+    {
+        seen += entry->buckets[i];
+        if (seen >= rank && seen > 0)
+        {
+            uint64_t bound = (2ULL << i) - 1;
+            return bound < entry->max_ns ? bound : entry->max_ns;
+        }
+    }
+    return entry->max_ns;
+}
+
+/**
+ * Function: format_stats_json
+ * Description: Appends the summed counters as one JSON object.
+ * Input: total - the summed counters, threads - number of threads, out - buffer receiving the text.
+ * Output: out holds the snapshot and a newline.
+ */
+static void format_stats_json(const ThreadStats *total, int threads, OutBuffer *out)
+{
+    out_printf(out, "{\"threads\":%d,\"bytes_read\":%llu,\"bytes_written\":%llu,\"syscalls\":%llu,\"phases\":{",
+               threads, (unsigned long long)total->bytes_read, (unsigned long long)total->bytes_written,
+               (unsigned long long)total->syscalls);
+    for (int p = 0; p < STATS_PHASES; p++)
+    {
+        const PhaseStats *entry = &total->phase[p];
+        out_printf(out, "%s\"%s\":{\"count\":%llu,\"total_ns\":%llu,\"max_ns\":%llu,\"p50_ns\":%llu,\"p99_ns\":%llu,\"histogram\":[",
+                   p > 0 ? "," : "", phase_names[p], (unsigned long long)entry->count,
+                   (unsigned long long)entry->total_ns, (unsigned long long)entry->max_ns,
+                   (unsigned long long)percentile(entry, 50), (unsigned long long)percentile(entry, 99));
+        // Trailing empty buckets are left out
+        int last = STATS_BUCKETS;
+        while (last > 0 && entry->buckets[last - 1] == 0)
+        {
+            last--;
+        }
+        for (int i = 0; i < last; i++)
+        {
+            out_printf(out, "%s%llu", i > 0 ? "," : "", (unsigned long long)entry->buckets[i]);
+        }
+        out_puts(out, "]}");
+    }
+    out_puts(out, "}}\n");
+}
+
+/**
+ * Function: format_stats_text
+ * Description: Appends the summed counters as a table, times in milliseconds and microseconds.
+ * Input: total - the summed counters, threads - number of threads, out - buffer receiving the text.
+ * Output: out holds the report.
+ */
+static void format_stats_text(const ThreadStats *total, int threads, OutBuffer *out)
+{
+    out_printf(out, "----------STATS OF %d THREAD%s----------\n", threads, threads == 1 ? "" : "S");
+    out_printf(out, "%-8s %10s %12s %10s %10s %10s %10s\n", "PHASE", "CALLS", "TOTAL ms", "MEAN us", "P50 us", "P99 us", "MAX us");
+    for (int p = 0; p < STATS_PHASES; p++)
+    {
+        const PhaseStats *entry = &total->phase[p];
+        double mean = entry->count > 0 ? (double)entry->total_ns / (double)entry->count : 0;
+        out_printf(out, "%-8s %10llu %12.3f %10.3f %10.3f %10.3f %10.3f\n", phase_names[p],
+                   (unsigned long long)entry->count, (double)entry->total_ns / 1e6, mean / 1e3,
+                   (double)percentile(entry, 50) / 1e3, (double)percentile(entry, 99) / 1e3,
+                   (double)entry->max_ns / 1e3);
+    }
+    out_printf(out, "READ     :   %llu bytes\n", (unsigned long long)total->bytes_read);
+    out_printf(out, "WRITTEN  :   %llu bytes\n", (unsigned long long)total->bytes_written);
+    out_printf(out, "SYSCALLS :   %llu\n", (unsigned long long)total->syscalls);
+}
+
+/**
+ * Function: report_stats
+ * Description: Sums the counters of every thread and prints the report to stderr for --stats and
+ *              the JSON snapshot for --stats-json. Registered with atexit, after the workers
+ *              have been joined.
+ * Input: None.
+ * Output: The report is written and the counters are released.
+ */
+void report_stats(void)
+{
+    ThreadStats total;
+    OutBuffer out;
+    int threads = 0;
+
+    // Writing the report is not part of the statistics
+    stats_enabled = 0;
+    memset(&total, 0, sizeof(total));
+    pthread_mutex_lock(&stats_lock);
+    for (ThreadStats *stats = stats_threads; stats != NULL; stats = stats->next)
+    {
+        for (int p = 0; p < STATS_PHASES; p++)
+        {
+            total.phase[p].count += stats->phase[p].count;
+            total.phase[p].total_ns += stats->phase[p].total_ns;
+            if (stats->phase[p].max_ns > total.phase[p].max_ns)
+            {
+                total.phase[p].max_ns = stats->phase[p].max_ns;
+            }
+            for (int i = 0; i < STATS_BUCKETS; i++)
+            {
+                total.phase[p].buckets[i] += stats->phase[p].buckets[i];
+            }
+        }
+        total.bytes_read += stats->bytes_read;
+        total.bytes_written += stats->bytes_written;
+        total.syscalls += stats->syscalls;
+        threads++;
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    init_out_buffer(&out);
+    if (stats_print)
+    {
+        format_stats_text(&total, threads, &out);
+        write_out_buffer(&out, stderr);
+    }
+    if (stats_json != NULL)
+    {
+        FILE *fptr = strcmp(stats_json, "-") == 0 ? stdout : fopen(stats_json, "w");
+        format_stats_json(&total, threads, &out);
+        if (fptr == NULL || write_out_buffer(&out, fptr) == failure)
+        {
+            perror(stats_json);
+        }
+        if (fptr != NULL && fptr != stdout)
+        {
+            fclose(fptr);
+        }
+    }
+    free_out_buffer(&out);
+}
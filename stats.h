@@ -0,0 +1,95 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "type.h"
+
+#define STATS_BUCKETS 40 // Latency histogram buckets, bucket i counts calls of 2^i to 2^(i+1) - 1 ns
+
+/**
+ * Phases timed by --stats. Each thread counts into its own ThreadStats, the threads are only
+ * summed when the report is printed, so workers never share a cache line for the counters.
+ */
+typedef enum
+{
+    phase_open,   // Opening the mp3 file
+    phase_header, // Reading and checking the ID3v2 header
+    phase_frames, // Walking the frames and loading the wanted ones
+    phase_decode, // Decoding frame text to UTF-8, with the ID3v1 fallback
+    phase_output, // Formatting the text, ndjson or bin output
+    phase_write,  // Writing the output, or the new tag and the copied audio of an edit
+    phase_commit, // Flushing and renaming an edited copy over the original
+    STATS_PHASES  // Number of phases
+} StatsPhase;
+
+/**
+ * Structure to hold the calls and latency histogram of one phase.
+ */
+typedef struct
+{
+    uint64_t count;                  // Number of calls
+    uint64_t total_ns;               // Time of all calls
+    uint64_t max_ns;                 // Slowest call
+    uint64_t buckets[STATS_BUCKETS]; // Calls per power of two nanoseconds
+} PhaseStats;
+
+/**
+ * Structure to hold the counters of one thread, linked into a list so they can be summed.
+ */
+typedef struct ThreadStats
+{
+    PhaseStats phase[STATS_PHASES]; // Time spent in each phase
+    uint64_t bytes_read;            // Bytes read from files
+    uint64_t bytes_written;         // Bytes written to files and stdout
+    uint64_t syscalls;              // System calls issued
+    struct ThreadStats *next;       // Next thread in the list
+} ThreadStats;
+
+extern int stats_enabled;
+
+// Function prototypes
+uint64_t stats_clock(void);
+void stats_record(StatsPhase phase, uint64_t start);
+void stats_count_io(uint64_t syscalls, uint64_t bytes_read, uint64_t bytes_written);
+void read_stats_options(int *argc, char *argv[]);
+void report_stats(void);
+
+/**
+ * Function: stats_begin
+ * Description: Starts timing a phase.
+ * Input: None.
+ * Output: Returns the start time, or 0 when --stats is off.
+ */
+static inline uint64_t stats_begin(void)
+{
+    return stats_enabled ? stats_clock() : 0;
+}
+
+/**
+ * Function: stats_end
+ * Description: Ends timing a phase started with stats_begin.
+ * Input: phase - the phase, start - the value stats_begin returned.
+ * Output: The call is counted in the thread's histogram of the phase.
+ */
+static inline void stats_end(StatsPhase phase, uint64_t start)
+{
+    if (start != 0)
+    {
+        stats_record(phase, start);
+    }
+}
+
+/**
+ * Function: stats_io
+ * Description: Counts system calls and the bytes they moved.
+ * Input: syscalls - number of calls, bytes_read - bytes read, bytes_written - bytes written.
+ * Output: The thread's counters are updated when --stats is on.
+ */
+static inline void stats_io(uint64_t syscalls, uint64_t bytes_read, uint64_t bytes_written)
+{
+    if (stats_enabled)
+    {
+        stats_count_io(syscalls, bytes_read, bytes_written);
+    }
+}
+
+#endif // STATS_H
@@ -0,0 +1,551 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "type.h"
+#include "tag_cache.h"
+
+#define CACHE_HEADER_SIZE 16 // Magic (8 bytes), version (4 bytes), reserved (4 bytes)
+#define CACHE_VERSION 2      // Layout version of CacheRecord, 2 holds UTF-8 decoded fields
+
+/**
+ * Function: record_size
+ * Description: Computes the number of bytes a record takes in the file, padding included.
+ * Input: record - pointer to the record header.
+ * Output: Returns the size of the record rounded up to a multiple of 8.
+ */
+static size_t record_size(const CacheRecord *record)
+{
+    size_t size = sizeof(CacheRecord) + record->path_length;
+    for (int i = 0; i < VIEW_FIELDS; i++)
+    {
+        if (record->field_length[i] != CACHE_MISSING)
+        {
+            size += record->field_length[i];
+        }
+    }
+    return (size + 7) & ~(size_t)7;
+}
+
+/**
+ * Function: hash_key
+ * Description: Mixes a device and inode number into a hash table position.
+ * Input: dev - device number, ino - inode number.
+ * Output: Returns the hash value.
+ */
+static uint64_t hash_key(uint64_t dev, uint64_t ino)
+{
+    uint64_t hash = (ino ^ (dev << 32) ^ (dev >> 32)) * 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 29);
+}
+
+/**
+ * Function: find_slot
+ * Description: Finds the hash table slot holding a key, or the empty slot where it would go.
+ * Input: cache - pointer to the TagCache, dev - device number, ino - inode number.
+ * Output: Returns a pointer to the slot.
+ */
+static const CacheRecord **find_slot(const TagCache *cache, uint64_t dev, uint64_t ino)
+{
+    size_t mask = cache->slot_count - 1;
+    size_t pos = hash_key(dev, ino) & mask;
+    while (cache->slots[pos] != NULL && (cache->slots[pos]->dev != dev || cache->slots[pos]->ino != ino))
+    {
+        pos = (pos + 1) & mask;
+    }
+    return &cache->slots[pos];
+}
+
+/**
+ * Function: next_record
+ * Description: Returns the record starting at offset if it lies completely inside the mapping.
+ * Input: cache - pointer to the TagCache, offset - position of the record in the mapping.
+ * Output: Returns the record, or NULL at the end of the file or at a truncated record.
+ */
+static const CacheRecord *next_record(const TagCache *cache, size_t offset)
+{
+    if (offset + sizeof(CacheRecord) > cache->map_size)
+    {
+        return NULL;
+    }
+    const CacheRecord *record = (const CacheRecord *)(cache->map + offset);
+    if (offset + record_size(record) > cache->map_size)
+    {
+        return NULL;
+    }
+    return record;
+}
+
+/**
+ * Function: open_tag_cache
+ * Description: Maps the cache file read-only and indexes its records by (device, inode). When a
+ *              file has several records the latest one wins, so refreshed entries simply shadow
+ *              the stale ones. A missing cache file, or one of an older version, gives an empty cache.
+ * Input: fname - the cache file name, cache - pointer to the TagCache struct to fill.
+ * Output: Returns success if the cache is ready, or failure if the file is not a tag cache.
+ */
+Status open_tag_cache(const char *fname, TagCache *cache)
+{
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->fname = strdup(fname);
+    if (cache->fname == NULL)
+    {
+        close_tag_cache(cache);
+        return failure;
+    }
+
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0 && errno != ENOENT)
+    {
+        perror(fname);
+        close_tag_cache(cache);
+        return failure;
+    }
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        cache->map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (cache->map == MAP_FAILED)
+        {
+            cache->map = NULL;
+        }
+        else
+        {
+            cache->map_size = (size_t)st.st_size;
+        }
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    if (cache->map != NULL && cache->map_size >= CACHE_HEADER_SIZE && memcmp(cache->map, CACHE_MAGIC, 8) == 0 &&
+        *(const uint32_t *)(cache->map + 8) != CACHE_VERSION)
+    {
+        // Records of an older layout are dropped, the file is rewritten when the cache is closed
+        munmap(cache->map, cache->map_size);
+        cache->map = NULL;
+        cache->map_size = 0;
+    }
+    if (cache->map != NULL && (cache->map_size < CACHE_HEADER_SIZE || memcmp(cache->map, CACHE_MAGIC, 8) != 0))
+    {
+        fprintf(stderr, "ERROR: %s is not a tag cache\n", fname);
+        close_tag_cache(cache);
+        return failure;
+    }
+
+    // Count the records, then size the hash table to stay at most half full
+    size_t offset = CACHE_HEADER_SIZE;
+    const CacheRecord *record;
+    while ((record = next_record(cache, offset)) != NULL)
+    {
+        cache->record_count++;
+        offset += record_size(record);
+    }
+    cache->slot_count = 16;
+    while (cache->slot_count < cache->record_count * 2)
+    {
+        cache->slot_count *= 2;
+    }
+    cache->slots = calloc(cache->slot_count, sizeof(CacheRecord *));
+    if (cache->slots == NULL)
+    {
+        close_tag_cache(cache);
+        return failure;
+    }
+
+    offset = CACHE_HEADER_SIZE;
+    while ((record = next_record(cache, offset)) != NULL)
+    {
+        *find_slot(cache, record->dev, record->ino) = record;
+        offset += record_size(record);
+    }
+    return success;
+}
+
+/**
+ * Function: lookup_tag_cache
+ * Description: Finds the record for a file whose size and modification time still match.
+ *              Safe to call from several threads at once.
+ * Input: cache - pointer to the TagCache, st - stat of the file.
+ * Output: Returns the record on a hit, or NULL if the file is not cached or has changed.
+ */
+const CacheRecord *lookup_tag_cache(TagCache *cache, const struct stat *st)
+{
+    const CacheRecord *record = *find_slot(cache, (uint64_t)st->st_dev, (uint64_t)st->st_ino);
+    if (record != NULL && record->size == (uint64_t)st->st_size &&
+        record->mtime_sec == (int64_t)st->st_mtim.tv_sec && record->mtime_nsec == (uint32_t)st->st_mtim.tv_nsec)
+    {
+        __atomic_add_fetch(&cache->hits, 1, __ATOMIC_RELAXED);
+        return record;
+    }
+    __atomic_add_fetch(&cache->misses, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/**
+ * Function: cache_record_fields
+ * Description: Copies the field values of a cache record into a TagFields struct.
+ * Input: record - the cache record, fields - receives the field values.
+ * Output: fields holds the cached values.
+ */
+void cache_record_fields(const CacheRecord *record, TagFields *fields)
+{
+    const unsigned char *ptr = (const unsigned char *)(record + 1) + record->path_length;
+
+    fields->text.length = 0;
+    fields->count = VIEW_FIELDS;
+    for (int i = 0; i < VIEW_FIELDS; i++)
+    {
+        fields->offset[i] = fields->text.length;
+        fields->found[i] = record->field_length[i] != CACHE_MISSING;
+        if (fields->found[i])
+        {
+            out_append(&fields->text, ptr, record->field_length[i]);
+            ptr += record->field_length[i];
+        }
+        fields->length[i] = fields->text.length - fields->offset[i];
+    }
+}
+
+/**
+ * Function: add_tag_cache
+ * Description: Queues a record for a file that was read because of a miss. Records are written
+ *              to the cache file by close_tag_cache. A file with a value too long for a record
+ *              is not cached, so it is always read live rather than shown cut short. Safe to
+ *              call from several threads at once.
+ * Input: cache - pointer to the TagCache, path - the file name, st - stat of the file taken before
+ *        it was read, fields - the field values read from the file.
+ * Output: Returns success if the record was queued or the file cannot be cached, or failure if
+ *         allocation fails.
+ */
+Status add_tag_cache(TagCache *cache, const char *path, const struct stat *st, const TagFields *fields)
+{
+    CacheRecord record;
+    char absolute[PATH_MAX];
+
+    // The absolute path lets --cache-compact check the file from any directory
+    if (realpath(path, absolute) != NULL)
+    {
+        path = absolute;
+    }
+    size_t path_length = strlen(path);
+
+    if (path_length >= CACHE_MISSING)
+    {
+        return failure;
+    }
+    memset(&record, 0, sizeof(record));
+    record.dev = (uint64_t)st->st_dev;
+    record.ino = (uint64_t)st->st_ino;
+    record.size = (uint64_t)st->st_size;
+    record.mtime_sec = (int64_t)st->st_mtim.tv_sec;
+    record.mtime_nsec = (uint32_t)st->st_mtim.tv_nsec;
+    record.path_length = (uint16_t)path_length;
+    for (int i = 0; i < VIEW_FIELDS; i++)
+    {
+        if (fields->found[i] && fields->length[i] >= CACHE_MISSING)
+        {
+            return success;
+        }
+        record.field_length[i] = fields->found[i] ? (uint16_t)fields->length[i] : CACHE_MISSING;
+    }
+    size_t size = record_size(&record);
+
+    pthread_mutex_lock(&cache->lock);
+    if (cache->pending_length + size > cache->pending_capacity)
+    {
+        size_t capacity = cache->pending_capacity ? cache->pending_capacity : BUFFER_SIZE;
+        while (capacity < cache->pending_length + size)
+        {
+            capacity *= 2;
+        }
+        unsigned char *pending = realloc(cache->pending, capacity);
+        if (pending == NULL)
+        {
+            pthread_mutex_unlock(&cache->lock);
+            return failure;
+        }
+        cache->pending = pending;
+        cache->pending_capacity = capacity;
+    }
+    unsigned char *ptr = cache->pending + cache->pending_length;
+    memset(ptr, 0, size);
+    memcpy(ptr, &record, sizeof(record));
+    ptr += sizeof(record);
+    memcpy(ptr, path, path_length);
+    ptr += path_length;
+    for (int i = 0; i < VIEW_FIELDS; i++)
+    {
+        if (record.field_length[i] != CACHE_MISSING)
+        {
+            memcpy(ptr, fields->text.data + fields->offset[i], record.field_length[i]);
+            ptr += record.field_length[i];
+        }
+    }
+    cache->pending_length += size;
+    cache->pending_count++;
+    pthread_mutex_unlock(&cache->lock);
+    return success;
+}
+
+/**
+ * Function: write_cache_header
+ * Description: Writes the magic and version at the start of a new cache file.
+ * Input: fd - descriptor of the cache file.
+ * Output: Returns success if the header was written, or failure on a write error.
+ */
+static Status write_cache_header(int fd)
+{
+    unsigned char header[CACHE_HEADER_SIZE] = {0};
+    uint32_t version = CACHE_VERSION;
+
+    memcpy(header, CACHE_MAGIC, 8);
+    memcpy(header + 8, &version, sizeof(version));
+    return write(fd, header, CACHE_HEADER_SIZE) == CACHE_HEADER_SIZE ? success : failure;
+}
+
+/**
+ * Function: lock_cache_file
+ * Description: Opens the cache file and takes an exclusive lock on it, so runs sharing a cache
+ *              append one after the other. A file replaced by --cache-compact while waiting for
+ *              the lock is opened again by name.
+ * Input: fname - the cache file name, create - set to create a missing file, readable by the
+ *        users the umask allows.
+ * Output: Returns the locked descriptor, or -1 if the file cannot be opened or locked.
+ */
+static int lock_cache_file(const char *fname, int create)
+{
+    for (;;)
+    {
+        struct stat held;
+        struct stat named;
+        int fd = open(fname, create ? O_RDWR | O_CREAT : O_RDWR, 0666);
+        if (fd < 0)
+        {
+            return -1;
+        }
+        if (flock(fd, LOCK_EX) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+        if (fstat(fd, &held) == 0 && stat(fname, &named) == 0 && held.st_dev == named.st_dev &&
+            held.st_ino == named.st_ino)
+        {
+            return fd;
+        }
+        close(fd);
+    }
+}
+
+/**
+ * Function: locked_valid_size
+ * Description: Finds the end of the last complete record of the locked cache file. The file is
+ *              walked again rather than trusting the mapping, since other runs may have appended
+ *              to it since it was opened.
+ * Input: fd - the locked cache file.
+ * Output: Returns the size to keep, or 0 if the file is empty, not a cache of this version, or unreadable.
+ */
+static size_t locked_valid_size(int fd)
+{
+    struct stat st;
+    TagCache view;
+
+    if (fstat(fd, &st) != 0 || st.st_size < CACHE_HEADER_SIZE)
+    {
+        return 0;
+    }
+    memset(&view, 0, sizeof(view));
+    view.map_size = (size_t)st.st_size;
+    view.map = mmap(NULL, view.map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view.map == MAP_FAILED)
+    {
+        return 0;
+    }
+
+    size_t offset = 0;
+    if (memcmp(view.map, CACHE_MAGIC, 8) == 0 && *(const uint32_t *)(view.map + 8) == CACHE_VERSION)
+    {
+        const CacheRecord *record;
+        offset = CACHE_HEADER_SIZE;
+        while ((record = next_record(&view, offset)) != NULL)
+        {
+            offset += record_size(record);
+        }
+    }
+    munmap(view.map, view.map_size);
+    return offset;
+}
+
+/**
+ * Function: close_tag_cache
+ * Description: Appends the records added during this run to the cache file and releases the
+ *              cache. The append holds an exclusive lock on the file.
+ * Input: cache - pointer to the TagCache.
+ * Output: Returns success if the new records were saved, or failure on a write error.
+ */
+Status close_tag_cache(TagCache *cache)
+{
+    Status status = success;
+
+    if (cache->pending_length > 0)
+    {
+        int fd = lock_cache_file(cache->fname, 1);
+        if (fd < 0)
+        {
+            perror(cache->fname);
+            status = failure;
+        }
+        else
+        {
+            // Start a new file, or drop a torn record left at the end of the old one
+            size_t valid_size = locked_valid_size(fd);
+            if (valid_size == 0)
+            {
+                status = ftruncate(fd, 0) == 0 ? write_cache_header(fd) : failure;
+            }
+            else if (ftruncate(fd, (off_t)valid_size) != 0 || lseek(fd, 0, SEEK_END) < 0)
+            {
+                status = failure;
+            }
+            if (status == success &&
+                write(fd, cache->pending, cache->pending_length) != (ssize_t)cache->pending_length)
+            {
+                status = failure;
+            }
+            if (status == failure)
+            {
+                perror(cache->fname);
+            }
+            close(fd);
+        }
+    }
+
+    if (cache->map != NULL)
+    {
+        munmap(cache->map, cache->map_size);
+    }
+    free(cache->slots);
+    free(cache->pending);
+    free(cache->fname);
+    pthread_mutex_destroy(&cache->lock);
+    cache->map = NULL;
+    cache->slots = NULL;
+    cache->pending = NULL;
+    cache->fname = NULL;
+    return status;
+}
+
+/**
+ * Function: print_cache_stats
+ * Description: Prints the hit and miss counters of the cache on stderr.
+ * Input: cache - pointer to the TagCache.
+ * Output: One summary line on stderr.
+ */
+void print_cache_stats(const TagCache *cache)
+{
+    fprintf(stderr, "CACHE    :   %zu hits, %zu misses, %zu records\n",
+            cache->hits, cache->misses, cache->record_count + cache->pending_count);
+}
+
+/**
+ * Function: compact_tag_cache
+ * Description: Rewrites the cache file with only the latest record of every file that still
+ *              exists unchanged. The new file is written next to the old one with the same
+ *              permissions and renamed over it, holding the lock of the old one so no run appends
+ *              to it meanwhile.
+ * Input: fname - the cache file name.
+ * Output: Returns success if the cache was compacted, or failure if it does not exist or there
+ *         is an error.
+ */
+Status compact_tag_cache(const char *fname)
+{
+    TagCache cache;
+    char temp_fname[PATH_MAX];
+    struct stat cache_st;
+    size_t kept = 0;
+    int lock_fd = lock_cache_file(fname, 0);
+
+    if (lock_fd < 0 || fstat(lock_fd, &cache_st) != 0)
+    {
+        perror(fname);
+        if (lock_fd >= 0)
+        {
+            close(lock_fd);
+        }
+        return failure;
+    }
+    if (open_tag_cache(fname, &cache) == failure)
+    {
+        close(lock_fd);
+        return failure;
+    }
+    if (snprintf(temp_fname, sizeof(temp_fname), "%s.XXXXXX", fname) >= (int)sizeof(temp_fname))
+    {
+        close_tag_cache(&cache);
+        close(lock_fd);
+        return failure;
+    }
+    int fd = mkstemp(temp_fname);
+    if (fd < 0)
+    {
+        perror("mkstemp");
+        close_tag_cache(&cache);
+        close(lock_fd);
+        return failure;
+    }
+
+    // mkstemp creates the file for its owner only, a shared cache must stay readable
+    fchmod(fd, cache_st.st_mode & 07777);
+    Status status = write_cache_header(fd);
+    size_t offset = CACHE_HEADER_SIZE;
+    const CacheRecord *record;
+    while (status == success && (record = next_record(&cache, offset)) != NULL)
+    {
+        size_t size = record_size(record);
+        offset += size;
+
+        // Keep only the latest record of each file, and only if the file is unchanged
+        if (*find_slot(&cache, record->dev, record->ino) != record)
+        {
+            continue;
+        }
+        char path[PATH_MAX];
+        struct stat st;
+        if (record->path_length >= sizeof(path))
+        {
+            continue;
+        }
+        memcpy(path, record + 1, record->path_length);
+        path[record->path_length] = '\0';
+        if (stat(path, &st) != 0 || (uint64_t)st.st_dev != record->dev || (uint64_t)st.st_ino != record->ino ||
+            (uint64_t)st.st_size != record->size || (int64_t)st.st_mtim.tv_sec != record->mtime_sec ||
+            (uint32_t)st.st_mtim.tv_nsec != record->mtime_nsec)
+        {
+            continue;
+        }
+        if (write(fd, record, size) != (ssize_t)size)
+        {
+            status = failure;
+        }
+        kept++;
+    }
+
+    if (status == success && fsync(fd) == 0 && rename(temp_fname, fname) == 0)
+    {
+        printf("----------CACHE COMPACTED: %zu OF %zu RECORDS KEPT----------\n", kept, cache.record_count);
+    }
+    else
+    {
+        perror(fname);
+        unlink(temp_fname);
+        status = failure;
+    }
+    close(fd);
+    close_tag_cache(&cache);
+    close(lock_fd);
+    return status;
+}
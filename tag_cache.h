@@ -0,0 +1,59 @@
+#ifndef TAG_CACHE_H
+#define TAG_CACHE_H
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include "type.h"
+#include "view.h"
+
+#define CACHE_MAGIC "MP3TAGC1" // First 8 bytes of a cache file
+#define CACHE_MISSING 0xFFFF   // Field length stored for a frame that is not in the tag
+
+/**
+ * Structure stored in front of every cache record. It is followed by the absolute path, then
+ * the field values back to back, then padding up to a multiple of 8 bytes.
+ */
+typedef struct
+{
+    uint64_t dev;                       // Device of the file
+    uint64_t ino;                       // Inode of the file
+    uint64_t size;                      // File size when the record was written
+    int64_t mtime_sec;                  // Modification time, seconds
+    uint32_t mtime_nsec;                // Modification time, nanoseconds
+    uint16_t path_length;               // Length of the path that follows
+    uint16_t field_length[VIEW_FIELDS]; // Length of each field, CACHE_MISSING if absent
+} CacheRecord;
+
+/**
+ * Structure to hold an open tag cache: the mmapped file, a hash table over its records and
+ * the records added during this run.
+ */
+typedef struct
+{
+    char *fname;                // Cache file name
+    unsigned char *map;         // Cache file mapped read-only, NULL if empty or missing
+    size_t map_size;            // Size of the mapping
+    const CacheRecord **slots;  // Open addressing hash table keyed by (dev, ino)
+    size_t slot_count;          // Size of the table, a power of two
+    size_t record_count;        // Number of records in the mapping
+
+    unsigned char *pending;     // New records, appended to the file when the cache is closed
+    size_t pending_length;      // Bytes used in pending
+    size_t pending_capacity;    // Allocated size of pending
+    size_t pending_count;       // Number of records in pending
+    pthread_mutex_t lock;       // Protects pending and the counters
+
+    size_t hits;                // Lookups answered from the cache
+    size_t misses;              // Lookups that had to read the file
+} TagCache;
+
+// Function prototypes
+Status open_tag_cache(const char *fname, TagCache *cache);
+const CacheRecord *lookup_tag_cache(TagCache *cache, const struct stat *st);
+void cache_record_fields(const CacheRecord *record, TagFields *fields);
+Status add_tag_cache(TagCache *cache, const char *path, const struct stat *st, const TagFields *fields);
+Status close_tag_cache(TagCache *cache);
+void print_cache_stats(const TagCache *cache);
+Status compact_tag_cache(const char *fname);
+
+#endif // TAG_CACHE_H
@@ -0,0 +1,192 @@
+/**
+ * Round trip of non-ASCII edits through the editor and the reader.
+ *
+ * Build and run: make test
+ * Usage: ./edit_roundtrip [scratch dir]
+ *
+ * Writes a small ID3v2.3 file, applies UTF-8 edits with mp3tag_apply_edits and reads every
+ * field back with mp3tag_get_field. Text that fits in ISO-8859-1 must be stored with encoding
+ * byte 0, other text as UTF-16 with a byte order mark, and both must read back unchanged. The
+ * last case grows the tag past its padding so the rewrite path is covered too. Exits with 0 if
+ * every case passes.
+ */
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include "type.h"
+#include "mp3tag.h"
+#include "mp3_edit.h"
+#include "text_decode.h"
+
+/**
+ * Structure to hold one edit and what the frame must look like afterwards.
+ */
+typedef struct
+{
+    const char *frame_id; // Frame edited
+    const char *value;    // UTF-8 text written and expected back
+    int encoding;         // Encoding byte expected in the frame
+} RoundTrip;
+
+/**
+ * Function: put_frame
+ * Description: Writes a v2.3 frame with ISO-8859-1 text.
+ * Input: ptr - where to write, id - frame ID, text - the frame data after the encoding byte,
+ *        length - bytes of text.
+ * Output: Returns the position just after the frame.
+ */
+static unsigned char *put_frame(unsigned char *ptr, const char *id, const char *text, size_t length)
+{
+    uint32_t size = (uint32_t)length + 1;
+
+    memcpy(ptr, id, 4);
+    ptr[4] = (size >> 24) & 0xFF;
+    ptr[5] = (size >> 16) & 0xFF;
+    ptr[6] = (size >> 8) & 0xFF;
+    ptr[7] = size & 0xFF;
+    ptr[8] = 0;
+    ptr[9] = 0;
+    ptr[10] = 0x00;
+    memcpy(ptr + 11, text, length);
+    return ptr + 11 + length;
+}
+
+/**
+ * Function: write_sample
+ * Description: Writes an mp3 file with an ID3v2.3 tag of TIT2, TPE1 and COMM, 64 bytes of
+ *              padding and a few bytes standing in for the audio.
+ * Input: path - the file to write.
+ * Output: Returns success, or failure if the file cannot be written.
+ */
+static Status write_sample(const char *path)
+{
+    unsigned char buffer[512];
+    unsigned char *ptr = buffer + ID3_HEADER_SIZE;
+
+    memset(buffer, 0, sizeof(buffer));
+    ptr = put_frame(ptr, "TIT2", "Old title", 9);
+    ptr = put_frame(ptr, "TPE1", "Old artist", 10);
+    ptr = put_frame(ptr, "COMM", "eng\0Old comment", 15);
+    ptr += 64;
+    memcpy(buffer, "ID3\x03\x00\x00", 6);
+    int_to_syncsafe((uint32_t)(ptr - buffer - ID3_HEADER_SIZE), buffer + 6);
+    memcpy(ptr, "\xFF\xFB\x90\x00audio", 9);
+    ptr += 9;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror(path);
+        return failure;
+    }
+    Status status = write(fd, buffer, (size_t)(ptr - buffer)) == ptr - buffer ? success : failure;
+    close(fd);
+    return status;
+}
+
+/**
+ * Function: check_field
+ * Description: Reads one frame of the file back and compares its encoding byte and its text.
+ * Input: path - the edited file, check - the expected frame.
+ * Output: Returns success if both match, or failure with the difference on stderr.
+ */
+static Status check_field(const char *path, const RoundTrip *check)
+{
+    Mp3Tag *handle;
+    Mp3TagFrame frame;
+    const char *value = NULL;
+    size_t length = 0;
+    int encoding = -1;
+    Status status = failure;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        perror(path);
+        return failure;
+    }
+    handle = mp3tag_new(NULL);
+    if (handle != NULL && mp3tag_open_fd(handle, fd, NULL, 0) == MP3TAG_OK)
+    {
+        for (int i = 0; i < mp3tag_frame_count(handle); i++)
+        {
+            if (mp3tag_frame(handle, i, &frame) == MP3TAG_OK && strcmp(frame.id, check->frame_id) == 0 && frame.size > 0)
+            {
+                encoding = frame.data[0];
+                break;
+            }
+        }
+        if (mp3tag_get_field(handle, check->frame_id, &value, &length) == MP3TAG_OK &&
+            length == strlen(check->value) && memcmp(value, check->value, length) == 0 && encoding == check->encoding)
+        {
+            status = success;
+        }
+    }
+    if (status == failure)
+    {
+        fprintf(stderr, "FAIL %s: wrote \"%s\" (encoding %d), read \"%s\" (encoding %d)\n", check->frame_id,
+                check->value, check->encoding, value ? value : "", encoding);
+    }
+    mp3tag_delete(handle);
+    close(fd);
+    return status;
+}
+
+/**
+ * Function: main
+ * Description: Runs every round trip case on a fresh sample file.
+ * Input: argc - argument count, argv - optional scratch directory, default /tmp.
+ * Output: Returns 0 if every case passed, 1 otherwise.
+ */
+int main(int argc, char *argv[])
+{
+    static char long_value[1024];
+    char path[PATH_MAX];
+    int failed = 0;
+
+    // Longer than the padding, so the tag has to grow
+    for (size_t i = 0; i + 2 < 600; i += 2)
+    {
+        memcpy(long_value + i, "\xCE\xA9", 2);
+    }
+    const RoundTrip cases[][4] = {
+        {{"TIT2", "Caf\xC3\xA9", ENCODING_LATIN1}, {"TPE1", "plain ascii", ENCODING_LATIN1}},
+        {{"TIT2", "Caf\xC3\xA9 \xCE\xA9mega", ENCODING_UTF16}, {"TPE1", "\xC3\x9Cn\xC3\xAF \xF0\x9F\x8E\xB5", ENCODING_UTF16},
+         {"COMM", "Kommentar \xE2\x82\xAC", ENCODING_UTF16}},
+        {{"COMM", "Ni\xC3\xB1o", ENCODING_LATIN1}},
+        {{"TIT2", long_value, ENCODING_UTF16}, {"TPE1", "\xC3\xA5\xC3\xA4\xC3\xB6", ENCODING_LATIN1}},
+    };
+
+    snprintf(path, sizeof(path), "%s/edit_roundtrip.mp3", argc > 1 ? argv[1] : "/tmp");
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        Mp3TagEdit edits[4];
+        Mp3Tag *handle = mp3tag_new(NULL);
+        int count = 0;
+
+        while (count < 4 && cases[c][count].frame_id != NULL)
+        {
+            edits[count].frame_id = cases[c][count].frame_id;
+            edits[count].value = cases[c][count].value;
+            count++;
+        }
+        if (handle == NULL || write_sample(path) == failure ||
+            mp3tag_apply_edits(handle, path, edits, count, EDIT_PADDING) != MP3TAG_OK)
+        {
+            fprintf(stderr, "FAIL case %zu: %s\n", c + 1, handle && mp3tag_error(handle) ? mp3tag_error(handle) : "setup");
+            failed++;
+        }
+        else
+        {
+            for (int i = 0; i < count; i++)
+            {
+                failed += check_field(path, &cases[c][i]) == failure;
+            }
+        }
+        mp3tag_delete(handle);
+    }
+    unlink(path);
+
+    printf("----------EDIT ROUND TRIP: %s----------\n", failed ? "FAILED" : "PASSED");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,403 @@
+/**
+ * Regression checks of the reader on small fixture files.
+ *
+ * Build and run: make test
+ * Usage: ./tag_fixtures [scratch dir]
+ *
+ * Writes one fixture per case and compares what the viewer prints with the expected text:
+ * v2.2 and v2.4 tags, a v2.3 tag unsynchronised as a whole (frame headers included) and a v2.4
+ * frame with its own unsynchronisation flag, --fields on the IDs as stored, and fields answered
+ * by the tag cache against the same file read live. The last case edits a tag too large to be
+ * loaded whole: an edit of the same length stays in place, a shorter one rewrites the file and
+ * leaves the other frames and the audio as they were. Exits with 0 if every case passes.
+ */
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "type.h"
+#include "view.h"
+#include "mp3_edit.h"
+#include "tag_cache.h"
+
+#define AUDIO "\xFF\xFB\x90\x00audio" // Stands in for the audio after the tag
+#define AUDIO_SIZE 9
+#define PRIV_SIZE (EDIT_MEMORY_LIMIT + 4096) // Makes the streamed fixture's tag too large to load whole
+
+/**
+ * Function: put_frame
+ * Description: Writes a frame with ISO-8859-1 text in the layout of the tag version: 6-byte
+ *              headers for v2.2, 10-byte headers with a plain size for v2.3 and a syncsafe size for v2.4.
+ * Input: ptr - where to write, version - major version of the tag, id - frame ID, text - the frame
+ *        data after the encoding byte, length - bytes of text, flags - the second frame flag byte.
+ * Output: Returns the position just after the frame.
+ */
+static unsigned char *put_frame(unsigned char *ptr, int version, const char *id, const char *text, size_t length, int flags)
+{
+    uint32_t size = (uint32_t)length + 1;
+
+    if (version == 2)
+    {
+        memcpy(ptr, id, 3);
+        ptr[3] = (size >> 16) & 0xFF;
+        ptr[4] = (size >> 8) & 0xFF;
+        ptr[5] = size & 0xFF;
+        ptr += 6;
+    }
+    else
+    {
+        memcpy(ptr, id, 4);
+        if (version == 4)
+        {
+            int_to_syncsafe(size, ptr + 4);
+        }
+        else
+        {
+            ptr[4] = (size >> 24) & 0xFF;
+            ptr[5] = (size >> 16) & 0xFF;
+            ptr[6] = (size >> 8) & 0xFF;
+            ptr[7] = size & 0xFF;
+        }
+        ptr[8] = 0;
+        ptr[9] = (unsigned char)flags;
+        ptr += 10;
+    }
+    *ptr = 0x00;
+    memcpy(ptr + 1, text, length);
+    return ptr + 1 + length;
+}
+
+/**
+ * Function: unsynchronise
+ * Description: Inserts a zero byte after every 0xFF, as a tag unsynchronised as a whole stores its frames.
+ * Input: dst - receives the bytes, at most twice the size of src, src - the frames, size - bytes of src.
+ * Output: Returns the number of bytes written to dst.
+ */
+static size_t unsynchronise(unsigned char *dst, const unsigned char *src, size_t size)
+{
+    size_t length = 0;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        dst[length++] = src[i];
+        if (src[i] == 0xFF)
+        {
+            dst[length++] = 0x00;
+        }
+    }
+    return length;
+}
+
+/**
+ * Function: write_fixture
+ * Description: Writes an mp3 file made of an ID3v2 header, the frames, zero padding and the audio stand-in.
+ * Input: path - the file to write, version - major version, flags - tag header flags,
+ *        frames - the frame bytes as stored, size - bytes of frames, padding - zero bytes after the frames.
+ * Output: Returns success, or failure if the file cannot be written.
+ */
+static Status write_fixture(const char *path, int version, int flags, const unsigned char *frames, size_t size, size_t padding)
+{
+    unsigned char header[ID3_HEADER_SIZE] = {'I', 'D', '3', (unsigned char)version, 0, (unsigned char)flags};
+    static const unsigned char zeros[256];
+    Status status = success;
+
+    int_to_syncsafe((uint32_t)(size + padding), header + 6);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror(path);
+        return failure;
+    }
+    if (write(fd, header, sizeof(header)) != (ssize_t)sizeof(header) || write(fd, frames, size) != (ssize_t)size)
+    {
+        status = failure;
+    }
+    for (size_t left = padding; left > 0 && status == success;)
+    {
+        size_t chunk = left < sizeof(zeros) ? left : sizeof(zeros);
+        status = write(fd, zeros, chunk) == (ssize_t)chunk ? success : failure;
+        left -= chunk;
+    }
+    if (status == success && write(fd, AUDIO, AUDIO_SIZE) != AUDIO_SIZE)
+    {
+        status = failure;
+    }
+    close(fd);
+    return status;
+}
+
+/**
+ * Function: view_text
+ * Description: Reads a file the way ./a.out -v does and formats its fields as text.
+ * Input: path - the file, fields - value of --fields, NULL for the six viewer fields,
+ *        out - receives the text, err - receives the error messages.
+ * Output: Returns success if the file was read, or failure otherwise.
+ */
+static Status view_text(const char *path, const char *fields, OutBuffer *out, OutBuffer *err)
+{
+    Music music;
+    Status status = success;
+
+    init_music(&music);
+    music.err = err;
+    music.Filename = (char *)path;
+    if (fields != NULL)
+    {
+        status = read_fields_option(fields, &music.wanted, err);
+    }
+    if (status == success)
+    {
+        status = read_fields(&music, &music.fields);
+    }
+    if (status == success)
+    {
+        format_fields(&music.wanted, &music.fields, out, err);
+    }
+    free_music(&music);
+    return status;
+}
+
+/**
+ * Function: check_view
+ * Description: Compares the text the viewer prints for a file with the expected text.
+ * Input: name - the case, path - the fixture, fields - value of --fields or NULL, expected - the text.
+ * Output: Returns success if the text matches, or failure with both texts on stderr.
+ */
+static Status check_view(const char *name, const char *path, const char *fields, const char *expected)
+{
+    OutBuffer out, err;
+    Status status;
+
+    init_out_buffer(&out);
+    init_out_buffer(&err);
+    status = view_text(path, fields, &out, &err);
+    out_putc(&out, '\0');
+    if (status == failure || strcmp(out.data, expected) != 0)
+    {
+        out_putc(&err, '\0');
+        fprintf(stderr, "FAIL %s:\n%s\nexpected:\n%s\nerrors:\n%s\n", name, out.data, expected, err.data);
+        status = failure;
+    }
+    free_out_buffer(&out);
+    free_out_buffer(&err);
+    return status;
+}
+
+/**
+ * Function: check_cache
+ * Description: Stores the fields of a file read live in a fresh tag cache, reopens the cache and
+ *              compares the text of the cached record with the live one.
+ * Input: name - the case, path - the fixture, cache_path - scratch file for the cache.
+ * Output: Returns success if both texts match, or failure with both on stderr.
+ */
+static Status check_cache(const char *name, const char *path, const char *cache_path)
+{
+    OutBuffer live, cached, err;
+    TagCache cache;
+    TagFields fields;
+    FieldList wanted;
+    struct stat st;
+    Status status = failure;
+
+    init_out_buffer(&live);
+    init_out_buffer(&cached);
+    init_out_buffer(&err);
+    init_tag_fields(&fields);
+    default_field_list(&wanted);
+    unlink(cache_path);
+
+    Music music;
+    init_music(&music);
+    music.err = &err;
+    music.Filename = (char *)path;
+    if (stat(path, &st) == 0 && read_fields(&music, &music.fields) == success &&
+        open_tag_cache(cache_path, &cache) == success)
+    {
+        format_fields(&music.wanted, &music.fields, &live, &err);
+        add_tag_cache(&cache, path, &st, &music.fields);
+        close_tag_cache(&cache);
+        if (open_tag_cache(cache_path, &cache) == success)
+        {
+            const CacheRecord *record = lookup_tag_cache(&cache, &st);
+            if (record != NULL)
+            {
+                cache_record_fields(record, &fields);
+                format_fields(&wanted, &fields, &cached, &err);
+                status = live.length == cached.length && memcmp(live.data, cached.data, live.length) == 0 ?
+                         success : failure;
+            }
+            close_tag_cache(&cache);
+        }
+    }
+    if (status == failure)
+    {
+        fprintf(stderr, "FAIL %s: cached fields differ from a live read:\n%.*s\ncached:\n%.*s\n", name,
+                (int)live.length, live.data ? live.data : "", (int)cached.length, cached.data ? cached.data : "");
+    }
+    free_music(&music);
+    free_out_buffer(&fields.text);
+    free_out_buffer(&live);
+    free_out_buffer(&cached);
+    free_out_buffer(&err);
+    unlink(cache_path);
+    return status;
+}
+
+/**
+ * Function: check_streamed_edit
+ * Description: Edits the title of the streamed fixture through the library and checks the
+ *              inode, the edited title and the frames and audio that were kept.
+ * Input: path - the fixture, title - the new title, same_file - set if the file must keep its inode,
+ *        priv - the PRIV frame data as written.
+ * Output: Returns success if every check passes, or failure with the reason on stderr.
+ */
+static Status check_streamed_edit(const char *path, const char *title, int same_file, const unsigned char *priv)
+{
+    Mp3TagEdit edit = {"TIT2", title};
+    Mp3TagFrame frame;
+    struct stat before, after;
+    unsigned char audio[AUDIO_SIZE];
+    const char *reason = NULL;
+    const char *value;
+    size_t length;
+    Mp3Tag *handle = mp3tag_new(NULL);
+
+    if (handle == NULL || stat(path, &before) != 0 || mp3tag_apply_edits(handle, path, &edit, 1, 0) != MP3TAG_OK ||
+        stat(path, &after) != 0)
+    {
+        fprintf(stderr, "FAIL streamed edit \"%s\": %s\n", title, handle && mp3tag_error(handle) ? mp3tag_error(handle) : "setup");
+        mp3tag_delete(handle);
+        return failure;
+    }
+    if ((before.st_ino == after.st_ino) != same_file)
+    {
+        reason = same_file ? "the file was rewritten" : "kept frames were moved in place";
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (reason == NULL && (fd < 0 || mp3tag_open_fd(handle, fd, NULL, 0) != MP3TAG_OK))
+    {
+        reason = "the edited file can not be read";
+    }
+    if (reason == NULL && (mp3tag_get_field(handle, "TIT2", &value, &length) != MP3TAG_OK ||
+                           length != strlen(title) || memcmp(value, title, length) != 0))
+    {
+        reason = "the title did not change";
+    }
+    if (reason == NULL && (mp3tag_get_field(handle, "TPE1", &value, &length) != MP3TAG_OK ||
+                           length != 6 || memcmp(value, "Artist", 6) != 0))
+    {
+        reason = "the frame after PRIV changed";
+    }
+    for (int i = 0; reason == NULL && i < mp3tag_frame_count(handle); i++)
+    {
+        if (mp3tag_frame(handle, i, &frame) == MP3TAG_OK && strcmp(frame.id, "PRIV") == 0 &&
+            (frame.size != PRIV_SIZE + 1 || memcmp(frame.data + 1, priv, PRIV_SIZE) != 0))
+        {
+            reason = "the PRIV frame changed";
+        }
+    }
+    if (reason == NULL && (pread(fd, audio, AUDIO_SIZE, after.st_size - AUDIO_SIZE) != AUDIO_SIZE ||
+                           memcmp(audio, AUDIO, AUDIO_SIZE) != 0))
+    {
+        reason = "the audio changed";
+    }
+    if (reason != NULL)
+    {
+        fprintf(stderr, "FAIL streamed edit \"%s\": %s\n", title, reason);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    mp3tag_delete(handle);
+    return reason == NULL ? success : failure;
+}
+
+/**
+ * Function: main
+ * Description: Writes every fixture and runs its checks.
+ * Input: argc - argument count, argv - optional scratch directory, default /tmp.
+ * Output: Returns 0 if every case passed, 1 otherwise.
+ */
+int main(int argc, char *argv[])
+{
+    static unsigned char frames[PRIV_SIZE + 256], stored[2 * sizeof(frames)], priv[PRIV_SIZE];
+    char album[255];
+    char path[PATH_MAX], cache_path[PATH_MAX], expected[1024];
+    const char *dir = argc > 1 ? argv[1] : "/tmp";
+    unsigned char *ptr;
+    int failed = 0;
+
+    snprintf(path, sizeof(path), "%s/tag_fixtures.mp3", dir);
+    snprintf(cache_path, sizeof(cache_path), "%s/tag_fixtures.cache", dir);
+
+    // v2.2: 3-character IDs and 3-byte sizes, viewed under the v2.3 names and by their own IDs;
+    // --fields TIT2 is not answered by TT2
+    ptr = put_frame(frames, 2, "TT2", "Two", 3, 0);
+    ptr = put_frame(ptr, 2, "TP1", "Artist22", 8, 0);
+    ptr = put_frame(ptr, 2, "TYE", "1999", 4, 0);
+    ptr = put_frame(ptr, 2, "COM", "engdesc\0Comment22", 17, 0);
+    if (write_fixture(path, 2, 0, frames, (size_t)(ptr - frames), 32) == failure)
+    {
+        return 1;
+    }
+    failed += check_view("v2.2", path, NULL,
+                         "TITLE    :   Two\nARTIST   :   Artist22\nALBUM    :   \nYEAR     :   1999\n"
+                         "MUSIC    :   \nCOMMENT  :   Comment22\n") == failure;
+    failed += check_view("v2.2 --fields", path, "TT2,TYE,COM,TIT2",
+                         "TT2      :   Two\nTYE      :   1999\nCOM      :   Comment22\nTITLE    :   \n") == failure;
+    failed += check_cache("v2.2 cache", path, cache_path) == failure;
+
+    // v2.4: syncsafe frame sizes (the album is over 127 bytes) and TDRC for the year
+    memset(album, 'a', 200);
+    ptr = put_frame(frames, 4, "TIT2", "Four", 4, 0);
+    ptr = put_frame(ptr, 4, "TALB", album, 200, 0);
+    ptr = put_frame(ptr, 4, "TDRC", "2004", 4, 0);
+    // Frame level unsynchronisation of "Art\xFF\xE0s"
+    ptr = put_frame(ptr, 4, "TPE1", "Art\xFF\x00\xE0s", 7, 0x02);
+    if (write_fixture(path, 4, 0, frames, (size_t)(ptr - frames), 32) == failure)
+    {
+        return 1;
+    }
+    snprintf(expected, sizeof(expected), "TITLE    :   Four\nARTIST   :   Art\xC3\xBF\xC3\xA0s\nALBUM    :   %.200s\n"
+             "YEAR     :   2004\nMUSIC    :   \nCOMMENT  :   \n", album);
+    failed += check_view("v2.4", path, NULL, expected) == failure;
+    // --fields TYER is not answered by TDRC
+    failed += check_view("v2.4 --fields", path, "TDRC,TYER,TPE1",
+                         "TDRC     :   2004\nYEAR     :   \nARTIST   :   Art\xC3\xBF\xC3\xA0s\n") == failure;
+    failed += check_cache("v2.4 cache", path, cache_path) == failure;
+
+    // v2.3 unsynchronised as a whole: a 255 byte frame gets 0xFF in its size, so the headers are unsynchronised too
+    memset(album, 'b', 254);
+    ptr = put_frame(frames, 3, "TIT2", "Caf\xE9 \xFF", 6, 0);
+    ptr = put_frame(ptr, 3, "TALB", album, 254, 0);
+    ptr = put_frame(ptr, 3, "TYER", "2003", 4, 0);
+    if (write_fixture(path, 3, 0x80, stored, unsynchronise(stored, frames, (size_t)(ptr - frames)), 32) == failure)
+    {
+        return 1;
+    }
+    snprintf(expected, sizeof(expected), "TITLE    :   Caf\xC3\xA9 \xC3\xBF\nARTIST   :   \nALBUM    :   %.254s\n"
+             "YEAR     :   2003\nMUSIC    :   \nCOMMENT  :   \n", album);
+    failed += check_view("v2.3 unsynchronised tag", path, NULL, expected) == failure;
+    failed += check_cache("v2.3 unsynchronised tag cache", path, cache_path) == failure;
+
+    // A tag too large to load whole for an edit, with a frame after the large one
+    for (size_t i = 0; i < PRIV_SIZE; i++)
+    {
+        priv[i] = (unsigned char)(i * 7);
+    }
+    ptr = put_frame(frames, 3, "TIT2", "Streamed", 8, 0);
+    ptr = put_frame(ptr, 3, "PRIV", (const char *)priv, PRIV_SIZE, 0);
+    ptr = put_frame(ptr, 3, "TPE1", "Artist", 6, 0);
+    if (write_fixture(path, 3, 0, frames, (size_t)(ptr - frames), 0) == failure)
+    {
+        return 1;
+    }
+    failed += check_streamed_edit(path, "Streamer", 1, priv) == failure;
+    failed += check_streamed_edit(path, "Short", 0, priv) == failure;
+    unlink(path);
+
+    printf("----------TAG FIXTURES: %s----------\n", failed ? "FAILED" : "PASSED");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,773 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include "type.h"
+#include "text_decode.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define TEXT_SIMD_X86 1
+#endif
+
+#define UTF16_BLOCK 8 // Code units converted one at a time before the vector kernel is tried again
+
+/**
+ * Kernels of the transcoders, picked once at run time from the CPU features.
+ */
+typedef struct
+{
+    const char *name;                                            // "scalar", "sse2" or "avx2"
+    size_t (*ascii_run)(const unsigned char *data, size_t size); // Length of the leading ASCII bytes
+    size_t (*utf16_length)(const unsigned char *data, size_t units); // Code units before a null unit
+    // Vector UTF-16 to UTF-8 conversion, NULL if there is none
+    size_t (*utf16_run)(const unsigned char *data, size_t units, int big_endian, char *dst, size_t *written);
+} TextKernels;
+
+static TextKernels kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Function: put_utf8
+ * Description: Writes one code point as UTF-8 into memory reserved by the caller.
+ * Input: dst - destination with room for four bytes, cp - the code point (at most 0x10FFFF).
+ * Output: Returns the number of bytes written.
+ */
+static size_t put_utf8(char *dst, uint32_t cp)
+{
+    if (cp < 0x80)
+    {
+        dst[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800)
+    {
+        dst[0] = (char)(0xC0 | (cp >> 6));
+        dst[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000)
+    {
+        dst[0] = (char)(0xE0 | (cp >> 12));
+        dst[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        dst[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    dst[0] = (char)(0xF0 | (cp >> 18));
+    dst[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    dst[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    dst[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+/**
+ * Function: ascii_run_scalar
+ * Description: Finds the leading run of ASCII bytes, eight bytes at a time.
+ * Input: data - the bytes, size - number of bytes.
+ * Output: Returns the length of the run.
+ */
+static size_t ascii_run_scalar(const unsigned char *data, size_t size)
+{
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        if (word & 0x8080808080808080ULL)
+        {
+            break;
+        }
+    }
+    while (i < size && data[i] < 0x80)
+    {
+        i++;
+    }
+    return i;
+}
+
+/**
+ * Function: utf16_length_scalar
+ * Description: Finds the first null UTF-16 code unit.
+ * Input: data - UTF-16 bytes, units - number of code units.
+ * Output: Returns the number of code units before the null unit, or units if there is none.
+ */
+static size_t utf16_length_scalar(const unsigned char *data, size_t units)
+{
+    size_t i = 0;
+    while (i < units && (data[2 * i] != 0 || data[2 * i + 1] != 0))
+    {
+        i++;
+    }
+    return i;
+}
+
+#ifdef TEXT_SIMD_X86
+// SSE2 is part of x86-64, so the SSE2 kernels need no target attribute and are inlined into
+// the AVX2 ones, which keeps the AVX2 code free of slow switches to legacy SSE encoding
+
+/**
+ * Function: ascii_run_sse2
+ * Description: Finds the leading run of ASCII bytes, sixteen bytes at a time.
+ * Input: data - the bytes, size - number of bytes.
+ * Output: Returns the length of the run.
+ */
+static inline __attribute__((always_inline)) size_t ascii_run_sse2(const unsigned char *data, size_t size)
+{
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(data + i)));
+        if (mask != 0)
+        {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    return i + ascii_run_scalar(data + i, size - i);
+}
+
+/**
+ * Function: utf16_length_sse2
+ * Description: Finds the first null UTF-16 code unit, eight units at a time.
+ * Input: data - UTF-16 bytes, units - number of code units.
+ * Output: Returns the number of code units before the null unit, or units if there is none.
+ */
+static inline __attribute__((always_inline)) size_t utf16_length_sse2(const unsigned char *data, size_t units)
+{
+    size_t i = 0;
+    for (; i + 8 <= units; i += 8)
+    {
+        __m128i u = _mm_loadu_si128((const __m128i *)(data + 2 * i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(u, _mm_setzero_si128()));
+        if (mask != 0)
+        {
+            return i + (size_t)__builtin_ctz(mask) / 2;
+        }
+    }
+    return i + utf16_length_scalar(data + 2 * i, units - i);
+}
+
+/**
+ * Function: ascii_run_avx2
+ * Description: Finds the leading run of ASCII bytes, thirty-two bytes at a time.
+ * Input: data - the bytes, size - number of bytes.
+ * Output: Returns the length of the run.
+ */
+__attribute__((target("avx2"))) static size_t ascii_run_avx2(const unsigned char *data, size_t size)
+{
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(data + i)));
+        if (mask != 0)
+        {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    return i + ascii_run_sse2(data + i, size - i);
+}
+
+/**
+ * Function: utf16_length_avx2
+ * Description: Finds the first null UTF-16 code unit, sixteen units at a time.
+ * Input: data - UTF-16 bytes, units - number of code units.
+ * Output: Returns the number of code units before the null unit, or units if there is none.
+ */
+__attribute__((target("avx2"))) static size_t utf16_length_avx2(const unsigned char *data, size_t units)
+{
+    size_t i = 0;
+    for (; i + 16 <= units; i += 16)
+    {
+        __m256i u = _mm256_loadu_si256((const __m256i *)(data + 2 * i));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi16(u, _mm256_setzero_si256()));
+        if (mask != 0)
+        {
+            return i + (size_t)__builtin_ctz(mask) / 2;
+        }
+    }
+    return i + utf16_length_sse2(data + 2 * i, units - i);
+}
+
+/**
+ * Function: utf16_run_sse2
+ * Description: Converts UTF-16 to UTF-8 in blocks of eight code units that all need the same
+ *              number of UTF-8 bytes (one, two, or three without surrogates). Stops at the first
+ *              mixed block, which is left to the scalar code.
+ * Input: data - UTF-16 bytes, units - number of code units, big_endian - byte order,
+ *        dst - output with room for three bytes per unit, written - receives the bytes written.
+ * Output: Returns the number of code units converted.
+ */
+static inline __attribute__((always_inline)) size_t utf16_run_sse2(const unsigned char *data, size_t units, int big_endian,
+                                                            char *dst, size_t *written)
+{
+    const __m128i zero = _mm_setzero_si128();
+    char *start = dst;
+    size_t i = 0;
+
+    for (; i + 8 <= units; i += 8)
+    {
+        __m128i u = _mm_loadu_si128((const __m128i *)(data + 2 * i));
+        if (big_endian)
+        {
+            u = _mm_or_si128(_mm_slli_epi16(u, 8), _mm_srli_epi16(u, 8));
+        }
+        __m128i high = _mm_and_si128(u, _mm_set1_epi16((short)0xF800));
+        int ascii = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(u, _mm_set1_epi16((short)0xFF80)), zero));
+
+        if (ascii == 0xFFFF)
+        {
+            // ASCII: one byte per unit
+            _mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(u, u));
+            dst += 8;
+        }
+        else if (ascii == 0 && _mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) == 0xFFFF)
+        {
+            // U+0080 to U+07FF: lead and trail byte form one little-endian word per unit
+            __m128i lead = _mm_or_si128(_mm_srli_epi16(u, 6), _mm_set1_epi16(0xC0));
+            __m128i trail = _mm_or_si128(_mm_and_si128(u, _mm_set1_epi16(0x3F)), _mm_set1_epi16(0x80));
+            _mm_storeu_si128((__m128i *)dst, _mm_or_si128(lead, _mm_slli_epi16(trail, 8)));
+            dst += 16;
+        }
+        else if (_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(high, zero),
+                                                _mm_cmpeq_epi16(high, _mm_set1_epi16((short)0xD800)))) == 0)
+        {
+            // U+0800 to U+FFFF without surrogates: three bytes per unit
+            unsigned char pair[16], last[16];
+            __m128i b0 = _mm_or_si128(_mm_srli_epi16(u, 12), _mm_set1_epi16(0xE0));
+            __m128i b1 = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(u, 6), _mm_set1_epi16(0x3F)), _mm_set1_epi16(0x80));
+            __m128i b2 = _mm_or_si128(_mm_and_si128(u, _mm_set1_epi16(0x3F)), _mm_set1_epi16(0x80));
+            _mm_storeu_si128((__m128i *)pair, _mm_or_si128(b0, _mm_slli_epi16(b1, 8)));
+            _mm_storeu_si128((__m128i *)last, _mm_packus_epi16(b2, b2));
+            for (int k = 0; k < 8; k++)
+            {
+                dst[3 * k] = (char)pair[2 * k];
+                dst[3 * k + 1] = (char)pair[2 * k + 1];
+                dst[3 * k + 2] = (char)last[k];
+            }
+            dst += 24;
+        }
+        else
+        {
+            break;
+        }
+    }
+    *written = (size_t)(dst - start);
+    return i;
+}
+
+/**
+ * Function: utf16_run_avx2
+ * Description: Converts blocks of sixteen ASCII, or sixteen U+0080 to U+07FF, UTF-16 code units,
+ *              then continues with the SSE2 kernel for the remaining blocks.
+ * Input: data - UTF-16 bytes, units - number of code units, big_endian - byte order,
+ *        dst - output with room for three bytes per unit, written - receives the bytes written.
+ * Output: Returns the number of code units converted.
+ */
+__attribute__((target("avx2"))) static size_t utf16_run_avx2(const unsigned char *data, size_t units, int big_endian,
+                                                            char *dst, size_t *written)
+{
+    char *start = dst;
+    size_t i = 0;
+
+    for (; i + 16 <= units; i += 16)
+    {
+        __m256i u = _mm256_loadu_si256((const __m256i *)(data + 2 * i));
+        if (big_endian)
+        {
+            u = _mm256_or_si256(_mm256_slli_epi16(u, 8), _mm256_srli_epi16(u, 8));
+        }
+        __m256i ascii = _mm256_cmpeq_epi16(_mm256_and_si256(u, _mm256_set1_epi16((short)0xFF80)), _mm256_setzero_si256());
+        if (_mm256_movemask_epi8(ascii) == -1)
+        {
+            // Packing works per 128-bit lane, the permute joins the two low halves
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(u, u), 0xD8);
+            _mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(packed));
+            dst += 16;
+        }
+        else if (_mm256_testz_si256(ascii, ascii) && _mm256_testz_si256(u, _mm256_set1_epi16((short)0xF800)))
+        {
+            __m256i lead = _mm256_or_si256(_mm256_srli_epi16(u, 6), _mm256_set1_epi16(0xC0));
+            __m256i trail = _mm256_or_si256(_mm256_and_si256(u, _mm256_set1_epi16(0x3F)), _mm256_set1_epi16(0x80));
+            _mm256_storeu_si256((__m256i *)dst, _mm256_or_si256(lead, _mm256_slli_epi16(trail, 8)));
+            dst += 32;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    size_t more;
+    i += utf16_run_sse2(data + 2 * i, units - i, big_endian, dst, &more);
+    *written = (size_t)(dst - start) + more;
+    return i;
+}
+#endif
+
+/**
+ * Function: select_kernels
+ * Description: Picks the fastest kernels the CPU supports. MP3TAG_SIMD=scalar|sse2 limits the
+ *              choice, which is useful to compare the paths.
+ * Input: None.
+ * Output: The kernels struct is filled.
+ */
+static void select_kernels(void)
+{
+    const char *limit = getenv("MP3TAG_SIMD");
+
+    kernels = (TextKernels){"scalar", ascii_run_scalar, utf16_length_scalar, NULL};
+#ifdef TEXT_SIMD_X86
+    __builtin_cpu_init();
+    if (limit != NULL && strcmp(limit, "scalar") == 0)
+    {
+        return;
+    }
+    kernels = (TextKernels){"sse2", ascii_run_sse2, utf16_length_sse2, utf16_run_sse2};
+    if ((limit == NULL || strcmp(limit, "sse2") != 0) && __builtin_cpu_supports("avx2"))
+    {
+        kernels = (TextKernels){"avx2", ascii_run_avx2, utf16_length_avx2, utf16_run_avx2};
+    }
+#else
+    (void)limit;
+#endif
+}
+
+/**
+ * Function: text_decode_kernel
+ * Description: Reports which transcoding kernels are in use.
+ * Input: None.
+ * Output: Returns "scalar", "sse2" or "avx2".
+ */
+const char *text_decode_kernel(void)
+{
+    pthread_once(&kernels_once, select_kernels);
+    return kernels.name;
+}
+
+/**
+ * Function: append_latin1
+ * Description: Converts ISO-8859-1 text to UTF-8. Every byte is one code point, runs of ASCII
+ *              bytes are found by the vector kernel and copied as they are.
+ * Input: out - buffer receiving the text, data - Latin-1 bytes, size - number of bytes.
+ * Output: The converted text is appended.
+ */
+void append_latin1(OutBuffer *out, const unsigned char *data, size_t size)
+{
+    pthread_once(&kernels_once, select_kernels);
+    if (out_reserve(out, size * 2) == failure)
+    {
+        return;
+    }
+    char *dst = out->data + out->length;
+    size_t i = 0;
+    while (i < size)
+    {
+        size_t run = kernels.ascii_run(data + i, size - i);
+        memcpy(dst, data + i, run);
+        dst += run;
+        i += run;
+        for (; i < size && data[i] >= 0x80; i++)
+        {
+            *dst++ = (char)(0xC0 | (data[i] >> 6));
+            *dst++ = (char)(0x80 | (data[i] & 0x3F));
+        }
+    }
+    out->length = (size_t)(dst - out->data);
+}
+
+/**
+ * Function: append_utf16
+ * Description: Converts UTF-16 text to UTF-8. Blocks the vector kernel can take are converted
+ *              by it, the rest one code point at a time. Surrogate pairs are combined and an
+ *              unpaired surrogate becomes U+FFFD.
+ * Input: out - buffer receiving the text, data - UTF-16 bytes, size - number of bytes (even),
+ *        big_endian - byte order of the code units.
+ * Output: The converted text is appended.
+ */
+static void append_utf16(OutBuffer *out, const unsigned char *data, size_t size, int big_endian)
+{
+    size_t units = size / 2;
+
+    pthread_once(&kernels_once, select_kernels);
+    // No code unit needs more than three bytes, a surrogate pair needs four for two units
+    if (out_reserve(out, units * 3) == failure)
+    {
+        return;
+    }
+    char *dst = out->data + out->length;
+    size_t i = 0;
+    while (i < units)
+    {
+        if (kernels.utf16_run != NULL)
+        {
+            size_t written;
+            i += kernels.utf16_run(data + 2 * i, units - i, big_endian, dst, &written);
+            dst += written;
+        }
+        size_t stop = kernels.utf16_run != NULL && units - i > UTF16_BLOCK ? i + UTF16_BLOCK : units;
+        while (i < stop)
+        {
+            const unsigned char *p = data + 2 * i;
+            uint32_t unit = big_endian ? (uint32_t)(p[0] << 8 | p[1]) : (uint32_t)(p[1] << 8 | p[0]);
+            i++;
+            if (unit >= 0xD800 && unit < 0xDC00 && i < units)
+            {
+                uint32_t low = big_endian ? (uint32_t)(p[2] << 8 | p[3]) : (uint32_t)(p[3] << 8 | p[2]);
+                if (low >= 0xDC00 && low < 0xE000)
+                {
+                    dst += put_utf8(dst, 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00));
+                    i++;
+                    continue;
+                }
+            }
+            dst += put_utf8(dst, unit >= 0xD800 && unit < 0xE000 ? 0xFFFD : unit);
+        }
+    }
+    out->length = (size_t)(dst - out->data);
+}
+
+/**
+ * Function: utf8_sequence
+ * Description: Checks the UTF-8 sequence starting at a byte of 0x80 or above. Overlong forms,
+ *              surrogates and values past U+10FFFF are not well formed.
+ * Input: data - the bytes, size - number of bytes available (at least 1), cp - receives the code point.
+ * Output: Returns the length of the sequence, or 0 if it is not well formed.
+ */
+static size_t utf8_sequence(const unsigned char *data, size_t size, uint32_t *cp)
+{
+    unsigned char lead = data[0];
+    size_t length = (lead & 0xE0) == 0xC0 ? 2 : (lead & 0xF0) == 0xE0 ? 3 : (lead & 0xF8) == 0xF0 ? 4 : 0;
+    uint32_t value = length == 2 ? lead & 0x1F : length == 3 ? lead & 0x0F : lead & 0x07;
+
+    if (length == 0 || length > size)
+    {
+        return 0;
+    }
+    for (size_t j = 1; j < length; j++)
+    {
+        if ((data[j] & 0xC0) != 0x80)
+        {
+            return 0;
+        }
+        value = (value << 6) | (data[j] & 0x3F);
+    }
+    if ((length == 2 && value < 0x80) || (length == 3 && value < 0x800) || (length == 4 && value < 0x10000) ||
+        (value >= 0xD800 && value < 0xE000) || value > 0x10FFFF)
+    {
+        return 0;
+    }
+    *cp = value;
+    return length;
+}
+
+/**
+ * Function: append_utf8_checked
+ * Description: Copies UTF-8 text, replacing every byte that is not part of a well-formed
+ *              sequence with U+FFFD so the output is always valid UTF-8. Runs of ASCII bytes are
+ *              found by the vector kernel and only multi-byte sequences are checked one by one.
+ * Input: out - buffer receiving the text, data - UTF-8 bytes, size - number of bytes.
+ * Output: The text is appended.
+ */
+static void append_utf8_checked(OutBuffer *out, const unsigned char *data, size_t size)
+{
+    pthread_once(&kernels_once, select_kernels);
+    // A stray byte becomes the three bytes of U+FFFD
+    if (out_reserve(out, size * 3) == failure)
+    {
+        return;
+    }
+    char *dst = out->data + out->length;
+    size_t i = 0;
+    while (i < size)
+    {
+        size_t run = kernels.ascii_run(data + i, size - i);
+        memcpy(dst, data + i, run);
+        dst += run;
+        i += run;
+        while (i < size && data[i] >= 0x80)
+        {
+            uint32_t cp;
+            size_t length = utf8_sequence(data + i, size - i, &cp);
+            if (length > 0)
+            {
+                memcpy(dst, data + i, length);
+                dst += length;
+                i += length;
+            }
+            else
+            {
+                dst += put_utf8(dst, 0xFFFD);
+                i++;
+            }
+        }
+    }
+    out->length = (size_t)(dst - out->data);
+}
+
+/**
+ * Function: string_length
+ * Description: Finds the end of one string in the given encoding: a null byte, or a null
+ *              code unit at an even offset for UTF-16.
+ * Input: encoding - text encoding, data - the bytes, size - number of bytes.
+ * Output: Returns the length of the string without its terminator.
+ */
+static size_t string_length(int encoding, const unsigned char *data, size_t size)
+{
+    if (encoding == ENCODING_UTF16 || encoding == ENCODING_UTF16BE)
+    {
+        pthread_once(&kernels_once, select_kernels);
+        return kernels.utf16_length(data, size / 2) * 2;
+    }
+    const unsigned char *end = memchr(data, 0, size);
+    return end ? (size_t)(end - data) : size;
+}
+
+/**
+ * Function: terminated_extent
+ * Description: Adds the terminator to the length of a string, without going past the data.
+ * Input: encoding - text encoding, length - string length in bytes, size - number of bytes available.
+ * Output: Returns the number of bytes up to and including the terminator, at most size.
+ */
+static size_t terminated_extent(int encoding, size_t length, size_t size)
+{
+    size_t extent = length + (encoding == ENCODING_UTF16 || encoding == ENCODING_UTF16BE ? 2 : 1);
+    return extent < size ? extent : size;
+}
+
+/**
+ * Function: text_extent
+ * Description: Counts the bytes one string takes in the frame, terminator included.
+ * Input: encoding - text encoding, data - the bytes, size - number of bytes.
+ * Output: Returns the number of bytes up to and including the terminator, at most size.
+ */
+static size_t text_extent(int encoding, const unsigned char *data, size_t size)
+{
+    return terminated_extent(encoding, string_length(encoding, data, size), size);
+}
+
+/**
+ * Function: decode_text
+ * Description: Converts one string in an ID3v2 text encoding to UTF-8. A UTF-16 byte order
+ *              mark selects the byte order; without one big-endian is assumed.
+ * Input: encoding - text encoding byte, data - the encoded string, size - bytes available,
+ *        out - buffer receiving the text.
+ * Output: Returns the number of bytes consumed, terminator included.
+ */
+size_t decode_text(int encoding, const unsigned char *data, size_t size, OutBuffer *out)
+{
+    size_t length = string_length(encoding, data, size);
+
+    switch (encoding)
+    {
+    case ENCODING_UTF16:
+    case ENCODING_UTF16BE:
+        if (length >= 2 && data[0] == 0xFF && data[1] == 0xFE)
+        {
+            append_utf16(out, data + 2, length - 2, 0);
+        }
+        else if (length >= 2 && data[0] == 0xFE && data[1] == 0xFF)
+        {
+            append_utf16(out, data + 2, length - 2, 1);
+        }
+        else
+        {
+            append_utf16(out, data, length, 1);
+        }
+        break;
+    case ENCODING_UTF8:
+        append_utf8_checked(out, data, length);
+        break;
+    default:
+        append_latin1(out, data, length);
+        break;
+    }
+    return terminated_extent(encoding, length, size);
+}
+
+/**
+ * Function: decode_frame_text
+ * Description: Decodes the text of a frame to UTF-8. Text frames may hold several null
+ *              separated strings (v2.4), which are joined with '/'. TXXX and WXXX give
+ *              "description=value", COMM and USLT give the text without language and description,
+ *              and URL frames give the Latin-1 URL. The v2.2 names (TXX, WXX, COM, ULT) work alike.
+ * Input: frame_id - the frame ID as stored, data - decoded frame data, size - its length,
+ *        out - buffer receiving the text.
+ * Output: Returns success if the frame holds text, or failure for binary frames such as APIC.
+ */
+Status decode_frame_text(const char *frame_id, const unsigned char *data, size_t size, OutBuffer *out)
+{
+    int encoding = size > 0 ? data[0] : ENCODING_LATIN1;
+    int user_frame = strcmp(frame_id, "TXXX") == 0 || strcmp(frame_id, "WXXX") == 0 ||
+                     strcmp(frame_id, "TXX") == 0 || strcmp(frame_id, "WXX") == 0;
+    int comment_frame = strcmp(frame_id, "COMM") == 0 || strcmp(frame_id, "USLT") == 0 ||
+                        strcmp(frame_id, "COM") == 0 || strcmp(frame_id, "ULT") == 0;
+
+    // URL frames have no encoding byte
+    if (frame_id[0] == 'W' && !user_frame)
+    {
+        append_latin1(out, data, string_length(ENCODING_LATIN1, data, size));
+        return success;
+    }
+    if (size == 0 || encoding > ENCODING_UTF8)
+    {
+        return frame_id[0] == 'T' ? success : failure;
+    }
+    data++;
+    size--;
+
+    if (user_frame)
+    {
+        size_t used = decode_text(encoding, data, size, out);
+        out_putc(out, '=');
+        if (frame_id[0] == 'W')
+        {
+            append_latin1(out, data + used, string_length(ENCODING_LATIN1, data + used, size - used));
+        }
+        else
+        {
+            decode_text(encoding, data + used, size - used, out);
+        }
+        return success;
+    }
+    if (comment_frame)
+    {
+        // Skip the language and the description
+        size_t used = size < 3 ? size : 3 + text_extent(encoding, data + 3, size - 3);
+        decode_text(encoding, data + used, size - used, out);
+        return success;
+    }
+    if (frame_id[0] != 'T')
+    {
+        return failure;
+    }
+
+    // Join the strings of a multi-value text frame, empty strings such as a trailing terminator are dropped
+    size_t offset = 0;
+    size_t start = out->length;
+    while (offset < size)
+    {
+        size_t mark = out->length;
+        if (mark != start)
+        {
+            out_putc(out, '/');
+        }
+        size_t value = out->length;
+        offset += decode_text(encoding, data + offset, size - offset, out);
+        if (out->length == value)
+        {
+            out->length = mark;
+        }
+    }
+    return success;
+}
+
+/**
+ * Function: next_code_point
+ * Description: Reads one code point of text given for an edit. Bytes that are not well-formed
+ *              UTF-8 are taken as ISO-8859-1 characters, so text from a Latin-1 terminal is kept.
+ * Input: data - the text, size - number of bytes, i - position, advanced past the code point.
+ * Output: Returns the code point.
+ */
+static uint32_t next_code_point(const unsigned char *data, size_t size, size_t *i)
+{
+    uint32_t cp = data[*i];
+    size_t length = cp >= 0x80 ? utf8_sequence(data + *i, size - *i, &cp) : 1;
+
+    *i += length > 0 ? length : 1;
+    return cp;
+}
+
+/**
+ * Function: pick_text_encoding
+ * Description: Chooses the encoding an edited frame is written in: ISO-8859-1 when every
+ *              character fits in it, otherwise UTF-8 in a v2.4 tag and UTF-16 in older ones.
+ * Input: text - the UTF-8 text, version - major version of the tag.
+ * Output: Returns ENCODING_LATIN1, ENCODING_UTF16 or ENCODING_UTF8.
+ */
+int pick_text_encoding(const char *text, int version)
+{
+    const unsigned char *data = (const unsigned char *)text;
+    size_t size = strlen(text);
+
+    for (size_t i = 0; i < size;)
+    {
+        if (next_code_point(data, size, &i) > 0xFF)
+        {
+            return version >= 4 ? ENCODING_UTF8 : ENCODING_UTF16;
+        }
+    }
+    return ENCODING_LATIN1;
+}
+
+/**
+ * Function: encoded_text_size
+ * Description: Counts the bytes encode_text writes for a text.
+ * Input: encoding - from pick_text_encoding, text - the UTF-8 text.
+ * Output: Returns the number of bytes, byte order mark included, without a terminator.
+ */
+size_t encoded_text_size(int encoding, const char *text)
+{
+    const unsigned char *data = (const unsigned char *)text;
+    size_t size = strlen(text);
+    size_t bytes = encoding == ENCODING_UTF16 ? 2 : 0;
+
+    for (size_t i = 0; i < size;)
+    {
+        uint32_t cp = next_code_point(data, size, &i);
+        if (encoding == ENCODING_UTF16)
+        {
+            bytes += cp >= 0x10000 ? 4 : 2;
+        }
+        else if (encoding == ENCODING_UTF8)
+        {
+            bytes += cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+        }
+        else
+        {
+            bytes++;
+        }
+    }
+    return bytes;
+}
+
+/**
+ * Function: encode_text
+ * Description: Writes a text in an ID3v2 text encoding, UTF-16 little-endian after a byte order
+ *              mark. Code points above 0xFF are only passed with ENCODING_UTF16 or ENCODING_UTF8.
+ * Input: encoding - from pick_text_encoding, text - the UTF-8 text, ptr - where to write,
+ *        with room for encoded_text_size bytes.
+ * Output: Returns the position just after the text.
+ */
+unsigned char *encode_text(int encoding, const char *text, unsigned char *ptr)
+{
+    const unsigned char *data = (const unsigned char *)text;
+    size_t size = strlen(text);
+
+    if (encoding == ENCODING_UTF16)
+    {
+        *ptr++ = 0xFF;
+        *ptr++ = 0xFE;
+    }
+    for (size_t i = 0; i < size;)
+    {
+        uint32_t cp = next_code_point(data, size, &i);
+        if (encoding == ENCODING_UTF16)
+        {
+            if (cp >= 0x10000)
+            {
+                uint32_t high = 0xD800 + ((cp - 0x10000) >> 10);
+                *ptr++ = high & 0xFF;
+                *ptr++ = (unsigned char)(high >> 8);
+                cp = 0xDC00 + ((cp - 0x10000) & 0x3FF);
+            }
+            *ptr++ = cp & 0xFF;
+            *ptr++ = (unsigned char)(cp >> 8);
+        }
+        else if (encoding == ENCODING_UTF8)
+        {
+            ptr += put_utf8((char *)ptr, cp);
+        }
+        else
+        {
+            *ptr++ = (unsigned char)cp;
+        }
+    }
+    return ptr;
+}
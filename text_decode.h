@@ -0,0 +1,23 @@
+#ifndef TEXT_DECODE_H
+#define TEXT_DECODE_H
+
+#include "type.h"
+#include "frame_index.h"
+#include "out_buffer.h"
+
+// Text encodings of ID3v2 frames, from the first byte of the frame data
+#define ENCODING_LATIN1 0   // ISO-8859-1
+#define ENCODING_UTF16 1    // UTF-16 with a byte order mark
+#define ENCODING_UTF16BE 2  // UTF-16 big-endian without a byte order mark (v2.4)
+#define ENCODING_UTF8 3     // UTF-8 (v2.4)
+
+// Function prototypes
+Status decode_frame_text(const char *frame_id, const unsigned char *data, size_t size, OutBuffer *out);
+size_t decode_text(int encoding, const unsigned char *data, size_t size, OutBuffer *out);
+void append_latin1(OutBuffer *out, const unsigned char *data, size_t size);
+const char *text_decode_kernel(void);
+int pick_text_encoding(const char *text, int version);
+size_t encoded_text_size(int encoding, const char *text);
+unsigned char *encode_text(int encoding, const char *text, unsigned char *ptr);
+
+#endif // TEXT_DECODE_H
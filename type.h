@@ -13,7 +13,14 @@ typedef enum
     edit,   // Operation to edit MP3 metadata
     view,   // Operation to view MP3 metadata
     help,   // Operation to display help/usage information
-    failure // Indicates an invalid or failed operation
+    failure, // Indicates an invalid or failed operation
+    compact, // Operation to compact a tag cache file
+    extract, // Operation to write the cover art to a file
+    serve,   // Operation to answer tag requests over a Unix socket
+    audio,   // Operation to print the duration and bitrate of the audio
+    index_build, // Operation to build or update the tag index of a library
+    query,       // Operation to answer a query from a tag index
+    watch        // Operation to print tag changes of a library as they happen
 } OperationType;
 
 // Enum to represent the status of a function or operation
@@ -0,0 +1,757 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "type.h"
+#include "view.h"
+#include "id3v1.h"
+#include "batch.h"
+#include "uring_scan.h"
+#include "stats.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#define URING_SUPPORTED 1
+#endif
+
+#ifdef URING_SUPPORTED
+
+#define URING_TAIL_SIZE (ID3V1_PLUS_SIZE + ID3V1_SIZE) // Bytes at the end of a file holding TAG+ and ID3v1
+#define URING_TAG_LIMIT (128 * 1024) // Largest tag read whole into a slot when the first read misses a frame
+#define URING_FLUSH_SIZE (64 * 1024) // Output collected before it is written to stdout
+
+/**
+ * Steps of reading one file, kept in the low bits of the user_data of every request.
+ */
+typedef enum
+{
+    step_open,  // Direct open of the file into the slot's fixed file
+    step_head,  // First BUFFER_SIZE bytes, linked to the open
+    step_rest,  // Rest of a tag larger than the first read
+    step_stat,  // Size of a file whose ID3v2 tag lacks a field
+    step_tail,  // ID3v1/TAG+ trailer
+    step_close  // Close of the fixed file
+} UringStep;
+
+/**
+ * Structure to hold the rings shared with the kernel.
+ */
+typedef struct
+{
+    int fd;                       // Ring file descriptor
+    void *sq_ring;                // Mapped submission ring
+    size_t sq_ring_size;
+    void *cq_ring;                // Mapped completion ring, the same mapping with IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;    // Mapped submission entries
+    size_t sqes_size;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned tail;                // Submission tail not yet published to the kernel
+    unsigned queued;              // Entries written since the last submit
+    size_t inflight;              // Requests submitted or queued whose completion is not reaped
+    int broken;                   // io_uring_enter failed, the remaining files are read synchronously
+} Uring;
+
+/**
+ * Structure to hold one file being read. Slot i reads files i, i + URING_DEPTH, ... into
+ * fixed file i, so its output is always printed before the slot is reused.
+ */
+typedef struct
+{
+    Music music;                          // Filename, library handle and fields of the file
+    unsigned char *head;                  // Start of the file, grown to hold the whole tag
+    uint32_t capacity;                    // Allocated size of head
+    uint32_t length;                      // Bytes read into head
+    int eof;                              // The last read of head stopped at the end of the file
+    unsigned char tail[URING_TAIL_SIZE];  // End of the file
+    uint32_t tail_length;                 // Bytes read into tail
+    struct statx stx;                     // Size of the file, locates the tail
+    int pending;                          // Requests in flight for this slot
+    int opened;                           // The fixed file is open
+    int sync;                             // The file is read again with plain system calls
+    int ready;                            // out holds the output of the file
+    OutBuffer out;                        // Output of the file, printed in input order
+} UringSlot;
+
+/**
+ * Function: open_ring
+ * Description: Creates an io_uring instance with io_uring_setup and maps its rings. The call is
+ *              made directly, so no liburing is needed at build or run time.
+ * Input: ring - pointer to the Uring struct to fill, entries - number of submission entries.
+ * Output: Returns success if the ring is ready, or failure if the kernel does not offer io_uring.
+ */
+static Status open_ring(Uring *ring, unsigned entries)
+{
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    // Let the kernel run completion work only when the ring is entered, older kernels refuse the flags
+    params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0 && errno == EINVAL)
+    {
+        memset(&params, 0, sizeof(params));
+        ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    }
+    if (ring->fd < 0)
+    {
+        return failure;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->sq_ring_size = ring->cq_ring_size > ring->sq_ring_size ? ring->cq_ring_size : ring->sq_ring_size;
+        ring->cq_ring_size = 0;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = ring->cq_ring_size == 0 ? ring->sq_ring
+                                            : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        ring->sq_ring = ring->sq_ring == MAP_FAILED ? NULL : ring->sq_ring;
+        ring->cq_ring = ring->cq_ring == MAP_FAILED ? NULL : ring->cq_ring;
+        ring->sqes = ring->sqes == MAP_FAILED ? NULL : ring->sqes;
+        return failure;
+    }
+
+    unsigned char *sq = ring->sq_ring;
+    unsigned char *cq = ring->cq_ring;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring->tail = *ring->sq_tail;
+    return success;
+}
+
+/**
+ * Function: close_ring
+ * Description: Unmaps the rings and closes the io_uring instance, which also closes its fixed files.
+ * Input: ring - pointer to the Uring struct.
+ * Output: The ring is released.
+ */
+static void close_ring(Uring *ring)
+{
+    if (ring->sqes != NULL)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring)
+    {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != NULL)
+    {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->fd >= 0)
+    {
+        close(ring->fd);
+    }
+    ring->fd = -1;
+}
+
+/**
+ * Function: get_sqe
+ * Description: Takes the next submission entry and clears it. The entry reaches the kernel with
+ *              the next submit_ring. The ring has two entries per slot and a slot never has more
+ *              than two requests queued, so it can not run out.
+ * Input: ring - pointer to the Uring struct, data - user_data returned with the completion.
+ * Output: Returns the entry to fill.
+ */
+static struct io_uring_sqe *get_sqe(Uring *ring, uint64_t data)
+{
+    unsigned index = ring->tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = data;
+    ring->sq_array[index] = index;
+    ring->tail++;
+    ring->queued++;
+    ring->inflight++;
+    return sqe;
+}
+
+/**
+ * Function: submit_ring
+ * Description: Publishes the queued entries to the kernel and waits for completions.
+ * Input: ring - pointer to the Uring struct, wait - number of completions to wait for.
+ * Output: Returns success, or failure if io_uring_enter fails for a reason other than a signal or a full completion ring.
+ */
+static Status submit_ring(Uring *ring, unsigned wait)
+{
+    __atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+    for (;;)
+    {
+        long done = syscall(__NR_io_uring_enter, ring->fd, ring->queued, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        stats_io(1, 0, 0);
+        if (done >= 0)
+        {
+            ring->queued -= (unsigned)done < ring->queued ? (unsigned)done : ring->queued;
+            return success;
+        }
+        if (errno == EAGAIN || errno == EBUSY)
+        {
+            // Completions must be reaped before more can be submitted
+            return success;
+        }
+        if (errno != EINTR)
+        {
+            perror("io_uring_enter");
+            return failure;
+        }
+    }
+}
+
+/**
+ * Function: user_data
+ * Description: Packs the slot and step of a request into its user_data.
+ * Input: slot - slot number, step - the step the request performs.
+ * Output: Returns the user_data value.
+ */
+static uint64_t user_data(unsigned slot, UringStep step)
+{
+    return ((uint64_t)slot << 3) | step;
+}
+
+/**
+ * Function: queue_open
+ * Description: Queues a direct open of a path into a fixed file, linked to the request queued next.
+ * Input: ring - pointer to the Uring struct, slot - slot number and fixed file index,
+ *        path - the file to open, flags - open flags.
+ * Output: The open is queued.
+ */
+static void queue_open(Uring *ring, unsigned slot, const char *path, int flags)
+{
+    struct io_uring_sqe *sqe = get_sqe(ring, user_data(slot, step_open));
+
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)path;
+    sqe->open_flags = flags;
+    // file_index is one based, the descriptor goes into the table instead of the process
+    sqe->file_index = slot + 1;
+    sqe->flags = IOSQE_IO_LINK;
+}
+
+/**
+ * Function: queue_close
+ * Description: Queues the close of a fixed file.
+ * Input: ring - pointer to the Uring struct, slot - slot number and fixed file index.
+ * Output: The close is queued.
+ */
+static void queue_close(Uring *ring, unsigned slot)
+{
+    struct io_uring_sqe *sqe = get_sqe(ring, user_data(slot, step_close));
+
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = slot + 1;
+}
+
+/**
+ * Function: queue_read
+ * Description: Queues a positioned read from the fixed file of a slot.
+ * Input: ring - pointer to the Uring struct, slot - slot number and fixed file index, step - the
+ *        step the read performs, buffer - destination, length - bytes to read, offset - file offset.
+ * Output: The read is queued.
+ */
+static void queue_read(Uring *ring, unsigned slot, UringStep step, void *buffer, uint32_t length, uint64_t offset)
+{
+    struct io_uring_sqe *sqe = get_sqe(ring, user_data(slot, step));
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = (int)slot;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (uintptr_t)buffer;
+    sqe->len = length;
+    sqe->off = offset;
+}
+
+/**
+ * Function: queue_statx
+ * Description: Queues a statx of the file of a slot for its size.
+ * Input: ring - pointer to the Uring struct, slot - slot number, state - the slot.
+ * Output: The statx is queued.
+ */
+static void queue_statx(Uring *ring, unsigned slot, UringSlot *state)
+{
+    struct io_uring_sqe *sqe = get_sqe(ring, user_data(slot, step_stat));
+
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)state->music.Filename;
+    sqe->len = STATX_SIZE;
+    sqe->off = (uintptr_t)&state->stx;
+}
+
+/**
+ * Function: reap_one
+ * Description: Takes the next completion, waiting for it if none is ready.
+ * Input: ring - pointer to the Uring struct, data - receives the user_data, res - receives the result.
+ * Output: Returns success, or failure if io_uring_enter fails.
+ */
+static Status reap_one(Uring *ring, uint64_t *data, int *res)
+{
+    unsigned head = *ring->cq_head;
+
+    while (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        if (submit_ring(ring, 1) == failure)
+        {
+            return failure;
+        }
+    }
+    const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    *data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    ring->inflight--;
+    return success;
+}
+
+/**
+ * Function: check_ring
+ * Description: Checks that the kernel has every feature the viewer uses: the OPENAT, READ, STATX
+ *              and CLOSE operations, a sparse fixed file table, and opens straight into that table
+ *              (Linux 5.15), tried once on the current directory.
+ * Input: ring - pointer to the Uring struct.
+ * Output: Returns success if the viewer can run on the ring, or failure otherwise.
+ */
+static Status check_ring(Uring *ring)
+{
+    static const int needed[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_STATX, IORING_OP_CLOSE};
+    size_t probe_size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_size);
+    int files[URING_DEPTH];
+    Status status = probe != NULL ? success : failure;
+
+    if (status == success && syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0)
+    {
+        status = failure;
+    }
+    for (size_t i = 0; status == success && i < sizeof(needed) / sizeof(needed[0]); i++)
+    {
+        if (needed[i] > probe->last_op || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+        {
+            status = failure;
+        }
+    }
+    free(probe);
+    if (status == failure)
+    {
+        return failure;
+    }
+
+    // Empty table entries are filled by the direct opens
+    for (int i = 0; i < URING_DEPTH; i++)
+    {
+        files[i] = -1;
+    }
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, files, URING_DEPTH) < 0)
+    {
+        return failure;
+    }
+
+    uint64_t data;
+    int open_res = -1, close_res = -1, res;
+    queue_open(ring, 0, ".", O_RDONLY | O_DIRECTORY);
+    queue_close(ring, 0);
+    for (int i = 0; i < 2; i++)
+    {
+        if (reap_one(ring, &data, &res) == failure)
+        {
+            return failure;
+        }
+        if ((data & 7) == step_open)
+        {
+            open_res = res;
+        }
+        else
+        {
+            close_res = res;
+        }
+    }
+    // A kernel that ignores file_index returns a plain descriptor
+    if (open_res > 0)
+    {
+        close(open_res);
+    }
+    return open_res == 0 && close_res == 0 ? success : failure;
+}
+
+/**
+ * Function: missing_field
+ * Description: Checks whether a wanted field was not found in the ID3v2 tag.
+ * Input: fields - the fields read.
+ * Output: Returns 1 if a field is missing, 0 otherwise.
+ */
+static int missing_field(const TagFields *fields)
+{
+    for (int i = 0; i < fields->count; i++)
+    {
+        if (!fields->found[i])
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Function: grow_head
+ * Description: Makes the head buffer of a slot large enough for the whole tag.
+ * Input: state - the slot, size - the tag size.
+ * Output: Returns success if the buffer holds size bytes, or failure if allocation fails.
+ */
+static Status grow_head(UringSlot *state, uint32_t size)
+{
+    if (state->capacity < size)
+    {
+        unsigned char *head = realloc(state->head, size);
+        if (head == NULL)
+        {
+            return failure;
+        }
+        state->head = head;
+        state->capacity = size;
+    }
+    return success;
+}
+
+/**
+ * Function: finish_file
+ * Description: Formats the output of a file and closes its fixed file. A file whose reads failed
+ *              or whose tag is too large for a slot is read again with plain system calls, so the
+ *              output and error messages are those of the thread pool.
+ * Input: ring - pointer to the Uring struct, batch - pointer to the BatchView struct, slot - slot
+ *        number, state - the slot, status - result of reading the fields.
+ * Output: The slot holds the output of its file.
+ */
+static void finish_file(Uring *ring, BatchView *batch, unsigned slot, UringSlot *state, Status status)
+{
+    if (state->sync)
+    {
+        view_batch_file(batch, &state->music, &state->out);
+    }
+    else
+    {
+        format_batch_file(&state->music, status, &state->out);
+    }
+    state->ready = 1;
+    if (state->opened && !ring->broken)
+    {
+        queue_close(ring, slot);
+        state->pending++;
+    }
+}
+
+/**
+ * Function: start_file
+ * Description: Queues the open of a file linked to the read of its first BUFFER_SIZE bytes, which
+ *              hold the whole tag of most files.
+ * Input: ring - pointer to the Uring struct, batch - pointer to the BatchView struct, slot - slot
+ *        number, state - the slot, path - the file.
+ * Output: The requests are queued, or the file is read synchronously once the ring is broken.
+ */
+static void start_file(Uring *ring, BatchView *batch, unsigned slot, UringSlot *state, char *path)
+{
+    state->music.Filename = path;
+    state->length = 0;
+    state->eof = 0;
+    state->tail_length = 0;
+    state->opened = 0;
+    state->sync = 0;
+    if (ring->broken)
+    {
+        state->sync = 1;
+        finish_file(ring, batch, slot, state, failure);
+        return;
+    }
+    queue_open(ring, slot, path, O_RDONLY);
+    queue_read(ring, slot, step_head, state->head, BUFFER_SIZE, 0);
+    state->pending = 2;
+}
+
+/**
+ * Function: advance_file
+ * Description: Moves a file to its next step once all of its requests have completed: walks the
+ *              frames read so far, reads the rest of the tag if a wanted frame lies beyond them,
+ *              and only if a field is missing finds the file size and reads the ID3v1/TAG+
+ *              trailer, like read_fields does.
+ * Input: ring - pointer to the Uring struct, batch - pointer to the BatchView struct, slot - slot
+ *        number, state - the slot, step - the step that completed.
+ * Output: The next requests are queued, or the output of the file is ready.
+ */
+static void advance_file(Uring *ring, BatchView *batch, unsigned slot, UringSlot *state, UringStep step)
+{
+    Music *music = &state->music;
+    Status status;
+
+    if (state->sync)
+    {
+        finish_file(ring, batch, slot, state, failure);
+        return;
+    }
+    switch (step)
+    {
+        case step_head:
+        case step_rest:
+        {
+            uint32_t size = id3_tag_size(state->head, state->length);
+            status = read_buffered_fields(music, state->head, state->length, NULL, 0, &music->fields);
+            if (status == failure && size > state->length)
+            {
+                // The wanted frames lie past the bytes read, huge tags take the frame walk
+                if (state->eof || size > URING_TAG_LIMIT || grow_head(state, size) == failure)
+                {
+                    state->sync = 1;
+                    finish_file(ring, batch, slot, state, failure);
+                    return;
+                }
+                queue_read(ring, slot, step_rest, state->head + state->length, size - state->length, state->length);
+                state->pending++;
+                return;
+            }
+            if (status == success && !missing_field(&music->fields))
+            {
+                finish_file(ring, batch, slot, state, status);
+                return;
+            }
+            queue_statx(ring, slot, state);
+            state->pending++;
+            return;
+        }
+        case step_stat:
+            if (state->stx.stx_size < ID3V1_SIZE)
+            {
+                // Too short for a trailer, the missing fields stay missing
+                status = read_buffered_fields(music, NULL, 0, state->tail, 0, &music->fields);
+                finish_file(ring, batch, slot, state, status);
+                return;
+            }
+            state->tail_length = state->stx.stx_size >= URING_TAIL_SIZE ? URING_TAIL_SIZE : ID3V1_SIZE;
+            queue_read(ring, slot, step_tail, state->tail, state->tail_length, state->stx.stx_size - state->tail_length);
+            state->pending++;
+            return;
+        case step_tail:
+            status = read_buffered_fields(music, NULL, 0, state->tail, state->tail_length, &music->fields);
+            finish_file(ring, batch, slot, state, status);
+            return;
+        default:
+            return;
+    }
+}
+
+/**
+ * Function: complete_step
+ * Description: Records the result of a completed request. A failed open cancels the linked read;
+ *              any failure sends the file to the synchronous path once its requests are done.
+ * Input: ring - pointer to the Uring struct, batch - pointer to the BatchView struct, slots - all
+ *        slots, data - user_data of the request, res - its result.
+ * Output: The slot is updated and advanced when it has no request left in flight.
+ */
+static void complete_step(Uring *ring, BatchView *batch, UringSlot *slots, uint64_t data, int res)
+{
+    unsigned slot = (unsigned)(data >> 3);
+    UringStep step = (UringStep)(data & 7);
+    UringSlot *state = &slots[slot];
+
+    state->pending--;
+    switch (step)
+    {
+        case step_open:
+            state->opened = res >= 0;
+            state->sync |= res < 0;
+            break;
+        case step_head:
+        case step_rest:
+            if (res < 0)
+            {
+                state->sync = 1;
+                break;
+            }
+            // Regular files only return short reads at the end
+            state->eof = step == step_head ? res < BUFFER_SIZE : res == 0;
+            state->length += (uint32_t)res;
+            stats_io(0, (uint64_t)res, 0);
+            break;
+        case step_stat:
+            state->sync |= res < 0;
+            break;
+        case step_tail:
+            state->sync |= res != (int)state->tail_length;
+            break;
+        case step_close:
+            // The output was formatted before the close was queued
+            state->opened = 0;
+            return;
+    }
+    if (state->pending == 0 && !state->ready)
+    {
+        advance_file(ring, batch, slot, state, step);
+    }
+}
+
+/**
+ * Function: abandon_ring
+ * Description: Reads every unfinished file synchronously after io_uring_enter failed. Fixed files
+ *              still open are closed with the ring.
+ * Input: ring - pointer to the Uring struct, batch - pointer to the BatchView struct, slots - all slots.
+ * Output: Every started file has its output, later files are read synchronously.
+ */
+static void abandon_ring(Uring *ring, BatchView *batch, UringSlot *slots)
+{
+    ring->broken = 1;
+    ring->inflight = 0;
+    for (unsigned slot = 0; slot < URING_DEPTH; slot++)
+    {
+        if (slots[slot].pending > 0 && !slots[slot].ready)
+        {
+            slots[slot].sync = 1;
+            finish_file(ring, batch, slot, &slots[slot], failure);
+        }
+        slots[slot].pending = 0;
+    }
+}
+
+/**
+ * Function: run_uring_view
+ * Description: Views every file in the batch from one thread with io_uring, keeping up to
+ *              URING_DEPTH files in flight. Each file is opened straight into a fixed file with
+ *              the read of its first 4KB linked behind the open, so the two cost one submission
+ *              and no descriptor enters the process. The output is the same as the thread pool's,
+ *              in input order. Nothing is printed if the kernel lacks a needed feature.
+ * Input: batch - pointer to the BatchView struct, with the stream header already written.
+ * Output: Returns success when all files are processed, or failure if io_uring is unavailable
+ *         and the caller should use the thread pool.
+ */
+Status run_uring_view(BatchView *batch)
+{
+    Uring ring;
+    size_t count = batch->files.count;
+
+    if (open_ring(&ring, URING_DEPTH * 2) == failure || check_ring(&ring) == failure)
+    {
+        close_ring(&ring);
+        return failure;
+    }
+    UringSlot *slots = calloc(URING_DEPTH, sizeof(UringSlot));
+    if (slots == NULL)
+    {
+        close_ring(&ring);
+        return failure;
+    }
+    for (int i = 0; i < URING_DEPTH; i++)
+    {
+        slots[i].head = malloc(BUFFER_SIZE);
+        slots[i].capacity = BUFFER_SIZE;
+        init_music(&slots[i].music);
+        init_out_buffer(&slots[i].out);
+        slots[i].music.wanted = batch->wanted;
+        slots[i].music.format = batch->format;
+        if (slots[i].head == NULL)
+        {
+            // Every file takes the synchronous path
+            slots[i].capacity = 0;
+            ring.broken = 1;
+        }
+    }
+
+    OutBuffer out;
+    size_t next = 0;
+    size_t printed = 0;
+    init_out_buffer(&out);
+    while (printed < count || ring.inflight > 0)
+    {
+        // Start files while their slots are free, the slot of file n - URING_DEPTH is printed and closed
+        while (next < count && next < printed + URING_DEPTH &&
+               slots[next % URING_DEPTH].pending == 0 && !slots[next % URING_DEPTH].ready)
+        {
+            start_file(&ring, batch, next % URING_DEPTH, &slots[next % URING_DEPTH], batch->files.paths[next]);
+            next++;
+        }
+
+        if (!ring.broken && (ring.queued > 0 || ring.inflight > 0))
+        {
+            uint64_t data;
+            int res;
+            if (submit_ring(&ring, 0) == failure || reap_one(&ring, &data, &res) == failure)
+            {
+                abandon_ring(&ring, batch, slots);
+            }
+            else
+            {
+                complete_step(&ring, batch, slots, data, res);
+                // Take every other completion already posted
+                while (*ring.cq_head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE) &&
+                       reap_one(&ring, &data, &res) == success)
+                {
+                    complete_step(&ring, batch, slots, data, res);
+                }
+            }
+        }
+
+        // Print finished files in input order
+        while (printed < next && slots[printed % URING_DEPTH].ready)
+        {
+            UringSlot *state = &slots[printed % URING_DEPTH];
+            if (state->out.length > 0)
+            {
+                out_append(&out, state->out.data, state->out.length);
+                state->out.length = 0;
+            }
+            state->ready = 0;
+            printed++;
+        }
+        if (out.length >= URING_FLUSH_SIZE)
+        {
+            write_out_buffer(&out, stdout);
+        }
+    }
+    write_out_buffer(&out, stdout);
+    free_out_buffer(&out);
+
+    for (int i = 0; i < URING_DEPTH; i++)
+    {
+        free(slots[i].head);
+        free_out_buffer(&slots[i].out);
+        free_music(&slots[i].music);
+    }
+    free(slots);
+    close_ring(&ring);
+    return success;
+}
+
+#else
+
+/**
+ * Function: run_uring_view
+ * Description: Stands in for the io_uring batch viewer on systems without io_uring.
+ * Input: batch - pointer to the BatchView struct.
+ * Output: Returns failure, the caller uses the thread pool.
+ */
+Status run_uring_view(BatchView *batch)
+{
+    (void)batch;
+    return failure;
+}
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef URING_SCAN_H
+#define URING_SCAN_H
+
+#include "type.h"
+#include "batch.h"
+
+#define URING_DEPTH 256 // Files read at once by the io_uring batch viewer, one fixed file slot each
+
+// Function prototypes
+Status run_uring_view(BatchView *batch);
+
+#endif // URING_SCAN_H
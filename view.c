@@ -1,6 +1,12 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "type.h"
 #include "view.h"
 #include "mp3_edit.h"
+#include "batch.h"
+#include "audio_hash.h"
+#include "stats.h"
 
 /**
  * Function: printHelp
@@ -12,13 +18,41 @@ void printHelp()
 {
     printf("\n.............Help Menu.....................\n\n");
     printf("1. -v -> to view mp3 file contents\n");
+    printf(" 1.1. -v <files/directories>... -> to view many files, directories are searched recursively\n");
+    printf(" 1.2. -j <threads> -> number of worker threads for many files\n");
+    printf(" 1.3. --cache <file> -> keep the fields in a cache file, unchanged files are not read again\n");
+    printf(" 1.4. --fields <ID,ID,...> -> print only these frames (e.g., TIT2,TPE1), any frame ID is accepted\n");
+    printf(" 1.5. --format=text|ndjson|bin -> text for people, one JSON object per file, or binary records\n");
+    printf(" 1.6. --io uring|threads -> read many files with io_uring (Linux 5.15+) or worker threads (default)\n");
+    printf(" 1.7. --hash -> also print a hash of the audio between the tags, equal for copies that differ only in their tags\n");
     printf("2. -e -> to edit mp3 file contents\n");
     printf(" 2.1. -t -> to edit song title\n");
-    printf(" 2.2. -A -> to edit artist name\n");
-    printf(" 2.3. -a -> to edit album name\n");
+    printf(" 2.2. -a -> to edit artist name\n");
+    printf(" 2.3. -A -> to edit album name\n");
     printf(" 2.4. -y -> to edit song year\n");
     printf(" 2.5. -m -> to edit song content\n");
     printf(" 2.6. -c -> to edit song comment\n");
+    printf(" 2.7. -p -> padding to leave for later edits when the tag has to grow\n");
+    printf(" 2.8. -f <FRAME> <text> -> to set any text frame (e.g., TPE2) or COMM, added if missing\n");
+    printf(" 2.9. -d <FRAME> -> to delete every frame with this ID\n");
+    printf(" 2.10. --set-art <image> -> to replace the cover art with a JPEG, PNG or GIF image\n");
+    printf(" 2.11. --manifest <file> -> to edit many files, one row per file: path<TAB>FRAME=value<TAB>...\n");
+    printf("       (.csv files are comma separated, an empty value deletes the frame, -j sets the threads)\n");
+    printf(" Several fields can be changed at once: -e -t <title> -a <artist> -y <year> <mp3filename>\n");
+    printf("3. --cache-compact <file> -> to drop stale records from a cache file\n");
+    printf("4. --extract-art <image> <mp3filename> -> to save the cover art to a file, - for stdout\n");
+    printf("5. --serve <socketpath> -> to answer -v and -e requests from mp3tag_client, -j sets the worker threads\n");
+    printf("6. --audio-info <files/directories>... -> to print the MPEG version, bitrate, duration and frame count\n");
+    printf(" 6.1. --scan full|sample[:windows] -> without a Xing, Info or VBRI header, walk every frame or sample windows (default 16)\n");
+    printf("7. --index-build <files/directories>... <indexfile> -> to index title, artist, album, year and genre, re-reading only changed files\n");
+    printf("8. --query <query> <indexfile> -> to find files in the index, e.g. 'artist=\"daft punk\" AND year>=2001'\n");
+    printf(" 8.1. field=words matches every word, word* any word starting with it; != negates; year takes <, <=, > and >=\n");
+    printf(" 8.2. conditions combine with AND, OR, NOT and parentheses\n");
+    printf("9. --stats -> with any operation, print calls and latency of each phase, bytes and syscalls to stderr\n");
+    printf(" 9.1. --stats-json <file> -> write the same counters and histograms as JSON, - for stdout\n");
+    printf("10. --watch <directory>... -> print an ndjson line for every mp3 file added, changed or removed, until stopped\n");
+    printf(" 10.1. --debounce <ms> -> wait until events stop for this long before reading the files (default 200)\n");
+    printf(" 10.2. --fields ID,ID,... -> frames printed for every file\n");
     printf("\n............................................\n\n");
 }
 
@@ -30,26 +64,85 @@ void printHelp()
  */
 Status read_and_validate(int argc, char *argv[], Music *music)
 {
+    music->Filename = NULL;
+    for (int i = 2; i < argc; i++)
+    {
+        // Frames to print instead of the six default fields
+        if (strcmp(argv[i], "--fields") == 0)
+        {
+            if (read_fields_option(i + 1 < argc ? argv[i + 1] : NULL, &music->wanted, music->err) == failure)
+            {
+                return failure;
+            }
+            i++;
+            continue;
+        }
+        // Output format
+        if (is_format_option(argv[i]))
+        {
+            if (read_format_option(argv[i], &music->format, music->err) == failure)
+            {
+                return failure;
+            }
+            continue;
+        }
+        // Hash of the audio payload, chunks of a large file are hashed on every core
+        if (strcmp(argv[i], "--hash") == 0)
+        {
+            music->hash_threads = default_threads();
+            continue;
+        }
+        music->Filename = argv[i];
+    }
+
     // Check if there are enough arguments for the filename
-    if (argc < 3)
+    if (music->Filename == NULL)
     {
-        fprintf(stderr, "ERROR: Filename argument missing.\n");
+        print_error(music->err, "ERROR: Filename argument missing.\n");
         return failure;
     }
 
     // Check if the file extension is ".mp3"
-    char *str = strstr(argv[2], ".mp3");
+    char *str = strstr(music->Filename, ".mp3");
     if (str == NULL || strcmp(str, ".mp3") != 0)
     {
-        fprintf(stderr, "ERROR: Mp3 File Type only\n");
+        print_error(music->err, "ERROR: Mp3 File Type only\n");
         return failure;
     }
-
-    // Set the filename in the Music struct
-    music->Filename = argv[2];
     return success;
 }
 
+/**
+ * Function: init_music
+ * Description: Initializes the Music struct with no open file and empty buffers.
+ * Input: music - pointer to the Music struct.
+ * Output: The struct is ready to be used for one or more files.
+ */
+void init_music(Music *music)
+{
+    music->fd = -1;
+    mp3tag_init(&music->handle, NULL);
+    init_tag_fields(&music->fields);
+    default_field_list(&music->wanted);
+    music->format = format_text;
+    music->error = NULL;
+    music->err = NULL;
+    music->hash_threads = 0;
+}
+
+/**
+ * Function: free_music
+ * Description: Closes the file if open and releases the tag buffer, frame index and field values.
+ * Input: music - pointer to the Music struct.
+ * Output: All resources held by the struct are released.
+ */
+void free_music(Music *music)
+{
+    closeFiles(music);
+    mp3tag_free(&music->handle);
+    free_out_buffer(&music->fields.text);
+}
+
 /**
  * Function: viewInfo
  * Description: Opens the mp3 file and displays the information about the mp3 file such as title, artist, album, year, genre, and comment.
@@ -58,188 +151,513 @@ Status read_and_validate(int argc, char *argv[], Music *music)
  */
 Status viewInfo(Music *music)
 {
-    // Open the mp3 file
-    if (openFiles(music) == failure)
-    {
-        return failure;
-    }
+    OutBuffer out;
+    init_out_buffer(&out);
 
-    // Check the header and version of the mp3 file
-    if (checkheaderandversion(music->fptr_fname) == failure)
-    {
-        closeFiles(music);
-        return failure;
-    }
+    // Collect the output and print it with one write
+    format_stream_header(music->format, &out);
+    Status status = format_info(music, &out);
+    write_out_buffer(&out, stdout);
+    free_out_buffer(&out);
+    return status;
+}
 
-    // Print and read each tag (title, artist, album, etc.)
-    printf("TITLE    :   ");
-    if (read_info(music, "TIT2") == failure)
-    {
-        fprintf(stderr, "Error in getting title name\n");
-    }
-    printf("ARTIST   :   ");
-    if (read_info(music, "TPE1") == failure)
+/**
+ * Fields shown by the viewer, in display order.
+ */
+const ViewField view_fields[VIEW_FIELDS] = {
+    {"TITLE    :   ", "TIT2", {"TT2", NULL}, "Error in getting title name"},
+    {"ARTIST   :   ", "TPE1", {"TP1", NULL}, "Error in getting artist name"},
+    {"ALBUM    :   ", "TALB", {"TAL", NULL}, "Error in getting album name"},
+    {"YEAR     :   ", "TYER", {"TDRC", "TYE"}, "Error in getting year"},
+    {"MUSIC    :   ", "TCON", {"TCO", NULL}, "Error in getting genre"},
+    {"COMMENT  :   ", "COMM", {"COM", NULL}, "Error in getting comments"},
+};
+
+/**
+ * Function: field_keys
+ * Description: Gives the frames the ID3v2 walk has to look for: the wanted IDs and, for the
+ *              viewer fields, their aliases.
+ * Input: wanted - the frames to print, keys - receives the packed IDs, room for
+ *        MAX_FIELDS + 2 * VIEW_FIELDS.
+ * Output: Returns the number of keys.
+ */
+static int field_keys(const FieldList *wanted, uint32_t *keys)
+{
+    int count = wanted->count;
+
+    memcpy(keys, wanted->key, count * sizeof(keys[0]));
+    for (int i = 0; wanted->aliases && i < wanted->count && i < VIEW_FIELDS; i++)
     {
-        fprintf(stderr, "Error in getting artist name\n");
+        for (int j = 0; j < 2 && view_fields[i].alias[j] != NULL; j++)
+        {
+            keys[count++] = frame_key(view_fields[i].alias[j]);
+        }
     }
-    printf("ALBUM    :   ");
-    if (read_info(music, "TALB") == failure)
+    return count;
+}
+
+/**
+ * Function: field_frame_id
+ * Description: Picks the frame a field is read from. A viewer field the ID3v2 tag lacks is read
+ *              from the first alias it has, so the year of a v2.4 tag comes from TDRC and a v2.2
+ *              tag gives its 3-character frames. Otherwise the wanted ID is kept, which lets the
+ *              ID3v1 trailer fill it in.
+ * Input: wanted - the frames to print, i - the field number, handle - the opened library handle.
+ * Output: Returns the frame ID to read.
+ */
+static const char *field_frame_id(const FieldList *wanted, int i, const Mp3Tag *handle)
+{
+    if (wanted->aliases && i < VIEW_FIELDS && !mp3tag_has_frame(handle, wanted->id[i]))
     {
-        fprintf(stderr, "Error in getting album name\n");
+        for (int j = 0; j < 2 && view_fields[i].alias[j] != NULL; j++)
+        {
+            if (mp3tag_has_frame(handle, view_fields[i].alias[j]))
+            {
+                return view_fields[i].alias[j];
+            }
+        }
     }
-    printf("YEAR     :   ");
-    if (read_info(music, "TYER") == failure)
+    return wanted->id[i];
+}
+
+/**
+ * Function: format_info
+ * Description: Opens the mp3 file and appends its title, artist, album, year, genre and comment
+ *              to the output buffer in the chosen format. A failed file gives an error record in
+ *              the ndjson and bin formats. The tag buffer and frame index in music are reused across calls.
+ * Input: music - pointer to the Music struct containing the filename, out - buffer receiving the text.
+ * Output: Returns success if the information is retrieved successfully, or failure if any error occurs during the process.
+ */
+Status format_info(Music *music, OutBuffer *out)
+{
+    if (read_fields(music, &music->fields) == failure)
     {
-        fprintf(stderr, "Error in getting year\n");
+        format_failed_record(music->format, music->Filename, music->error, out);
+        return failure;
     }
-    printf("MUSIC    :   ");
-    if (read_info(music, "TCON") == failure)
+    if (music->format == format_text)
     {
-        fprintf(stderr, "Error in getting genre\n");
+        format_fields(&music->wanted, &music->fields, out, music->err);
     }
-    printf("COMMENT  :   ");
-    if (read_info(music, "COMM") == failure)
+    else
     {
-        fprintf(stderr, "Error in getting comments\n");
+        format_record(music->format, music->Filename, &music->wanted, &music->fields, out);
     }
-
-    // Close the file
-    closeFiles(music);
     return success;
 }
 
 /**
- * Function: openFiles
- * Description: Opens the mp3 file for reading.
- * Input: music - pointer to the Music struct containing the filename.
- * Output: Returns success if the file is opened successfully, or failure if there is an error opening the file.
+ * Function: collect_fields
+ * Description: Copies the text of every wanted frame from the tags open in a library handle.
+ * Input: music - pointer to the Music struct with the filename and the wanted frames, handle - the
+ *        opened library handle, fields - receives the field values, report - set to print an
+ *        error for a file without tags.
+ * Output: Returns success if the file has an ID3v2 or ID3v1 tag, or failure if it has neither.
  */
-Status openFiles(Music *music)
+static Status collect_fields(Music *music, Mp3Tag *handle, TagFields *fields, int report)
 {
-    // Try to open the mp3 file in read mode
-    music->fptr_fname = fopen(music->Filename, "r");
-    if (music->fptr_fname == NULL)
+    const FieldList *wanted = &music->wanted;
+
+    // Read each tag (title, artist, album, etc.) into the field buffer as UTF-8
+    fields->text.length = 0;
+    fields->count = wanted->count;
+    fields->hashed = 0;
+    for (int i = 0; i < wanted->count; i++)
+    {
+        fields->offset[i] = fields->text.length;
+        fields->found[i] = mp3tag_append_field(handle, field_frame_id(wanted, i, handle), &fields->text) == success;
+        fields->length[i] = fields->text.length - fields->offset[i];
+    }
+
+    if (!mp3tag_has_tag(handle))
     {
-        perror("fopen");
-        fprintf(stderr, "ERROR: Unable to open file %s\n", music->Filename);
+        if (report)
+        {
+            print_error(music->err, "ERROR: %s has no ID3v2 or ID3v1 tag.\n", music->Filename);
+        }
+        music->error = "No ID3v2 or ID3v1 tag";
         return failure;
     }
     return success;
 }
 
 /**
- * Function: closeFiles
- * Description: Closes the mp3 file.
- * Input: music - pointer to the Music struct containing the file pointer.
- * Output: Returns success if the file is closed successfully, or failure if there is an error closing the file.
+ * Function: report_tag_error
+ * Description: Prints why the library could not read the file, or left out or cut short its
+ *              ID3v2 tag. The library itself prints nothing.
+ * Input: music - pointer to the Music struct with the filename and the opened handle.
+ * Output: The reason, if any, is reported to music->err.
  */
-Status closeFiles(Music *music)
+static void report_tag_error(const Music *music)
 {
-    if (music->fptr_fname != NULL)
+    const char *error = mp3tag_error(&music->handle);
+
+    if (error != NULL)
     {
-        fclose(music->fptr_fname);
-        music->fptr_fname = NULL;
-        return success;
+        print_error(music->err, "ERROR: %s: %s.\n", music->Filename, error);
     }
-    return failure;
 }
 
 /**
- * Function: checkheaderandversion
- * Description: Checks the ID3 header and version of the mp3 file to ensure it's a valid ID3v2 file.
- * Input: fname - the file pointer of the mp3 file.
- * Output: Returns success if the header and version are valid, or failure if there is an error.
+ * Function: read_fields
+ * Description: Opens the mp3 file and copies the text of every wanted frame through the library
+ *              handle in music. Only the wanted frames of the ID3v2 tag are read and the frame walk stops once all of them are
+ *              found. ID3v2 frames take precedence; a field the ID3v2 tag lacks, or every field
+ *              of a file without an ID3v2 tag, is taken from the ID3v1/TAG+ trailer. The
+ *              trailer is read only when a field is still missing.
+ * Input: music - pointer to the Music struct containing the filename and the wanted frames,
+ *        fields - receives the field values.
+ * Output: Returns success if an ID3v2 or ID3v1 tag was read, or failure if the file has neither.
  */
-Status checkheaderandversion(FILE *fname)
+Status read_fields(Music *music, TagFields *fields)
 {
-    char head[4];
-    char ver[2];
+    uint32_t keys[MAX_FIELDS + 2 * VIEW_FIELDS];
+    int key_count = field_keys(&music->wanted, keys);
 
-    // Read the ID3 header (first 3 bytes)
-    if (fread(head, 1, 3, fname) != 3)
+    // Open the mp3 file, its size locates the ID3v1 trailer
+    if (openFiles(music) == failure)
     {
-        fprintf(stderr, "ERROR: Failed to read header.\n");
+        print_error(music->err, "ERROR: %s: %s.\n", music->Filename, music->error);
         return failure;
     }
-    head[3] = '\0';
 
-    // Read the version (next 2 bytes)
-    if (fread(ver, 1, 2, fname) != 2)
+    // Load the wanted frames of the ID3v2 tag, the audio data is never read
+    Mp3TagStatus opened = mp3tag_open_fd(&music->handle, music->fd, keys, key_count);
+    report_tag_error(music);
+    if (opened != MP3TAG_OK)
     {
-        fprintf(stderr, "ERROR: Failed to read version.\n");
+        music->error = mp3tag_error(&music->handle);
+        closeFiles(music);
         return failure;
     }
 
-    // Check if the header matches "ID3" and the version is 3.0
-    if (strcmp(head, "ID3") == 0 && ver[0] == 0x03 && ver[1] == 0x00)
+    Status status = collect_fields(music, &music->handle, fields, 1);
+
+    // The audio hash is taken while the file is open, after the tag told where the audio starts
+    if (status == success && music->hash_threads > 0)
     {
-        return success;
+        if (hash_audio(&music->handle, music->hash_threads, &fields->hash) == failure)
+        {
+            print_error(music->err, "ERROR: Failed to hash the audio of %s\n", music->Filename);
+            music->error = "Error in hashing the audio";
+            status = failure;
+        }
+        fields->hashed = status == success;
     }
-    return failure;
+    closeFiles(music);
+    return status;
 }
 
 /**
- * Function: read_info
- * Description: Reads and displays the content of a specific tag in the mp3 file.
- * Input: music - pointer to the Music struct, tag - the 4-character string representing the tag to read (e.g., "TIT2" for title).
- * Output: Returns success if the tag content is successfully read, or failure if any error occurs while reading.
+ * Function: read_buffered_fields
+ * Description: Like read_fields for a file the caller has read itself, for instance with
+ *              asynchronous I/O. The head may end inside the tag; if the wanted frames are not
+ *              all in it the call fails and the caller reads more. Without the tail, fields the
+ *              ID3v2 tag lacks stay missing and a file without an ID3v2 tag fails quietly, so the
+ *              caller can read the tail and call again with head NULL, which keeps the ID3v2 tag
+ *              already parsed by the handle.
+ * Input: music - pointer to the Music struct containing the filename and the wanted frames,
+ *        head - the start of the file, or NULL to add the tail,
+ *        head_size - bytes in head, tail - the last bytes of the file or NULL,
+ *        tail_size - bytes in tail, fields - receives the field values.
+ * Output: Returns success if an ID3v2 or ID3v1 tag was read, or failure if the parts hold neither.
  */
-Status read_info(Music *music, const char *tag)
+Status read_buffered_fields(Music *music, const unsigned char *head, size_t head_size,
+                            const unsigned char *tail, size_t tail_size, TagFields *fields)
 {
-    if (music->fptr_fname == NULL)
+    uint32_t keys[MAX_FIELDS + 2 * VIEW_FIELDS];
+    int key_count = field_keys(&music->wanted, keys);
+
+    if (head == NULL)
     {
-        fprintf(stderr, "ERROR: File pointer is NULL.\n");
+        mp3tag_set_tail(&music->handle, tail, tail_size);
+    }
+    else if (mp3tag_open_parts(&music->handle, head, head_size, keys, key_count, tail, tail_size) != MP3TAG_OK)
+    {
+        music->error = mp3tag_error(&music->handle);
         return failure;
     }
+    else
+    {
+        report_tag_error(music);
+    }
+    return collect_fields(music, &music->handle, fields, tail != NULL);
+}
 
-    char frame_id[4];
-    uint32_t size;
-
-    // Move the file pointer to the start of the frames section
-    fseek(music->fptr_fname, 10, SEEK_SET);
+/**
+ * Function: read_handle_fields
+ * Description: Like read_fields for tags already held by a library handle, for instance one kept
+ *              in a cache after mp3tag_detach.
+ * Input: music - pointer to the Music struct containing the filename and the wanted frames,
+ *        handle - the opened library handle, fields - receives the field values.
+ * Output: Returns success if the handle holds an ID3v2 or ID3v1 tag, or failure if it has neither.
+ */
+Status read_handle_fields(Music *music, Mp3Tag *handle, TagFields *fields)
+{
+    return collect_fields(music, handle, fields, 1);
+}
 
-    // Loop through each frame in the mp3 file to find the requested tag
-    while (fread(frame_id, 1, 4, music->fptr_fname) == 4)
+/**
+ * Function: format_fields
+ * Description: Appends one labelled line per wanted frame to the output buffer. The six viewer
+ *              fields use their names as label, other frames their ID.
+ * Input: wanted - the frames to print, fields - the field values, out - buffer receiving the text,
+ *        err - receives an error message per missing field, NULL to print them on stderr.
+ * Output: Missing fields print an empty line and an error message.
+ */
+void format_fields(const FieldList *wanted, const TagFields *fields, OutBuffer *out, OutBuffer *err)
+{
+    uint64_t start = stats_begin();
+    for (int i = 0; i < wanted->count && i < fields->count; i++)
     {
-        // Read the size of the current frame
-        if (fread(&size, 4, 1, music->fptr_fname) != 1)
+        const ViewField *view = NULL;
+        for (int j = 0; j < VIEW_FIELDS && view == NULL; j++)
         {
-            fprintf(stderr, "ERROR: Failed to read frame size.\n");
-            return failure;
+            if (strcmp(view_fields[j].tag, wanted->id[i]) == 0)
+            {
+                view = &view_fields[j];
+            }
         }
-        little_to_big((char *)&size, sizeof(size)); // Convert to big-endian format
 
-        // Skip the flags (2 bytes)
-        fseek(music->fptr_fname, 2, SEEK_CUR);
+        if (view != NULL)
+        {
+            out_puts(out, view->label);
+        }
+        else
+        {
+            out_printf(out, "%-9s:   ", wanted->id[i]);
+        }
+        out_append(out, fields->text.data + fields->offset[i], fields->length[i]);
+        out_putc(out, '\n');
+        if (!fields->found[i] && view != NULL)
+        {
+            print_error(err, "%s\n", view->error);
+        }
+        else if (!fields->found[i])
+        {
+            print_error(err, "Error in getting %s\n", wanted->id[i]);
+        }
+    }
+    if (fields->hashed)
+    {
+        out_printf(out, "HASH     :   %016llx\n", (unsigned long long)fields->hash);
+    }
+    stats_end(phase_output, start);
+}
 
-        // If the current frame matches the requested tag, read and display its content
-        if (strncmp(frame_id, tag, 4) == 0)
+/**
+ * Function: format_record
+ * Description: Appends the ndjson or bin record of one file: its path and the value of every
+ *              wanted frame, keyed by frame ID. A missing frame is null in ndjson and has the
+ *              length BIN_MISSING in bin. The audio hash of --hash comes last, as "hash" in
+ *              ndjson and as a HASH field in bin, in 16 hex digits.
+ * Input: format - format_ndjson or format_bin, path - the file, wanted - the frames,
+ *        fields - the decoded values, out - buffer receiving the record.
+ * Output: The record is appended.
+ */
+void format_record(OutputFormat format, const char *path, const FieldList *wanted, const TagFields *fields, OutBuffer *out)
+{
+    uint64_t start = stats_begin();
+    if (format == format_ndjson)
+    {
+        out_puts(out, "{\"path\":");
+        out_json_string(out, path, strlen(path));
+        for (int i = 0; i < wanted->count && i < fields->count; i++)
         {
-            for (uint32_t i = 0; i < size; i++)
+            out_printf(out, ",\"%s\":", wanted->id[i]);
+            if (fields->found[i])
+            {
+                out_json_string(out, fields->text.data + fields->offset[i], fields->length[i]);
+            }
+            else
             {
-                char ch;
-                if (fread(&ch, 1, 1, music->fptr_fname) != 1)
-                {
-                    fprintf(stderr, "ERROR: Failed to read tag content.\n");
-                    return failure;
-                }
-                if (ch != '\0') // Skip padding null characters
-                {
-                    putchar(ch);
-                }
+                out_puts(out, "null");
             }
-            printf("\n");
-            return success;
         }
-        else
+        if (fields->hashed)
         {
-            // Skip the content of the current frame if it doesn't match the requested tag
-            fseek(music->fptr_fname, size, SEEK_CUR);
+            out_printf(out, ",\"hash\":\"%016llx\"", (unsigned long long)fields->hash);
         }
+        out_puts(out, "}\n");
+        stats_end(phase_output, start);
+        return;
     }
 
-    // Print an error if the requested tag was not found
-    fprintf(stderr, "ERROR: Tag %s not found.\n", tag);
+    size_t record = begin_bin_record(out, 0, path);
+    out_le16(out, (uint16_t)(wanted->count + (fields->hashed ? 1 : 0)));
+    for (int i = 0; i < wanted->count; i++)
+    {
+        int found = i < fields->count && fields->found[i];
+        out_append(out, wanted->id[i], 4);
+        out_le32(out, found ? (uint32_t)fields->length[i] : BIN_MISSING);
+        if (found)
+        {
+            out_append(out, fields->text.data + fields->offset[i], fields->length[i]);
+        }
+    }
+    if (fields->hashed)
+    {
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)fields->hash);
+        out_append(out, "HASH", 4);
+        out_le32(out, 16);
+        out_append(out, hex, 16);
+    }
+    end_bin_record(out, record);
+    stats_end(phase_output, start);
+}
+
+/**
+ * Function: init_tag_fields
+ * Description: Initializes an empty set of field values.
+ * Input: fields - pointer to the TagFields struct.
+ * Output: No field is present.
+ */
+void init_tag_fields(TagFields *fields)
+{
+    init_out_buffer(&fields->text);
+    for (int i = 0; i < VIEW_FIELDS; i++)
+    {
+        fields->offset[i] = 0;
+        fields->length[i] = 0;
+        fields->found[i] = 0;
+    }
+    fields->count = 0;
+    fields->hashed = 0;
+}
+
+/**
+ * Function: default_field_list
+ * Description: Sets a field list to the six viewer fields, which are also read from their aliases
+ *              (TDRC for the year, the v2.2 names).
+ * Input: list - pointer to the FieldList struct.
+ * Output: list holds TIT2, TPE1, TALB, TYER, TCON and COMM.
+ */
+void default_field_list(FieldList *list)
+{
+    for (int i = 0; i < VIEW_FIELDS; i++)
+    {
+        strcpy(list->id[i], view_fields[i].tag);
+        list->key[i] = frame_key(list->id[i]);
+    }
+    list->count = VIEW_FIELDS;
+    list->aliases = 1;
+}
+
+/**
+ * Function: read_fields_option
+ * Description: Parses the value of a --fields option, a comma separated list of frame IDs.
+ *              The IDs are matched as stored, 3-character ones in v2.2 tags, without aliases.
+ *              An ID listed twice is printed once.
+ * Input: value - the option value (may be NULL if missing), list - receives the frame IDs,
+ *        err - receives the error message, NULL to print it on stderr.
+ * Output: Returns success if every ID is a valid 3 or 4-character frame ID, or failure otherwise.
+ */
+Status read_fields_option(const char *value, FieldList *list, OutBuffer *err)
+{
+    const char *ptr = value;
+
+    list->count = 0;
+    list->aliases = 0;
+    if (value == NULL)
+    {
+        print_error(err, "ERROR: --fields needs up to %d comma separated frame IDs (e.g., TIT2,TPE1 or TT2 in v2.2 tags)\n", MAX_FIELDS);
+        return failure;
+    }
+    while (ptr != NULL)
+    {
+        const char *comma = strchr(ptr, ',');
+        size_t length = comma ? (size_t)(comma - ptr) : strlen(ptr);
+        char id[5];
+
+        // A v2.2 ID is checked like a v2.3 one with a digit added
+        snprintf(id, sizeof(id), "%.*s", length == 3 || length == 4 ? (int)length : 0, ptr);
+        char check[5] = "0000";
+        memcpy(check, id, length == 3 || length == 4 ? length : 0);
+        if (length < 3 || length > 4 || !is_valid_frame_id(check) || list->count == MAX_FIELDS)
+        {
+            print_error(err, "ERROR: --fields needs up to %d comma separated frame IDs (e.g., TIT2,TPE1 or TT2 in v2.2 tags)\n", MAX_FIELDS);
+            return failure;
+        }
+
+        // Keep the first occurrence of a repeated ID
+        uint32_t key = frame_key(id);
+        int duplicate = 0;
+        for (int i = 0; i < list->count; i++)
+        {
+            duplicate |= list->key[i] == key;
+        }
+        if (!duplicate)
+        {
+            strcpy(list->id[list->count], id);
+            list->key[list->count++] = key;
+        }
+        ptr = comma ? comma + 1 : NULL;
+    }
+    return success;
+}
+
+/**
+ * Function: is_default_field_list
+ * Description: Checks if a field list holds exactly the six viewer fields in their usual order.
+ * Input: list - pointer to the FieldList struct.
+ * Output: Returns 1 for the default list, 0 otherwise.
+ */
+int is_default_field_list(const FieldList *list)
+{
+    if (list->count != VIEW_FIELDS)
+    {
+        return 0;
+    }
+    for (int i = 0; i < VIEW_FIELDS; i++)
+    {
+        if (strcmp(list->id[i], view_fields[i].tag) != 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Function: openFiles
+ * Description: Opens the mp3 file for reading. The reason of a failure is left in music->error
+ *              for the caller to report.
+ * Input: music - pointer to the Music struct containing the filename.
+ * Output: Returns success if the file is opened successfully, or failure if there is an error opening the file.
+ */
+Status openFiles(Music *music)
+{
+    // Try to open the mp3 file in read mode
+    uint64_t start = stats_begin();
+    music->fd = open(music->Filename, O_RDONLY);
+    stats_io(1, 0, 0);
+    stats_end(phase_open, start);
+    if (music->fd < 0)
+    {
+        snprintf(music->error_text, sizeof(music->error_text), "Unable to open file: %s", strerror(errno));
+        music->error = music->error_text;
+        return failure;
+    }
+    return success;
+}
+
+/**
+ * Function: closeFiles
+ * Description: Closes the mp3 file. The tag buffer and frame index are kept for reuse.
+ * Input: music - pointer to the Music struct containing the file descriptor.
+ * Output: Returns success if the file is closed successfully, or failure if there is an error closing the file.
+ */
+Status closeFiles(Music *music)
+{
+    if (music->fd >= 0)
+    {
+        close(music->fd);
+        stats_io(1, 0, 0);
+        music->fd = -1;
+        return success;
+    }
     return failure;
 }
 
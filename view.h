@@ -3,6 +3,51 @@
 
 #include <stdio.h>
 #include "type.h"
+#include "frame_index.h"
+#include "out_buffer.h"
+#include "output_format.h"
+#include "mp3tag_private.h"
+
+#define VIEW_FIELDS 6 // Number of fields shown by the viewer
+#define MAX_FIELDS 32 // Upper limit for the --fields option
+
+/**
+ * Structure to describe one field shown by the viewer.
+ */
+typedef struct
+{
+    const char *label; // Label printed before the value
+    const char *tag;   // Frame holding the value
+    const char *alias[2]; // Frames read instead when the tag lacks it, e.g. its v2.2 name
+    const char *error; // Message printed if the frame is missing
+} ViewField;
+
+extern const ViewField view_fields[VIEW_FIELDS];
+
+/**
+ * Structure to hold the frames a view prints, the six viewer fields unless --fields is given.
+ */
+typedef struct
+{
+    char id[MAX_FIELDS][5];    // Frame IDs in display order
+    uint32_t key[MAX_FIELDS];  // The same IDs packed by frame_key
+    int count;                 // Number of frames
+    int aliases;               // Set for the viewer fields, which also accept their aliases
+} FieldList;
+
+/**
+ * Structure to hold the text of every viewer field for one file.
+ */
+typedef struct
+{
+    OutBuffer text;            // Field values stored back to back
+    size_t offset[MAX_FIELDS]; // Start of each value in text
+    size_t length[MAX_FIELDS]; // Length of each value
+    int found[MAX_FIELDS];     // Set if the frame was present in the tag
+    int count;                 // Number of fields
+    int hashed;                // Set if hash holds the audio hash of --hash
+    uint64_t hash;             // Hash of the audio payload, see audio_hash.h
+} TagFields;
 
 /**
  * Structure to hold music file information.
@@ -10,18 +55,37 @@
 typedef struct
 {
     char *Filename;   // Name of the MP3 file
-    FILE *fptr_fname; // File pointer for the MP3 file
+    int fd;           // File descriptor for the MP3 file
+    Mp3Tag handle;    // Library handle holding the tag buffer and frame index, reused across files
+    TagFields fields; // Field values read from the tag
+    FieldList wanted; // Frames to read and print
+    OutputFormat format; // Output format, text values are decoded to UTF-8 for the others
+    const char *error;   // Reason for the last failure of read_fields
+    char error_text[64]; // Holds error when it names a system error
+    OutBuffer *err;      // Receives the error messages, NULL to print them on stderr
+    int hash_threads;    // Threads hashing the audio for --hash, 0 if the audio is not hashed
 } Music;
 
 // Function prototypes
 OperationType check_operation_type(char *argv);
 Status read_and_validate(int argc, char *argv[], Music *music);
 void printHelp();
+void init_music(Music *music);
+void free_music(Music *music);
 Status viewInfo(Music *music);
+Status format_info(Music *music, OutBuffer *out);
+Status read_fields(Music *music, TagFields *fields);
+Status read_buffered_fields(Music *music, const unsigned char *head, size_t head_size,
+                            const unsigned char *tail, size_t tail_size, TagFields *fields);
+Status read_handle_fields(Music *music, Mp3Tag *handle, TagFields *fields);
+void format_fields(const FieldList *wanted, const TagFields *fields, OutBuffer *out, OutBuffer *err);
+void format_record(OutputFormat format, const char *path, const FieldList *wanted, const TagFields *fields, OutBuffer *out);
+void init_tag_fields(TagFields *fields);
+void default_field_list(FieldList *list);
+Status read_fields_option(const char *value, FieldList *list, OutBuffer *err);
+int is_default_field_list(const FieldList *list);
 Status openFiles(Music *music);
 Status closeFiles(Music *music);
-Status checkheaderandversion(FILE *fname);
-Status read_info(Music *music, const char *tag);
 void little_to_big(char *ptr, int size);
 
 #endif // VIEW_H
\ No newline at end of file
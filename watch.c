@@ -0,0 +1,944 @@
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+#include "type.h"
+#include "watch.h"
+#include "output_format.h"
+#include "stats.h"
+
+// Events that can change, add or remove an mp3 file or a directory below a watched one
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_DELETE_SELF)
+
+/**
+ * Function: hash_path
+ * Description: Hashes the bytes of a path with FNV-1a.
+ * Input: path - the path.
+ * Output: Returns the hash.
+ */
+static uint64_t hash_path(const char *path)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (const unsigned char *ptr = (const unsigned char *)path; *ptr != '\0'; ptr++)
+    {
+        hash = (hash ^ *ptr) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Function: init_watch_table
+ * Description: Allocates the buckets of an empty path table.
+ * Input: table - pointer to the WatchTable.
+ * Output: Returns success, or failure if memory is exhausted.
+ */
+static Status init_watch_table(WatchTable *table)
+{
+    table->buckets = calloc(WATCH_BUCKETS, sizeof(WatchEntry *));
+    table->bucket_count = table->buckets != NULL ? WATCH_BUCKETS : 0;
+    table->count = 0;
+    return table->buckets != NULL ? success : failure;
+}
+
+/**
+ * Function: free_watch_table
+ * Description: Releases every entry of a path table and its buckets.
+ * Input: table - pointer to the WatchTable.
+ * Output: The table is empty and unallocated.
+ */
+static void free_watch_table(WatchTable *table)
+{
+    for (size_t i = 0; i < table->bucket_count; i++)
+    {
+        WatchEntry *entry = table->buckets[i];
+        while (entry != NULL)
+        {
+            WatchEntry *next = entry->next;
+            free(entry->path);
+            free(entry);
+            entry = next;
+        }
+    }
+    free(table->buckets);
+    table->buckets = NULL;
+    table->bucket_count = 0;
+    table->count = 0;
+}
+
+/**
+ * Function: find_watch_entry
+ * Description: Looks a path up in a table.
+ * Input: table - the WatchTable, path - the path.
+ * Output: Returns the entry, or NULL if the path is not in the table.
+ */
+static WatchEntry *find_watch_entry(const WatchTable *table, const char *path)
+{
+    WatchEntry *entry = table->buckets[hash_path(path) & (table->bucket_count - 1)];
+
+    while (entry != NULL && strcmp(entry->path, path) != 0)
+    {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+/**
+ * Function: grow_watch_table
+ * Description: Doubles the buckets of a table once it holds more entries than buckets. A table
+ *              that cannot grow keeps working with longer chains.
+ * Input: table - pointer to the WatchTable.
+ * Output: The entries are spread over the new buckets.
+ */
+static void grow_watch_table(WatchTable *table)
+{
+    size_t bucket_count = table->bucket_count * 2;
+    WatchEntry **buckets = calloc(bucket_count, sizeof(WatchEntry *));
+
+    if (buckets == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; i < table->bucket_count; i++)
+    {
+        WatchEntry *entry = table->buckets[i];
+        while (entry != NULL)
+        {
+            WatchEntry *next = entry->next;
+            size_t slot = hash_path(entry->path) & (bucket_count - 1);
+            entry->next = buckets[slot];
+            buckets[slot] = entry;
+            entry = next;
+        }
+    }
+    free(table->buckets);
+    table->buckets = buckets;
+    table->bucket_count = bucket_count;
+}
+
+/**
+ * Function: add_watch_entry
+ * Description: Gives the entry of a path, adding a zeroed one if the path is not in the table.
+ * Input: table - pointer to the WatchTable, path - the path, copied when added.
+ * Output: Returns the entry, or NULL if memory is exhausted.
+ */
+static WatchEntry *add_watch_entry(WatchTable *table, const char *path)
+{
+    WatchEntry *entry = find_watch_entry(table, path);
+
+    if (entry != NULL)
+    {
+        return entry;
+    }
+    entry = calloc(1, sizeof(WatchEntry));
+    if (entry == NULL || (entry->path = strdup(path)) == NULL)
+    {
+        free(entry);
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        return NULL;
+    }
+    if (table->count >= table->bucket_count)
+    {
+        grow_watch_table(table);
+    }
+    size_t slot = hash_path(path) & (table->bucket_count - 1);
+    entry->next = table->buckets[slot];
+    table->buckets[slot] = entry;
+    table->count++;
+    return entry;
+}
+
+/**
+ * Function: remove_watch_entry
+ * Description: Takes a path out of a table.
+ * Input: table - pointer to the WatchTable, path - the path.
+ * Output: The entry is freed if the path was in the table.
+ */
+static void remove_watch_entry(WatchTable *table, const char *path)
+{
+    WatchEntry **link = &table->buckets[hash_path(path) & (table->bucket_count - 1)];
+
+    while (*link != NULL)
+    {
+        WatchEntry *entry = *link;
+        if (strcmp(entry->path, path) == 0)
+        {
+            *link = entry->next;
+            free(entry->path);
+            free(entry);
+            table->count--;
+            return;
+        }
+        link = &entry->next;
+    }
+}
+
+/**
+ * Function: set_identity
+ * Description: Records the identity of a file in its entry.
+ * Input: entry - the WatchEntry, st - the file's stat.
+ * Output: The entry is updated.
+ */
+static void set_identity(WatchEntry *entry, const struct stat *st)
+{
+    entry->dev = (uint64_t)st->st_dev;
+    entry->ino = (uint64_t)st->st_ino;
+    entry->size = (uint64_t)st->st_size;
+    entry->mtime_sec = (int64_t)st->st_mtim.tv_sec;
+    entry->mtime_nsec = (uint32_t)st->st_mtim.tv_nsec;
+}
+
+/**
+ * Function: same_identity
+ * Description: Checks if a file is still the one recorded in its entry.
+ * Input: entry - the WatchEntry, st - the file's stat.
+ * Output: Returns 1 if device, inode, size and modification time match, 0 otherwise.
+ */
+static int same_identity(const WatchEntry *entry, const struct stat *st)
+{
+    return entry->dev == (uint64_t)st->st_dev && entry->ino == (uint64_t)st->st_ino &&
+           entry->size == (uint64_t)st->st_size && entry->mtime_sec == (int64_t)st->st_mtim.tv_sec &&
+           entry->mtime_nsec == (uint32_t)st->st_mtim.tv_nsec;
+}
+
+/**
+ * Function: join_path
+ * Description: Builds the path of a directory entry.
+ * Input: dir - the directory, name - the entry's name.
+ * Output: Returns the heap allocated path, or NULL if memory is exhausted.
+ */
+static char *join_path(const char *dir, const char *name)
+{
+    size_t dir_length = strlen(dir);
+    size_t name_length = strlen(name);
+    char *path = malloc(dir_length + name_length + 2);
+
+    if (path == NULL)
+    {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        return NULL;
+    }
+    memcpy(path, dir, dir_length);
+    path[dir_length] = '/';
+    memcpy(path + dir_length + 1, name, name_length + 1);
+    return path;
+}
+
+/**
+ * Function: is_below
+ * Description: Checks if a path is a directory or lies inside it.
+ * Input: path - the path, dir - the directory.
+ * Output: Returns 1 if path is dir or starts with dir and a slash, 0 otherwise.
+ */
+static int is_below(const char *path, const char *dir)
+{
+    size_t length = strlen(dir);
+    return strncmp(path, dir, length) == 0 && (path[length] == '\0' || path[length] == '/');
+}
+
+/**
+ * Function: mark_pending
+ * Description: Notes that a path had an event, restarting the debounce period.
+ * Input: watcher - pointer to the Watcher, path - the path.
+ * Output: The path is in the pending table unless memory is exhausted.
+ */
+static void mark_pending(Watcher *watcher, const char *path)
+{
+    watcher->last_event = stats_clock();
+    if (watcher->pending.count == 0)
+    {
+        watcher->first_pending = watcher->last_event;
+    }
+    add_watch_entry(&watcher->pending, path);
+}
+
+/**
+ * Function: pending_due
+ * Description: Gives the time the pending paths are to be printed: once events have stopped for
+ *              the debounce period, or WATCH_MAX_DELAY_FACTOR periods after the oldest one.
+ * Input: watcher - pointer to the Watcher, debounce - the debounce period in nanoseconds.
+ * Output: Returns the time in stats_clock nanoseconds.
+ */
+static uint64_t pending_due(const Watcher *watcher, uint64_t debounce)
+{
+    uint64_t quiet = watcher->last_event + debounce;
+    uint64_t limit = watcher->first_pending + debounce * WATCH_MAX_DELAY_FACTOR;
+    return quiet < limit ? quiet : limit;
+}
+
+/**
+ * Function: mark_below
+ * Description: Marks every known file inside a directory as pending, for a directory that was
+ *              deleted or moved away.
+ * Input: watcher - pointer to the Watcher, dir - the directory.
+ * Output: The files are in the pending table.
+ */
+static void mark_below(Watcher *watcher, const char *dir)
+{
+    for (size_t i = 0; i < watcher->known.bucket_count; i++)
+    {
+        for (WatchEntry *entry = watcher->known.buckets[i]; entry != NULL; entry = entry->next)
+        {
+            if (is_below(entry->path, dir))
+            {
+                mark_pending(watcher, entry->path);
+            }
+        }
+    }
+}
+
+/**
+ * Function: set_dir
+ * Description: Records the path of a watch descriptor. A directory moved inside the tree keeps
+ *              its descriptor, so the path is replaced.
+ * Input: watcher - pointer to the Watcher, wd - the watch descriptor, path - the directory.
+ * Output: Returns success, or failure if memory is exhausted.
+ */
+static Status set_dir(Watcher *watcher, int wd, const char *path)
+{
+    if ((size_t)wd >= watcher->dir_capacity)
+    {
+        size_t capacity = watcher->dir_capacity > 0 ? watcher->dir_capacity : 64;
+        while (capacity <= (size_t)wd)
+        {
+            capacity *= 2;
+        }
+        char **dirs = realloc(watcher->dirs, capacity * sizeof(char *));
+        if (dirs == NULL)
+        {
+            fprintf(stderr, "ERROR: Memory allocation failed.\n");
+            return failure;
+        }
+        memset(dirs + watcher->dir_capacity, 0, (capacity - watcher->dir_capacity) * sizeof(char *));
+        watcher->dirs = dirs;
+        watcher->dir_capacity = capacity;
+    }
+
+    char *copy = strdup(path);
+    if (copy == NULL)
+    {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        return failure;
+    }
+    if (watcher->dirs[wd] == NULL)
+    {
+        watcher->dir_count++;
+    }
+    free(watcher->dirs[wd]);
+    watcher->dirs[wd] = copy;
+    return success;
+}
+
+/**
+ * Function: drop_dir
+ * Description: Forgets a watch descriptor the kernel has removed.
+ * Input: watcher - pointer to the Watcher, wd - the watch descriptor.
+ * Output: Its path is freed.
+ */
+static void drop_dir(Watcher *watcher, int wd)
+{
+    if (wd >= 0 && (size_t)wd < watcher->dir_capacity && watcher->dirs[wd] != NULL)
+    {
+        free(watcher->dirs[wd]);
+        watcher->dirs[wd] = NULL;
+        watcher->dir_count--;
+    }
+}
+
+/**
+ * Function: unwatch_below
+ * Description: Stops watching a directory moved away and every directory inside it. If it was
+ *              moved inside the tree it is watched again under its new path.
+ * Input: watcher - pointer to the Watcher, dir - the directory.
+ * Output: The watches are removed, their paths are freed when IN_IGNORED arrives.
+ */
+static void unwatch_below(Watcher *watcher, const char *dir)
+{
+    for (size_t wd = 0; wd < watcher->dir_capacity; wd++)
+    {
+        if (watcher->dirs[wd] != NULL && is_below(watcher->dirs[wd], dir))
+        {
+            inotify_rm_watch(watcher->inotify_fd, (int)wd);
+        }
+    }
+}
+
+/**
+ * Function: watch_tree
+ * Description: Watches a directory and every directory inside it. The watch is added before the
+ *              directory is listed so no file created meanwhile is missed. At startup the mp3
+ *              files found are recorded as known, later they are marked pending to be added.
+ * Input: watcher - pointer to the Watcher, path - the directory, mark - set to mark the files
+ *        pending instead of recording them.
+ * Output: Returns success, or failure if the directory itself could not be watched.
+ */
+static Status watch_tree(Watcher *watcher, const char *path, int mark)
+{
+    int wd = inotify_add_watch(watcher->inotify_fd, path, WATCH_EVENTS | IN_ONLYDIR | IN_DONT_FOLLOW);
+
+    if (wd < 0)
+    {
+        if (errno == ENOSPC)
+        {
+            fprintf(stderr, "ERROR: Cannot watch %s, raise fs.inotify.max_user_watches.\n", path);
+        }
+        else
+        {
+            perror(path);
+        }
+        return failure;
+    }
+    if (set_dir(watcher, wd, path) == failure)
+    {
+        return failure;
+    }
+
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+    {
+        perror(path);
+        return failure;
+    }
+    struct dirent *item;
+    while ((item = readdir(dir)) != NULL)
+    {
+        if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0)
+        {
+            continue;
+        }
+        char *child = join_path(path, item->d_name);
+        struct stat st;
+        if (child == NULL)
+        {
+            break;
+        }
+        if (lstat(child, &st) == 0)
+        {
+            if (S_ISDIR(st.st_mode))
+            {
+                watch_tree(watcher, child, mark);
+            }
+            else if (S_ISREG(st.st_mode) && has_mp3_extension(item->d_name))
+            {
+                if (mark)
+                {
+                    mark_pending(watcher, child);
+                }
+                else
+                {
+                    WatchEntry *entry = add_watch_entry(&watcher->known, child);
+                    if (entry != NULL)
+                    {
+                        set_identity(entry, &st);
+                    }
+                }
+            }
+        }
+        free(child);
+    }
+    closedir(dir);
+    return success;
+}
+
+/**
+ * Function: rescan
+ * Description: Recovers from an overflowed event queue: every known file and every file now in
+ *              the tree is marked pending, so the next flush prints whatever was missed.
+ * Input: watcher - pointer to the Watcher.
+ * Output: The pending table covers the whole tree.
+ */
+static void rescan(Watcher *watcher)
+{
+    fprintf(stderr, "----------EVENT QUEUE OVERFLOWED, RESCANNING----------\n");
+    for (size_t i = 0; i < watcher->roots.count; i++)
+    {
+        mark_below(watcher, watcher->roots.paths[i]);
+        watch_tree(watcher, watcher->roots.paths[i], 1);
+    }
+}
+
+/**
+ * Function: handle_event
+ * Description: Turns one inotify event into pending paths. Directories created or moved in are
+ *              watched and their files marked, directories deleted or moved away mark the files
+ *              that were in them.
+ * Input: watcher - pointer to the Watcher, event - the event.
+ * Output: The pending table and the watched directories are updated.
+ */
+static void handle_event(Watcher *watcher, const struct inotify_event *event)
+{
+    if (event->mask & IN_Q_OVERFLOW)
+    {
+        rescan(watcher);
+        return;
+    }
+    if (event->wd < 0 || (size_t)event->wd >= watcher->dir_capacity || watcher->dirs[event->wd] == NULL)
+    {
+        return;
+    }
+    if (event->mask & IN_IGNORED)
+    {
+        drop_dir(watcher, event->wd);
+        return;
+    }
+    if (event->mask & IN_DELETE_SELF)
+    {
+        mark_below(watcher, watcher->dirs[event->wd]);
+        return;
+    }
+    if (event->len == 0)
+    {
+        return;
+    }
+
+    char *child = join_path(watcher->dirs[event->wd], event->name);
+    if (child == NULL)
+    {
+        return;
+    }
+    if (event->mask & IN_ISDIR)
+    {
+        if (event->mask & IN_MOVED_FROM)
+        {
+            unwatch_below(watcher, child);
+        }
+        if (event->mask & (IN_MOVED_FROM | IN_DELETE))
+        {
+            mark_below(watcher, child);
+        }
+        else if (event->mask & (IN_CREATE | IN_MOVED_TO))
+        {
+            watch_tree(watcher, child, 1);
+        }
+    }
+    else if (!(event->mask & IN_CREATE) && has_mp3_extension(event->name))
+    {
+        // A new file is read once it is closed after writing, not when it is created
+        mark_pending(watcher, child);
+    }
+    free(child);
+}
+
+/**
+ * Function: read_events
+ * Description: Reads every queued inotify event without blocking.
+ * Input: watcher - pointer to the Watcher.
+ * Output: Returns success, or failure if reading the events failed.
+ */
+static Status read_events(Watcher *watcher)
+{
+    char buffer[WATCH_EVENT_BUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;)
+    {
+        ssize_t length = read(watcher->inotify_fd, buffer, sizeof(buffer));
+        if (length < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return success;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("inotify");
+            return failure;
+        }
+        stats_io(1, (uint64_t)length, 0);
+        for (char *ptr = buffer; ptr < buffer + length;)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            handle_event(watcher, event);
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+/**
+ * Function: format_delta
+ * Description: Appends the ndjson line of one added, changed or removed file.
+ * Input: event - "added", "changed" or "removed", path - the file, fields - its field values,
+ *        NULL for a removed file, wanted - the frames printed, error - why the tag could not be
+ *        read, NULL if it was, out - buffer receiving the line.
+ * Output: The line is appended.
+ */
+static void format_delta(const char *event, const char *path, const TagFields *fields, const FieldList *wanted,
+                         const char *error, OutBuffer *out)
+{
+    uint64_t start = stats_begin();
+
+    out_printf(out, "{\"event\":\"%s\",\"path\":", event);
+    out_json_string(out, path, strlen(path));
+    if (error != NULL)
+    {
+        out_puts(out, ",\"error\":");
+        out_json_string(out, error, strlen(error));
+    }
+    else if (fields != NULL)
+    {
+        for (int i = 0; i < wanted->count && i < fields->count; i++)
+        {
+            out_printf(out, ",\"%s\":", wanted->id[i]);
+            if (fields->found[i])
+            {
+                out_json_string(out, fields->text.data + fields->offset[i], fields->length[i]);
+            }
+            else
+            {
+                out_puts(out, "null");
+            }
+        }
+    }
+    out_puts(out, "}\n");
+    stats_end(phase_output, start);
+}
+
+/**
+ * Function: update_file
+ * Description: Compares one pending path with what was last printed for it and appends the
+ *              delta. Only files that are new or whose identity changed go through the frame
+ *              parser.
+ * Input: watcher - pointer to the Watcher, path - the pending path.
+ * Output: The known table is updated and the delta, if any, appended to the output.
+ */
+static void update_file(Watcher *watcher, char *path)
+{
+    WatchEntry *entry = find_watch_entry(&watcher->known, path);
+    struct stat st;
+
+    if (lstat(path, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        if (entry != NULL)
+        {
+            format_delta("removed", path, NULL, &watcher->wanted, NULL, &watcher->out);
+            remove_watch_entry(&watcher->known, path);
+            watcher->removed++;
+        }
+        return;
+    }
+    if (entry != NULL && same_identity(entry, &st))
+    {
+        return;
+    }
+
+    const char *event = entry != NULL ? "changed" : "added";
+    Music *music = &watcher->music;
+    music->Filename = path;
+    if (read_fields(music, &music->fields) == success)
+    {
+        format_delta(event, path, &music->fields, &watcher->wanted, NULL, &watcher->out);
+    }
+    else
+    {
+        format_delta(event, path, NULL, &watcher->wanted, music->error != NULL ? music->error : "Failed to read the tag",
+                     &watcher->out);
+    }
+    music->Filename = NULL;
+
+    if (entry == NULL)
+    {
+        entry = add_watch_entry(&watcher->known, path);
+    }
+    if (entry != NULL)
+    {
+        set_identity(entry, &st);
+    }
+    if (event[0] == 'a')
+    {
+        watcher->added++;
+    }
+    else
+    {
+        watcher->changed++;
+    }
+}
+
+/**
+ * Function: compare_paths
+ * Description: Orders paths by their bytes for qsort.
+ * Input: a, b - pointers to the two path pointers.
+ * Output: Returns the strcmp result.
+ */
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Function: flush_pending
+ * Description: Prints the deltas of every pending path, in path order, and empties the pending
+ *              table.
+ * Input: watcher - pointer to the Watcher.
+ * Output: Returns success, or failure if the output could not be written.
+ */
+static Status flush_pending(Watcher *watcher)
+{
+    WatchTable *pending = &watcher->pending;
+    char **paths = malloc(pending->count * sizeof(char *));
+    size_t count = 0;
+
+    if (paths == NULL)
+    {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        return failure;
+    }
+    // The paths move to the array, the entries are freed
+    for (size_t i = 0; i < pending->bucket_count; i++)
+    {
+        WatchEntry *entry = pending->buckets[i];
+        while (entry != NULL)
+        {
+            WatchEntry *next = entry->next;
+            paths[count++] = entry->path;
+            free(entry);
+            entry = next;
+        }
+        pending->buckets[i] = NULL;
+    }
+    pending->count = 0;
+
+    qsort(paths, count, sizeof(char *), compare_paths);
+    for (size_t i = 0; i < count; i++)
+    {
+        update_file(watcher, paths[i]);
+        free(paths[i]);
+    }
+    free(paths);
+
+    Status status = write_out_buffer(&watcher->out, stdout);
+    if (fflush(stdout) != 0)
+    {
+        status = failure;
+    }
+    if (status == failure)
+    {
+        perror("stdout");
+    }
+    return status;
+}
+
+/**
+ * Function: read_and_validate_watch
+ * Description: Reads --debounce, --fields and the directories to watch.
+ * Input: argc - argument count, argv - argument vector, watcher - the Watcher to fill.
+ * Output: Returns success if at least one directory was given and every option is valid,
+ *         or failure otherwise.
+ */
+Status read_and_validate_watch(int argc, char *argv[], Watcher *watcher)
+{
+    memset(watcher, 0, sizeof(*watcher));
+    init_path_list(&watcher->roots);
+    default_field_list(&watcher->wanted);
+    watcher->debounce_ms = WATCH_DEBOUNCE_MS;
+    watcher->inotify_fd = -1;
+    watcher->signal_fd = -1;
+    init_music(&watcher->music);
+    watcher->music.format = format_ndjson;
+    init_out_buffer(&watcher->out);
+
+    for (int i = 2; i < argc; i++)
+    {
+        // Quiet time in milliseconds before pending changes are printed
+        if (strcmp(argv[i], "--debounce") == 0)
+        {
+            char *end = NULL;
+            long value = i + 1 < argc ? strtol(argv[i + 1], &end, 10) : -1;
+            if (end == NULL || *end != '\0' || end == argv[i + 1] || value < 0 || value > WATCH_MAX_DEBOUNCE_MS)
+            {
+                fprintf(stderr, "ERROR: --debounce needs milliseconds from 0 to %d.\n", WATCH_MAX_DEBOUNCE_MS);
+                free_watch(watcher);
+                return failure;
+            }
+            watcher->debounce_ms = (int)value;
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--fields") == 0)
+        {
+            if (read_fields_option(i + 1 < argc ? argv[i + 1] : NULL, &watcher->wanted, NULL) == failure)
+            {
+                free_watch(watcher);
+                return failure;
+            }
+            i++;
+            continue;
+        }
+
+        struct stat st;
+        if (stat(argv[i], &st) != 0 || !S_ISDIR(st.st_mode))
+        {
+            fprintf(stderr, "ERROR: %s is not a directory.\n", argv[i]);
+            free_watch(watcher);
+            return failure;
+        }
+        // Trailing slashes would double up in the printed paths
+        size_t length = strlen(argv[i]);
+        while (length > 1 && argv[i][length - 1] == '/')
+        {
+            argv[i][--length] = '\0';
+        }
+        if (add_path(&watcher->roots, argv[i]) == failure)
+        {
+            free_watch(watcher);
+            return failure;
+        }
+    }
+
+    if (watcher->roots.count == 0)
+    {
+        fprintf(stderr, "ERROR: No directory to watch.\n");
+        free_watch(watcher);
+        return failure;
+    }
+    return success;
+}
+
+/**
+ * Function: open_watch
+ * Description: Blocks the stop signals into a signalfd, opens the inotify instance and watches
+ *              every directory of the tree, recording the mp3 files already there.
+ * Input: watcher - pointer to the Watcher filled by read_and_validate_watch.
+ * Output: Returns success, or failure if a directory given could not be watched.
+ */
+static Status open_watch(Watcher *watcher)
+{
+    sigset_t signals;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    if (sigprocmask(SIG_BLOCK, &signals, NULL) != 0 ||
+        (watcher->signal_fd = signalfd(-1, &signals, SFD_CLOEXEC)) < 0)
+    {
+        perror("signalfd");
+        return failure;
+    }
+    watcher->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher->inotify_fd < 0)
+    {
+        perror("inotify");
+        return failure;
+    }
+    if (init_watch_table(&watcher->known) == failure || init_watch_table(&watcher->pending) == failure)
+    {
+        fprintf(stderr, "ERROR: Memory allocation failed.\n");
+        return failure;
+    }
+    for (size_t i = 0; i < watcher->roots.count; i++)
+    {
+        if (watch_tree(watcher, watcher->roots.paths[i], 0) == failure)
+        {
+            return failure;
+        }
+    }
+    return success;
+}
+
+/**
+ * Function: run_watch
+ * Description: Watches the directories until a stop signal arrives. Events are collected until
+ *              none arrive for the debounce period, or for WATCH_MAX_DELAY_FACTOR periods while
+ *              they keep coming, then the deltas of the files they touched are printed.
+ * Input: watcher - pointer to the Watcher filled by read_and_validate_watch.
+ * Output: Returns success after a clean stop, or failure if watching could not start or stopped
+ *         on an error.
+ */
+Status run_watch(Watcher *watcher)
+{
+    Status status = open_watch(watcher);
+    uint64_t debounce = (uint64_t)watcher->debounce_ms * 1000000ULL;
+    int stopping = 0;
+
+    if (status == failure)
+    {
+        return failure;
+    }
+    watcher->music.wanted = watcher->wanted;
+    fprintf(stderr, "----------WATCHING %zu FILES IN %zu DIRECTORIES----------\n", watcher->known.count,
+            watcher->dir_count);
+
+    while (!stopping && status == success)
+    {
+        struct pollfd fds[2] = {{watcher->signal_fd, POLLIN, 0}, {watcher->inotify_fd, POLLIN, 0}};
+        int timeout = -1;
+
+        if (watcher->pending.count > 0)
+        {
+            uint64_t due = pending_due(watcher, debounce);
+            uint64_t now = stats_clock();
+            timeout = due > now ? (int)((due - now + 999999) / 1000000) : 0;
+        }
+        if (poll(fds, 2, timeout) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("poll");
+            status = failure;
+            break;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            stopping = 1;
+        }
+        if ((fds[1].revents & POLLIN) && read_events(watcher) == failure)
+        {
+            status = failure;
+        }
+        // Changes still pending when stopping are printed too
+        if (watcher->pending.count > 0 && (stopping || stats_clock() >= pending_due(watcher, debounce)) &&
+            flush_pending(watcher) == failure)
+        {
+            status = failure;
+        }
+    }
+
+    fprintf(stderr, "----------STOPPED WATCHING: %zu ADDED, %zu CHANGED, %zu REMOVED----------\n",
+            watcher->added, watcher->changed, watcher->removed);
+    return status;
+}
+
+/**
+ * Function: free_watch
+ * Description: Closes the watches and releases everything a Watcher holds.
+ * Input: watcher - pointer to the Watcher.
+ * Output: All resources held by the struct are released.
+ */
+void free_watch(Watcher *watcher)
+{
+    if (watcher->inotify_fd >= 0)
+    {
+        close(watcher->inotify_fd);
+        watcher->inotify_fd = -1;
+    }
+    if (watcher->signal_fd >= 0)
+    {
+        close(watcher->signal_fd);
+        watcher->signal_fd = -1;
+    }
+    for (size_t wd = 0; wd < watcher->dir_capacity; wd++)
+    {
+        free(watcher->dirs[wd]);
+    }
+    free(watcher->dirs);
+    watcher->dirs = NULL;
+    watcher->dir_capacity = 0;
+    watcher->dir_count = 0;
+    if (watcher->known.buckets != NULL)
+    {
+        free_watch_table(&watcher->known);
+    }
+    if (watcher->pending.buckets != NULL)
+    {
+        free_watch_table(&watcher->pending);
+    }
+    free_path_list(&watcher->roots);
+    free_music(&watcher->music);
+    free_out_buffer(&watcher->out);
+}
@@ -0,0 +1,80 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <sys/stat.h>
+#include "type.h"
+#include "batch.h"
+#include "view.h"
+
+#define WATCH_DEBOUNCE_MS 200        // Quiet time after the last event before the changes are printed
+#define WATCH_MAX_DEBOUNCE_MS 60000  // Largest --debounce accepted
+#define WATCH_MAX_DELAY_FACTOR 5     // A steady stream of events is flushed after this many debounce periods
+#define WATCH_EVENT_BUFFER 65536     // Bytes of inotify events read at once
+#define WATCH_BUCKETS 1024           // Initial buckets of a path table, a power of two
+
+/*
+ * --watch prints one ndjson line per file whose tags may have changed, after events stop
+ * arriving for the debounce period:
+ *   {"event":"added","path":"dir/a.mp3","TIT2":"Title",...}
+ *   {"event":"changed","path":"dir/a.mp3","TIT2":"New title",...}
+ *   {"event":"removed","path":"dir/a.mp3"}
+ * A file whose tag cannot be read carries "error" in place of the fields. Files are compared
+ * by device, inode, size and modification time, so an event that left a file as it was
+ * prints nothing. Symbolic links are not followed.
+ */
+
+/**
+ * Structure to hold one path in a WatchTable, with the identity of the file when it was last
+ * printed.
+ */
+typedef struct WatchEntry
+{
+    char *path;              // Heap allocated path
+    uint64_t dev;            // Device of the file
+    uint64_t ino;            // Inode of the file
+    uint64_t size;           // File size
+    int64_t mtime_sec;       // Modification time, seconds
+    uint32_t mtime_nsec;     // Modification time, nanoseconds
+    struct WatchEntry *next; // Next entry in the same bucket
+} WatchEntry;
+
+/**
+ * Structure to hold a set of paths, hashed by their bytes.
+ */
+typedef struct
+{
+    WatchEntry **buckets; // Chains of entries
+    size_t bucket_count;  // Number of buckets, a power of two
+    size_t count;         // Number of entries
+} WatchTable;
+
+/**
+ * Structure to hold the state of --watch.
+ */
+typedef struct
+{
+    PathList roots;          // Directories given on the command line
+    FieldList wanted;        // Frames to print for every file
+    int debounce_ms;         // Quiet time before pending changes are printed
+    int inotify_fd;          // Instance every directory is watched on
+    int signal_fd;           // Receives the stop signals
+    char **dirs;             // Path of each watched directory, indexed by watch descriptor
+    size_t dir_capacity;     // Allocated size of dirs
+    size_t dir_count;        // Number of directories watched
+    WatchTable known;        // mp3 files as last printed
+    WatchTable pending;      // Paths with events since the last flush
+    uint64_t first_pending;  // Time of the oldest pending event
+    uint64_t last_event;     // Time of the newest pending event
+    Music music;             // Reused for every file read
+    OutBuffer out;           // Lines of one flush
+    size_t added;            // Number of added lines printed
+    size_t changed;          // Number of changed lines printed
+    size_t removed;          // Number of removed lines printed
+} Watcher;
+
+// Function prototypes
+Status read_and_validate_watch(int argc, char *argv[], Watcher *watcher);
+Status run_watch(Watcher *watcher);
+void free_watch(Watcher *watcher);
+
+#endif // WATCH_H